@@ -4,10 +4,39 @@ MAC_PREFIX="C1:"
 MAC_SUFFIX=`sudo hciconfig hci0 | grep "BD Address" | cut -d ":" -f 3-7 | cut -d " " -f 1`
 sudo hciconfig hci0 up
 sleep 1
-sudo /home/bedis/bdaddr/bdaddr -i hci0 -r $MAC_PREFIX$MAC_SUFFIX
+
+# A provisioned Tag takes the static address of its bundle, which starts at
+# byte 16, least significant byte first. A relative path is relative to bin
+# like the other paths of the config. A Tag whose bundle cannot be read does
+# not go on the air with the C1: address of another identity.
+PROVISION_BUNDLE=`grep "^provision_bundle=" /home/bedis/Tag/config/config.conf | cut -d "=" -f 2- | tr -d "\r"`
+if [ -n "$PROVISION_BUNDLE" ]; then
+    case "$PROVISION_BUNDLE" in
+        /*) ;;
+        *) PROVISION_BUNDLE="/home/bedis/Tag/bin/$PROVISION_BUNDLE" ;;
+    esac
+    if [ ! -r "$PROVISION_BUNDLE" ]; then
+        echo "Unable to read the provision bundle $PROVISION_BUNDLE" >&2
+        exit 1
+    fi
+    MAC_ADDRESS=`od -An -tx1 -j 16 -N 6 "$PROVISION_BUNDLE" | awk 'NF == 6 { for(i = NF ; i > 1 ; i--) printf "%s:", toupper($i); print toupper($1) }'`
+    if [ -z "$MAC_ADDRESS" ]; then
+        echo "The provision bundle $PROVISION_BUNDLE is too short" >&2
+        exit 1
+    fi
+else
+    MAC_ADDRESS=$MAC_PREFIX$MAC_SUFFIX
+fi
+sudo /home/bedis/bdaddr/bdaddr -i hci0 -r $MAC_ADDRESS
 sudo hciconfig hci0 reset
-sudo systemctl restart bluetooth.service
-sleep 1
-sudo hciconfig hci0 up
+
+# With an exclusive HCI transport the Tag takes the controller from the
+# kernel, so bluetoothd does not need to pick up the new address
+HCI_TRANSPORT=`grep "^hci_transport=" /home/bedis/Tag/config/config.conf | cut -d "=" -f 2`
+if [ -z "$HCI_TRANSPORT" ] || [ "$HCI_TRANSPORT" = "0" ]; then
+    sudo systemctl restart bluetooth.service
+    sleep 1
+    sudo hciconfig hci0 up
+fi
 
 exit 0
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+# Usage: upgrade_tag.sh [new Tag binary]
+# The new binary replaces the file instead of being written into the
+# running binary, which the kernel refuses while the Tag runs.
+TAG_BIN=/home/bedis/Tag/bin
+
+if [ -n "$1" ]; then
+    sudo install -m 775 "$1" $TAG_BIN/Tag.new
+    sudo mv $TAG_BIN/Tag.new $TAG_BIN/Tag
+fi
+
+sudo kill -SIGUSR2 `cat $TAG_BIN/Tag.pid`
+
+exit 0
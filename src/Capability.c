@@ -0,0 +1,312 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used by the Tag to probe the
+      capability of the controller and to keep it in the capability cache.
+
+ File Name:
+
+      Capability.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Capability.h"
+#include "State.h"
+#include "Transport.h"
+
+#define Debugging
+
+/* The checksum covers every byte following the checksum field */
+static uint32_t capability_checksum(ControllerCapability *capability){
+    size_t offset = offsetof(ControllerCapability, checksum) +
+                    sizeof(capability->checksum);
+
+    return crc32_checksum((uint8_t *)capability + offset,
+                          sizeof(ControllerCapability) - offset);
+}
+
+static ErrorCode read_local_version(int device_handle,
+                                    read_local_version_rp *version){
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    memset(version, 0, sizeof(*version));
+
+    return_value = send_hci_request(device_handle,
+                                    OGF_INFO_PARAM,
+                                    OCF_READ_LOCAL_VERSION,
+                                    NULL, 0,
+                                    version,
+                                    READ_LOCAL_VERSION_RP_SIZE);
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+    if(version->status){
+        zlog_error(category_health_report,
+                   "Read local version returned status %d",
+                   version->status);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Read local version returned status %d",
+                   version->status);
+#endif
+        return E_ADVERTISE_STATUS;
+    }
+
+    return WORK_SUCCESSFULLY;
+}
+
+/* Read the cache and check that it belongs to the controller */
+static bool load_capability_cache(char *file_name,
+                                  bdaddr_t *bdaddr,
+                                  read_local_version_rp *version,
+                                  ControllerCapability *capability){
+    int file = -1;
+    ssize_t length = 0;
+
+    file = open(file_name, O_RDONLY);
+    if(-1 == file){
+        return false;
+    }
+
+    length = read(file, capability, sizeof(ControllerCapability));
+    close(file);
+
+    if(sizeof(ControllerCapability) != length ||
+       CAPABILITY_MAGIC != capability->magic ||
+       CAPABILITY_VERSION != capability->version ||
+       capability_checksum(capability) != capability->checksum){
+        return false;
+    }
+
+    /* A new dongle or a firmware update invalidates the cache */
+    return 0 == memcmp(&capability->bdaddr, bdaddr, sizeof(bdaddr_t)) &&
+           capability->hci_version == version->hci_ver &&
+           capability->hci_revision == btohs(version->hci_rev) &&
+           capability->lmp_version == version->lmp_ver &&
+           capability->manufacturer == btohs(version->manufacturer) &&
+           capability->lmp_subversion == btohs(version->lmp_subver);
+}
+
+/* Write the cache to a temporary file which replaces the cache at once, so
+   that a crash never leaves a partial cache behind */
+static void save_capability_cache(char *file_name,
+                                  ControllerCapability *capability){
+    char temporary_file_name[CONFIG_BUFFER_SIZE];
+    int file = -1;
+    ssize_t length = 0;
+
+    snprintf(temporary_file_name, sizeof(temporary_file_name), "%s.tmp",
+             file_name);
+
+    file = open(temporary_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(-1 == file){
+        zlog_error(category_health_report,
+                   "Unable to write capability cache %s", file_name);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to write capability cache %s", file_name);
+#endif
+        return;
+    }
+
+    length = write(file, capability, sizeof(ControllerCapability));
+    if(0 != close(file) || sizeof(ControllerCapability) != length){
+        unlink(temporary_file_name);
+        return;
+    }
+
+    rename(temporary_file_name, file_name);
+}
+
+static ErrorCode probe_controller_capability(
+    int device_handle,
+    ControllerCapability *capability){
+
+    read_local_commands_rp commands;
+    le_read_local_supported_features_rp features;
+    TxPowerSetting tx_power_setting;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    memset(&commands, 0, sizeof(commands));
+    return_value = send_hci_request(device_handle,
+                                    OGF_INFO_PARAM,
+                                    OCF_READ_LOCAL_COMMANDS,
+                                    NULL, 0,
+                                    &commands,
+                                    READ_LOCAL_COMMANDS_RP_SIZE);
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+    if(commands.status){
+        zlog_error(category_health_report,
+                   "Read local supported commands returned status %d",
+                   commands.status);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Read local supported commands returned status %d",
+                   commands.status);
+#endif
+        return E_ADVERTISE_STATUS;
+    }
+    memcpy(capability->supported_commands, commands.commands,
+           LENGTH_OF_SUPPORTED_COMMANDS);
+
+    memset(&features, 0, sizeof(features));
+    return_value = send_hci_request(device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_READ_LOCAL_SUPPORTED_FEATURES,
+                                    NULL, 0,
+                                    &features,
+                                    LE_READ_LOCAL_SUPPORTED_FEATURES_RP_SIZE);
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+    if(features.status){
+        zlog_error(category_health_report,
+                   "LE read local supported features returned status %d",
+                   features.status);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "LE read local supported features returned status %d",
+                   features.status);
+#endif
+        return E_ADVERTISE_STATUS;
+    }
+    memcpy(capability->le_features, features.features,
+           LENGTH_OF_LE_FEATURES);
+
+    /* A controller which supports extended advertising disallows legacy
+       advertising commands once an extended one was sent and the other
+       way round, so only the commands of one kind are probed, chosen from
+       the commands and features read above. Guessing legacy advertising
+       after a failed read would mix them. */
+    memset(&tx_power_setting, 0, sizeof(tx_power_setting));
+    if(has_extended_advertising(capability)){
+        return_value = read_tx_power_range(device_handle, &tx_power_setting);
+    }else{
+        return_value = read_legacy_tx_power(device_handle, &tx_power_setting);
+    }
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+    capability->min_tx_power_in_dbm = tx_power_setting.min_tx_power_in_dbm;
+    capability->max_tx_power_in_dbm = tx_power_setting.max_tx_power_in_dbm;
+    capability->default_tx_power_in_dbm =
+        tx_power_setting.default_tx_power_in_dbm;
+
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode get_controller_capability(int device_handle,
+                                    int dongle_device_id,
+                                    char *file_name,
+                                    ControllerCapability *capability){
+    read_local_version_rp version;
+    bdaddr_t bdaddr;
+    struct timespec start_time, end_time;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    /* The BD address comes from the kernel without a HCI round trip, and
+       the local version is the only command needed to validate the
+       cache */
+    memset(&bdaddr, 0, sizeof(bdaddr));
+    if(read_hci_bdaddr(dongle_device_id, &bdaddr) < 0){
+        return E_OPEN_DEVICE;
+    }
+
+    return_value = read_local_version(device_handle, &version);
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+
+    if(load_capability_cache(file_name, &bdaddr, &version, capability)){
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+#ifdef Debugging
+        zlog_info(category_debug,
+                  "Controller capability from cache in %ld us",
+                  (end_time.tv_sec - start_time.tv_sec) * 1000000 +
+                  (end_time.tv_nsec - start_time.tv_nsec) / 1000);
+#endif
+        return WORK_SUCCESSFULLY;
+    }
+
+    memset(capability, 0, sizeof(ControllerCapability));
+    capability->magic = CAPABILITY_MAGIC;
+    capability->version = CAPABILITY_VERSION;
+    memcpy(&capability->bdaddr, &bdaddr, sizeof(bdaddr_t));
+    capability->hci_version = version.hci_ver;
+    capability->hci_revision = btohs(version.hci_rev);
+    capability->lmp_version = version.lmp_ver;
+    capability->manufacturer = btohs(version.manufacturer);
+    capability->lmp_subversion = btohs(version.lmp_subver);
+
+    return_value = probe_controller_capability(device_handle, capability);
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+
+    capability->checksum = capability_checksum(capability);
+    save_capability_cache(file_name, capability);
+
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    zlog_info(category_health_report,
+              "Probed controller HCI %d.%04X manufacturer 0x%04X "
+              "subversion 0x%04X in %ld us, extended advertising %d",
+              capability->hci_version,
+              capability->hci_revision,
+              capability->manufacturer,
+              capability->lmp_subversion,
+              (end_time.tv_sec - start_time.tv_sec) * 1000000 +
+              (end_time.tv_nsec - start_time.tv_nsec) / 1000,
+              has_extended_advertising(capability));
+
+    return WORK_SUCCESSFULLY;
+}
+
+bool is_command_supported(ControllerCapability *capability, int command){
+    return 0 != (capability->supported_commands[command / 8] &
+                 (1 << (command % 8)));
+}
+
+bool has_extended_advertising(ControllerCapability *capability){
+    return 0 != (capability->le_features[LE_FEATURE_EXTENDED_ADVERTISING / 8]
+                 & (1 << (LE_FEATURE_EXTENDED_ADVERTISING % 8))) &&
+           is_command_supported(
+               capability, COMMAND_LE_SET_EXTENDED_ADVERTISING_PARAMETERS) &&
+           is_command_supported(
+               capability, COMMAND_LE_SET_EXTENDED_ADVERTISING_DATA) &&
+           is_command_supported(
+               capability, COMMAND_LE_SET_EXTENDED_ADVERTISING_ENABLE);
+}
+
+bool has_vendor_tx_power(ControllerCapability *capability){
+    return MANUFACTURER_ZEPHYR == capability->manufacturer;
+}
+
+void get_capability_tx_power_range(ControllerCapability *capability,
+                                   TxPowerSetting *setting){
+    setting->min_tx_power_in_dbm = capability->min_tx_power_in_dbm;
+    setting->max_tx_power_in_dbm = capability->max_tx_power_in_dbm;
+    setting->default_tx_power_in_dbm = capability->default_tx_power_in_dbm;
+    setting->selected_tx_power_in_dbm = capability->default_tx_power_in_dbm;
+    setting->method = TX_POWER_CONTROLLER_DEFAULT;
+}
@@ -0,0 +1,217 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to probe what the controller of the dongle supports and to
+    cache the result on disk.
+
+File Name:
+
+    Capability.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    The probe reads the local version, the supported commands and the LE
+    features of the controller, and then the TX power range with either
+    legacy or extended advertising commands only, as the features tell.
+    The result is
+    cached in a file keyed by the BD address and the firmware version of
+    the controller. On later starts only the local version is read, and the
+    cache is used when the controller is the one which was probed, and
+    probed again otherwise. Features such as extended advertising and TX
+    power control ask the capability instead of trying commands which the
+    controller may reject.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef CAPABILITY_H
+#define CAPABILITY_H
+
+#include "Tag.h"
+#include "Power.h"
+
+/*
+  CONSTANTS
+*/
+
+/* File path of the capability cache of the Tag */
+#define CAPABILITY_FILE_NAME "../bin/Tag.capability"
+
+/* Magic number at the start of the capability cache */
+#define CAPABILITY_MAGIC 0x43505441
+
+/* Version of the layout of the capability cache. It must be increased
+   whenever ControllerCapability or the way it is probed changes. */
+#define CAPABILITY_VERSION 2
+
+/* Number of bytes of the Supported Commands bit mask */
+#define LENGTH_OF_SUPPORTED_COMMANDS 64
+
+/* Number of bytes of the LE Features bit mask */
+#define LENGTH_OF_LE_FEATURES 8
+
+/* Bits of the Supported Commands bit mask, numbered as octet * 8 + bit */
+#define COMMAND_LE_SET_ADVERTISING_SET_RANDOM_ADDRESS 290
+#define COMMAND_LE_SET_EXTENDED_ADVERTISING_PARAMETERS 291
+#define COMMAND_LE_SET_EXTENDED_ADVERTISING_DATA 292
+#define COMMAND_LE_SET_EXTENDED_ADVERTISING_ENABLE 294
+#define COMMAND_LE_READ_TRANSMIT_POWER 311
+
+/* Bit of the LE Features bit mask of LE Extended Advertising */
+#define LE_FEATURE_EXTENDED_ADVERTISING 12
+
+/* Company identifier of Zephyr controllers, which expose the vendor
+   specific Write Tx Power Level command */
+#define MANUFACTURER_ZEPHYR 0x05F1
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The capability of the controller, which is also the layout of the
+   capability cache */
+typedef struct ControllerCapability {
+
+    uint32_t magic;
+
+    uint32_t version;
+
+    /* CRC-32 of the bytes following this field */
+    uint32_t checksum;
+
+    /* The key of the cache: the BD address and the firmware version */
+    bdaddr_t bdaddr;
+    uint8_t hci_version;
+    uint16_t hci_revision;
+    uint8_t lmp_version;
+    uint16_t manufacturer;
+    uint16_t lmp_subversion;
+
+    uint8_t supported_commands[LENGTH_OF_SUPPORTED_COMMANDS];
+
+    uint8_t le_features[LENGTH_OF_LE_FEATURES];
+
+    /* The TX power range and the default TX power, of legacy advertising
+       or of an advertising set */
+    int8_t min_tx_power_in_dbm;
+    int8_t max_tx_power_in_dbm;
+    int8_t default_tx_power_in_dbm;
+
+} __attribute__ ((packed)) ControllerCapability;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  get_controller_capability:
+
+      This function returns the capability of the controller, from the
+      capability cache when the BD address and the firmware version of the
+      controller match the cache, or from a probe of the controller
+      otherwise. A probe rewrites the cache.
+
+  Parameters:
+
+      device_handle - the socket of the dongle
+      dongle_device_id - the id of the dongle
+      file_name - the name of the capability cache
+      capability - the capability to be filled
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode get_controller_capability(int device_handle,
+                                    int dongle_device_id,
+                                    char *file_name,
+                                    ControllerCapability *capability);
+
+/*
+  is_command_supported:
+
+      This function tells whether the controller supports a HCI command.
+
+  Parameters:
+
+      capability - the capability of the controller
+      command - the bit of the command in the Supported Commands bit mask
+
+  Return value:
+
+      bool - true if the command is supported
+*/
+
+bool is_command_supported(ControllerCapability *capability, int command);
+
+/*
+  has_extended_advertising:
+
+      This function tells whether the controller supports the extended
+      advertising commands used by the Tag.
+
+  Parameters:
+
+      capability - the capability of the controller
+
+  Return value:
+
+      bool - true if extended advertising is supported
+*/
+
+bool has_extended_advertising(ControllerCapability *capability);
+
+/*
+  has_vendor_tx_power:
+
+      This function tells whether the controller exposes the vendor
+      specific Write Tx Power Level command.
+
+  Parameters:
+
+      capability - the capability of the controller
+
+  Return value:
+
+      bool - true if the vendor specific command is exposed
+*/
+
+bool has_vendor_tx_power(ControllerCapability *capability);
+
+/*
+  get_capability_tx_power_range:
+
+      This function fills a TX power setting with the TX power range and
+      the default TX power of the controller.
+
+  Parameters:
+
+      capability - the capability of the controller
+      setting - the TX power setting to be filled
+
+  Return value:
+
+      None
+*/
+
+void get_capability_tx_power_range(ControllerCapability *capability,
+                                   TxPowerSetting *setting);
+
+#endif
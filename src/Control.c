@@ -0,0 +1,432 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs executed by the Tag to serve the
+      local control plane, i.e., the control socket and the control ring.
+
+ File Name:
+
+      Control.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "Control.h"
+#include "Energy.h"
+#include "Transport.h"
+#include "Template.h"
+
+#define Debugging
+
+/* HCI socket used by the data-only update path */
+static int control_device_handle = -1;
+
+/* The listening control socket */
+static int control_listen_socket = -1;
+
+/* The control ring in shared memory */
+static ControlRing *control_ring = NULL;
+
+static pthread_t control_socket_thread;
+
+static pthread_t control_ring_thread;
+
+/* Whether the threads of the control plane keep serving requests, which
+   only stops them all when one of them cannot be started */
+static bool control_running = false;
+
+/* Latency statistics of the applied requests, protected by
+   g_advertising.lock */
+static ControlStatistics control_statistics;
+
+/* Whether a burst is active, the time it ends and the advertising interval
+   restored after it, protected by g_advertising.lock */
+static bool burst_active = false;
+static uint64_t burst_end_in_ns = 0;
+static int burst_saved_min_interval = 0;
+static int burst_saved_max_interval = 0;
+
+/* Apply a CONTROL_SET_FIELD request to the payload */
+static ErrorCode set_payload_field(ControlRequest *request){
+    AdvertisingPayload *payload = &g_advertising.payload;
+
+    switch(request->field){
+        case PAYLOAD_FIELD_COORDINATES:
+            if(LENGTH_OF_COORDINATES != request->length){
+                return E_CONTROL_REQUEST;
+            }
+            memcpy(payload->coordinates, request->value,
+                   LENGTH_OF_COORDINATES);
+            payload->dirty_slots |=
+                PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_COORDINATES);
+            break;
+
+        case PAYLOAD_FIELD_BUTTON:
+            if(1 != request->length){
+                return E_CONTROL_REQUEST;
+            }
+            payload->button_state = request->value[0];
+            payload->dirty_slots |= PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_BUTTON);
+            break;
+
+        case PAYLOAD_FIELD_MEASURED_POWER:
+            if(1 != request->length){
+                return E_CONTROL_REQUEST;
+            }
+            payload->measured_power = (int8_t)request->value[0];
+            payload->dirty_slots |=
+                PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_MEASURED_POWER);
+            break;
+
+        default:
+            return E_CONTROL_REQUEST;
+    }
+
+    return update_advertising_data(control_device_handle);
+}
+
+/* Restore the advertising interval after a burst ends. The caller must hold
+   g_advertising.lock. */
+static void end_burst_if_expired(void){
+    if(burst_active && get_monotonic_time_in_ns() >= burst_end_in_ns){
+        if(WORK_SUCCESSFULLY == set_advertising_interval(
+               control_device_handle,
+               burst_saved_min_interval,
+               burst_saved_max_interval)){
+            burst_active = false;
+        }
+    }
+}
+
+ErrorCode apply_control_request(ControlRequest *request, ControlReply *reply){
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    uint64_t latency_in_ns = 0;
+
+    TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+
+    switch(request->command){
+        case CONTROL_SET_FIELD:
+            return_value = set_payload_field(request);
+            break;
+
+        case CONTROL_TRIGGER_BURST:
+            if(!burst_active){
+                burst_saved_min_interval =
+                    g_advertising.min_interval_in_units_0625_ms;
+                burst_saved_max_interval =
+                    g_advertising.max_interval_in_units_0625_ms;
+            }
+            return_value = set_advertising_interval(
+                control_device_handle,
+                BURST_INTERVAL_IN_UNITS_0625_MS,
+                BURST_INTERVAL_IN_UNITS_0625_MS);
+            if(WORK_SUCCESSFULLY == return_value){
+                burst_active = true;
+                burst_end_in_ns = get_monotonic_time_in_ns() +
+                    (uint64_t)request->burst_duration_in_ms * 1000000ULL;
+            }
+            break;
+
+        case CONTROL_QUERY_STATE:
+            break;
+
+        default:
+            return_value = E_CONTROL_REQUEST;
+            break;
+    }
+
+    /* The HCI commands above return on Command Complete */
+    if(CONTROL_QUERY_STATE != request->command &&
+       0 != request->client_timestamp_in_ns){
+        latency_in_ns = get_monotonic_time_in_ns() -
+                        request->client_timestamp_in_ns;
+
+        control_statistics.number_of_requests++;
+        control_statistics.total_latency_in_ns += latency_in_ns;
+        control_statistics.last_latency_in_ns = latency_in_ns;
+        if(latency_in_ns > control_statistics.max_latency_in_ns){
+            control_statistics.max_latency_in_ns = latency_in_ns;
+        }
+    }
+
+    if(NULL != reply){
+        memset(reply, 0, sizeof(*reply));
+        reply->error_code = return_value;
+        reply->latency_in_ns = latency_in_ns;
+        reply->min_interval_in_units_0625_ms =
+            g_advertising.min_interval_in_units_0625_ms;
+        reply->max_interval_in_units_0625_ms =
+            g_advertising.max_interval_in_units_0625_ms;
+        reply->tx_power_in_dbm = g_advertising.tx_power_in_dbm;
+        reply->extended_advertising = g_advertising.extended_advertising;
+        reply->burst_active = burst_active;
+        reply->payload = g_advertising.payload;
+        reply->statistics = control_statistics;
+    }
+
+    pthread_mutex_unlock(&g_advertising.lock);
+
+    if(WORK_SUCCESSFULLY != return_value){
+        zlog_error(category_health_report,
+                   "Control request %d field %d failed with error %d",
+                   request->command, request->field, return_value);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Control request %d field %d failed with error %d",
+                   request->command, request->field, return_value);
+#endif
+    }
+
+    return return_value;
+}
+
+static void *serve_control_socket(void *argument){
+    struct pollfd poll_fds[CONTROL_MAX_CLIENTS + 1];
+    int number_of_fds = 1;
+    int client_socket = -1;
+    ControlRequest request;
+    ControlReply reply;
+    ssize_t length = 0;
+    int i;
+
+    TRACE_THREAD_START();
+    set_energy_subsystem(SUBSYSTEM_CONTROL);
+
+    poll_fds[0].fd = control_listen_socket;
+    poll_fds[0].events = POLLIN;
+
+    while(true == ready_to_work && control_running){
+
+        if(poll(poll_fds, number_of_fds, CONTROL_POLL_TIMEOUT_IN_MS) < 0 &&
+           EINTR != errno){
+            break;
+        }
+        account_wakeup();
+
+        TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+        end_burst_if_expired();
+        pthread_mutex_unlock(&g_advertising.lock);
+
+        if(poll_fds[0].revents & POLLIN){
+            client_socket = accept(control_listen_socket, NULL, NULL);
+            account_syscalls(1);
+            if(client_socket >= 0){
+                if(number_of_fds <= CONTROL_MAX_CLIENTS){
+                    poll_fds[number_of_fds].fd = client_socket;
+                    poll_fds[number_of_fds].events = POLLIN;
+                    poll_fds[number_of_fds].revents = 0;
+                    number_of_fds++;
+                }else{
+                    close(client_socket);
+                }
+            }
+        }
+
+        for(i = number_of_fds - 1 ; i >= 1 ; i--){
+            if(0 == poll_fds[i].revents){
+                continue;
+            }
+
+            length = recv(poll_fds[i].fd, &request, sizeof(request), 0);
+            account_syscalls(1);
+
+            if(length == sizeof(request)){
+                apply_control_request(&request, &reply);
+                send(poll_fds[i].fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+                account_syscalls(1);
+                continue;
+            }
+
+            /* The client hung up or sent a malformed request */
+            close(poll_fds[i].fd);
+            poll_fds[i] = poll_fds[number_of_fds - 1];
+            number_of_fds--;
+        }
+    }
+
+    for(i = 1 ; i < number_of_fds ; i++){
+        close(poll_fds[i].fd);
+    }
+
+    return NULL;
+}
+
+static void *serve_control_ring(void *argument){
+    struct timespec timeout;
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    ControlRequest request;
+
+    TRACE_THREAD_START();
+    set_energy_subsystem(SUBSYSTEM_CONTROL);
+
+    timeout.tv_sec = CONTROL_POLL_TIMEOUT_IN_MS / 1000;
+    timeout.tv_nsec = (CONTROL_POLL_TIMEOUT_IN_MS % 1000) * 1000000L;
+
+    while(true == ready_to_work && control_running){
+        tail = __atomic_load_n(&control_ring->tail, __ATOMIC_RELAXED);
+        head = __atomic_load_n(&control_ring->head, __ATOMIC_ACQUIRE);
+
+        if(head == tail){
+            /* Sleep until the producer moves head away from tail */
+            syscall(SYS_futex, &control_ring->head, FUTEX_WAIT, tail,
+                    &timeout, NULL, 0);
+            account_wakeup();
+            continue;
+        }
+
+        request = control_ring->entries[tail & (CONTROL_RING_SIZE - 1)];
+        __atomic_store_n(&control_ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+        apply_control_request(&request, NULL);
+    }
+
+    return NULL;
+}
+
+ErrorCode start_control_plane(int dongle_device_id, int device_handle){
+    struct sockaddr_un address;
+    int retry_time = 0;
+
+    /* A HCI socket handed over by the previous Tag is used as it is */
+    control_device_handle = device_handle;
+
+    retry_time = SOCKET_OPEN_RETRY;
+    while(control_device_handle < 0 && retry_time--){
+        control_device_handle = open_hci_device(dongle_device_id);
+
+        if(control_device_handle >= 0){
+            break;
+        }
+    }
+
+    if(control_device_handle < 0){
+        zlog_error(category_health_report,
+                   "Error openning socket for control plane");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Error openning socket for control plane");
+#endif
+        return E_OPEN_DEVICE;
+    }
+
+    control_listen_socket = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if(control_listen_socket < 0){
+        close_hci_device(control_device_handle);
+        return E_OPEN_SOCKET;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, CONTROL_SOCKET_PATH,
+            sizeof(address.sun_path) - 1);
+    unlink(CONTROL_SOCKET_PATH);
+
+    /* Connections are refused until listen, so nobody else connects
+       before the mode is restricted */
+    if(-1 == bind(control_listen_socket, (struct sockaddr *)&address,
+                  sizeof(address)) ||
+       -1 == chmod(CONTROL_SOCKET_PATH, CONTROL_SOCKET_MODE) ||
+       -1 == listen(control_listen_socket, CONTROL_MAX_CLIENTS)){
+        zlog_error(category_health_report,
+                   "Unable to listen on control socket: %s",
+                   strerror(errno));
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to listen on control socket: %s",
+                   strerror(errno));
+#endif
+        close(control_listen_socket);
+        unlink(CONTROL_SOCKET_PATH);
+        close_hci_device(control_device_handle);
+        return E_OPEN_SOCKET;
+    }
+
+    control_ring = control_ring_map(true);
+    if(NULL == control_ring){
+        zlog_error(category_health_report,
+                   "Unable to map control ring: %s", strerror(errno));
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to map control ring: %s", strerror(errno));
+#endif
+        close(control_listen_socket);
+        unlink(CONTROL_SOCKET_PATH);
+        close_hci_device(control_device_handle);
+        return E_OPEN_FILE;
+    }
+
+    control_running = true;
+
+    if(0 != pthread_create(&control_socket_thread, NULL,
+                           serve_control_socket, NULL)){
+        control_running = false;
+    }else if(0 != pthread_create(&control_ring_thread, NULL,
+                                 serve_control_ring, NULL)){
+        control_running = false;
+        pthread_join(control_socket_thread, NULL);
+    }
+
+    if(!control_running){
+        zlog_error(category_health_report,
+                   "Unable to start the threads of the control plane");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to start the threads of the control plane");
+#endif
+        close(control_listen_socket);
+        unlink(CONTROL_SOCKET_PATH);
+        control_ring_unmap(control_ring);
+        shm_unlink(CONTROL_RING_NAME);
+        control_ring = NULL;
+        close_hci_device(control_device_handle);
+        return E_START_THREAD;
+    }
+
+    return WORK_SUCCESSFULLY;
+}
+
+void stop_control_plane(void){
+    if(NULL == control_ring){
+        return;
+    }
+
+    pthread_join(control_socket_thread, NULL);
+    pthread_join(control_ring_thread, NULL);
+    control_running = false;
+
+    /* Advertising outlives the control plane when the Tag hands over to a
+       new binary, so a burst must not be left behind */
+    TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+    burst_end_in_ns = 0;
+    end_burst_if_expired();
+    pthread_mutex_unlock(&g_advertising.lock);
+
+    close(control_listen_socket);
+    unlink(CONTROL_SOCKET_PATH);
+
+    control_ring_unmap(control_ring);
+    shm_unlink(CONTROL_RING_NAME);
+    control_ring = NULL;
+
+    close_hci_device(control_device_handle);
+}
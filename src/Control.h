@@ -0,0 +1,362 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains the definitions of the local control-plane
+    protocol of the Tag, and declarations of the functions used by the Tag
+    and by other processes on the box to push payload fields, trigger
+    bursts and query the state of the Tag.
+
+File Name:
+
+    Control.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    Clients talk to the Tag either through a Unix-domain SOCK_SEQPACKET
+    socket, which replies to each request, or through a single-producer/
+    single-consumer ring in shared memory, which is fire-and-forget. The
+    Tag applies the requests through the data-only HCI update path and
+    records the latency from client write to Command Complete.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "Tag.h"
+
+/*
+  CONSTANTS
+*/
+
+/* File path of the Unix-domain socket of the control plane */
+#define CONTROL_SOCKET_PATH "../bin/Tag.sock"
+
+/* Name of the shared memory object of the control ring */
+#define CONTROL_RING_NAME "/Tag_control"
+
+/* Mode of the control ring, which only the user of the Tag may write */
+#define CONTROL_RING_MODE 0600
+
+/* Mode of the control socket, which only the user of the Tag may connect
+   to */
+#define CONTROL_SOCKET_MODE 0600
+
+/* Number of entries of the control ring, a power of two */
+#define CONTROL_RING_SIZE 64
+
+/* Magic number marking an initialized control ring */
+#define CONTROL_RING_MAGIC 0x54414743
+
+/* Maximum number of clients connected to the control socket at once */
+#define CONTROL_MAX_CLIENTS 8
+
+/* Timeout in milliseconds of the waits of the control threads, so that
+   they notice ready_to_work being cleared */
+#define CONTROL_POLL_TIMEOUT_IN_MS 500
+
+/* Maximum number of bytes of a payload field */
+#define CONTROL_MAX_VALUE_LENGTH 16
+
+/* Advertising interval in units of 0.625ms used during a burst, which is
+   the minimum allowed for legacy non-connectable advertising */
+#define BURST_INTERVAL_IN_UNITS_0625_MS 0x00A0
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The commands of the control plane */
+typedef enum _ControlCommand{
+
+    CONTROL_SET_FIELD = 1,
+    CONTROL_TRIGGER_BURST = 2,
+    CONTROL_QUERY_STATE = 3
+
+} ControlCommand;
+
+/* The payload fields which clients may set */
+typedef enum _PayloadField{
+
+    /* 8 bytes, 4 bytes for X and 4 bytes for Y coordinate */
+    PAYLOAD_FIELD_COORDINATES = 1,
+
+    /* 1 byte */
+    PAYLOAD_FIELD_BUTTON = 2,
+
+    /* 1 byte, signed */
+    PAYLOAD_FIELD_MEASURED_POWER = 3
+
+} PayloadField;
+
+/* A request sent by a client */
+typedef struct ControlRequest {
+
+    /* One of ControlCommand */
+    uint8_t command;
+
+    /* One of PayloadField for CONTROL_SET_FIELD */
+    uint8_t field;
+
+    /* Number of bytes used in value */
+    uint8_t length;
+
+    uint8_t value[CONTROL_MAX_VALUE_LENGTH];
+
+    /* Duration of a burst for CONTROL_TRIGGER_BURST */
+    uint32_t burst_duration_in_ms;
+
+    /* CLOCK_MONOTONIC time at which the client wrote the request, or 0 */
+    uint64_t client_timestamp_in_ns;
+
+} ControlRequest;
+
+/* The latency statistics of the requests applied by the Tag */
+typedef struct ControlStatistics {
+
+    uint64_t number_of_requests;
+
+    uint64_t total_latency_in_ns;
+
+    uint64_t max_latency_in_ns;
+
+    uint64_t last_latency_in_ns;
+
+} ControlStatistics;
+
+/* The reply of the Tag to a request received on the control socket */
+typedef struct ControlReply {
+
+    /* ErrorCode of the request */
+    int32_t error_code;
+
+    /* Latency from client write to Command Complete of the request */
+    uint64_t latency_in_ns;
+
+    int32_t min_interval_in_units_0625_ms;
+
+    int32_t max_interval_in_units_0625_ms;
+
+    int32_t tx_power_in_dbm;
+
+    uint8_t extended_advertising;
+
+    uint8_t burst_active;
+
+    AdvertisingPayload payload;
+
+    ControlStatistics statistics;
+
+} ControlReply;
+
+/* The single-producer/single-consumer ring in shared memory. The producer
+   only writes head and the consumer only writes tail. head also serves as
+   the futex word on which the consumer sleeps while the ring is empty.
+   The producer holds an exclusive flock on the ring while it is mapped,
+   so a second producer cannot attach. */
+typedef struct ControlRing {
+
+    uint32_t magic;
+
+    uint32_t head;
+
+    uint32_t tail;
+
+    ControlRequest entries[CONTROL_RING_SIZE];
+
+} ControlRing;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  start_control_plane:
+
+      This function creates the control socket and the control ring, opens
+      a HCI socket for the data-only update path, and starts the threads
+      which serve them.
+
+  Parameters:
+
+      dongle_device_id - the bluetooth dongle device which the Tag uses to
+                         advertise
+      device_handle - a HCI socket of the dongle to be used for the
+                      data-only update path, or -1 to open one
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode start_control_plane(int dongle_device_id, int device_handle);
+
+/*
+  stop_control_plane:
+
+      This function waits for the control threads to notice that
+      ready_to_work is cleared, and removes the control socket and ring.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      None
+*/
+
+void stop_control_plane(void);
+
+/*
+  apply_control_request:
+
+      This function applies a request to the advertising state of the Tag
+      and fills the reply with the resulting state.
+
+  Parameters:
+
+      request - the request of a client
+      reply - the reply to be filled, or NULL
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode apply_control_request(ControlRequest *request, ControlReply *reply);
+
+/*
+  get_monotonic_time_in_ns:
+
+      This function returns the CLOCK_MONOTONIC time used to timestamp
+      requests.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      uint64_t - the time in nano seconds
+*/
+
+uint64_t get_monotonic_time_in_ns(void);
+
+/*
+  control_connect:
+
+      This function connects a client to the control socket of the Tag.
+
+  Parameters:
+
+      socket_path - the file path of the control socket
+
+  Return value:
+
+      int - the connected socket, or -1 on error
+*/
+
+int control_connect(char *socket_path);
+
+/*
+  control_send_request:
+
+      This function timestamps a request, sends it to the Tag and waits for
+      the reply.
+
+  Parameters:
+
+      control_socket - the connected control socket
+      request - the request to be sent
+      reply - the reply of the Tag
+
+  Return value:
+
+      ErrorCode - E_OPEN_SOCKET if the request cannot be exchanged, or the
+                  error code of the request otherwise
+*/
+
+ErrorCode control_send_request(int control_socket,
+                               ControlRequest *request,
+                               ControlReply *reply);
+
+/*
+  control_ring_map:
+
+      This function maps the control ring in shared memory.
+
+  Parameters:
+
+      create - whether to create and initialize the ring, as done by the
+               Tag, or to attach to an existing ring as its producer, as
+               done by clients
+
+  Return value:
+
+      ControlRing * - the mapped ring, or NULL on error or if another
+                      producer is attached
+*/
+
+ControlRing *control_ring_map(bool create);
+
+/*
+  control_ring_unmap:
+
+      This function unmaps the control ring and releases the producer lock.
+
+  Parameters:
+
+      ring - the mapped control ring
+
+  Return value:
+
+      None
+*/
+
+void control_ring_unmap(ControlRing *ring);
+
+/*
+  control_ring_push:
+
+      This function timestamps a request, writes it into the control ring
+      and wakes up the Tag. It is called by the single producer.
+
+  Parameters:
+
+      ring - the mapped control ring
+      request - the request to be written
+
+  Return value:
+
+      bool - false if the ring is full, or true otherwise
+*/
+
+bool control_ring_push(ControlRing *ring, ControlRequest *request);
+
+#endif
@@ -0,0 +1,173 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs shared by the Tag and by the clients
+      of its control plane to exchange requests through the control socket
+      and the control ring.
+
+ File Name:
+
+      ControlClient.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include <linux/futex.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+
+#include "Control.h"
+
+/* The ring file of the producer, kept open to hold the producer lock for
+   as long as the ring is mapped */
+static int producer_ring_file = -1;
+
+uint64_t get_monotonic_time_in_ns(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+int control_connect(char *socket_path){
+    int control_socket = -1;
+    struct sockaddr_un address;
+
+    control_socket = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if(control_socket < 0){
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+
+    if(-1 == connect(control_socket, (struct sockaddr *)&address,
+                     sizeof(address))){
+        close(control_socket);
+        return -1;
+    }
+
+    return control_socket;
+}
+
+ErrorCode control_send_request(int control_socket,
+                               ControlRequest *request,
+                               ControlReply *reply){
+
+    request->client_timestamp_in_ns = get_monotonic_time_in_ns();
+
+    if(sizeof(*request) != send(control_socket, request, sizeof(*request),
+                                0)){
+        return E_OPEN_SOCKET;
+    }
+
+    if(sizeof(*reply) != recv(control_socket, reply, sizeof(*reply), 0)){
+        return E_OPEN_SOCKET;
+    }
+
+    return reply->error_code;
+}
+
+ControlRing *control_ring_map(bool create){
+    int ring_file = -1;
+    ControlRing *ring = NULL;
+
+    if(create){
+        ring_file = shm_open(CONTROL_RING_NAME, O_RDWR | O_CREAT,
+                             CONTROL_RING_MODE);
+    }else{
+        ring_file = shm_open(CONTROL_RING_NAME, O_RDWR, 0);
+    }
+    if(ring_file < 0){
+        return NULL;
+    }
+
+    /* The mode of shm_open is masked by the umask and left as it is for a
+       ring created by an earlier run, so it is set again */
+    if(create && (-1 == fchmod(ring_file, CONTROL_RING_MODE) ||
+                  -1 == ftruncate(ring_file, sizeof(ControlRing)))){
+        close(ring_file);
+        return NULL;
+    }
+
+    /* head is written by the single producer only, so a second client is
+       refused instead of racing on it. The lock is released when the ring
+       file is closed, also when the client dies. */
+    if(!create && -1 == flock(ring_file, LOCK_EX | LOCK_NB)){
+        close(ring_file);
+        return NULL;
+    }
+
+    ring = (ControlRing *)mmap(NULL, sizeof(ControlRing),
+                               PROT_READ | PROT_WRITE, MAP_SHARED,
+                               ring_file, 0);
+
+    if(MAP_FAILED == ring){
+        close(ring_file);
+        return NULL;
+    }
+
+    if(create){
+        close(ring_file);
+    }else{
+        producer_ring_file = ring_file;
+    }
+
+    if(create){
+        memset(ring, 0, sizeof(ControlRing));
+        __atomic_store_n(&ring->magic, CONTROL_RING_MAGIC, __ATOMIC_RELEASE);
+    }else if(CONTROL_RING_MAGIC != __atomic_load_n(&ring->magic,
+                                                   __ATOMIC_ACQUIRE)){
+        control_ring_unmap(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+void control_ring_unmap(ControlRing *ring){
+    munmap(ring, sizeof(ControlRing));
+
+    if(-1 != producer_ring_file){
+        close(producer_ring_file);
+        producer_ring_file = -1;
+    }
+}
+
+bool control_ring_push(ControlRing *ring, ControlRequest *request){
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if(head - tail >= CONTROL_RING_SIZE){
+        return false;
+    }
+
+    request->client_timestamp_in_ns = get_monotonic_time_in_ns();
+    ring->entries[head & (CONTROL_RING_SIZE - 1)] = *request;
+
+    /* Publish the entry before the new head, then wake up the Tag sleeping
+       on the head futex. The futex is shared between processes, so the
+       private futex operations cannot be used. */
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &ring->head, FUTEX_WAKE, 1, NULL, NULL, 0);
+
+    return true;
+}
@@ -0,0 +1,287 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used by the Tag to account its
+      activity per subsystem and to estimate its charge per day.
+
+ File Name:
+
+      Energy.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Energy.h"
+#include "Planner.h"
+#include "Control.h"
+#include "Scanner.h"
+#include "Sensor.h"
+
+#define Debugging
+
+static const char *subsystem_names[NUMBER_OF_SUBSYSTEMS] = {
+    "main", "control", "sensor", "scanner", "sync",
+    "locator", "privacy"
+};
+
+/* The subsystem of the calling thread */
+static __thread Subsystem current_subsystem = SUBSYSTEM_MAIN;
+
+/* The counters are word-sized, so that increments stay lock-free on every
+   Raspberry Pi */
+static unsigned long energy_counters[NUMBER_OF_SUBSYSTEMS]
+                                    [NUMBER_OF_ENERGY_COUNTERS];
+
+/* The counters and the context switches at the last report */
+static unsigned long reported_counters[NUMBER_OF_SUBSYSTEMS]
+                                      [NUMBER_OF_ENERGY_COUNTERS];
+static long reported_context_switches = 0;
+static struct timespec reported_time;
+
+void set_energy_subsystem(Subsystem subsystem){
+    current_subsystem = subsystem;
+}
+
+void account_wakeup(void){
+    __sync_fetch_and_add(
+        &energy_counters[current_subsystem][ENERGY_WAKEUPS], 1);
+    __sync_fetch_and_add(
+        &energy_counters[current_subsystem][ENERGY_SYSCALLS], 1);
+}
+
+void account_syscalls(int number_of_syscalls){
+    __sync_fetch_and_add(
+        &energy_counters[current_subsystem][ENERGY_SYSCALLS],
+        number_of_syscalls);
+}
+
+void account_hci_command(void){
+    __sync_fetch_and_add(
+        &energy_counters[current_subsystem][ENERGY_HCI_COMMANDS], 1);
+    __sync_fetch_and_add(
+        &energy_counters[current_subsystem][ENERGY_SYSCALLS],
+        SYSCALLS_PER_HCI_COMMAND);
+}
+
+void get_energy_model(Config *config, EnergyModel *model){
+    model->wakeup_cost_in_uas = config->energy_wakeup_cost_in_uas;
+    model->hci_command_cost_in_uas = config->energy_hci_command_cost_in_uas;
+    model->advertising_event_cost_in_uas =
+        config->energy_advertising_event_cost_in_uas;
+    model->baseline_current_in_ua = config->energy_baseline_current_in_ua;
+}
+
+double advertising_events_per_second(int min_interval_in_units_0625_ms,
+                                     int max_interval_in_units_0625_ms){
+    double interval_in_micro_seconds =
+        (min_interval_in_units_0625_ms + max_interval_in_units_0625_ms) /
+        2.0 * MICRO_SECONDS_PER_INTERVAL_UNIT +
+        MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS / 2.0;
+
+    return 1000000.0 / interval_in_micro_seconds;
+}
+
+double estimate_milli_amp_hours_per_day(EnergyModel *model,
+                                        EnergyRates *rates){
+    double current_in_ua = model->baseline_current_in_ua +
+        rates->wakeups_per_second * model->wakeup_cost_in_uas +
+        rates->hci_commands_per_second * model->hci_command_cost_in_uas +
+        rates->advertising_events_per_second *
+            model->advertising_event_cost_in_uas;
+
+    return current_in_ua * SECONDS_PER_DAY /
+           MICRO_AMPERE_SECONDS_PER_MILLI_AMPERE_HOUR;
+}
+
+void report_energy_accounting(EnergyModel *model){
+    unsigned long counters[NUMBER_OF_ENERGY_COUNTERS];
+    unsigned long total[NUMBER_OF_ENERGY_COUNTERS];
+    struct timespec now;
+    struct rusage usage;
+    EnergyRates rates;
+    double duration_in_seconds = 0;
+    long context_switches = 0;
+    int subsystem;
+    int counter;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    getrusage(RUSAGE_SELF, &usage);
+
+    if(0 == reported_time.tv_sec){
+        reported_time = now;
+        reported_context_switches = usage.ru_nvcsw + usage.ru_nivcsw;
+        return;
+    }
+
+    duration_in_seconds = (now.tv_sec - reported_time.tv_sec) +
+                          (now.tv_nsec - reported_time.tv_nsec) / 1e9;
+    if(duration_in_seconds <= 0){
+        return;
+    }
+
+    memset(total, 0, sizeof(total));
+
+    for(subsystem = 0 ; subsystem < NUMBER_OF_SUBSYSTEMS ; subsystem++){
+        for(counter = 0 ; counter < NUMBER_OF_ENERGY_COUNTERS ; counter++){
+            counters[counter] =
+                __sync_fetch_and_add(&energy_counters[subsystem][counter], 0);
+            total[counter] += counters[counter] -
+                              reported_counters[subsystem][counter];
+        }
+
+        zlog_info(category_health_report,
+                  "Energy %s: wakeups %.0f/h syscalls %.0f/h HCI %.0f/h",
+                  subsystem_names[subsystem],
+                  (counters[ENERGY_WAKEUPS] -
+                   reported_counters[subsystem][ENERGY_WAKEUPS]) *
+                  SECONDS_PER_HOUR / duration_in_seconds,
+                  (counters[ENERGY_SYSCALLS] -
+                   reported_counters[subsystem][ENERGY_SYSCALLS]) *
+                  SECONDS_PER_HOUR / duration_in_seconds,
+                  (counters[ENERGY_HCI_COMMANDS] -
+                   reported_counters[subsystem][ENERGY_HCI_COMMANDS]) *
+                  SECONDS_PER_HOUR / duration_in_seconds);
+
+        memcpy(reported_counters[subsystem], counters, sizeof(counters));
+    }
+
+    TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+    rates.advertising_events_per_second = advertising_events_per_second(
+        g_advertising.min_interval_in_units_0625_ms,
+        g_advertising.max_interval_in_units_0625_ms);
+    pthread_mutex_unlock(&g_advertising.lock);
+
+    rates.wakeups_per_second = total[ENERGY_WAKEUPS] / duration_in_seconds;
+    rates.hci_commands_per_second =
+        total[ENERGY_HCI_COMMANDS] / duration_in_seconds;
+
+    /* Context switches measured by the kernel cross-check the counted
+       wakeups */
+    context_switches = usage.ru_nvcsw + usage.ru_nivcsw;
+
+    zlog_info(category_health_report,
+              "Energy total: wakeups %.0f/h (context switches %.0f/h) "
+              "HCI %.0f/h advertising events %.0f/h, %.3f mAh/day",
+              rates.wakeups_per_second * SECONDS_PER_HOUR,
+              (context_switches - reported_context_switches) *
+              SECONDS_PER_HOUR / duration_in_seconds,
+              rates.hci_commands_per_second * SECONDS_PER_HOUR,
+              rates.advertising_events_per_second * SECONDS_PER_HOUR,
+              estimate_milli_amp_hours_per_day(model, &rates));
+
+    reported_context_switches = context_switches;
+    reported_time = now;
+}
+
+void print_energy_table(Config *config, int updates_per_hour){
+    int intervals[] = {0x00A0, 0x0140, 0x0320, 0x0640, 0x0C80, 0x1900};
+    EnergyModel model;
+    EnergyRates rates;
+    double host_wakeups_per_second = 0;
+    double scanner_wakeups_per_second = 0;
+    double restarts_per_second = 0;
+    double host_milli_amp_hours = 0;
+    size_t i;
+
+    get_energy_model(config, &model);
+
+    /* Idle threads wake up when their waits time out */
+    host_wakeups_per_second =
+        1000000.0 / INTERVAL_FOR_BUSY_WAITING_CHECK_IN_MICRO_SECONDS +
+        2 * 1000.0 / CONTROL_POLL_TIMEOUT_IN_MS;
+    if(config->sensor_sampling_rate_in_hz > 0 &&
+       config->sensor_sampling_rate_in_hz <= SENSOR_MAX_SAMPLING_RATE_IN_HZ){
+        host_wakeups_per_second += config->sensor_sampling_rate_in_hz;
+    }
+    if(config->scanner_dongle_id >= 0){
+        scanner_wakeups_per_second = 1000.0 / SCANNER_POLL_TIMEOUT_IN_MS;
+    }
+
+    printf("updates/h %d, wakeup %.1f uAs, HCI command %.1f uAs, "
+           "advertising event %.1f uAs, baseline %.1f uA\n",
+           updates_per_hour,
+           model.wakeup_cost_in_uas,
+           model.hci_command_cost_in_uas,
+           model.advertising_event_cost_in_uas,
+           model.baseline_current_in_ua);
+    printf("%12s %12s %12s %12s %12s %12s\n",
+           "interval_ms", "events/h", "wakeups/h", "hci/h",
+           "host_mAh/d", "total_mAh/d");
+
+    for(i = 0 ; i < sizeof(intervals) / sizeof(intervals[0]) ; i++){
+        rates.advertising_events_per_second =
+            advertising_events_per_second(intervals[i], intervals[i]);
+
+        /* The loopback scanner wakes up for every received packet, and
+           every update of the payload is one HCI command */
+        rates.wakeups_per_second = host_wakeups_per_second;
+        if(config->scanner_dongle_id >= 0){
+            rates.wakeups_per_second += scanner_wakeups_per_second +
+                                        rates.advertising_events_per_second;
+        }
+        rates.hci_commands_per_second =
+            (double)updates_per_hour / SECONDS_PER_HOUR;
+
+        /* A synchronized Tag wakes up to restart advertising at its slot,
+           with two HCI commands, every few frames of one interval. The
+           rare scans for the sync beacon are left out. */
+        if(strlen(config->sync_beacon_address) > 0 &&
+           config->sync_realign_interval_in_frames > 0){
+            restarts_per_second =
+                1000000.0 / (intervals[i] * MICRO_SECONDS_PER_INTERVAL_UNIT) /
+                config->sync_realign_interval_in_frames;
+            rates.wakeups_per_second += restarts_per_second;
+            rates.hci_commands_per_second += 2 * restarts_per_second;
+        }
+
+        /* The locator enables and disables its scan once per period. The
+           wakeups per received report depend on the LBeacons around and
+           are left out. */
+        if(config->locator_dongle_id >= 0 &&
+           config->locator_scan_period_in_seconds > 0){
+            rates.wakeups_per_second +=
+                1.0 / config->locator_scan_period_in_seconds;
+            rates.hci_commands_per_second +=
+                2.0 / config->locator_scan_period_in_seconds;
+        }
+
+        /* A rotation disables advertising, sets the address and the data
+           and enables advertising again */
+        if(strlen(config->privacy_key) > 0 &&
+           config->privacy_rotation_interval_in_seconds > 0){
+            rates.wakeups_per_second +=
+                1.0 / config->privacy_rotation_interval_in_seconds;
+            rates.hci_commands_per_second +=
+                4.0 / config->privacy_rotation_interval_in_seconds;
+        }
+
+        host_milli_amp_hours =
+            (rates.wakeups_per_second * model.wakeup_cost_in_uas +
+             rates.hci_commands_per_second * model.hci_command_cost_in_uas) *
+            SECONDS_PER_DAY / MICRO_AMPERE_SECONDS_PER_MILLI_AMPERE_HOUR;
+
+        printf("%12.1f %12.0f %12.0f %12.0f %12.3f %12.3f\n",
+               intervals[i] * MICRO_SECONDS_PER_INTERVAL_UNIT / 1000.0,
+               rates.advertising_events_per_second * SECONDS_PER_HOUR,
+               rates.wakeups_per_second * SECONDS_PER_HOUR,
+               rates.hci_commands_per_second * SECONDS_PER_HOUR,
+               host_milli_amp_hours,
+               estimate_milli_amp_hours_per_day(&model, &rates));
+    }
+}
@@ -0,0 +1,289 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to account its wakeups, syscalls, HCI commands and
+    advertising events per subsystem, and to estimate the charge they cost
+    with a configurable energy model.
+
+File Name:
+
+    Energy.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    Each thread of the Tag declares the subsystem it belongs to. Timer and
+    event wakeups, syscalls and HCI commands are counted at the points
+    where the threads block and call into the kernel, and charged to the
+    subsystem of the calling thread. Advertising events happen in the
+    controller without host involvement and are derived from the
+    advertising interval. The energy model gives the charge of a wakeup, a
+    HCI command and an advertising event, and a baseline current. The Tag
+    reports the measured rates and the estimated mAh per day periodically
+    and at exit, and -e prints the estimate of the current config over a
+    range of advertising intervals for a given number of payload updates
+    per hour.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <sys/resource.h>
+
+#include "Tag.h"
+
+/*
+  CONSTANTS
+*/
+
+/* Number of syscalls made by hci_send_req for one HCI command: reading and
+   setting the socket filter, writing the command, polling and reading the
+   events, and restoring the socket filter */
+#define SYSCALLS_PER_HCI_COMMAND 6
+
+/* Charge in micro-ampere-seconds (micro coulombs) per mAh */
+#define MICRO_AMPERE_SECONDS_PER_MILLI_AMPERE_HOUR 3600000.0
+
+#define SECONDS_PER_HOUR 3600
+
+#define SECONDS_PER_DAY 86400
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The subsystems to which the activity of the Tag is charged */
+typedef enum _Subsystem{
+
+    SUBSYSTEM_MAIN = 0,
+    SUBSYSTEM_CONTROL = 1,
+    SUBSYSTEM_SENSOR = 2,
+    SUBSYSTEM_SCANNER = 3,
+    SUBSYSTEM_SYNC = 4,
+    SUBSYSTEM_LOCATOR = 5,
+    SUBSYSTEM_PRIVACY = 6,
+
+    NUMBER_OF_SUBSYSTEMS
+
+} Subsystem;
+
+/* The counted activities of a subsystem */
+typedef enum _EnergyCounter{
+
+    ENERGY_WAKEUPS = 0,
+    ENERGY_SYSCALLS = 1,
+    ENERGY_HCI_COMMANDS = 2,
+
+    NUMBER_OF_ENERGY_COUNTERS
+
+} EnergyCounter;
+
+/* The energy model of the gateway and the dongle */
+typedef struct EnergyModel {
+
+    /* Charge in micro-ampere-seconds of a wakeup of the host CPU */
+    double wakeup_cost_in_uas;
+
+    /* Charge in micro-ampere-seconds of a HCI command round trip */
+    double hci_command_cost_in_uas;
+
+    /* Charge in micro-ampere-seconds of an advertising event on the three
+       advertising channels */
+    double advertising_event_cost_in_uas;
+
+    /* Current in micro-amperes drawn regardless of the activity */
+    double baseline_current_in_ua;
+
+} EnergyModel;
+
+/* The activity rates of the Tag */
+typedef struct EnergyRates {
+
+    double wakeups_per_second;
+
+    double hci_commands_per_second;
+
+    double advertising_events_per_second;
+
+} EnergyRates;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  set_energy_subsystem:
+
+      This function declares the subsystem to which the activity of the
+      calling thread is charged. Threads which do not declare a subsystem
+      are charged to SUBSYSTEM_MAIN.
+
+  Parameters:
+
+      subsystem - the subsystem of the calling thread
+
+  Return value:
+
+      None
+*/
+
+void set_energy_subsystem(Subsystem subsystem);
+
+/*
+  account_wakeup:
+
+      This function counts a wakeup of the calling thread and the syscall
+      it returned from.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      None
+*/
+
+void account_wakeup(void);
+
+/*
+  account_syscalls:
+
+      This function counts syscalls of the calling thread.
+
+  Parameters:
+
+      number_of_syscalls - the number of syscalls
+
+  Return value:
+
+      None
+*/
+
+void account_syscalls(int number_of_syscalls);
+
+/*
+  account_hci_command:
+
+      This function counts a HCI command of the calling thread and the
+      syscalls it takes.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      None
+*/
+
+void account_hci_command(void);
+
+/*
+  get_energy_model:
+
+      This function fills the energy model from the config.
+
+  Parameters:
+
+      config - the pointer to the config struct of the Tag
+      model - the energy model to be filled
+
+  Return value:
+
+      None
+*/
+
+void get_energy_model(Config *config, EnergyModel *model);
+
+/*
+  advertising_events_per_second:
+
+      This function returns the rate of advertising events at an
+      advertising interval, including the average advertising delay which
+      the controller adds to every interval.
+
+  Parameters:
+
+      min_interval_in_units_0625_ms - the minimum advertising interval
+      max_interval_in_units_0625_ms - the maximum advertising interval
+
+  Return value:
+
+      double - the number of advertising events per second
+*/
+
+double advertising_events_per_second(int min_interval_in_units_0625_ms,
+                                     int max_interval_in_units_0625_ms);
+
+/*
+  estimate_milli_amp_hours_per_day:
+
+      This function applies the energy model to activity rates.
+
+  Parameters:
+
+      model - the energy model
+      rates - the activity rates
+
+  Return value:
+
+      double - the estimated charge in mAh per day
+*/
+
+double estimate_milli_amp_hours_per_day(EnergyModel *model,
+                                        EnergyRates *rates);
+
+/*
+  report_energy_accounting:
+
+      This function logs the activity of every subsystem since the last
+      report, and the estimated charge per day at these rates.
+
+  Parameters:
+
+      model - the energy model
+
+  Return value:
+
+      None
+*/
+
+void report_energy_accounting(EnergyModel *model);
+
+/*
+  print_energy_table:
+
+      This function prints the estimated charge per day of the config over
+      a range of advertising intervals, from the wakeup rates of the
+      subsystems enabled in the config.
+
+  Parameters:
+
+      config - the pointer to the config struct of the Tag
+      updates_per_hour - the number of payload updates per hour
+
+  Return value:
+
+      None
+*/
+
+void print_energy_table(Config *config, int updates_per_hour);
+
+#endif
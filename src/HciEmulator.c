@@ -0,0 +1,424 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains a controller emulator on a pseudo terminal, which
+      answers H4 HCI commands like the advertising dongle, so that the UART
+      transport and the beacon sync of the Tag can be exercised without a
+      controller.
+
+ File Name:
+
+      HciEmulator.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+      Usage:
+
+          HciEmulator [-b sync_beacon_address] [-f frame_period_in_ms]
+                      [-p skew_in_ppm]
+
+      The emulator prints the path of the pseudo terminal, which is set as
+      hci_uart_device in the config of the Tag with hci_transport=2. Every
+      command gets a Command Complete event. The commands used by the Tag
+      to bring up legacy advertising and to scan succeed, and other
+      commands fail with Unknown HCI Command. Changes of the advertising
+      parameters, data and enable are printed to the standard error.
+
+      With -b the emulator also plays the sync beacon, whose clock runs
+      off the clock of the emulator by the given skew. While scanning is
+      enabled, the sync advertisement sent at the start of every frame is
+      reported after a pseudo-random advDelay. The advertising events of
+      the Tag are emulated with the advDelay as well, and the offset of
+      each event in the frame of the beacon is printed to the standard
+      error.
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+
+/* HCI status code of Unknown HCI Command */
+#define STATUS_UNKNOWN_COMMAND 0x01
+
+/* Upper bound in micro seconds of the advDelay */
+#define MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS 10000
+
+/* Time in micro seconds of one advertising interval unit */
+#define MICRO_SECONDS_PER_INTERVAL_UNIT 625
+
+/* The BD address of the emulated controller, least significant byte
+   first */
+static const uint8_t emulated_bdaddr[6] = {0x01, 0x00, 0x00, 0x00, 0x00, 0xC1};
+
+/* Flags, and the manufacturer specific data of the sync advertisement
+   without the frame period */
+static const uint8_t sync_advertising_data[] = {
+    0x02, 0x01, 0x06, 0x07, 0xFF, 0x0F, 0x00, 0x42, 0x53
+};
+
+/* The emulated advertising of the Tag */
+static bool is_advertising = false;
+static int advertising_interval_in_units = 0;
+static int64_t next_advertising_event_in_us = INT64_MAX;
+
+static bool is_scanning = false;
+
+/* The emulated sync beacon, whose time is (1 + skew) * t + offset at the
+   time t of the emulator */
+static bool has_sync_beacon = false;
+static bdaddr_t sync_beacon;
+static int64_t frame_period_in_us = 1000000;
+static double beacon_skew = 0;
+static double beacon_offset_in_us = 0;
+static int64_t next_sync_advertisement_in_us = INT64_MAX;
+
+static int64_t get_time_in_us(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int64_t get_advertising_delay(void){
+    return rand() % (MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS + 1);
+}
+
+/* The time of the emulator at which the beacon starts its next frame */
+static int64_t get_next_frame_start(int64_t time_in_us){
+    double beacon_time = (1 + beacon_skew) * time_in_us + beacon_offset_in_us;
+    double frame = (int64_t)(beacon_time / frame_period_in_us) + 1;
+
+    return (frame * frame_period_in_us - beacon_offset_in_us) /
+           (1 + beacon_skew);
+}
+
+static bool read_exact(int terminal, uint8_t *buffer, int length){
+    ssize_t received = 0;
+
+    while(length > 0){
+        received = read(terminal, buffer, length);
+        if(received < 0 && EINTR == errno){
+            continue;
+        }
+        if(received <= 0){
+            return false;
+        }
+        buffer += received;
+        length -= received;
+    }
+
+    return true;
+}
+
+static void send_command_complete(int terminal,
+                                  uint16_t opcode,
+                                  uint8_t *parameters,
+                                  int length){
+    uint8_t event[1 + HCI_EVENT_HDR_SIZE + 255];
+
+    /* Packet type, event code, parameter length, number of allowed
+       commands, opcode and return parameters */
+    event[0] = HCI_EVENT_PKT;
+    event[1] = EVT_CMD_COMPLETE;
+    event[2] = EVT_CMD_COMPLETE_SIZE + length;
+    event[3] = 1;
+    event[4] = opcode & 0xFF;
+    event[5] = opcode >> 8;
+    memcpy(event + 6, parameters, length);
+
+    if(write(terminal, event, 6 + length) != 6 + length){
+        perror("write");
+    }
+}
+
+static void handle_command(int terminal,
+                           uint16_t opcode,
+                           uint8_t *parameters,
+                           int length){
+    uint8_t response[255];
+    int response_length = 1;
+    int i;
+
+    memset(response, 0, sizeof(response));
+
+    switch(opcode){
+        case cmd_opcode_pack(OGF_HOST_CTL, OCF_RESET):
+            fprintf(stderr, "reset\n");
+            break;
+
+        case cmd_opcode_pack(OGF_INFO_PARAM, OCF_READ_LOCAL_VERSION):
+            /* Bluetooth 5.0, Broadcom */
+            response[1] = 0x09;
+            response[2] = 0x01;
+            response[4] = 0x09;
+            response[5] = 0x0F;
+            response[7] = 0x01;
+            response_length = READ_LOCAL_VERSION_RP_SIZE;
+            break;
+
+        case cmd_opcode_pack(OGF_INFO_PARAM, OCF_READ_LOCAL_COMMANDS):
+            response_length = READ_LOCAL_COMMANDS_RP_SIZE;
+            break;
+
+        case cmd_opcode_pack(OGF_INFO_PARAM, OCF_READ_BD_ADDR):
+            memcpy(response + 1, emulated_bdaddr, sizeof(emulated_bdaddr));
+            response_length = 1 + sizeof(emulated_bdaddr);
+            break;
+
+        case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_READ_LOCAL_SUPPORTED_FEATURES):
+            response_length = LE_READ_LOCAL_SUPPORTED_FEATURES_RP_SIZE;
+            break;
+
+        case cmd_opcode_pack(OGF_LE_CTL,
+                             OCF_LE_READ_ADVERTISING_CHANNEL_TX_POWER):
+            response_length = LE_READ_ADVERTISING_CHANNEL_TX_POWER_RP_SIZE;
+            break;
+
+        case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_ADVERTISING_PARAMETERS):
+            if(length >= 4){
+                fprintf(stderr, "interval [%d, %d]\n",
+                        parameters[0] | (parameters[1] << 8),
+                        parameters[2] | (parameters[3] << 8));
+                advertising_interval_in_units =
+                    parameters[0] | (parameters[1] << 8);
+            }
+            break;
+
+        case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_ADVERTISING_DATA):
+            if(length >= 1){
+                fprintf(stderr, "data");
+                for(i = 0 ; i < parameters[0] && i + 1 < length ; i++){
+                    fprintf(stderr, " %02X", parameters[i + 1]);
+                }
+                fprintf(stderr, "\n");
+            }
+            break;
+
+        case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_ADVERTISE_ENABLE):
+            if(length >= 1){
+                /* The beacon sync restarts advertising every few frames,
+                   which is only reported when the events are not */
+                if(!has_sync_beacon){
+                    fprintf(stderr, "advertising %s\n",
+                            parameters[0] ? "enabled" : "disabled");
+                }
+                is_advertising = parameters[0];
+                next_advertising_event_in_us = is_advertising ?
+                    get_time_in_us() + get_advertising_delay() : INT64_MAX;
+            }
+            break;
+
+        case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE):
+            if(length >= 1){
+                is_scanning = parameters[0];
+            }
+            break;
+
+        case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_PARAMETERS):
+        case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_RANDOM_ADDRESS):
+        case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_EVENT_MASK):
+            break;
+
+        default:
+            response[0] = STATUS_UNKNOWN_COMMAND;
+            break;
+    }
+
+    send_command_complete(terminal, opcode, response, response_length);
+}
+
+static void send_sync_advertisement(int terminal){
+    uint8_t event[64];
+    int data_length = sizeof(sync_advertising_data) + 2;
+    int length = 0;
+
+    /* LE Advertising Report of one non-connectable advertisement */
+    event[length++] = HCI_EVENT_PKT;
+    event[length++] = EVT_LE_META_EVENT;
+    event[length++] = 0;
+    event[length++] = EVT_LE_ADVERTISING_REPORT;
+    event[length++] = 1;
+    event[length++] = 0x03;
+    event[length++] = LE_PUBLIC_ADDRESS;
+    memcpy(event + length, &sync_beacon, sizeof(bdaddr_t));
+    length += sizeof(bdaddr_t);
+    event[length++] = data_length;
+    memcpy(event + length, sync_advertising_data,
+           sizeof(sync_advertising_data));
+    length += sizeof(sync_advertising_data);
+    event[length++] = (frame_period_in_us / 1000) & 0xFF;
+    event[length++] = (frame_period_in_us / 1000) >> 8;
+    event[length++] = (uint8_t)-60;
+    event[2] = length - 1 - HCI_EVENT_HDR_SIZE;
+
+    if(write(terminal, event, length) != length){
+        perror("write");
+    }
+}
+
+/* Emulate the advertising events and the sync advertisements which are
+   due */
+static void run_timers(int terminal){
+    int64_t now_in_us = get_time_in_us();
+    double beacon_time = 0;
+
+    while(next_advertising_event_in_us <= now_in_us){
+        if(has_sync_beacon){
+            beacon_time = (1 + beacon_skew) * next_advertising_event_in_us +
+                          beacon_offset_in_us;
+            fprintf(stderr, "advertising event at frame offset %.3f ms\n",
+                    (beacon_time - (int64_t)(beacon_time /
+                                             frame_period_in_us) *
+                                   frame_period_in_us) / 1000);
+        }
+        next_advertising_event_in_us +=
+            (int64_t)advertising_interval_in_units *
+            MICRO_SECONDS_PER_INTERVAL_UNIT + get_advertising_delay();
+    }
+
+    while(next_sync_advertisement_in_us <= now_in_us){
+        if(is_scanning){
+            send_sync_advertisement(terminal);
+        }
+        next_sync_advertisement_in_us =
+            get_next_frame_start(next_sync_advertisement_in_us) +
+            get_advertising_delay();
+    }
+}
+
+static int get_timer_timeout_in_ms(void){
+    int64_t next_in_us = next_advertising_event_in_us;
+    int64_t now_in_us = get_time_in_us();
+
+    if(next_sync_advertisement_in_us < next_in_us){
+        next_in_us = next_sync_advertisement_in_us;
+    }
+    if(INT64_MAX == next_in_us){
+        return -1;
+    }
+    if(next_in_us <= now_in_us){
+        return 0;
+    }
+
+    return (next_in_us - now_in_us + 999) / 1000;
+}
+
+int main(int argc, char **argv){
+    struct termios attributes;
+    struct pollfd poll_descriptor;
+    uint8_t header[HCI_COMMAND_HDR_SIZE];
+    uint8_t parameters[255];
+    uint8_t packet_type = 0;
+    int terminal = -1;
+    int peer = -1;
+    int option;
+
+    while((option = getopt(argc, argv, "b:f:p:")) != -1){
+        switch(option){
+            case 'b':
+                if(str2ba(optarg, &sync_beacon) < 0){
+                    fprintf(stderr, "Invalid address %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                has_sync_beacon = true;
+                break;
+            case 'f':
+                frame_period_in_us = atoi(optarg) * 1000LL;
+                break;
+            case 'p':
+                beacon_skew = atof(optarg) / 1e6;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-b sync_beacon_address] "
+                        "[-f frame_period_in_ms] [-p skew_in_ppm]\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    srand(time(NULL));
+    if(has_sync_beacon){
+        beacon_offset_in_us = rand() % frame_period_in_us;
+        next_sync_advertisement_in_us =
+            get_next_frame_start(get_time_in_us()) + get_advertising_delay();
+    }
+
+    terminal = posix_openpt(O_RDWR | O_NOCTTY);
+    if(terminal < 0 || grantpt(terminal) < 0 || unlockpt(terminal) < 0){
+        perror("posix_openpt");
+        return EXIT_FAILURE;
+    }
+
+    /* Holding the peer side open keeps reads from failing while the Tag is
+       not connected, and raw mode keeps the line discipline from echoing
+       the commands back */
+    peer = open(ptsname(terminal), O_RDWR | O_NOCTTY);
+    if(peer < 0 || tcgetattr(peer, &attributes) < 0){
+        perror("open");
+        return EXIT_FAILURE;
+    }
+    cfmakeraw(&attributes);
+    tcsetattr(peer, TCSANOW, &attributes);
+
+    printf("%s\n", ptsname(terminal));
+    fflush(stdout);
+
+    poll_descriptor.fd = terminal;
+    poll_descriptor.events = POLLIN;
+
+    while(true){
+        run_timers(terminal);
+        if(poll(&poll_descriptor, 1, get_timer_timeout_in_ms()) <= 0){
+            continue;
+        }
+
+        if(!read_exact(terminal, &packet_type, 1)){
+            break;
+        }
+        if(HCI_COMMAND_PKT != packet_type){
+            continue;
+        }
+
+        if(!read_exact(terminal, header, HCI_COMMAND_HDR_SIZE) ||
+           !read_exact(terminal, parameters, header[2])){
+            break;
+        }
+
+        handle_command(terminal, header[0] | (header[1] << 8),
+                       parameters, header[2]);
+    }
+
+    close(peer);
+    close(terminal);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,601 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains a controller on a pseudo terminal which replays
+      the HCI events of a recorded btsnoop trace to the Tag, and checks that
+      the Tag sends the recorded HCI commands, so that failures of a
+      controller in the field can be reproduced and regression tested.
+
+ File Name:
+
+      HciReplay.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+      Usage:
+
+          HciReplay [-x speedup] [-r first_record] [-i controller_index]
+                    [-t command_timeout_in_ms] [-o] [-v] trace
+
+      The trace is a btsnoop file of HCI UART (H4), unencapsulated HCI
+      (H1) or Linux monitor packets, as written by "btmon -w" or by the HCI
+      snoop log of Android. Data packets are ignored. Of a monitor trace
+      the controller given by -i is replayed, by default the one of the
+      first command.
+
+      Like HciEmulator, the replay prints the path of the pseudo terminal,
+      which is set as hci_uart_device in the config of the Tag with
+      hci_transport=2. It then walks the trace from the first record. At a
+      command it waits for the Tag to send a command and asserts that the
+      opcode and the parameters are the recorded ones, or only the opcode
+      with -o, since advertising data and random addresses change between
+      runs. At an event it sends the event to the Tag at the recorded
+      time after the last command, divided by the speedup of -x, so that
+      -x 1 keeps the timing of the controller, -x 100 replays a hundred
+      times faster and -x 0 sends every event at once.
+
+      A trace taken with btmon on the BlueZ transport also holds the
+      commands of the kernel. The replay then starts at the record given
+      by -r, which is the first command of the Tag.
+
+      The exit status is 0 when the whole trace is replayed, 2 when the
+      Tag sends another command than the recorded one, or no command within
+      the timeout of -t, and 1 on other errors.
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+
+/* The file header of btsnoop: identification, version and datalink */
+#define BTSNOOP_HEADER_SIZE 16
+#define BTSNOOP_VERSION 1
+
+/* The record header of btsnoop: original length, included length, flags,
+   cumulative drops and timestamp, all big endian */
+#define BTSNOOP_RECORD_HEADER_SIZE 24
+
+/* The datalinks of btsnoop */
+#define BTSNOOP_DATALINK_H1 1001
+#define BTSNOOP_DATALINK_H4 1002
+#define BTSNOOP_DATALINK_MONITOR 2001
+
+/* The flags of a H1 record */
+#define BTSNOOP_FLAG_RECEIVED 0x01
+#define BTSNOOP_FLAG_COMMAND_OR_EVENT 0x02
+
+/* The opcodes of a monitor record, which are the lower half of its flags,
+   with the index of the controller in the upper half */
+#define MONITOR_COMMAND_PKT 2
+#define MONITOR_EVENT_PKT 3
+
+/* Exit status when the Tag does not send the recorded command */
+#define EXIT_MISMATCH 2
+
+/* Default time in milli seconds to wait for a command of the Tag */
+#define DEFAULT_COMMAND_TIMEOUT_IN_MS 10000
+
+/* A command or event of the trace, without its packet type */
+typedef struct ReplayPacket {
+
+    /* The number of the record in the trace, starting at 1 */
+    int record_number;
+
+    int64_t timestamp_in_us;
+
+    /* HCI_COMMAND_PKT or HCI_EVENT_PKT */
+    uint8_t type;
+
+    int length;
+    uint8_t *data;
+
+} ReplayPacket;
+
+static const uint8_t btsnoop_identification[8] = {
+    'b', 't', 's', 'n', 'o', 'o', 'p', '\0'
+};
+
+static ReplayPacket *packets = NULL;
+static int number_of_packets = 0;
+
+static double speedup = 1;
+
+static bool is_opcode_only = false;
+
+static bool is_verbose = false;
+
+static int64_t get_time_in_us(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint32_t get_big_endian_32(uint8_t *data){
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+           ((uint32_t)data[2] << 8) | data[3];
+}
+
+static int64_t get_big_endian_64(uint8_t *data){
+    return ((int64_t)get_big_endian_32(data) << 32) |
+           get_big_endian_32(data + 4);
+}
+
+static uint8_t *read_file(char *path, long *size){
+    FILE *file = NULL;
+    uint8_t *content = NULL;
+
+    file = fopen(path, "rb");
+    if(NULL == file){
+        perror(path);
+        return NULL;
+    }
+
+    if(0 != fseek(file, 0, SEEK_END) || (*size = ftell(file)) < 0 ||
+       0 != fseek(file, 0, SEEK_SET)){
+        perror(path);
+        fclose(file);
+        return NULL;
+    }
+
+    content = malloc(*size > 0 ? *size : 1);
+    if(NULL == content || fread(content, 1, *size, file) != *size){
+        fprintf(stderr, "Unable to read %s\n", path);
+        free(content);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+
+    return content;
+}
+
+/* A packet is kept only when the length in its header matches the
+   record, so that a truncated record never reaches the Tag */
+static bool is_complete_packet(uint8_t type, uint8_t *data, int length){
+    if(HCI_COMMAND_PKT == type){
+        return length >= HCI_COMMAND_HDR_SIZE &&
+               length == HCI_COMMAND_HDR_SIZE + data[2];
+    }
+
+    return length >= HCI_EVENT_HDR_SIZE &&
+           length == HCI_EVENT_HDR_SIZE + data[1];
+}
+
+static bool add_packet(int record_number,
+                       int64_t timestamp_in_us,
+                       uint8_t type,
+                       uint8_t *data,
+                       int length){
+    static int capacity = 0;
+    ReplayPacket *grown = NULL;
+
+    if(!is_complete_packet(type, data, length)){
+        fprintf(stderr, "Skipping incomplete record %d\n", record_number);
+        return true;
+    }
+
+    if(number_of_packets == capacity){
+        capacity = capacity ? capacity * 2 : 256;
+        grown = realloc(packets, sizeof(ReplayPacket) * capacity);
+        if(NULL == grown){
+            return false;
+        }
+        packets = grown;
+    }
+
+    packets[number_of_packets].record_number = record_number;
+    packets[number_of_packets].timestamp_in_us = timestamp_in_us;
+    packets[number_of_packets].type = type;
+    packets[number_of_packets].length = length;
+    packets[number_of_packets].data = data;
+    number_of_packets++;
+
+    return true;
+}
+
+/* Collect the commands and events of the trace in content, from the
+   record first_record on */
+static bool load_trace(uint8_t *content,
+                       long size,
+                       int first_record,
+                       int controller_index){
+    uint8_t *record = NULL;
+    uint8_t *data = NULL;
+    uint32_t datalink = 0;
+    uint32_t included_length = 0;
+    uint32_t flags = 0;
+    int64_t timestamp_in_us = 0;
+    uint8_t type = 0;
+    long offset = BTSNOOP_HEADER_SIZE;
+    int record_number = 0;
+    int length = 0;
+
+    if(size < BTSNOOP_HEADER_SIZE ||
+       0 != memcmp(content, btsnoop_identification,
+                   sizeof(btsnoop_identification)) ||
+       BTSNOOP_VERSION != get_big_endian_32(content + 8)){
+        fprintf(stderr, "Not a btsnoop trace\n");
+        return false;
+    }
+
+    datalink = get_big_endian_32(content + 12);
+    if(BTSNOOP_DATALINK_H1 != datalink && BTSNOOP_DATALINK_H4 != datalink &&
+       BTSNOOP_DATALINK_MONITOR != datalink){
+        fprintf(stderr, "Unsupported btsnoop datalink %u\n", datalink);
+        return false;
+    }
+
+    while(offset + BTSNOOP_RECORD_HEADER_SIZE <= size){
+        record = content + offset;
+        record_number++;
+
+        included_length = get_big_endian_32(record + 4);
+        flags = get_big_endian_32(record + 8);
+        timestamp_in_us = get_big_endian_64(record + 16);
+        data = record + BTSNOOP_RECORD_HEADER_SIZE;
+        length = included_length;
+
+        offset += BTSNOOP_RECORD_HEADER_SIZE + included_length;
+        if(offset > size){
+            fprintf(stderr, "Trace ends inside record %d\n", record_number);
+            break;
+        }
+
+        if(record_number < first_record){
+            continue;
+        }
+
+        switch(datalink){
+            case BTSNOOP_DATALINK_H1:
+                if(!(flags & BTSNOOP_FLAG_COMMAND_OR_EVENT)){
+                    continue;
+                }
+                type = (flags & BTSNOOP_FLAG_RECEIVED) ?
+                       HCI_EVENT_PKT : HCI_COMMAND_PKT;
+                break;
+
+            case BTSNOOP_DATALINK_H4:
+                if(length < 1){
+                    continue;
+                }
+                type = data[0];
+                data++;
+                length--;
+                break;
+
+            default:
+                if(MONITOR_COMMAND_PKT == (flags & 0xFFFF)){
+                    type = HCI_COMMAND_PKT;
+                }else if(MONITOR_EVENT_PKT == (flags & 0xFFFF)){
+                    type = HCI_EVENT_PKT;
+                }else{
+                    continue;
+                }
+                /* The controller of the first command is replayed unless
+                   another one is given */
+                if(controller_index < 0 && HCI_COMMAND_PKT == type){
+                    controller_index = flags >> 16;
+                }
+                if(controller_index < 0 || controller_index != flags >> 16){
+                    continue;
+                }
+                break;
+        }
+
+        if(HCI_COMMAND_PKT != type && HCI_EVENT_PKT != type){
+            continue;
+        }
+
+        if(!add_packet(record_number, timestamp_in_us, type, data, length)){
+            fprintf(stderr, "Unable to allocate the packets\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void print_packet(const char *label, uint8_t *data, int length){
+    int i;
+
+    fprintf(stderr, "%s", label);
+    for(i = 0 ; i < length ; i++){
+        fprintf(stderr, " %02X", data[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+static bool read_exact(int terminal, uint8_t *buffer, int length){
+    ssize_t received = 0;
+
+    while(length > 0){
+        received = read(terminal, buffer, length);
+        if(received < 0 && EINTR == errno){
+            continue;
+        }
+        if(received <= 0){
+            return false;
+        }
+        buffer += received;
+        length -= received;
+    }
+
+    return true;
+}
+
+/* Read the next command of the Tag into command, without the packet type.
+   Other packets are dropped. */
+static int receive_command(int terminal,
+                           uint8_t *command,
+                           int timeout_in_ms){
+    struct pollfd poll_descriptor;
+    int64_t deadline_in_us = get_time_in_us() + timeout_in_ms * 1000LL;
+    int64_t remaining_in_us = 0;
+    uint8_t packet_type = 0;
+    int return_value = 0;
+
+    poll_descriptor.fd = terminal;
+    poll_descriptor.events = POLLIN;
+
+    while(true){
+        remaining_in_us = deadline_in_us - get_time_in_us();
+        if(remaining_in_us < 0){
+            return 0;
+        }
+
+        return_value = poll(&poll_descriptor, 1,
+                            (remaining_in_us + 999) / 1000);
+        if(return_value < 0 && EINTR == errno){
+            continue;
+        }
+        if(return_value <= 0){
+            return return_value;
+        }
+
+        if(!read_exact(terminal, &packet_type, 1)){
+            return -1;
+        }
+        if(HCI_COMMAND_PKT != packet_type){
+            continue;
+        }
+
+        if(!read_exact(terminal, command, HCI_COMMAND_HDR_SIZE) ||
+           !read_exact(terminal, command + HCI_COMMAND_HDR_SIZE,
+                       command[2])){
+            return -1;
+        }
+
+        return HCI_COMMAND_HDR_SIZE + command[2];
+    }
+}
+
+static bool send_event(int terminal, ReplayPacket *packet){
+    uint8_t event[1 + HCI_EVENT_HDR_SIZE + 255];
+
+    event[0] = HCI_EVENT_PKT;
+    memcpy(event + 1, packet->data, packet->length);
+
+    return write(terminal, event, 1 + packet->length) == 1 + packet->length;
+}
+
+static void sleep_until(int64_t time_in_us){
+    struct timespec wakeup;
+
+    wakeup.tv_sec = time_in_us / 1000000;
+    wakeup.tv_nsec = (time_in_us % 1000000) * 1000;
+
+    while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                   &wakeup, NULL));
+}
+
+/* Check a command of the Tag against the recorded one. Only a different
+   opcode fails with -o. */
+static bool check_command(ReplayPacket *packet, uint8_t *command, int length){
+    char label[64];
+    bool is_same_opcode = 0 == memcmp(packet->data, command, 2);
+    bool is_same = is_same_opcode && packet->length == length &&
+                   0 == memcmp(packet->data, command, length);
+
+    if(is_same){
+        if(is_verbose){
+            fprintf(stderr, "record %d command 0x%04X\n",
+                    packet->record_number,
+                    command[0] | (command[1] << 8));
+        }
+        return true;
+    }
+
+    snprintf(label, sizeof(label), "record %d expected",
+             packet->record_number);
+    print_packet(label, packet->data, packet->length);
+    print_packet("          received", command, length);
+
+    return is_opcode_only && is_same_opcode;
+}
+
+static int replay(int terminal, int command_timeout_in_ms){
+    uint8_t command[HCI_COMMAND_HDR_SIZE + 255];
+    ReplayPacket *packet = NULL;
+    int64_t start_in_us = get_time_in_us();
+    int64_t anchor_in_us = start_in_us;
+    int64_t anchor_timestamp_in_us = 0;
+    int64_t due_in_us = 0;
+    int number_of_commands = 0;
+    int number_of_events = 0;
+    int length = 0;
+    int i;
+
+    if(number_of_packets > 0){
+        anchor_timestamp_in_us = packets[0].timestamp_in_us;
+    }
+
+    for(i = 0 ; i < number_of_packets ; i++){
+        packet = &packets[i];
+
+        if(HCI_COMMAND_PKT == packet->type){
+            length = receive_command(terminal, command,
+                                     command_timeout_in_ms);
+            if(length < 0){
+                perror("read");
+                return EXIT_FAILURE;
+            }
+            if(0 == length){
+                fprintf(stderr, "record %d expected command 0x%04X, none "
+                        "received in %d ms\n", packet->record_number,
+                        packet->data[0] | (packet->data[1] << 8),
+                        command_timeout_in_ms);
+                return EXIT_MISMATCH;
+            }
+            if(!check_command(packet, command, length)){
+                return EXIT_MISMATCH;
+            }
+
+            /* The events which follow are timed from the command */
+            anchor_in_us = get_time_in_us();
+            anchor_timestamp_in_us = packet->timestamp_in_us;
+            number_of_commands++;
+            continue;
+        }
+
+        if(speedup > 0){
+            due_in_us = anchor_in_us +
+                        (packet->timestamp_in_us - anchor_timestamp_in_us) /
+                        speedup;
+            sleep_until(due_in_us);
+        }
+
+        if(!send_event(terminal, packet)){
+            perror("write");
+            return EXIT_FAILURE;
+        }
+        if(is_verbose){
+            fprintf(stderr, "record %d event 0x%02X\n",
+                    packet->record_number, packet->data[0]);
+        }
+        number_of_events++;
+    }
+
+    fprintf(stderr, "Replayed %d commands and %d events of %.3f s in "
+            "%.3f s\n", number_of_commands, number_of_events,
+            number_of_packets > 0 ?
+                (packets[number_of_packets - 1].timestamp_in_us -
+                 packets[0].timestamp_in_us) / 1e6 : 0,
+            (get_time_in_us() - start_in_us) / 1e6);
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv){
+    struct termios attributes;
+    uint8_t *content = NULL;
+    long size = 0;
+    int first_record = 1;
+    int controller_index = -1;
+    int command_timeout_in_ms = DEFAULT_COMMAND_TIMEOUT_IN_MS;
+    int exit_status = EXIT_SUCCESS;
+    int terminal = -1;
+    int peer = -1;
+    int option;
+
+    while((option = getopt(argc, argv, "x:r:i:t:ov")) != -1){
+        switch(option){
+            case 'x':
+                speedup = atof(optarg);
+                break;
+            case 'r':
+                first_record = atoi(optarg);
+                break;
+            case 'i':
+                controller_index = atoi(optarg);
+                break;
+            case 't':
+                command_timeout_in_ms = atoi(optarg);
+                break;
+            case 'o':
+                is_opcode_only = true;
+                break;
+            case 'v':
+                is_verbose = true;
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if(optind != argc - 1 || speedup < 0){
+        fprintf(stderr, "Usage: %s [-x speedup] [-r first_record] "
+                "[-i controller_index] [-t command_timeout_in_ms] [-o] "
+                "[-v] trace\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    content = read_file(argv[optind], &size);
+    if(NULL == content){
+        return EXIT_FAILURE;
+    }
+    if(!load_trace(content, size, first_record, controller_index)){
+        free(content);
+        return EXIT_FAILURE;
+    }
+
+    terminal = posix_openpt(O_RDWR | O_NOCTTY);
+    if(terminal < 0 || grantpt(terminal) < 0 || unlockpt(terminal) < 0){
+        perror("posix_openpt");
+        return EXIT_FAILURE;
+    }
+
+    /* Holding the peer side open keeps reads from failing while the Tag is
+       not connected, and raw mode keeps the line discipline from echoing
+       the commands back */
+    peer = open(ptsname(terminal), O_RDWR | O_NOCTTY);
+    if(peer < 0 || tcgetattr(peer, &attributes) < 0){
+        perror("open");
+        return EXIT_FAILURE;
+    }
+    cfmakeraw(&attributes);
+    tcsetattr(peer, TCSANOW, &attributes);
+
+    printf("%s\n", ptsname(terminal));
+    fflush(stdout);
+
+    exit_status = replay(terminal, command_timeout_in_ms);
+
+    close(peer);
+    close(terminal);
+    free(packets);
+    free(content);
+
+    return exit_status;
+}
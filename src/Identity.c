@@ -0,0 +1,160 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used by the Tag and the server to
+      derive the rotating private identity of a Tag.
+
+ File Name:
+
+      Identity.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Identity.h"
+
+#define ROTATE_LEFT(value, bits) \
+    (((value) << (bits)) | ((value) >> (64 - (bits))))
+
+#define SIP_ROUND(v0, v1, v2, v3) \
+    do{ \
+        v0 += v1; v1 = ROTATE_LEFT(v1, 13); v1 ^= v0; \
+        v0 = ROTATE_LEFT(v0, 32); \
+        v2 += v3; v3 = ROTATE_LEFT(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = ROTATE_LEFT(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = ROTATE_LEFT(v1, 17); v1 ^= v2; \
+        v2 = ROTATE_LEFT(v2, 32); \
+    }while(0)
+
+static uint64_t read_little_endian(const uint8_t *data, size_t length){
+    uint64_t value = 0;
+    size_t i;
+
+    for(i = 0 ; i < length ; i++){
+        value |= (uint64_t)data[i] << (8 * i);
+    }
+
+    return value;
+}
+
+uint64_t siphash_2_4(const uint8_t *key, const uint8_t *message,
+                     size_t length){
+    uint64_t k0 = read_little_endian(key, 8);
+    uint64_t k1 = read_little_endian(key + 8, 8);
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+    uint64_t block = 0;
+    size_t offset = 0;
+
+    for(offset = 0 ; offset + 8 <= length ; offset += 8){
+        block = read_little_endian(message + offset, 8);
+        v3 ^= block;
+        SIP_ROUND(v0, v1, v2, v3);
+        SIP_ROUND(v0, v1, v2, v3);
+        v0 ^= block;
+    }
+
+    /* The last block carries the remaining bytes and the length */
+    block = read_little_endian(message + offset, length - offset) |
+            ((uint64_t)length << 56);
+    v3 ^= block;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= block;
+
+    v2 ^= 0xff;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+bool parse_identity_key(const char *text, uint8_t *key){
+    unsigned int value = 0;
+    int i;
+
+    if(2 * IDENTITY_KEY_LENGTH != strlen(text)){
+        return false;
+    }
+
+    for(i = 0 ; i < IDENTITY_KEY_LENGTH ; i++){
+        if(1 != sscanf(text + 2 * i, "%2x", &value)){
+            return false;
+        }
+        key[i] = value;
+    }
+
+    return true;
+}
+
+uint32_t get_identity_epoch(time_t time, int rotation_interval_in_seconds){
+    return time / rotation_interval_in_seconds;
+}
+
+static uint64_t get_prf_output(const uint8_t *key,
+                               uint8_t domain,
+                               uint32_t epoch){
+    uint8_t message[5];
+
+    message[0] = domain;
+    message[1] = epoch;
+    message[2] = epoch >> 8;
+    message[3] = epoch >> 16;
+    message[4] = epoch >> 24;
+
+    return siphash_2_4(key, message, sizeof(message));
+}
+
+void derive_private_identity(const uint8_t *key,
+                             uint32_t epoch,
+                             PrivateIdentity *identity){
+    uint64_t output = 0;
+    int i;
+
+    identity->epoch = epoch;
+
+    output = get_prf_output(key, IDENTITY_DOMAIN_ADDRESS, epoch);
+    for(i = 0 ; i < IDENTITY_ADDRESS_LENGTH ; i++){
+        identity->address[i] = output >> (8 * i);
+    }
+    identity->address[IDENTITY_ADDRESS_LENGTH - 1] &=
+        ~IDENTITY_ADDRESS_TYPE_MASK;
+
+    /* The random part of a private address is neither all zeros nor all
+       ones */
+    if(0 == (output & 0x3FFFFFFFFFFFULL) ||
+       0x3FFFFFFFFFFFULL == (output & 0x3FFFFFFFFFFFULL)){
+        identity->address[0] ^= 0x01;
+    }
+
+    output = get_prf_output(key, IDENTITY_DOMAIN_COORDINATES, epoch);
+    for(i = 0 ; i < IDENTITY_COORDINATES_LENGTH ; i++){
+        identity->coordinate_mask[i] = output >> (8 * i);
+    }
+
+    output = get_prf_output(key, IDENTITY_DOMAIN_FIELDS, epoch);
+    for(i = 0 ; i < IDENTITY_FIELDS_LENGTH ; i++){
+        identity->field_mask[i] = output >> (8 * i);
+    }
+    identity->sequence_start = output >> (8 * IDENTITY_FIELDS_LENGTH);
+}
@@ -0,0 +1,181 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag and by the server to derive the rotating private identity
+    of a Tag from its key.
+
+File Name:
+
+    Identity.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    Time is divided into epochs of the rotation interval, counted from the
+    Unix epoch, so that the Tag and the server agree on the epoch without
+    talking to each other. For every epoch the keyed PRF SipHash-2-4 over
+    a domain byte and the epoch number gives the private address of the
+    Tag and the mask which is XORed into the coordinates on the air.
+
+    The private address is a non-resolvable private address: the two most
+    significant bits are 00 and the rest is taken from the PRF. Unlike a
+    resolvable private address it carries no hash which the server checks
+    key by key. The server precomputes the addresses of all tags for the
+    epochs around the current one instead, and looks the address up in an
+    index. This file depends on no library, so that it is linked into the
+    resolver on the server as it is.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef IDENTITY_H
+#define IDENTITY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+/*
+  CONSTANTS
+*/
+
+/* Length in bytes of the key of a Tag */
+#define IDENTITY_KEY_LENGTH 16
+
+/* Length in bytes of a BD address */
+#define IDENTITY_ADDRESS_LENGTH 6
+
+/* Length in bytes of the coordinates of the payload */
+#define IDENTITY_COORDINATES_LENGTH 8
+
+/* Length in bytes of the fields of the payload which stay the same across
+   epochs: measured power, major, minor and the 4 bytes of the sensor
+   summary, in the order of the default payload template */
+#define IDENTITY_FIELDS_LENGTH 7
+
+/* Domain bytes which separate the outputs of the PRF for one epoch */
+#define IDENTITY_DOMAIN_ADDRESS 0x01
+#define IDENTITY_DOMAIN_COORDINATES 0x02
+#define IDENTITY_DOMAIN_FIELDS 0x03
+
+/* The two most significant bits of a non-resolvable private address */
+#define IDENTITY_ADDRESS_TYPE_MASK 0xC0
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The private identity of a Tag in one epoch */
+typedef struct PrivateIdentity {
+
+    uint32_t epoch;
+
+    /* The private address, least significant byte first like bdaddr_t */
+    uint8_t address[IDENTITY_ADDRESS_LENGTH];
+
+    /* The mask XORed into the coordinates */
+    uint8_t coordinate_mask[IDENTITY_COORDINATES_LENGTH];
+
+    /* The mask XORed into the fields which stay the same across epochs */
+    uint8_t field_mask[IDENTITY_FIELDS_LENGTH];
+
+    /* The sequence number from which the payload counts in the epoch */
+    uint8_t sequence_start;
+
+} PrivateIdentity;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  siphash_2_4:
+
+      This function computes SipHash-2-4 of a message.
+
+  Parameters:
+
+      key - the 16 bytes key
+      message - the message
+      length - the length of the message
+
+  Return value:
+
+      uint64_t - the 64 bits output
+*/
+
+uint64_t siphash_2_4(const uint8_t *key, const uint8_t *message,
+                     size_t length);
+
+/*
+  parse_identity_key:
+
+      This function parses a key written as 32 hexadecimal digits.
+
+  Parameters:
+
+      text - the key in hexadecimal digits
+      key - the 16 bytes key to be filled
+
+  Return value:
+
+      bool - false if the text is not 32 hexadecimal digits
+*/
+
+bool parse_identity_key(const char *text, uint8_t *key);
+
+/*
+  get_identity_epoch:
+
+      This function returns the epoch of a wall clock time.
+
+  Parameters:
+
+      time - the seconds since the Unix epoch
+      rotation_interval_in_seconds - the length of an epoch
+
+  Return value:
+
+      uint32_t - the epoch number
+*/
+
+uint32_t get_identity_epoch(time_t time, int rotation_interval_in_seconds);
+
+/*
+  derive_private_identity:
+
+      This function derives the private address, the coordinate and field
+      masks and the starting sequence number of a Tag in an epoch.
+
+  Parameters:
+
+      key - the 16 bytes key of the Tag
+      epoch - the epoch number
+      identity - the private identity to be filled
+
+  Return value:
+
+      None
+*/
+
+void derive_private_identity(const uint8_t *key,
+                             uint32_t epoch,
+                             PrivateIdentity *identity);
+
+#endif
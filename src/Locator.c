@@ -0,0 +1,863 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs executed by the Tag in reverse
+      positioning mode, which scans for the LBeacons around the Tag and
+      advertises the located position.
+
+ File Name:
+
+      Locator.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Locator.h"
+#include "Energy.h"
+#include "Transport.h"
+
+#define Debugging
+
+/* A HCI event of a recorded trace */
+typedef struct LocatorTraceEvent {
+
+    /* Reception time in micro seconds */
+    int64_t reception_time_in_us;
+
+    int number_of_reports;
+
+    int length;
+
+    uint8_t packet[HCI_MAX_EVENT_SIZE];
+
+} LocatorTraceEvent;
+
+/* Handle of the dongle which scans for LBeacons */
+static int locator_device_handle = -1;
+
+/* Handle of the advertising dongle, which is the scan handle when the
+   advertising dongle scans itself */
+static int locator_advertising_handle = -1;
+
+static int scan_window_in_ms = 0;
+
+static int scan_period_in_seconds = 0;
+
+static bool is_weighted_position = false;
+
+static FILE *trace_file = NULL;
+
+/* Only the locator thread touches the table */
+static BeaconTable beacon_table;
+
+static pthread_t locator_thread;
+
+static bool locator_running = false;
+
+static uint64_t get_time_in_ns(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+bool parse_lbeacon_report(le_advertising_info *info, uint8_t *coordinates){
+    uint8_t *data = info->data;
+    uint8_t *uuid = NULL;
+    int length = 0;
+    int i = 0;
+
+    /* Walk the AD structures for the manufacturer specific data */
+    while(i < info->length){
+        length = data[i];
+        if(0 == length || i + 1 + length > info->length){
+            return false;
+        }
+
+        if(EIR_MANUFACTURE_SPECIFIC_DATA == data[i + 1] &&
+           length - 1 == IBEACON_MANUFACTURER_DATA_LENGTH &&
+           IBEACON_COMPANY_IDENTIFIER == (data[i + 2] | (data[i + 3] << 8)) &&
+           IBEACON_TYPE == data[i + 4] &&
+           IBEACON_DATA_LENGTH == data[i + 5]){
+            uuid = &data[i + 6];
+            memcpy(coordinates, uuid + LBEACON_UUID_X_OFFSET,
+                   LENGTH_OF_COORDINATES / 2);
+            memcpy(coordinates + LENGTH_OF_COORDINATES / 2,
+                   uuid + LBEACON_UUID_Y_OFFSET,
+                   LENGTH_OF_COORDINATES / 2);
+            return true;
+        }
+
+        i += 1 + length;
+    }
+
+    return false;
+}
+
+static int get_home_index(bdaddr_t *bdaddr){
+    return hash_bdaddr(bdaddr) & (LOCATOR_TABLE_SIZE - 1);
+}
+
+/* Return the index of the entry of the LBeacon, or of the free entry at
+   which it is to be inserted. The load factor keeps a free entry in the
+   table. */
+static int find_beacon_index(BeaconTable *table, bdaddr_t *bdaddr){
+    int index = get_home_index(bdaddr);
+
+    while(table->entries[index].is_used &&
+          0 != memcmp(&table->entries[index].bdaddr, bdaddr,
+                      sizeof(bdaddr_t))){
+        index = (index + 1) & (LOCATOR_TABLE_SIZE - 1);
+    }
+
+    return index;
+}
+
+void record_beacon_report(BeaconTable *table,
+                          bdaddr_t *bdaddr,
+                          uint8_t *coordinates,
+                          int rssi,
+                          uint64_t reception_time_in_ns){
+    BeaconEntry *entry = &table->entries[find_beacon_index(table, bdaddr)];
+
+    if(!entry->is_used){
+        if(table->number_of_beacons >= LOCATOR_MAX_NUMBER_OF_BEACONS){
+            table->number_of_drops++;
+            return;
+        }
+
+        entry->is_used = true;
+        memcpy(&entry->bdaddr, bdaddr, sizeof(bdaddr_t));
+        entry->smoothed_rssi = rssi;
+        entry->number_of_reports = 0;
+        table->number_of_beacons++;
+    }else{
+        entry->smoothed_rssi +=
+            LOCATOR_RSSI_SMOOTHING * (rssi - entry->smoothed_rssi);
+    }
+
+    /* A LBeacon may be moved and configured with new coordinates */
+    memcpy(entry->coordinates, coordinates, LENGTH_OF_COORDINATES);
+    entry->last_seen_time_in_ns = reception_time_in_ns;
+    entry->number_of_reports++;
+}
+
+int process_locator_event(BeaconTable *table,
+                          uint8_t *buffer,
+                          int length,
+                          uint64_t reception_time_in_ns){
+    uint8_t coordinates[LENGTH_OF_COORDINATES];
+    evt_le_meta_event *meta_event = NULL;
+    le_advertising_info *info = NULL;
+    uint8_t *report = NULL;
+    int number_of_reports = 0;
+    int number_of_lbeacon_reports = 0;
+    int i;
+
+    if(length < 1 + HCI_EVENT_HDR_SIZE + 2 ||
+       HCI_EVENT_PKT != buffer[0] ||
+       EVT_LE_META_EVENT != buffer[1]){
+        return 0;
+    }
+
+    meta_event = (evt_le_meta_event *)(buffer + 1 + HCI_EVENT_HDR_SIZE);
+    if(EVT_LE_ADVERTISING_REPORT != meta_event->subevent){
+        return 0;
+    }
+
+    /* Each report is followed by its RSSI */
+    number_of_reports = meta_event->data[0];
+    report = meta_event->data + 1;
+    for(i = 0 ; i < number_of_reports ; i++){
+        info = (le_advertising_info *)report;
+        if(report + sizeof(le_advertising_info) + info->length + 1 >
+           buffer + length){
+            break;
+        }
+
+        if(parse_lbeacon_report(info, coordinates)){
+            record_beacon_report(table, &info->bdaddr, coordinates,
+                                 (int8_t)info->data[info->length],
+                                 reception_time_in_ns);
+            number_of_lbeacon_reports++;
+        }
+
+        report += sizeof(le_advertising_info) + info->length + 1;
+    }
+
+    return number_of_lbeacon_reports;
+}
+
+/* Free an entry and move the following entries of the probe sequence
+   which may not be found across the free entry any more */
+static void remove_beacon_entry(BeaconTable *table, int index){
+    int next = index;
+    int home = 0;
+
+    while(true){
+        next = (next + 1) & (LOCATOR_TABLE_SIZE - 1);
+        if(!table->entries[next].is_used){
+            break;
+        }
+
+        /* The entry stays if its home lies cyclically in (index, next] */
+        home = get_home_index(&table->entries[next].bdaddr);
+        if(index <= next ?
+           (index < home && home <= next) :
+           (index < home || home <= next)){
+            continue;
+        }
+
+        table->entries[index] = table->entries[next];
+        index = next;
+    }
+
+    table->entries[index].is_used = false;
+    table->number_of_beacons--;
+}
+
+void expire_beacons(BeaconTable *table, uint64_t now_in_ns){
+    uint64_t timeout_in_ns =
+        LOCATOR_BEACON_TIMEOUT_IN_SECONDS * 1000000000ULL;
+    int index = 0;
+
+    while(index < LOCATOR_TABLE_SIZE){
+        if(table->entries[index].is_used &&
+           now_in_ns - table->entries[index].last_seen_time_in_ns >
+           timeout_in_ns){
+            /* The entry moved into the freed index is checked next */
+            remove_beacon_entry(table, index);
+            continue;
+        }
+        index++;
+    }
+}
+
+static uint32_t read_big_endian(uint8_t *data){
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+           ((uint32_t)data[2] << 8) | data[3];
+}
+
+static void write_big_endian(uint8_t *data, uint32_t value){
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+bool locate_tag(BeaconTable *table,
+                bool weighted,
+                bdaddr_t *nearest,
+                uint8_t *coordinates){
+    BeaconEntry *strongest[LOCATOR_NUMBER_OF_WEIGHTED_BEACONS];
+    BeaconEntry *entry = NULL;
+    BeaconEntry *current = NULL;
+    double weight = 0;
+    double total_weight = 0;
+    double x = 0;
+    double y = 0;
+    int number_of_strongest = 0;
+    int i, j;
+
+    /* The strongest LBeacons, strongest first */
+    for(i = 0 ; i < LOCATOR_TABLE_SIZE ; i++){
+        entry = &table->entries[i];
+        if(!entry->is_used){
+            continue;
+        }
+
+        for(j = number_of_strongest ;
+            j > 0 && strongest[j - 1]->smoothed_rssi < entry->smoothed_rssi;
+            j--){
+            if(j < LOCATOR_NUMBER_OF_WEIGHTED_BEACONS){
+                strongest[j] = strongest[j - 1];
+            }
+        }
+        if(j < LOCATOR_NUMBER_OF_WEIGHTED_BEACONS){
+            strongest[j] = entry;
+            if(number_of_strongest < LOCATOR_NUMBER_OF_WEIGHTED_BEACONS){
+                number_of_strongest++;
+            }
+        }
+    }
+
+    if(0 == number_of_strongest){
+        return false;
+    }
+
+    entry = strongest[0];
+    current = &table->entries[find_beacon_index(table, nearest)];
+    if(current->is_used && current != entry &&
+       entry->smoothed_rssi <
+       current->smoothed_rssi + LOCATOR_HYSTERESIS_IN_DB){
+        entry = current;
+    }
+    memcpy(nearest, &entry->bdaddr, sizeof(bdaddr_t));
+
+    if(!weighted){
+        memcpy(coordinates, entry->coordinates, LENGTH_OF_COORDINATES);
+        return true;
+    }
+
+    /* The received amplitude falls with the distance under free space
+       path loss */
+    for(i = 0 ; i < number_of_strongest ; i++){
+        weight = pow(10, strongest[i]->smoothed_rssi / 20.0);
+        total_weight += weight;
+        x += weight * read_big_endian(strongest[i]->coordinates);
+        y += weight * read_big_endian(
+                 strongest[i]->coordinates + LENGTH_OF_COORDINATES / 2);
+    }
+
+    write_big_endian(coordinates, (uint32_t)(x / total_weight + 0.5));
+    write_big_endian(coordinates + LENGTH_OF_COORDINATES / 2,
+                     (uint32_t)(y / total_weight + 0.5));
+
+    return true;
+}
+
+static ErrorCode set_locator_scan_enable(bool enable){
+    uint8_t status = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    le_set_scan_enable_cp scan_enable;
+
+    memset(&scan_enable, 0, sizeof(scan_enable));
+    scan_enable.enable = enable ? 0x01 : 0x00;
+    /* Every report refines the smoothed RSSI */
+    scan_enable.filter_dup = 0x00;
+
+    return_value = send_hci_request(locator_device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_SET_SCAN_ENABLE,
+                                    &scan_enable,
+                                    LE_SET_SCAN_ENABLE_CP_SIZE,
+                                    &status, 1);
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+
+    return status ? E_ADVERTISE_STATUS : WORK_SUCCESSFULLY;
+}
+
+static void record_trace_event(uint8_t *buffer,
+                               int length,
+                               uint64_t reception_time_in_ns){
+    int i;
+
+    fprintf(trace_file, "%llu ",
+            (unsigned long long)(reception_time_in_ns / 1000));
+    for(i = 0 ; i < length ; i++){
+        fprintf(trace_file, "%02X", buffer[i]);
+    }
+    fputc('\n', trace_file);
+}
+
+/* Record the reports received until the end of the scan window */
+static void collect_beacon_reports(uint64_t window_end_in_ns){
+    uint8_t buffer[HCI_MAX_EVENT_SIZE];
+    struct timespec reception_time;
+    uint64_t now_in_ns = 0;
+    uint64_t reception_time_in_ns = 0;
+    int length = 0;
+
+    while(true == ready_to_work){
+        now_in_ns = get_time_in_ns();
+        if(now_in_ns >= window_end_in_ns){
+            return;
+        }
+
+        length = receive_hci_event(locator_device_handle, buffer,
+                                   sizeof(buffer),
+                                   (window_end_in_ns - now_in_ns) /
+                                   1000000 + 1,
+                                   &reception_time);
+        account_wakeup();
+        if(length <= 0){
+            continue;
+        }
+
+        reception_time_in_ns =
+            (uint64_t)reception_time.tv_sec * 1000000000ULL +
+            reception_time.tv_nsec;
+
+        if(NULL != trace_file){
+            record_trace_event(buffer, length, reception_time_in_ns);
+        }
+        process_locator_event(&beacon_table, buffer, length,
+                              reception_time_in_ns);
+    }
+}
+
+static bool sleep_until(uint64_t time_in_ns){
+    struct timespec deadline;
+    uint64_t now_in_ns = 0;
+    uint64_t wakeup_in_ns = 0;
+
+    while(true == ready_to_work){
+        now_in_ns = get_time_in_ns();
+        if(now_in_ns >= time_in_ns){
+            return true;
+        }
+
+        wakeup_in_ns = time_in_ns;
+        if(wakeup_in_ns - now_in_ns >
+           INTERVAL_FOR_BUSY_WAITING_CHECK_IN_MICRO_SECONDS * 1000ULL){
+            wakeup_in_ns = now_in_ns +
+                INTERVAL_FOR_BUSY_WAITING_CHECK_IN_MICRO_SECONDS * 1000ULL;
+        }
+
+        deadline.tv_sec = wakeup_in_ns / 1000000000ULL;
+        deadline.tv_nsec = wakeup_in_ns % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        account_wakeup();
+    }
+
+    return false;
+}
+
+/* Change the coordinates of the payload by a data-only update */
+static void publish_coordinates(uint8_t *coordinates, bdaddr_t *nearest){
+    AdvertisingPayload *payload = &g_advertising.payload;
+    BeaconEntry *entry = NULL;
+    char address[LENGTH_OF_MAC_ADDRESS];
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+
+    if(0 == memcmp(payload->coordinates, coordinates,
+                   LENGTH_OF_COORDINATES)){
+        pthread_mutex_unlock(&g_advertising.lock);
+        return;
+    }
+
+    memcpy(payload->coordinates, coordinates, LENGTH_OF_COORDINATES);
+    payload->dirty_slots |= PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_COORDINATES);
+    return_value = update_advertising_data(locator_advertising_handle);
+
+    pthread_mutex_unlock(&g_advertising.lock);
+
+    if(WORK_SUCCESSFULLY != return_value){
+        zlog_error(category_health_report,
+                   "Unable to advertise the located position");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to advertise the located position");
+#endif
+        return;
+    }
+
+    entry = &beacon_table.entries[find_beacon_index(&beacon_table,
+                                                    nearest)];
+    ba2str(nearest, address);
+    zlog_info(category_health_report,
+              "Located at %02X%02X%02X%02X%02X%02X%02X%02X, nearest "
+              "LBeacon %s at %.1f dBm of %d LBeacons",
+              coordinates[0], coordinates[1], coordinates[2],
+              coordinates[3], coordinates[4], coordinates[5],
+              coordinates[6], coordinates[7],
+              address, entry->smoothed_rssi,
+              beacon_table.number_of_beacons);
+}
+
+static void *locate(void *argument){
+    uint8_t coordinates[LENGTH_OF_COORDINATES];
+    bdaddr_t nearest;
+    uint64_t period_start_in_ns = 0;
+    uint64_t period_in_ns = scan_period_in_seconds * 1000000000ULL;
+    uint64_t window_in_ns = scan_window_in_ms * 1000000ULL;
+    bool is_continuous = window_in_ns >= period_in_ns;
+    bool is_scanning = false;
+
+    TRACE_THREAD_START();
+    set_energy_subsystem(SUBSYSTEM_LOCATOR);
+
+    memset(&beacon_table, 0, sizeof(beacon_table));
+    memset(&nearest, 0, sizeof(nearest));
+    period_start_in_ns = get_time_in_ns();
+
+    while(true == ready_to_work){
+
+        if(!is_scanning){
+            is_scanning = WORK_SUCCESSFULLY == set_locator_scan_enable(true);
+        }
+        collect_beacon_reports(period_start_in_ns +
+                               (is_continuous ? period_in_ns : window_in_ns));
+
+        /* A window shorter than the period leaves the dongle idle until
+           the next scan */
+        if(is_scanning && !is_continuous){
+            set_locator_scan_enable(false);
+            is_scanning = false;
+        }
+
+        expire_beacons(&beacon_table, get_time_in_ns());
+        if(locate_tag(&beacon_table, is_weighted_position, &nearest,
+                      coordinates)){
+            publish_coordinates(coordinates, &nearest);
+        }
+
+        period_start_in_ns += period_in_ns;
+        if(!sleep_until(period_start_in_ns)){
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+ErrorCode start_locator(Config *config){
+    uint8_t status = 0;
+    int retry_time = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    le_set_scan_parameters_cp scan_parameters;
+    struct hci_filter filter;
+
+    if(config->locator_dongle_id < 0){
+        return WORK_SUCCESSFULLY;
+    }
+
+    /* One dongle cannot run two scans with different schedules */
+    if(config->locator_scan_window_in_ms <= 0 ||
+       config->locator_scan_period_in_seconds <= 0 ||
+       config->locator_dongle_id == config->scanner_dongle_id ||
+       (config->locator_dongle_id == config->advertise_dongle_id &&
+        strlen(config->sync_beacon_address) > 0)){
+        zlog_error(category_health_report,
+                   "Invalid locator config");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Invalid locator config");
+#endif
+        return E_ADVERTISE_MODE;
+    }
+
+    scan_window_in_ms = config->locator_scan_window_in_ms;
+    scan_period_in_seconds = config->locator_scan_period_in_seconds;
+    is_weighted_position = config->locator_weighted_position > 0;
+
+    if(strlen(config->locator_trace_file) > 0){
+        trace_file = fopen(config->locator_trace_file, "a");
+        if(NULL == trace_file){
+            zlog_error(category_health_report,
+                       "Unable to open locator trace %s",
+                       config->locator_trace_file);
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "Unable to open locator trace %s",
+                       config->locator_trace_file);
+#endif
+            return E_OPEN_FILE;
+        }
+    }
+
+    retry_time = SOCKET_OPEN_RETRY;
+    while(retry_time--){
+        locator_device_handle = open_hci_device(config->locator_dongle_id);
+
+        if(locator_device_handle >= 0){
+            break;
+        }
+    }
+
+    locator_advertising_handle = locator_device_handle;
+    if(locator_device_handle >= 0 &&
+       config->locator_dongle_id != g_advertising.dongle_device_id){
+        locator_advertising_handle =
+            open_hci_device(g_advertising.dongle_device_id);
+    }
+
+    if(locator_device_handle < 0 || locator_advertising_handle < 0){
+        zlog_error(category_health_report,
+                   "Error openning socket for locator");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Error openning socket for locator");
+#endif
+        stop_locator();
+        return E_OPEN_DEVICE;
+    }
+
+    /* A scan left enabled by an earlier run rejects new parameters */
+    set_locator_scan_enable(false);
+
+    memset(&scan_parameters, 0, sizeof(scan_parameters));
+    scan_parameters.type = SCANNER_TYPE_PASSIVE;
+    scan_parameters.interval = htobs(SCANNER_INTERVAL_IN_UNITS_0625_MS);
+    scan_parameters.window = htobs(SCANNER_WINDOW_IN_UNITS_0625_MS);
+    scan_parameters.own_bdaddr_type = LE_PUBLIC_ADDRESS;
+    scan_parameters.filter = 0x00;
+
+    return_value = send_hci_request(locator_device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_SET_SCAN_PARAMETERS,
+                                    &scan_parameters,
+                                    LE_SET_SCAN_PARAMETERS_CP_SIZE,
+                                    &status, 1);
+    if(WORK_SUCCESSFULLY == return_value && status){
+        return_value = E_ADVERTISE_STATUS;
+    }
+    if(WORK_SUCCESSFULLY != return_value){
+        zlog_error(category_health_report,
+                   "Unable to set scan parameters on dongle %d",
+                   config->locator_dongle_id);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to set scan parameters on dongle %d",
+                   config->locator_dongle_id);
+#endif
+        stop_locator();
+        return return_value;
+    }
+
+    /* Only LE meta events reach the locator thread on a raw HCI socket of
+       BlueZ */
+    hci_filter_clear(&filter);
+    hci_filter_set_ptype(HCI_EVENT_PKT, &filter);
+    hci_filter_set_event(EVT_LE_META_EVENT, &filter);
+    setsockopt(locator_device_handle, SOL_HCI, HCI_FILTER,
+               &filter, sizeof(filter));
+
+    zlog_info(category_health_report,
+              "Locator on dongle %d, scan %d ms every %d s, %s position",
+              config->locator_dongle_id,
+              scan_window_in_ms,
+              scan_period_in_seconds,
+              is_weighted_position ? "weighted" : "nearest");
+
+    if(0 != pthread_create(&locator_thread, NULL, locate, NULL)){
+        zlog_error(category_health_report,
+                   "Unable to start the thread of the locator");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to start the thread of the locator");
+#endif
+        stop_locator();
+        return E_START_THREAD;
+    }
+    locator_running = true;
+
+    return WORK_SUCCESSFULLY;
+}
+
+void stop_locator(void){
+    if(locator_running){
+        pthread_join(locator_thread, NULL);
+        locator_running = false;
+    }
+
+    if(locator_advertising_handle >= 0 &&
+       locator_advertising_handle != locator_device_handle){
+        close_hci_device(locator_advertising_handle);
+    }
+    locator_advertising_handle = -1;
+
+    if(locator_device_handle >= 0){
+        set_locator_scan_enable(false);
+        close_hci_device(locator_device_handle);
+        locator_device_handle = -1;
+    }
+
+    if(NULL != trace_file){
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+}
+
+/* Load a recorded trace into an array of events. The array is allocated
+   once, so that the replay measures the parser and the table only. */
+static LocatorTraceEvent *load_locator_trace(char *path,
+                                             int *number_of_events){
+    char line[2 * HCI_MAX_EVENT_SIZE + 32];
+    LocatorTraceEvent *events = NULL;
+    LocatorTraceEvent *resized = NULL;
+    LocatorTraceEvent *event = NULL;
+    evt_le_meta_event *meta_event = NULL;
+    long long reception_time_in_us = 0;
+    unsigned int value = 0;
+    int capacity = 0;
+    int offset = 0;
+    char *hex = NULL;
+    FILE *file = NULL;
+
+    *number_of_events = 0;
+
+    file = fopen(path, "r");
+    if(NULL == file){
+        return NULL;
+    }
+
+    while(NULL != fgets(line, sizeof(line), file)){
+        if(*number_of_events == capacity){
+            capacity = capacity ? 2 * capacity : 1024;
+            resized = realloc(events, capacity * sizeof(LocatorTraceEvent));
+            if(NULL == resized){
+                break;
+            }
+            events = resized;
+        }
+
+        event = &events[*number_of_events];
+        if(1 != sscanf(line, "%lld %n", &reception_time_in_us, &offset)){
+            continue;
+        }
+        event->reception_time_in_us = reception_time_in_us;
+
+        event->length = 0;
+        for(hex = line + offset ;
+            event->length < HCI_MAX_EVENT_SIZE &&
+            1 == sscanf(hex, "%2x", &value) ;
+            hex += 2){
+            event->packet[event->length++] = value;
+        }
+
+        event->number_of_reports = 0;
+        if(event->length >= 1 + HCI_EVENT_HDR_SIZE + 2 &&
+           HCI_EVENT_PKT == event->packet[0] &&
+           EVT_LE_META_EVENT == event->packet[1]){
+            meta_event =
+                (evt_le_meta_event *)(event->packet + 1 + HCI_EVENT_HDR_SIZE);
+            if(EVT_LE_ADVERTISING_REPORT == meta_event->subevent){
+                event->number_of_reports = meta_event->data[0];
+            }
+        }
+
+        (*number_of_events)++;
+    }
+
+    fclose(file);
+
+    return events;
+}
+
+ErrorCode print_locator_benchmark(char *trace_file, Config *config){
+    static BeaconTable table;
+    uint8_t coordinates[LENGTH_OF_COORDINATES];
+    uint8_t published[LENGTH_OF_COORDINATES];
+    char address[LENGTH_OF_MAC_ADDRESS];
+    LocatorTraceEvent *events = NULL;
+    bdaddr_t nearest;
+    struct timespec cpu_start, cpu_end;
+    uint64_t period_in_ns = 0;
+    uint64_t trace_span_in_ns = 0;
+    uint64_t next_location_in_ns = 0;
+    uint64_t reception_time_in_ns = 0;
+    uint64_t number_of_reports = 0;
+    uint64_t number_of_lbeacon_reports = 0;
+    uint64_t number_of_replayed_events = 0;
+    uint64_t number_of_updates = 0;
+    double cpu_time_in_seconds = 0;
+    int number_of_events = 0;
+    int number_of_passes = 0;
+    int pass;
+    int i;
+
+    events = load_locator_trace(trace_file, &number_of_events);
+    if(NULL == events || 0 == number_of_events){
+        fprintf(stderr, "Unable to load locator trace %s\n", trace_file);
+        free(events);
+        return E_OPEN_FILE;
+    }
+
+    for(i = 0 ; i < number_of_events ; i++){
+        number_of_reports += events[i].number_of_reports;
+    }
+    number_of_passes = number_of_reports > 0 ?
+        (LOCATOR_BENCHMARK_MIN_REPORTS + number_of_reports - 1) /
+        number_of_reports : 1;
+    number_of_reports = 0;
+
+    /* Passes follow each other in the time of the trace, one event gap
+       apart */
+    trace_span_in_ns =
+        (events[number_of_events - 1].reception_time_in_us -
+         events[0].reception_time_in_us) * 1000ULL *
+        number_of_events / (number_of_events > 1 ? number_of_events - 1 : 1);
+    period_in_ns = (config->locator_scan_period_in_seconds > 0 ?
+                    config->locator_scan_period_in_seconds : 1) *
+                   1000000000ULL;
+
+    memset(&table, 0, sizeof(table));
+    memset(&nearest, 0, sizeof(nearest));
+    memset(published, 0, sizeof(published));
+    next_location_in_ns = period_in_ns;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+    for(pass = 0 ; pass < number_of_passes ; pass++){
+        for(i = 0 ; i < number_of_events ; i++){
+            reception_time_in_ns =
+                (events[i].reception_time_in_us -
+                 events[0].reception_time_in_us) * 1000ULL +
+                pass * trace_span_in_ns;
+
+            /* The position is picked at the end of every scan period */
+            while(reception_time_in_ns >= next_location_in_ns){
+                expire_beacons(&table, next_location_in_ns);
+                if(locate_tag(&table, config->locator_weighted_position > 0,
+                              &nearest, coordinates) &&
+                   0 != memcmp(published, coordinates,
+                               LENGTH_OF_COORDINATES)){
+                    memcpy(published, coordinates, LENGTH_OF_COORDINATES);
+                    number_of_updates++;
+                }
+                next_location_in_ns += period_in_ns;
+            }
+
+            number_of_lbeacon_reports += process_locator_event(
+                &table, events[i].packet, events[i].length,
+                reception_time_in_ns);
+            number_of_reports += events[i].number_of_reports;
+        }
+        number_of_replayed_events += number_of_events;
+    }
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    cpu_time_in_seconds = (cpu_end.tv_sec - cpu_start.tv_sec) +
+                          (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9;
+
+    printf("events %llu, reports %llu, LBeacon reports %llu, "
+           "passes %d over %.1f s of trace\n",
+           (unsigned long long)number_of_replayed_events,
+           (unsigned long long)number_of_reports,
+           (unsigned long long)number_of_lbeacon_reports,
+           number_of_passes,
+           number_of_passes * trace_span_in_ns / 1e9);
+    printf("CPU %.3f s, %.0f reports/s on one core, %.0f ns/report\n",
+           cpu_time_in_seconds,
+           cpu_time_in_seconds > 0 ?
+               number_of_reports / cpu_time_in_seconds : 0,
+           number_of_reports > 0 ?
+               cpu_time_in_seconds * 1e9 / number_of_reports : 0);
+
+    ba2str(&nearest, address);
+    printf("LBeacons %d, dropped %llu, position updates %llu, "
+           "%s position %02X%02X%02X%02X%02X%02X%02X%02X, nearest %s\n",
+           table.number_of_beacons,
+           (unsigned long long)table.number_of_drops,
+           (unsigned long long)number_of_updates,
+           config->locator_weighted_position > 0 ? "weighted" : "nearest",
+           published[0], published[1], published[2], published[3],
+           published[4], published[5], published[6], published[7],
+           address);
+
+    free(events);
+
+    return WORK_SUCCESSFULLY;
+}
@@ -0,0 +1,317 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to locate itself from the LBeacons around it, and to replay
+    recorded advertising reports as a benchmark.
+
+File Name:
+
+    Locator.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    In reverse positioning mode the Tag scans for the LBeacons around it
+    instead of advertising the fixed coordinates of lbeacon_uuid. A LBeacon
+    advertises its coordinates in the UUID of an iBeacon, at the same
+    positions at which set_payload_coordinates takes them from
+    lbeacon_uuid. The scan is duty-cycled: it runs for a window at the
+    start of every scan period, and the dongle does not scan in between.
+
+    Every advertising report of a LBeacon is recorded in a fixed-size
+    table with open addressing, keyed by the BD address of the LBeacon,
+    which keeps an exponentially smoothed RSSI per LBeacon. Nothing is
+    allocated per report, so the table sustains the reports of a crowded
+    hall on one core. After every scan the LBeacons not heard for a while
+    are dropped, and the Tag advertises the coordinates of the nearest
+    LBeacon, or the position of the nearest LBeacons weighted by their
+    RSSI. The coordinates are changed by a data-only update of the
+    advertising data, which leaves advertising enabled.
+
+    The received advertising reports can be recorded to a trace file, one
+    HCI event per line preceded by its reception time in micro seconds,
+    and -r replays a trace through the parser and the table at full
+    speed.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef LOCATOR_H
+#define LOCATOR_H
+
+#include <math.h>
+#include <time.h>
+
+#include "Tag.h"
+#include "Planner.h"
+#include "Scanner.h"
+
+/*
+  CONSTANTS
+*/
+
+/* Company identifier, type and length of the manufacturer specific data
+   of an iBeacon */
+#define IBEACON_COMPANY_IDENTIFIER 0x004C
+#define IBEACON_TYPE 0x02
+#define IBEACON_DATA_LENGTH 0x15
+
+/* Length of the manufacturer specific data of an iBeacon: company
+   identifier, type, length, UUID, major, minor and measured power */
+#define IBEACON_MANUFACTURER_DATA_LENGTH 25
+
+/* Offsets in the UUID of the X and the Y coordinate, 4 bytes each */
+#define LBEACON_UUID_X_OFFSET 6
+#define LBEACON_UUID_Y_OFFSET 12
+
+/* Number of entries of the table of LBeacons, a power of two */
+#define LOCATOR_TABLE_SIZE 256
+
+/* Number of LBeacons kept in the table, which bounds the load factor to
+   3/4 so that the probe sequences stay short */
+#define LOCATOR_MAX_NUMBER_OF_BEACONS 192
+
+/* Weight of a new report in the smoothed RSSI */
+#define LOCATOR_RSSI_SMOOTHING 0.25
+
+/* Time in seconds after which a LBeacon not heard is dropped */
+#define LOCATOR_BEACON_TIMEOUT_IN_SECONDS 30
+
+/* Margin in dB by which another LBeacon must be stronger than the nearest
+   one to take over, so that the Tag between two LBeacons does not update
+   its payload after every scan */
+#define LOCATOR_HYSTERESIS_IN_DB 3
+
+/* Number of the strongest LBeacons which make up the weighted position */
+#define LOCATOR_NUMBER_OF_WEIGHTED_BEACONS 3
+
+/* Number of advertising reports replayed at least by the benchmark. A
+   shorter trace is replayed again with its times shifted. */
+#define LOCATOR_BENCHMARK_MIN_REPORTS 1000000
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* A LBeacon heard by the Tag */
+typedef struct BeaconEntry {
+
+    bool is_used;
+
+    bdaddr_t bdaddr;
+
+    /* The X and Y coordinates carried in the UUID */
+    uint8_t coordinates[LENGTH_OF_COORDINATES];
+
+    /* Exponentially smoothed RSSI in dBm */
+    float smoothed_rssi;
+
+    /* CLOCK_MONOTONIC time of the last report */
+    uint64_t last_seen_time_in_ns;
+
+    uint32_t number_of_reports;
+
+} BeaconEntry;
+
+/* The table of LBeacons with open addressing and linear probing */
+typedef struct BeaconTable {
+
+    BeaconEntry entries[LOCATOR_TABLE_SIZE];
+
+    int number_of_beacons;
+
+    /* Reports of new LBeacons dropped because the table was full */
+    uint64_t number_of_drops;
+
+} BeaconTable;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  parse_lbeacon_report:
+
+      This function tells whether an advertising report is an iBeacon,
+      and extracts the coordinates from its UUID.
+
+  Parameters:
+
+      info - the advertising report
+      coordinates - the coordinates to be filled
+
+  Return value:
+
+      bool - true if the advertising report is an iBeacon
+*/
+
+bool parse_lbeacon_report(le_advertising_info *info, uint8_t *coordinates);
+
+/*
+  record_beacon_report:
+
+      This function looks the LBeacon up in the table, inserts it if it
+      is new and the table has room, and smooths its RSSI.
+
+  Parameters:
+
+      table - the table of LBeacons
+      bdaddr - the BD address of the LBeacon
+      coordinates - the coordinates carried by the LBeacon
+      rssi - the RSSI in dBm of the report
+      reception_time_in_ns - the CLOCK_MONOTONIC time of the reception
+
+  Return value:
+
+      None
+*/
+
+void record_beacon_report(BeaconTable *table,
+                          bdaddr_t *bdaddr,
+                          uint8_t *coordinates,
+                          int rssi,
+                          uint64_t reception_time_in_ns);
+
+/*
+  process_locator_event:
+
+      This function records the reports of LBeacons in a HCI event read
+      from the dongle.
+
+  Parameters:
+
+      table - the table of LBeacons
+      buffer - the HCI event, starting with the packet type
+      length - the length of the HCI event
+      reception_time_in_ns - the CLOCK_MONOTONIC time of the reception
+
+  Return value:
+
+      int - the number of reports of LBeacons in the event
+*/
+
+int process_locator_event(BeaconTable *table,
+                          uint8_t *buffer,
+                          int length,
+                          uint64_t reception_time_in_ns);
+
+/*
+  expire_beacons:
+
+      This function drops the LBeacons which have not been heard for
+      LOCATOR_BEACON_TIMEOUT_IN_SECONDS, and moves the following entries
+      of their probe sequences back so that lookups need no tombstones.
+
+  Parameters:
+
+      table - the table of LBeacons
+      now_in_ns - the current CLOCK_MONOTONIC time
+
+  Return value:
+
+      None
+*/
+
+void expire_beacons(BeaconTable *table, uint64_t now_in_ns);
+
+/*
+  locate_tag:
+
+      This function picks the coordinates to be advertised from the table.
+      The nearest LBeacon is kept until another one is stronger by
+      LOCATOR_HYSTERESIS_IN_DB. The weighted position averages the X and Y
+      coordinates, read as big-endian integers, of the strongest LBeacons
+      weighted by their received amplitude.
+
+  Parameters:
+
+      table - the table of LBeacons
+      weighted - whether the weighted position is picked
+      nearest - the BD address of the nearest LBeacon, which is read for
+                the hysteresis and updated
+      coordinates - the coordinates to be filled
+
+  Return value:
+
+      bool - false if the table holds no LBeacon
+*/
+
+bool locate_tag(BeaconTable *table,
+                bool weighted,
+                bdaddr_t *nearest,
+                uint8_t *coordinates);
+
+/*
+  start_locator:
+
+      This function starts the thread which scans for LBeacons and keeps
+      the coordinates of the payload at the located position. Nothing is
+      started if no locator dongle is configured.
+
+  Parameters:
+
+      config - the pointer to the config struct of the Tag
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode start_locator(Config *config);
+
+/*
+  stop_locator:
+
+      This function waits for the locator thread to notice that
+      ready_to_work is cleared, stops the LE scan and closes the trace
+      file. The last coordinates stay in the payload.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      None
+*/
+
+void stop_locator(void);
+
+/*
+  print_locator_benchmark:
+
+      This function loads a recorded trace, replays it through the parser
+      and the table with the reception times of the trace, picks the
+      position after every scan period of the trace, and prints the
+      reports per second sustained on one core and the CPU time per
+      report.
+
+  Parameters:
+
+      trace_file - the path of the recorded trace
+      config - the pointer to the config struct of the Tag
+
+  Return value:
+
+      ErrorCode - E_OPEN_FILE if the trace cannot be loaded or holds no
+                  event, or WORK_SUCCESSFULLY otherwise
+*/
+
+ErrorCode print_locator_benchmark(char *trace_file, Config *config);
+
+#endif
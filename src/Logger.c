@@ -0,0 +1,111 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs of the minimal logger.
+
+ File Name:
+
+      Logger.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Logger.h"
+
+static zlog_category_t categories[LOGGER_MAX_NUMBER_OF_CATEGORIES];
+
+static int number_of_categories = 0;
+
+static const char *get_level_name(int level){
+    if(level >= LOGGER_LEVEL_ERROR){
+        return "ERROR";
+    }
+    if(level >= LOGGER_LEVEL_INFO){
+        return "INFO";
+    }
+    return "DEBUG";
+}
+
+int zlog_init(const char *config){
+    return 0;
+}
+
+zlog_category_t *zlog_get_category(const char *name){
+    int i;
+
+    for(i = 0 ; i < number_of_categories ; i++){
+        if(0 == strcmp(categories[i].name, name)){
+            return &categories[i];
+        }
+    }
+
+    if(number_of_categories == LOGGER_MAX_NUMBER_OF_CATEGORIES){
+        return NULL;
+    }
+
+    categories[number_of_categories].name = name;
+
+    return &categories[number_of_categories++];
+}
+
+void zlog_fini(void){
+}
+
+void write_log(zlog_category_t *category, int level, const char *format, ...){
+    char message[LOGGER_MESSAGE_LENGTH];
+    struct timespec now;
+    va_list arguments;
+    int length = 0;
+    int message_length = 0;
+
+    if(NULL == category || level < LOGGER_MIN_LEVEL){
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    length = snprintf(message, sizeof(message), "%ld.%06ld %s %s ",
+                      (long)now.tv_sec, now.tv_nsec / 1000,
+                      get_level_name(level), category->name);
+    if(length < 0 || length >= sizeof(message) - 1){
+        return;
+    }
+
+    va_start(arguments, format);
+    message_length = vsnprintf(message + length, sizeof(message) - length,
+                               format, arguments);
+    va_end(arguments);
+    if(message_length < 0){
+        return;
+    }
+
+    /* A truncated message keeps room for the newline */
+    length += message_length;
+    if(length > sizeof(message) - 2){
+        length = sizeof(message) - 2;
+    }
+
+    /* Messages may already end with a newline, like zlog allows */
+    if(length > 0 && '\n' == message[length - 1]){
+        length--;
+    }
+    message[length++] = '\n';
+
+    write(STDERR_FILENO, message, length);
+}
@@ -0,0 +1,165 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of the minimal logger, which
+    replaces zlog in the minimal build of the Tag.
+
+File Name:
+
+    Logger.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    The minimal logger implements the part of the zlog API used by the Tag,
+    so that the sources log the same way in both builds. The zlog config is
+    not read: every message at or above LOGGER_MIN_LEVEL is formatted into
+    a buffer on the stack and written to the standard error with a single
+    write, prefixed by the wall clock time in seconds and the category. The
+    time is not broken down into a date, since loading the time zone
+    allocates on the heap.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+  CONSTANTS
+*/
+
+/* Levels of the messages, the same as the levels of zlog */
+#define LOGGER_LEVEL_DEBUG 20
+#define LOGGER_LEVEL_INFO 40
+#define LOGGER_LEVEL_ERROR 100
+
+/* Messages below this level are dropped */
+#ifndef LOGGER_MIN_LEVEL
+#define LOGGER_MIN_LEVEL LOGGER_LEVEL_INFO
+#endif
+
+/* Maximum number of categories */
+#define LOGGER_MAX_NUMBER_OF_CATEGORIES 4
+
+/* Maximum length of a message including the prefix */
+#define LOGGER_MESSAGE_LENGTH 512
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* A category of messages */
+typedef struct zlog_category_s {
+
+    const char *name;
+
+} zlog_category_t;
+
+/*
+  MACROS
+*/
+
+#define zlog_error(category, ...) \
+    write_log(category, LOGGER_LEVEL_ERROR, __VA_ARGS__)
+
+#define zlog_info(category, ...) \
+    write_log(category, LOGGER_LEVEL_INFO, __VA_ARGS__)
+
+#define zlog_debug(category, ...) \
+    write_log(category, LOGGER_LEVEL_DEBUG, __VA_ARGS__)
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  zlog_init:
+
+      This function is kept for the zlog API. The config is not read.
+
+  Parameters:
+
+      config - the path of the zlog config
+
+  Return value:
+
+      int - 0
+*/
+
+int zlog_init(const char *config);
+
+/*
+  zlog_get_category:
+
+      This function returns the category with the given name, which is
+      added if it is not known yet.
+
+  Parameters:
+
+      name - the name of the category, which must outlive the logger
+
+  Return value:
+
+      zlog_category_t * - the category, or NULL if there are already
+                          LOGGER_MAX_NUMBER_OF_CATEGORIES categories
+*/
+
+zlog_category_t *zlog_get_category(const char *name);
+
+/*
+  zlog_fini:
+
+      This function is kept for the zlog API. Nothing is released.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      None
+*/
+
+void zlog_fini(void);
+
+/*
+  write_log:
+
+      This function formats a message and writes it to the standard error.
+      Messages of a NULL category are dropped like in zlog.
+
+  Parameters:
+
+      category - the category of the message
+      level - the level of the message
+      format - the printf format of the message
+
+  Return value:
+
+      None
+*/
+
+void write_log(zlog_category_t *category, int level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif
@@ -0,0 +1,96 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the allocator of the minimal build of the Tag,
+      which aborts on every allocation.
+
+ File Name:
+
+      NoHeap.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+      The minimal build keeps all of its state in static buffers. The
+      Makefile checks at link time that no object of the minimal build
+      calls the allocator or a libc function which allocates, and the
+      functions here replace the allocator of libc, so that an allocation
+      made anyway, also inside libc or libbluetooth, stops the Tag at once
+      with the name of the function on the standard error. Every run of the
+      minimal build, on a dongle or against HciEmulator, is a test that the
+      Tag never allocates.
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void abort_allocation(const char *function_name){
+    static const char message[] = " called in the no-heap build\n";
+
+    write(STDERR_FILENO, function_name, strlen(function_name));
+    write(STDERR_FILENO, message, sizeof(message) - 1);
+    abort();
+}
+
+void *malloc(size_t size){
+    abort_allocation("malloc");
+    return NULL;
+}
+
+void *calloc(size_t number, size_t size){
+    abort_allocation("calloc");
+    return NULL;
+}
+
+void *realloc(void *pointer, size_t size){
+    abort_allocation("realloc");
+    return NULL;
+}
+
+int posix_memalign(void **pointer, size_t alignment, size_t size){
+    abort_allocation("posix_memalign");
+    return -1;
+}
+
+void *aligned_alloc(size_t alignment, size_t size){
+    abort_allocation("aligned_alloc");
+    return NULL;
+}
+
+void *memalign(size_t alignment, size_t size){
+    abort_allocation("memalign");
+    return NULL;
+}
+
+void *valloc(size_t size){
+    abort_allocation("valloc");
+    return NULL;
+}
+
+void *pvalloc(size_t size){
+    abort_allocation("pvalloc");
+    return NULL;
+}
+
+/* Nothing is ever allocated, so only NULL can be freed */
+void free(void *pointer){
+    if(NULL != pointer){
+        abort_allocation("free");
+    }
+}
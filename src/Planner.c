@@ -0,0 +1,313 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used by the Tag to plan a
+      collision-aware advertising interval and start phase, and to measure
+      the delivery rate of a simulated fleet of co-located tags.
+
+ File Name:
+
+      Planner.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Planner.h"
+
+uint32_t hash_bdaddr(bdaddr_t *bdaddr){
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for(i = 0 ; i < sizeof(bdaddr->b) ; i++){
+        hash ^= bdaddr->b[i];
+        hash *= 16777619u;
+    }
+
+    /* Final avalanche so that neighbouring addresses spread over the whole
+       range of offsets and phases */
+    hash ^= hash >> 15;
+    hash *= 2246822519u;
+    hash ^= hash >> 13;
+
+    return hash;
+}
+
+ErrorCode read_unit_identity(bdaddr_t *bdaddr){
+    char machine_id[MAXIMUM_MACHINE_ID_LENGTH];
+    uint64_t hash = 14695981039346656037ull;
+    ssize_t length = 0;
+    ssize_t i;
+    int file_descriptor;
+
+    memset(bdaddr, 0, sizeof(bdaddr_t));
+
+    /* The machine id is read with open and read rather than stdio, which
+       allocates its buffer on the heap */
+    file_descriptor = open(MACHINE_ID_FILE_NAME, O_RDONLY | O_CLOEXEC);
+    if(file_descriptor >= 0){
+        length = read(file_descriptor, machine_id, sizeof(machine_id));
+        close(file_descriptor);
+    }
+
+    while(length > 0 && isspace((unsigned char)machine_id[length - 1])){
+        length--;
+    }
+
+    if(length > 0){
+        /* 64-bit FNV-1a, of which the low six bytes are the address */
+        for(i = 0 ; i < length ; i++){
+            hash ^= (uint8_t)machine_id[i];
+            hash *= 1099511628211ull;
+        }
+        for(i = 0 ; i < sizeof(bdaddr->b) ; i++){
+            bdaddr->b[i] = (hash >> (8 * i)) & 0xFF;
+        }
+        return WORK_SUCCESSFULLY;
+    }
+
+    file_descriptor = open(RANDOM_FILE_NAME, O_RDONLY | O_CLOEXEC);
+    if(file_descriptor < 0){
+        return E_OPEN_FILE;
+    }
+    length = read(file_descriptor, bdaddr->b, sizeof(bdaddr->b));
+    close(file_descriptor);
+
+    if(length != sizeof(bdaddr->b)){
+        return E_OPEN_FILE;
+    }
+
+    return WORK_SUCCESSFULLY;
+}
+
+static int clamp_interval(int interval_in_units_0625_ms){
+    if(interval_in_units_0625_ms < MIN_ADVERTISING_INTERVAL_IN_UNITS_0625_MS)
+        return MIN_ADVERTISING_INTERVAL_IN_UNITS_0625_MS;
+    if(interval_in_units_0625_ms > MAX_ADVERTISING_INTERVAL_IN_UNITS_0625_MS)
+        return MAX_ADVERTISING_INTERVAL_IN_UNITS_0625_MS;
+    return interval_in_units_0625_ms;
+}
+
+ErrorCode plan_advertising_schedule(bdaddr_t *bdaddr,
+                                    int interval_in_units_0625_ms,
+                                    int interval_spread_in_units_0625_ms,
+                                    bool use_interval_range,
+                                    AdvertisingPlan *plan){
+    uint32_t hash = 0;
+    int offset = 0;
+
+    if(interval_in_units_0625_ms < MIN_ADVERTISING_INTERVAL_IN_UNITS_0625_MS ||
+       interval_in_units_0625_ms > MAX_ADVERTISING_INTERVAL_IN_UNITS_0625_MS){
+        return E_ADVERTISE_MODE;
+    }
+
+    if(interval_spread_in_units_0625_ms < 0){
+        interval_spread_in_units_0625_ms = 0;
+    }
+
+    hash = hash_bdaddr(bdaddr);
+
+    /* The low half of the hash selects the interval offset */
+    offset = (hash & 0xFFFF) % (interval_spread_in_units_0625_ms + 1);
+
+    plan->min_interval_in_units_0625_ms =
+        clamp_interval(interval_in_units_0625_ms + offset);
+
+    if(use_interval_range){
+        plan->max_interval_in_units_0625_ms =
+            clamp_interval(interval_in_units_0625_ms +
+                           interval_spread_in_units_0625_ms);
+    }else{
+        plan->max_interval_in_units_0625_ms =
+            plan->min_interval_in_units_0625_ms;
+    }
+
+    /* The high half of the hash selects the start phase within one
+       interval */
+    plan->start_phase_in_micro_seconds =
+        (hash >> 16) % interval_in_units_0625_ms *
+        MICRO_SECONDS_PER_INTERVAL_UNIT;
+
+    return WORK_SUCCESSFULLY;
+}
+
+/* The simulation allocates its events, and is left out of the minimal
+   build */
+#ifndef MINIMAL_FOOTPRINT
+
+static int compare_event_time(const void *lhs, const void *rhs){
+    int64_t left = *(const int64_t *)lhs;
+    int64_t right = *(const int64_t *)rhs;
+
+    return (left > right) - (left < right);
+}
+
+size_t count_collided_events(int64_t *events, size_t number_of_events){
+    size_t number_of_collided = 0;
+    size_t i;
+
+    qsort(events, number_of_events, sizeof(int64_t), compare_event_time);
+
+    /* All tags hop 37, 38, 39 with the same spacing, so two events collide
+       on every channel when their start times are closer than the air time
+       of one PDU. */
+    for(i = 0 ; i < number_of_events ; i++){
+        if((i > 0 &&
+            events[i] - events[i - 1] <
+            ADVERTISING_PDU_AIR_TIME_IN_MICRO_SECONDS) ||
+           (i + 1 < number_of_events &&
+            events[i + 1] - events[i] <
+            ADVERTISING_PDU_AIR_TIME_IN_MICRO_SECONDS)){
+            number_of_collided++;
+        }
+    }
+
+    return number_of_collided;
+}
+
+double simulate_fleet_delivery_rate(int number_of_tags,
+                                    int interval_in_units_0625_ms,
+                                    int interval_spread_in_units_0625_ms,
+                                    bool use_planner,
+                                    bool use_interval_range,
+                                    int max_advertising_delay_in_micro_seconds,
+                                    int duration_in_seconds){
+    unsigned int seed = SIMULATION_RANDOM_SEED;
+    int64_t duration_in_micro_seconds =
+        (int64_t)duration_in_seconds * 1000000;
+    int64_t *events = NULL;
+    int64_t event_time = 0;
+    size_t events_per_tag = 0;
+    size_t number_of_events = 0;
+    size_t number_of_collided = 0;
+    size_t i;
+    int tag;
+    int interval = 0;
+    AdvertisingPlan plan;
+    bdaddr_t bdaddr;
+
+    if(number_of_tags <= 0 || duration_in_seconds <= 0){
+        return 0;
+    }
+
+    events_per_tag = duration_in_micro_seconds /
+        ((int64_t)clamp_interval(interval_in_units_0625_ms) *
+         MICRO_SECONDS_PER_INTERVAL_UNIT) + 1;
+
+    events = (int64_t *)malloc(sizeof(int64_t) * events_per_tag *
+                               number_of_tags);
+    if(events == NULL){
+        return -1;
+    }
+
+    for(tag = 0 ; tag < number_of_tags ; tag++){
+
+        /* Addresses follow the C1: prefix assigned by change_mac.sh */
+        memset(&bdaddr, 0, sizeof(bdaddr));
+        bdaddr.b[5] = 0xC1;
+        bdaddr.b[0] = tag & 0xFF;
+        bdaddr.b[1] = (tag >> 8) & 0xFF;
+        bdaddr.b[2] = rand_r(&seed) & 0xFF;
+
+        plan.min_interval_in_units_0625_ms = interval_in_units_0625_ms;
+        plan.max_interval_in_units_0625_ms = interval_in_units_0625_ms;
+        plan.start_phase_in_micro_seconds = 0;
+
+        if(use_planner){
+            plan_advertising_schedule(&bdaddr,
+                                      interval_in_units_0625_ms,
+                                      interval_spread_in_units_0625_ms,
+                                      use_interval_range,
+                                      &plan);
+        }
+
+        event_time = rand_r(&seed) % SIMULATED_BOOT_WINDOW_IN_MICRO_SECONDS +
+                     plan.start_phase_in_micro_seconds;
+
+        for(i = 0 ; i < events_per_tag ; i++){
+            if(event_time >= duration_in_micro_seconds){
+                break;
+            }
+            events[number_of_events++] = event_time;
+
+            interval = plan.min_interval_in_units_0625_ms +
+                rand_r(&seed) % (plan.max_interval_in_units_0625_ms -
+                                 plan.min_interval_in_units_0625_ms + 1);
+
+            event_time += (int64_t)interval * MICRO_SECONDS_PER_INTERVAL_UNIT +
+                rand_r(&seed) % (max_advertising_delay_in_micro_seconds + 1);
+        }
+    }
+
+    number_of_collided = count_collided_events(events, number_of_events);
+
+    free(events);
+
+    if(number_of_events == 0){
+        return 0;
+    }
+
+    return (double)(number_of_events - number_of_collided) /
+           number_of_events;
+}
+
+void print_fleet_simulation(int number_of_tags, Config *config){
+    int delays[] = {0, MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS};
+    int duration_in_seconds = 600;
+    int i;
+
+    printf("Fleet of %d tags, interval %d x 0.625 ms, spread %d x 0.625 ms, "
+           "%d s simulated\n",
+           number_of_tags,
+           config->advertise_interval_in_units_0625_ms,
+           config->advertise_interval_spread_in_units_0625_ms,
+           duration_in_seconds);
+    printf("%-16s %-16s %-16s %-16s\n",
+           "advDelay (us)", "pinned", "planned", "planned range");
+
+    for(i = 0 ; i < sizeof(delays) / sizeof(delays[0]) ; i++){
+        printf("%-16d %-16.4f %-16.4f %-16.4f\n",
+               delays[i],
+               simulate_fleet_delivery_rate(
+                   number_of_tags,
+                   config->advertise_interval_in_units_0625_ms,
+                   config->advertise_interval_spread_in_units_0625_ms,
+                   false,
+                   false,
+                   delays[i],
+                   duration_in_seconds),
+               simulate_fleet_delivery_rate(
+                   number_of_tags,
+                   config->advertise_interval_in_units_0625_ms,
+                   config->advertise_interval_spread_in_units_0625_ms,
+                   true,
+                   false,
+                   delays[i],
+                   duration_in_seconds),
+               simulate_fleet_delivery_rate(
+                   number_of_tags,
+                   config->advertise_interval_in_units_0625_ms,
+                   config->advertise_interval_spread_in_units_0625_ms,
+                   true,
+                   true,
+                   delays[i],
+                   duration_in_seconds));
+    }
+}
+
+#endif
@@ -0,0 +1,259 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to plan a collision-aware advertising interval and start
+    phase, and to simulate the delivery rate of a fleet of co-located tags.
+
+File Name:
+
+    Planner.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    Tags flashed with the same advertising interval and powered on together
+    may fall into phase lockstep and keep colliding on air. The planner
+    derives a per-tag interval offset and start phase from the BD address
+    of the dongle so that co-located tags drift apart.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <fcntl.h>
+#include "Tag.h"
+
+/*
+  CONSTANTS
+*/
+
+/* Time in micro seconds of one advertising interval unit (0.625 ms) */
+#define MICRO_SECONDS_PER_INTERVAL_UNIT 625
+
+/* Minimum advertising interval in units of 0.625ms allowed by the Bluetooth
+   specifications for non-connectable advertising */
+#define MIN_ADVERTISING_INTERVAL_IN_UNITS_0625_MS 0x00A0
+
+/* Maximum advertising interval in units of 0.625ms allowed by the Bluetooth
+   specifications */
+#define MAX_ADVERTISING_INTERVAL_IN_UNITS_0625_MS 0x4000
+
+/* Upper bound in micro seconds of the pseudo-random advDelay the controller
+   adds to each advertising event */
+#define MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS 10000
+
+/* On-air time in micro seconds of one legacy advertising PDU carrying the
+   Tag payload at 1 Mbps */
+#define ADVERTISING_PDU_AIR_TIME_IN_MICRO_SECONDS 296
+
+/* Time window in micro seconds during which the tags of a simulated fleet
+   are powered on by rc.local */
+#define SIMULATED_BOOT_WINDOW_IN_MICRO_SECONDS 20000
+
+/* Seed of the pseudo-random generator used by the fleet simulation, so that
+   runs are reproducible */
+#define SIMULATION_RANDOM_SEED 20201019
+
+/* File holding the identifier of the installation of the gateway, which is
+   unique per unit and stable across boots */
+#define MACHINE_ID_FILE_NAME "/etc/machine-id"
+
+/* Source of the random identity of a unit without a machine id */
+#define RANDOM_FILE_NAME "/dev/urandom"
+
+/* Maximum length of the machine id read by the planner */
+#define MAXIMUM_MACHINE_ID_LENGTH 64
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The advertising schedule planned for the Tag */
+typedef struct AdvertisingPlan {
+
+    /* Lower bound of the advertising interval in units of 0.625ms */
+    int min_interval_in_units_0625_ms;
+
+    /* Upper bound of the advertising interval in units of 0.625ms */
+    int max_interval_in_units_0625_ms;
+
+    /* Delay in micro seconds before advertising is enabled */
+    int start_phase_in_micro_seconds;
+
+} AdvertisingPlan;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  hash_bdaddr:
+
+      This function hashes the BD address of the dongle with FNV-1a and a
+      final avalanche. The hash is the identity of the Tag from which its
+      interval offset, start phase and TDMA slot are derived.
+
+  Parameters:
+
+      bdaddr - the BD address of the dongle used to advertise
+
+  Return value:
+
+      uint32_t - the hash of the BD address
+*/
+
+uint32_t hash_bdaddr(bdaddr_t *bdaddr);
+
+/*
+  read_unit_identity:
+
+      This function derives an address for the planner when the BD address
+      of the dongle cannot be read, so that such units do not all plan from
+      the same all-zero address. The address is the hash of the machine id
+      of the gateway, or random bytes when there is no machine id.
+
+  Parameters:
+
+      bdaddr - the pointer to the derived address
+
+  Return value:
+
+      ErrorCode - E_OPEN_FILE if neither the machine id nor random bytes
+                  can be read, or WORK_SUCCESSFULLY otherwise
+*/
+
+ErrorCode read_unit_identity(bdaddr_t *bdaddr);
+
+/*
+  plan_advertising_schedule:
+
+      This function derives a distinct interval offset and start phase from
+      the BD address of the dongle. The offset is taken from the range
+      [0, interval_spread] so that co-located tags advertise with slightly
+      different intervals, and the phase is taken from the range of one
+      interval so that tags powered on together do not start in lockstep.
+
+  Parameters:
+
+      bdaddr - the BD address of the dongle used to advertise
+      interval_in_units_0625_ms - the configured advertising interval
+      interval_spread_in_units_0625_ms - the width of the range from which
+                                         the interval offset is chosen
+      use_interval_range - whether to let the controller choose the
+                           interval between the planned interval and the
+                           top of the spread range instead of pinning
+                           min_interval and max_interval to the same value
+      plan - the pointer to the planned schedule
+
+  Return value:
+
+      ErrorCode - E_ADVERTISE_MODE if the configured interval is outside
+                  the range allowed by the Bluetooth specifications, or
+                  WORK_SUCCESSFULLY otherwise
+*/
+
+ErrorCode plan_advertising_schedule(bdaddr_t *bdaddr,
+                                    int interval_in_units_0625_ms,
+                                    int interval_spread_in_units_0625_ms,
+                                    bool use_interval_range,
+                                    AdvertisingPlan *plan);
+
+#ifndef MINIMAL_FOOTPRINT
+
+/*
+  count_collided_events:
+
+      This function sorts the start times of the advertising events of a
+      simulated fleet and counts the events whose PDUs overlap on air with
+      another event.
+
+  Parameters:
+
+      events - the start times in micro seconds of the advertising events
+      number_of_events - the number of advertising events
+
+  Return value:
+
+      size_t - the number of collided advertising events
+*/
+
+size_t count_collided_events(int64_t *events, size_t number_of_events);
+
+/*
+  simulate_fleet_delivery_rate:
+
+      This function simulates a fleet of co-located tags advertising on a
+      simulated controller and returns the fraction of advertising events
+      received by a scanner without collision. The controller model places
+      each advertising event at the previous event plus the advertising
+      interval plus a pseudo-random advDelay, and two events collide when
+      their PDUs overlap on air.
+
+  Parameters:
+
+      number_of_tags - the number of tags in the fleet
+      interval_in_units_0625_ms - the configured advertising interval
+      interval_spread_in_units_0625_ms - the spread used by the planner
+      use_planner - whether the tags use plan_advertising_schedule or all
+                    pin the configured interval and start within the boot
+                    window of rc.local
+      use_interval_range - whether the planned tags let the controller
+                           choose each interval within the planned range,
+                           modelled as a uniformly random interval
+      max_advertising_delay_in_micro_seconds - the upper bound of advDelay
+                                               of the simulated controller
+      duration_in_seconds - the simulated time
+
+  Return value:
+
+      double - the delivery rate between 0 and 1, or a negative value if
+               the simulation cannot allocate its event table
+*/
+
+double simulate_fleet_delivery_rate(int number_of_tags,
+                                    int interval_in_units_0625_ms,
+                                    int interval_spread_in_units_0625_ms,
+                                    bool use_planner,
+                                    bool use_interval_range,
+                                    int max_advertising_delay_in_micro_seconds,
+                                    int duration_in_seconds);
+
+/*
+  print_fleet_simulation:
+
+      This function runs the fleet simulation for the configured interval
+      without the planner, with the planner pinning the interval and with
+      the planner using an interval range, for controllers with and without
+      advDelay, and prints the delivery rates to the standard output.
+
+  Parameters:
+
+      number_of_tags - the number of tags in the fleet
+      config - the pointer to the config struct of the Tag
+
+  Return value:
+
+      None
+*/
+
+void print_fleet_simulation(int number_of_tags, Config *config);
+
+#endif
+
+#endif
@@ -0,0 +1,366 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used by the Tag to manage the TX
+      power of the dongle and the per-zone power schedule.
+
+ File Name:
+
+      Power.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Power.h"
+
+#define Debugging
+
+/* Pack an advertising interval into the 24-bit little-endian field of the
+   extended advertising commands */
+static void pack_interval(uint8_t *field, int interval_in_units_0625_ms){
+    field[0] = interval_in_units_0625_ms & 0xFF;
+    field[1] = (interval_in_units_0625_ms >> 8) & 0xFF;
+    field[2] = (interval_in_units_0625_ms >> 16) & 0xFF;
+}
+
+ErrorCode read_legacy_tx_power(int device_handle, TxPowerSetting *setting){
+    le_read_advertising_channel_tx_power_rp advertising_tx_power;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    memset(&advertising_tx_power, 0, sizeof(advertising_tx_power));
+
+    return_value = send_hci_request(device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_READ_ADVERTISING_CHANNEL_TX_POWER,
+                                    NULL, 0,
+                                    &advertising_tx_power,
+                                    sizeof(advertising_tx_power));
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+    if(advertising_tx_power.status){
+        zlog_error(category_health_report,
+                   "LE read advertising TX power returned status %d",
+                   advertising_tx_power.status);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "LE read advertising TX power returned status %d",
+                   advertising_tx_power.status);
+#endif
+        return E_ADVERTISE_STATUS;
+    }
+
+    setting->default_tx_power_in_dbm = advertising_tx_power.level;
+    setting->selected_tx_power_in_dbm = advertising_tx_power.level;
+    setting->min_tx_power_in_dbm = advertising_tx_power.level;
+    setting->max_tx_power_in_dbm = advertising_tx_power.level;
+    setting->method = TX_POWER_CONTROLLER_DEFAULT;
+
+#ifdef Debugging
+    zlog_info(category_debug, "Legacy advertising TX power %d dBm",
+              setting->default_tx_power_in_dbm);
+#endif
+
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode read_tx_power_range(int device_handle, TxPowerSetting *setting){
+    le_read_transmit_power_rp transmit_power;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    uint8_t status = 0;
+
+    /* The advertising set reports the TX power the controller selects
+       without a preference, which stands in for the legacy advertising TX
+       power. The parameters are set again before advertising. */
+    return_value = set_extended_advertising_parameters(
+        device_handle,
+        TX_POWER_PROBE_INTERVAL_IN_UNITS_0625_MS,
+        TX_POWER_PROBE_INTERVAL_IN_UNITS_0625_MS,
+        TX_POWER_NO_PREFERENCE,
+        setting,
+        &status);
+    if(WORK_SUCCESSFULLY != return_value){
+        zlog_error(category_health_report,
+                   "LE set extended advertising parameters returned "
+                   "status %d", status);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "LE set extended advertising parameters returned "
+                   "status %d", status);
+#endif
+        return return_value;
+    }
+
+    setting->default_tx_power_in_dbm = setting->selected_tx_power_in_dbm;
+    setting->min_tx_power_in_dbm = setting->selected_tx_power_in_dbm;
+    setting->max_tx_power_in_dbm = setting->selected_tx_power_in_dbm;
+    setting->method = TX_POWER_CONTROLLER_DEFAULT;
+
+    /* An error status of LE Read Transmit Power leaves the range at the
+       default TX power */
+    memset(&transmit_power, 0, sizeof(transmit_power));
+
+    return_value = send_hci_request(device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_READ_TRANSMIT_POWER,
+                                    NULL, 0,
+                                    &transmit_power,
+                                    sizeof(transmit_power));
+    if(WORK_SUCCESSFULLY == return_value && 0 == transmit_power.status){
+        setting->min_tx_power_in_dbm = transmit_power.min_tx_power;
+        setting->max_tx_power_in_dbm = transmit_power.max_tx_power;
+    }
+
+#ifdef Debugging
+    zlog_info(category_debug,
+              "TX power range [%d, %d] dBm, default %d dBm",
+              setting->min_tx_power_in_dbm,
+              setting->max_tx_power_in_dbm,
+              setting->default_tx_power_in_dbm);
+#endif
+
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode set_extended_advertising_parameters(
+    int device_handle,
+    int min_interval_in_units_0625_ms,
+    int max_interval_in_units_0625_ms,
+    int tx_power_in_dbm,
+    TxPowerSetting *setting,
+    uint8_t *status){
+
+    le_set_extended_advertising_parameters_cp parameters;
+    le_set_extended_advertising_parameters_rp response;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    memset(&parameters, 0, sizeof(parameters));
+    parameters.handle = EXTENDED_ADVERTISING_HANDLE;
+    parameters.properties = htobs(EXTENDED_ADVERTISING_LEGACY_NONCONN);
+    pack_interval(parameters.min_interval, min_interval_in_units_0625_ms);
+    pack_interval(parameters.max_interval, max_interval_in_units_0625_ms);
+    /* all three advertising channels */
+    parameters.chan_map = 7;
+    parameters.own_bdaddr_type = g_advertising.own_address_type;
+    parameters.tx_power = tx_power_in_dbm;
+    parameters.primary_phy = ADVERTISING_PHY_LE_1M;
+    parameters.secondary_phy = ADVERTISING_PHY_LE_1M;
+
+    memset(&response, 0, sizeof(response));
+
+    return_value = send_hci_request(device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_SET_EXTENDED_ADVERTISING_PARAMETERS,
+                                    &parameters, sizeof(parameters),
+                                    &response, sizeof(response));
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+
+    *status = response.status;
+    if(response.status){
+        return E_ADVERTISE_STATUS;
+    }
+
+    setting->selected_tx_power_in_dbm = response.tx_power;
+    setting->method = TX_POWER_EXTENDED_COMMAND;
+
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode set_extended_advertising_data(
+    int device_handle,
+    le_set_advertising_data_cp *advertising_data){
+
+    le_set_extended_advertising_data_cp extended_data;
+    uint8_t status = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    memset(&extended_data, 0, sizeof(extended_data));
+    extended_data.handle = EXTENDED_ADVERTISING_HANDLE;
+    extended_data.operation = EXTENDED_ADVERTISING_DATA_COMPLETE;
+    /* Legacy PDUs cannot be fragmented */
+    extended_data.fragment_preference = 0x01;
+    extended_data.length = advertising_data->length;
+    memcpy(extended_data.data, advertising_data->data,
+           advertising_data->length);
+
+    return_value = send_hci_request(device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_SET_EXTENDED_ADVERTISING_DATA,
+                                    &extended_data,
+                                    4 + extended_data.length,
+                                    &status, 1);
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+
+    if(status){
+        zlog_error(category_health_report,
+                   "LE set extended advertising data returned status %d",
+                   status);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "LE set extended advertising data returned status %d",
+                   status);
+#endif
+        return E_ADVERTISE_STATUS;
+    }
+
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode set_extended_advertise_enable(int device_handle, bool enable){
+    le_set_extended_advertise_enable_cp advertise_enable;
+    uint8_t status = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    memset(&advertise_enable, 0, sizeof(advertise_enable));
+    advertise_enable.enable = enable ? 0x01 : 0x00;
+    advertise_enable.number_of_sets = 1;
+    advertise_enable.handle = EXTENDED_ADVERTISING_HANDLE;
+
+    return_value = send_hci_request(device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_SET_EXTENDED_ADVERTISE_ENABLE,
+                                    &advertise_enable,
+                                    sizeof(advertise_enable),
+                                    &status, 1);
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+
+    if(status){
+        zlog_error(category_health_report,
+                   "LE set extended advertise enable returned status %d",
+                   status);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "LE set extended advertise enable returned status %d",
+                   status);
+#endif
+        return E_ADVERTISE_STATUS;
+    }
+
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode set_vendor_tx_power(int device_handle,
+                              int tx_power_in_dbm,
+                              TxPowerSetting *setting){
+    vs_write_tx_power_level_cp tx_power_level;
+    vs_write_tx_power_level_rp response;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    memset(&tx_power_level, 0, sizeof(tx_power_level));
+    tx_power_level.handle_type = VS_TX_POWER_HANDLE_TYPE_ADVERTISING;
+    tx_power_level.handle = htobs(0);
+    tx_power_level.tx_power = tx_power_in_dbm;
+
+    memset(&response, 0, sizeof(response));
+
+    return_value = send_hci_request(device_handle,
+                                    OGF_VENDOR_SPECIFIC,
+                                    OCF_VS_WRITE_TX_POWER_LEVEL,
+                                    &tx_power_level, sizeof(tx_power_level),
+                                    &response, sizeof(response));
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+
+    if(response.status){
+        zlog_error(category_health_report,
+                   "Vendor write TX power level returned status %d",
+                   response.status);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Vendor write TX power level returned status %d",
+                   response.status);
+#endif
+        return E_ADVERTISE_STATUS;
+    }
+
+    setting->selected_tx_power_in_dbm = response.selected_tx_power;
+    setting->method = TX_POWER_VENDOR_COMMAND;
+
+    return WORK_SUCCESSFULLY;
+}
+
+int calibrate_measured_power(int rssi_value, TxPowerSetting *setting){
+    return rssi_value + setting->selected_tx_power_in_dbm -
+           setting->default_tx_power_in_dbm;
+}
+
+ErrorCode parse_zone_power_schedule(char *schedule,
+                                    ZonePower *zones,
+                                    int *number_of_zones){
+    char *entry = NULL;
+    char *save_pointer = NULL;
+    int zone_id = 0;
+    int tx_power_in_dbm = 0;
+    int interval_in_units_0625_ms = 0;
+
+    *number_of_zones = 0;
+
+    for(entry = strtok_r(schedule, ZONE_ENTRY_DELIMITER, &save_pointer);
+        entry != NULL;
+        entry = strtok_r(NULL, ZONE_ENTRY_DELIMITER, &save_pointer)){
+
+        if(*number_of_zones >= MAX_NUMBER_OF_ZONES){
+            zlog_error(category_health_report,
+                       "Too many entries in zone power schedule");
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "Too many entries in zone power schedule");
+#endif
+            return E_ADVERTISE_MODE;
+        }
+
+        if(3 != sscanf(entry, "%d:%d:%d", &zone_id, &tx_power_in_dbm,
+                       &interval_in_units_0625_ms)){
+            zlog_error(category_health_report,
+                       "Malformed zone power schedule entry [%s]", entry);
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "Malformed zone power schedule entry [%s]", entry);
+#endif
+            return E_ADVERTISE_MODE;
+        }
+
+        zones[*number_of_zones].zone_id = zone_id;
+        zones[*number_of_zones].tx_power_in_dbm = tx_power_in_dbm;
+        zones[*number_of_zones].interval_in_units_0625_ms =
+            interval_in_units_0625_ms;
+        (*number_of_zones)++;
+    }
+
+    return WORK_SUCCESSFULLY;
+}
+
+ZonePower *find_zone_power(int zone_id, ZonePower *zones, int number_of_zones){
+    int i;
+
+    for(i = 0 ; i < number_of_zones ; i++){
+        if(zones[i].zone_id == zone_id){
+            return &zones[i];
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,414 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to read the supported TX power range of the dongle, to set
+    the TX power through the extended advertising or vendor specific
+    commands, and to look up the per-zone power schedule.
+
+File Name:
+
+    Power.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    Legacy advertising commands have no way to set the TX power. A
+    controller which supports extended advertising is driven with LE Set
+    Extended Advertising Parameters, whose Advertising_TX_Power field the
+    controller honours, and never with legacy advertising commands, which
+    it disallows once an extended one was sent. On controllers that only
+    support legacy advertising the Tag falls back to the Zephyr vendor
+    command Write Tx Power Level.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef POWER_H
+#define POWER_H
+
+#include "Tag.h"
+
+/*
+  CONSTANTS
+*/
+
+/* TX power value meaning that the Tag has no preference and the controller
+   uses its default TX power */
+#define TX_POWER_NO_PREFERENCE 127
+
+/* Advertising interval of the advertising set with which the default TX
+   power of an extended advertising controller is read */
+#define TX_POWER_PROBE_INTERVAL_IN_UNITS_0625_MS 0x00A0
+
+/* Maximum number of entries in the per-zone power schedule */
+#define MAX_NUMBER_OF_ZONES 16
+
+/* Separator between the entries of the per-zone power schedule */
+#define ZONE_ENTRY_DELIMITER ","
+
+/* HCI opcode command fields not defined by every BlueZ release */
+#define OCF_LE_SET_EXTENDED_ADVERTISING_PARAMETERS 0x0036
+#define OCF_LE_SET_EXTENDED_ADVERTISING_DATA 0x0037
+#define OCF_LE_SET_EXTENDED_ADVERTISE_ENABLE 0x0039
+#define OCF_LE_READ_TRANSMIT_POWER 0x004B
+#define OCF_LE_SET_ADVERTISING_SET_RANDOM_ADDRESS 0x0035
+
+/* Zephyr HCI vendor specific command to write the TX power level */
+#define OGF_VENDOR_SPECIFIC 0x3F
+#define OCF_VS_WRITE_TX_POWER_LEVEL 0x000E
+
+/* Handle type of the advertising role in Write Tx Power Level */
+#define VS_TX_POWER_HANDLE_TYPE_ADVERTISING 0x00
+
+/* Advertising set used by the Tag for extended advertising commands */
+#define EXTENDED_ADVERTISING_HANDLE 0x00
+
+/* Advertising event properties of a legacy ADV_NONCONN_IND PDU sent with
+   extended advertising commands */
+#define EXTENDED_ADVERTISING_LEGACY_NONCONN 0x0010
+
+/* Operation of LE Set Extended Advertising Data for complete data */
+#define EXTENDED_ADVERTISING_DATA_COMPLETE 0x03
+
+/* LE 1M PHY used on the primary and secondary advertising channels */
+#define ADVERTISING_PHY_LE_1M 0x01
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* Command parameters of LE Set Extended Advertising Parameters */
+typedef struct {
+    uint8_t handle;
+    uint16_t properties;
+    uint8_t min_interval[3];
+    uint8_t max_interval[3];
+    uint8_t chan_map;
+    uint8_t own_bdaddr_type;
+    uint8_t peer_bdaddr_type;
+    bdaddr_t peer_bdaddr;
+    uint8_t filter;
+    int8_t tx_power;
+    uint8_t primary_phy;
+    uint8_t secondary_max_skip;
+    uint8_t secondary_phy;
+    uint8_t sid;
+    uint8_t scan_request_notification;
+} __attribute__ ((packed)) le_set_extended_advertising_parameters_cp;
+
+/* Return parameters of LE Set Extended Advertising Parameters */
+typedef struct {
+    uint8_t status;
+    int8_t tx_power;
+} __attribute__ ((packed)) le_set_extended_advertising_parameters_rp;
+
+/* Command parameters of LE Set Extended Advertising Data */
+typedef struct {
+    uint8_t handle;
+    uint8_t operation;
+    uint8_t fragment_preference;
+    uint8_t length;
+    uint8_t data[31];
+} __attribute__ ((packed)) le_set_extended_advertising_data_cp;
+
+/* Command parameters of LE Set Extended Advertising Enable for one set */
+typedef struct {
+    uint8_t enable;
+    uint8_t number_of_sets;
+    uint8_t handle;
+    uint16_t duration;
+    uint8_t max_extended_events;
+} __attribute__ ((packed)) le_set_extended_advertise_enable_cp;
+
+/* Command parameters of LE Set Advertising Set Random Address */
+typedef struct {
+    uint8_t handle;
+    bdaddr_t bdaddr;
+} __attribute__ ((packed)) le_set_advertising_set_random_address_cp;
+
+/* Return parameters of LE Read Transmit Power */
+typedef struct {
+    uint8_t status;
+    int8_t min_tx_power;
+    int8_t max_tx_power;
+} __attribute__ ((packed)) le_read_transmit_power_rp;
+
+/* Command parameters of the vendor command Write Tx Power Level */
+typedef struct {
+    uint8_t handle_type;
+    uint16_t handle;
+    int8_t tx_power;
+} __attribute__ ((packed)) vs_write_tx_power_level_cp;
+
+/* Return parameters of the vendor command Write Tx Power Level */
+typedef struct {
+    uint8_t status;
+    uint8_t handle_type;
+    uint16_t handle;
+    int8_t selected_tx_power;
+} __attribute__ ((packed)) vs_write_tx_power_level_rp;
+
+/* The way the TX power of the Tag is controlled */
+typedef enum _TxPowerMethod{
+
+    TX_POWER_CONTROLLER_DEFAULT = 0,
+    TX_POWER_EXTENDED_COMMAND = 1,
+    TX_POWER_VENDOR_COMMAND = 2
+
+} TxPowerMethod;
+
+/* The TX power range of the dongle and the TX power used to advertise */
+typedef struct TxPowerSetting {
+
+    /* Minimum and maximum TX power in dBm supported by the dongle */
+    int min_tx_power_in_dbm;
+    int max_tx_power_in_dbm;
+
+    /* TX power in dBm used by the dongle without a preference, for legacy
+       advertising or for an advertising set */
+    int default_tx_power_in_dbm;
+
+    /* TX power in dBm selected by the dongle to advertise */
+    int selected_tx_power_in_dbm;
+
+    TxPowerMethod method;
+
+} TxPowerSetting;
+
+/* One entry of the per-zone power schedule */
+typedef struct ZonePower {
+
+    int zone_id;
+
+    /* TX power in dBm used to advertise inside the zone */
+    int tx_power_in_dbm;
+
+    /* Time interval in units of 0.625ms between advertising inside the
+       zone */
+    int interval_in_units_0625_ms;
+
+} ZonePower;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  read_legacy_tx_power:
+
+      This function reads the TX power used for legacy advertising with LE
+      Read Advertising Channel TX Power, to which the TX power range
+      collapses. It is a legacy advertising command, so it must only be
+      sent to a dongle without extended advertising.
+
+  Parameters:
+
+      device_handle - the handle of the open HCI socket
+      setting - the pointer to the TX power setting to be filled
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode read_legacy_tx_power(int device_handle, TxPowerSetting *setting);
+
+/*
+  read_tx_power_range:
+
+      This function reads the TX power range supported by the dongle with
+      LE Read Transmit Power, and the default TX power as selected by LE
+      Set Extended Advertising Parameters without a preference. Only
+      commands allowed alongside extended advertising are sent, so it must
+      only be used with a dongle which supports extended advertising. When
+      the dongle rejects LE Read Transmit Power, the range collapses to the
+      default TX power.
+
+  Parameters:
+
+      device_handle - the handle of the open HCI socket
+      setting - the pointer to the TX power setting to be filled
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode read_tx_power_range(int device_handle, TxPowerSetting *setting);
+
+/*
+  set_extended_advertising_parameters:
+
+      This function sets the advertising parameters of a legacy
+      non-connectable PDU through LE Set Extended Advertising Parameters,
+      requesting the specified TX power.
+
+  Parameters:
+
+      device_handle - the handle of the open HCI socket
+      min_interval_in_units_0625_ms - the lower bound of the advertising
+                                      interval
+      max_interval_in_units_0625_ms - the upper bound of the advertising
+                                      interval
+      tx_power_in_dbm - the requested TX power
+      setting - the pointer to the TX power setting which records the TX
+                power selected by the dongle
+      status - the status returned by the dongle
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode set_extended_advertising_parameters(
+    int device_handle,
+    int min_interval_in_units_0625_ms,
+    int max_interval_in_units_0625_ms,
+    int tx_power_in_dbm,
+    TxPowerSetting *setting,
+    uint8_t *status);
+
+/*
+  set_extended_advertising_data:
+
+      This function hands the encoded advertising data to the advertising
+      set of the Tag through LE Set Extended Advertising Data.
+
+  Parameters:
+
+      device_handle - the handle of the open HCI socket
+      advertising_data - the encoded advertising data
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode set_extended_advertising_data(
+    int device_handle,
+    le_set_advertising_data_cp *advertising_data);
+
+/*
+  set_extended_advertise_enable:
+
+      This function enables or disables the advertising set of the Tag
+      through LE Set Extended Advertising Enable.
+
+  Parameters:
+
+      device_handle - the handle of the open HCI socket
+      enable - whether to enable advertising
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode set_extended_advertise_enable(int device_handle, bool enable);
+
+/*
+  set_vendor_tx_power:
+
+      This function sets the TX power of legacy advertising through the
+      vendor specific command Write Tx Power Level.
+
+  Parameters:
+
+      device_handle - the handle of the open HCI socket
+      tx_power_in_dbm - the requested TX power
+      setting - the pointer to the TX power setting which records the TX
+                power selected by the dongle
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode set_vendor_tx_power(int device_handle,
+                              int tx_power_in_dbm,
+                              TxPowerSetting *setting);
+
+/*
+  calibrate_measured_power:
+
+      This function returns the RSSI a scanner measures at 1 m from the Tag
+      at the selected TX power. The configured RSSI is calibrated at the
+      default TX power of the dongle, so the difference between the
+      selected and the default TX power is added to it.
+
+  Parameters:
+
+      rssi_value - the RSSI measured at 1 m at the default TX power
+      setting - the pointer to the TX power setting
+
+  Return value:
+
+      int - the calibrated measured power in dBm
+*/
+
+int calibrate_measured_power(int rssi_value, TxPowerSetting *setting);
+
+/*
+  parse_zone_power_schedule:
+
+      This function parses the per-zone power schedule. The schedule is a
+      list of entries separated by commas, and each entry has the form
+      zone_id:tx_power_in_dbm:interval_in_units_0625_ms.
+
+  Parameters:
+
+      schedule - the per-zone power schedule read from the config file
+      zones - the array of zone entries to be filled
+      number_of_zones - the number of parsed entries
+
+  Return value:
+
+      ErrorCode - E_ADVERTISE_MODE if an entry is malformed, or
+                  WORK_SUCCESSFULLY otherwise
+*/
+
+ErrorCode parse_zone_power_schedule(char *schedule,
+                                    ZonePower *zones,
+                                    int *number_of_zones);
+
+/*
+  find_zone_power:
+
+      This function looks up the entry of the specified zone in the
+      per-zone power schedule.
+
+  Parameters:
+
+      zone_id - the zone in which the Tag is deployed
+      zones - the array of zone entries
+      number_of_zones - the number of entries
+
+  Return value:
+
+      ZonePower * - the entry of the zone, or NULL if the zone is not in
+                    the schedule
+*/
+
+ZonePower *find_zone_power(int zone_id, ZonePower *zones, int number_of_zones);
+
+#endif
@@ -0,0 +1,335 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs executed by the privacy thread of
+      the Tag, which rotates the private identity of the Tag.
+
+ File Name:
+
+      Privacy.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Privacy.h"
+#include "Energy.h"
+#include "Transport.h"
+#include "Template.h"
+
+#define Debugging
+
+/* Handle of the advertising dongle */
+static int privacy_device_handle = -1;
+
+static uint8_t privacy_key[IDENTITY_KEY_LENGTH];
+
+static int rotation_interval_in_seconds = 0;
+
+/* The precomputed identities, indexed by the epoch modulo the batch
+   size. Only the privacy thread touches them. */
+static PrivateIdentity identities[PRIVACY_BATCH_SIZE];
+static bool is_precomputed[PRIVACY_BATCH_SIZE];
+
+/* The private address on the air, protected by address_lock */
+static bdaddr_t private_address;
+static bool has_private_address = false;
+static pthread_mutex_t address_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The epoch of the identity with which advertising was enabled */
+static uint32_t initial_epoch = 0;
+static bool has_initial_identity = false;
+
+static pthread_t privacy_thread;
+
+static bool privacy_running = false;
+
+static uint32_t get_current_epoch(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return get_identity_epoch(now.tv_sec, rotation_interval_in_seconds);
+}
+
+static bool has_identity(uint32_t epoch){
+    return is_precomputed[epoch % PRIVACY_BATCH_SIZE] &&
+           epoch == identities[epoch % PRIVACY_BATCH_SIZE].epoch;
+}
+
+/* Derive the identities of a batch of epochs from the current one once
+   fewer than half of them are left */
+static void precompute_identities(uint32_t epoch){
+    int number_of_identities = 0;
+    int i;
+
+    for(i = 0 ; i < PRIVACY_BATCH_SIZE ; i++){
+        if(has_identity(epoch + i)){
+            number_of_identities++;
+        }
+    }
+    if(number_of_identities >= PRIVACY_BATCH_SIZE / 2){
+        return;
+    }
+
+    for(i = 0 ; i < PRIVACY_BATCH_SIZE ; i++){
+        if(!has_identity(epoch + i)){
+            derive_private_identity(
+                privacy_key, epoch + i,
+                &identities[(epoch + i) % PRIVACY_BATCH_SIZE]);
+            is_precomputed[(epoch + i) % PRIVACY_BATCH_SIZE] = true;
+        }
+    }
+}
+
+static ErrorCode rotate_identity(uint32_t epoch){
+    PrivateIdentity *identity = &identities[epoch % PRIVACY_BATCH_SIZE];
+    AdvertisingPayload *payload = &g_advertising.payload;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    bdaddr_t address;
+
+    /* Only a step of the wall clock leaves the epoch without a
+       precomputed identity */
+    if(!has_identity(epoch)){
+        derive_private_identity(privacy_key, epoch, identity);
+        is_precomputed[epoch % PRIVACY_BATCH_SIZE] = true;
+    }
+
+    memcpy(&address, identity->address, sizeof(bdaddr_t));
+
+    TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+    set_payload_identity(payload, identity);
+    return_value = set_private_address(privacy_device_handle, &address);
+    pthread_mutex_unlock(&g_advertising.lock);
+
+    if(WORK_SUCCESSFULLY != return_value){
+        zlog_error(category_health_report,
+                   "Unable to rotate to the identity of epoch %u", epoch);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to rotate to the identity of epoch %u", epoch);
+#endif
+        return return_value;
+    }
+
+    pthread_mutex_lock(&address_lock);
+    memcpy(&private_address, &address, sizeof(bdaddr_t));
+    has_private_address = true;
+    pthread_mutex_unlock(&address_lock);
+
+#ifdef Debugging
+    zlog_info(category_debug, "Rotated to the identity of epoch %u", epoch);
+#endif
+
+    return WORK_SUCCESSFULLY;
+}
+
+/* Sleep until the given epoch starts. A failed rotation is retried after
+   one check interval. */
+static bool sleep_until_epoch(uint32_t epoch, bool is_retry){
+    struct timespec deadline;
+    struct timespec now;
+    uint64_t epoch_start_in_us =
+        (uint64_t)epoch * rotation_interval_in_seconds * 1000000ULL;
+    uint64_t now_in_us = 0;
+    uint64_t wakeup_in_us = 0;
+
+    while(true == ready_to_work){
+        clock_gettime(CLOCK_REALTIME, &now);
+        now_in_us = (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+        if(now_in_us >= epoch_start_in_us){
+            return true;
+        }
+
+        wakeup_in_us = epoch_start_in_us;
+        if(wakeup_in_us - now_in_us >
+           INTERVAL_FOR_BUSY_WAITING_CHECK_IN_MICRO_SECONDS){
+            wakeup_in_us = now_in_us +
+                           INTERVAL_FOR_BUSY_WAITING_CHECK_IN_MICRO_SECONDS;
+        }
+
+        deadline.tv_sec = wakeup_in_us / 1000000;
+        deadline.tv_nsec = (wakeup_in_us % 1000000) * 1000;
+        clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &deadline, NULL);
+        account_wakeup();
+
+        if(is_retry){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void *rotate_identities(void *argument){
+    uint32_t epoch = 0;
+    uint32_t active_epoch = initial_epoch;
+    bool has_active_epoch = has_initial_identity;
+
+    TRACE_THREAD_START();
+    set_energy_subsystem(SUBSYSTEM_PRIVACY);
+
+    while(true == ready_to_work){
+        epoch = get_current_epoch();
+
+        if(!has_active_epoch || epoch != active_epoch){
+            if(WORK_SUCCESSFULLY == rotate_identity(epoch)){
+                active_epoch = epoch;
+                has_active_epoch = true;
+            }
+        }
+
+        /* The batch is refilled after the rotation, off its path */
+        precompute_identities(epoch);
+
+        if(!sleep_until_epoch(epoch + 1, epoch != active_epoch)){
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static ErrorCode read_privacy_config(Config *config){
+    if(!parse_identity_key(config->privacy_key, privacy_key) ||
+       config->privacy_rotation_interval_in_seconds <
+       PRIVACY_MIN_ROTATION_INTERVAL_IN_SECONDS){
+        zlog_error(category_health_report,
+                   "Invalid privacy config");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Invalid privacy config");
+#endif
+        return E_ADVERTISE_MODE;
+    }
+    rotation_interval_in_seconds =
+        config->privacy_rotation_interval_in_seconds;
+
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode get_initial_identity(Config *config,
+                               PrivateIdentity *identity,
+                               bool *is_private){
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    *is_private = false;
+    has_initial_identity = false;
+
+    if(0 == strlen(config->privacy_key)){
+        return WORK_SUCCESSFULLY;
+    }
+
+    return_value = read_privacy_config(config);
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+
+    initial_epoch = get_current_epoch();
+    derive_private_identity(privacy_key, initial_epoch, identity);
+
+    pthread_mutex_lock(&address_lock);
+    memcpy(&private_address, identity->address, sizeof(bdaddr_t));
+    has_private_address = true;
+    pthread_mutex_unlock(&address_lock);
+
+    has_initial_identity = true;
+    *is_private = true;
+
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode start_privacy(Config *config){
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    int retry_time = 0;
+
+    if(0 == strlen(config->privacy_key)){
+        return WORK_SUCCESSFULLY;
+    }
+
+    return_value = read_privacy_config(config);
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+
+    retry_time = SOCKET_OPEN_RETRY;
+    while(retry_time--){
+        privacy_device_handle =
+            open_hci_device(g_advertising.dongle_device_id);
+
+        if(privacy_device_handle >= 0){
+            break;
+        }
+    }
+
+    if(privacy_device_handle < 0){
+        zlog_error(category_health_report,
+                   "Error openning socket for privacy");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Error openning socket for privacy");
+#endif
+        return E_OPEN_DEVICE;
+    }
+
+    memset(is_precomputed, 0, sizeof(is_precomputed));
+    precompute_identities(get_current_epoch());
+
+    zlog_info(category_health_report,
+              "Private identity rotated every %d s",
+              rotation_interval_in_seconds);
+
+    if(0 != pthread_create(&privacy_thread, NULL, rotate_identities, NULL)){
+        zlog_error(category_health_report,
+                   "Unable to start the thread of the privacy");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to start the thread of the privacy");
+#endif
+        stop_privacy();
+        return E_START_THREAD;
+    }
+    privacy_running = true;
+
+    return WORK_SUCCESSFULLY;
+}
+
+void stop_privacy(void){
+    if(privacy_running){
+        pthread_join(privacy_thread, NULL);
+        privacy_running = false;
+    }
+
+    if(privacy_device_handle >= 0){
+        close_hci_device(privacy_device_handle);
+        privacy_device_handle = -1;
+    }
+}
+
+bool get_private_address(bdaddr_t *address){
+    bool is_private = false;
+
+    pthread_mutex_lock(&address_lock);
+    is_private = has_private_address;
+    if(is_private){
+        memcpy(address, &private_address, sizeof(bdaddr_t));
+    }
+    pthread_mutex_unlock(&address_lock);
+
+    return is_private;
+}
@@ -0,0 +1,142 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of functions used by the Tag to
+    advertise with a rotating private identity.
+
+File Name:
+
+    Privacy.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    With a privacy key in the config the Tag advertises with the private
+    address of the current epoch instead of the public address of the
+    dongle, and masks the coordinates of the payload, so that the Tag
+    cannot be followed across epochs by anyone without its key. The
+    identities of the coming epochs are derived in batches by the privacy
+    thread ahead of time, and at an epoch boundary the rotation only hands
+    the precomputed address and advertising data to the dongle, with
+    advertising disabled for the few HCI commands of the rotation. See
+    Identity.h for the derivation and Resolver.h for the server side.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef PRIVACY_H
+#define PRIVACY_H
+
+#include <time.h>
+
+#include "Tag.h"
+#include "Identity.h"
+
+/*
+  CONSTANTS
+*/
+
+/* Number of epochs whose identities are kept precomputed. A new batch is
+   derived once fewer than half of them lie ahead. */
+#define PRIVACY_BATCH_SIZE 16
+
+/* Lower bound of the rotation interval in seconds */
+#define PRIVACY_MIN_ROTATION_INTERVAL_IN_SECONDS 60
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  get_initial_identity:
+
+      This function derives the private identity of the current epoch,
+      with which advertising is enabled, so that a Tag with a privacy key
+      never goes on the air with its public address or unmasked
+      coordinates. The privacy thread takes over from this epoch.
+
+  Parameters:
+
+      config - the pointer to the config struct of the Tag
+      identity - the identity to be filled
+      is_private - set to whether a privacy key is configured
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode get_initial_identity(Config *config,
+                               PrivateIdentity *identity,
+                               bool *is_private);
+
+/*
+  start_privacy:
+
+      This function derives the first batch of private identities and
+      starts the thread which rotates to the identity of the current epoch
+      and then at every epoch boundary. The epoch of get_initial_identity
+      is not rotated again. Nothing is started if no privacy key is
+      configured.
+
+  Parameters:
+
+      config - the pointer to the config struct of the Tag
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode start_privacy(Config *config);
+
+/*
+  stop_privacy:
+
+      This function waits for the privacy thread to notice that
+      ready_to_work is cleared. The Tag keeps advertising with the last
+      private identity.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      None
+*/
+
+void stop_privacy(void);
+
+/*
+  get_private_address:
+
+      This function returns the private address on the air.
+
+  Parameters:
+
+      address - the private address to be filled
+
+  Return value:
+
+      bool - false if the Tag advertises with the public address
+*/
+
+bool get_private_address(bdaddr_t *address);
+
+#endif
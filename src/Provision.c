@@ -0,0 +1,180 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used by the Tag and the provisioning
+      tool to read and write the provisioning bundle of a Tag.
+
+ File Name:
+
+      Provision.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Provision.h"
+
+static const char hexadecimal_digits[] = "0123456789ABCDEF";
+
+/* The bundle is checked by itself, without the CRC of State.c, which
+   needs the headers of the Tag */
+static uint32_t get_crc32(const uint8_t *data, int length){
+    uint32_t crc = 0xFFFFFFFF;
+    int i, j;
+
+    for(i = 0 ; i < length ; i++){
+        crc ^= data[i];
+        for(j = 0 ; j < 8 ; j++){
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+static void put_little_endian(uint8_t *data, uint32_t value, int length){
+    int i;
+
+    for(i = 0 ; i < length ; i++){
+        data[i] = value >> (8 * i);
+    }
+}
+
+static uint32_t get_little_endian(const uint8_t *data, int length){
+    uint32_t value = 0;
+    int i;
+
+    for(i = 0 ; i < length ; i++){
+        value |= (uint32_t)data[i] << (8 * i);
+    }
+
+    return value;
+}
+
+static void format_hexadecimal(const uint8_t *data, int length, char *text){
+    int i;
+
+    for(i = 0 ; i < length ; i++){
+        text[2 * i] = hexadecimal_digits[data[i] >> 4];
+        text[2 * i + 1] = hexadecimal_digits[data[i] & 0x0F];
+    }
+    text[2 * length] = '\0';
+}
+
+void encode_provision_bundle(ProvisionRecord *record, uint8_t *bundle){
+    uint8_t *data = bundle + PROVISION_HEADER_SIZE;
+
+    put_little_endian(data, record->serial_number, 4);
+    memcpy(data + 4, record->address, PROVISION_ADDRESS_LENGTH);
+    put_little_endian(data + 10, (uint16_t)record->sync_slot_index, 2);
+    memcpy(data + 12, record->uuid, PROVISION_UUID_LENGTH);
+    memcpy(data + 28, record->key, PROVISION_KEY_LENGTH);
+
+    put_little_endian(bundle, PROVISION_MAGIC, 4);
+    put_little_endian(bundle + 4, PROVISION_VERSION, 2);
+    put_little_endian(bundle + 6, PROVISION_RECORD_SIZE, 2);
+    put_little_endian(bundle + 8, get_crc32(data, PROVISION_RECORD_SIZE), 4);
+}
+
+bool decode_provision_bundle(uint8_t *bundle,
+                             int length,
+                             ProvisionRecord *record){
+    uint8_t *data = bundle + PROVISION_HEADER_SIZE;
+
+    if(length != PROVISION_BUNDLE_SIZE ||
+       PROVISION_MAGIC != get_little_endian(bundle, 4) ||
+       PROVISION_VERSION != get_little_endian(bundle + 4, 2) ||
+       PROVISION_RECORD_SIZE != get_little_endian(bundle + 6, 2) ||
+       get_crc32(data, PROVISION_RECORD_SIZE) !=
+       get_little_endian(bundle + 8, 4)){
+        return false;
+    }
+
+    record->serial_number = get_little_endian(data, 4);
+    memcpy(record->address, data + 4, PROVISION_ADDRESS_LENGTH);
+    record->sync_slot_index = (int16_t)get_little_endian(data + 10, 2);
+    memcpy(record->uuid, data + 12, PROVISION_UUID_LENGTH);
+    memcpy(record->key, data + 28, PROVISION_KEY_LENGTH);
+
+    return true;
+}
+
+bool read_provision_bundle(char *path, ProvisionRecord *record){
+    /* One byte more than a bundle, so that a longer file is refused */
+    uint8_t bundle[PROVISION_BUNDLE_SIZE + 1];
+    ssize_t received = 0;
+    int length = 0;
+    int file = -1;
+
+    file = open(path, O_RDONLY | O_CLOEXEC);
+    if(file < 0){
+        return false;
+    }
+
+    while(length < sizeof(bundle)){
+        received = read(file, bundle + length, sizeof(bundle) - length);
+        if(received <= 0){
+            break;
+        }
+        length += received;
+    }
+
+    close(file);
+
+    return received >= 0 && decode_provision_bundle(bundle, length, record);
+}
+
+bool write_provision_bundle(char *path, ProvisionRecord *record){
+    uint8_t bundle[PROVISION_BUNDLE_SIZE];
+    bool is_written = false;
+    int file = -1;
+
+    encode_provision_bundle(record, bundle);
+
+    file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                PROVISION_FILE_MODE);
+    if(file < 0){
+        return false;
+    }
+
+    /* The bundle holds the privacy key, and a replaced file keeps the
+       mode it was created with */
+    if(-1 == fchmod(file, PROVISION_FILE_MODE)){
+        close(file);
+        return false;
+    }
+
+    is_written = write(file, bundle, sizeof(bundle)) == sizeof(bundle);
+
+    return 0 == close(file) && is_written;
+}
+
+void format_provision_uuid(ProvisionRecord *record, char *uuid){
+    format_hexadecimal(record->uuid, PROVISION_UUID_LENGTH, uuid);
+}
+
+void format_provision_key(ProvisionRecord *record, char *key){
+    format_hexadecimal(record->key, PROVISION_KEY_LENGTH, key);
+}
+
+void format_provision_address(uint8_t *address, char *text){
+    snprintf(text, PROVISION_ADDRESS_TEXT_LENGTH,
+             "%02X:%02X:%02X:%02X:%02X:%02X",
+             address[5], address[4], address[3],
+             address[2], address[1], address[0]);
+}
@@ -0,0 +1,240 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag and by the provisioning tool to read and write the
+    provisioning bundle of a Tag.
+
+File Name:
+
+    Provision.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    The provisioning bundle holds what differs between the tags of a
+    fleet: the static BD address set by change_mac.sh, the LBeacon UUID
+    with the coordinates of the Tag, the privacy key and the sync slot.
+    The config file stays the same on every Tag, and provision_bundle in
+    the config names the bundle of the Tag.
+
+    A bundle is a header of the magic number, the version, the length of
+    the record and the CRC-32 of the record, followed by the record. All
+    integers are little endian. The static address starts at byte
+    PROVISION_ADDRESS_OFFSET of the file, least significant byte first,
+    so that change_mac.sh reads it with od. This file depends on no
+    library and never allocates, so that it is linked into the Tag, also
+    into the minimal build, and into the provisioning tool as it is.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef PROVISION_H
+#define PROVISION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+  CONSTANTS
+*/
+
+/* The magic number of a bundle, "TPRV" in the file */
+#define PROVISION_MAGIC 0x56525054
+
+#define PROVISION_VERSION 1
+
+/* Length in bytes of the header and of the record of a bundle */
+#define PROVISION_HEADER_SIZE 12
+#define PROVISION_RECORD_SIZE 44
+#define PROVISION_BUNDLE_SIZE (PROVISION_HEADER_SIZE + PROVISION_RECORD_SIZE)
+
+/* Offset of the static address in a bundle */
+#define PROVISION_ADDRESS_OFFSET (PROVISION_HEADER_SIZE + 4)
+
+/* Length in bytes of a BD address, of the UUID and of the privacy key */
+#define PROVISION_ADDRESS_LENGTH 6
+#define PROVISION_UUID_LENGTH 16
+#define PROVISION_KEY_LENGTH 16
+
+/* Length of the text of a BD address with its terminator */
+#define PROVISION_ADDRESS_TEXT_LENGTH 18
+
+/* Mode of the files holding privacy keys, which only their owner may
+   read */
+#define PROVISION_FILE_MODE 0600
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The record of a Tag */
+typedef struct ProvisionRecord {
+
+    uint32_t serial_number;
+
+    /* The static BD address, least significant byte first like
+       bdaddr_t */
+    uint8_t address[PROVISION_ADDRESS_LENGTH];
+
+    /* The slot in the frame of the sync beacon, or -1 to keep the
+       config */
+    int16_t sync_slot_index;
+
+    /* The LBeacon UUID, whose bytes 6 to 9 and 12 to 15 are the X and Y
+       coordinates of the payload */
+    uint8_t uuid[PROVISION_UUID_LENGTH];
+
+    uint8_t key[PROVISION_KEY_LENGTH];
+
+} ProvisionRecord;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  encode_provision_bundle:
+
+      This function encodes a record into a bundle.
+
+  Parameters:
+
+      record - the record
+      bundle - the buffer of PROVISION_BUNDLE_SIZE bytes to be filled
+
+  Return value:
+
+      None
+*/
+
+void encode_provision_bundle(ProvisionRecord *record, uint8_t *bundle);
+
+/*
+  decode_provision_bundle:
+
+      This function decodes a bundle and checks its header and checksum.
+
+  Parameters:
+
+      bundle - the bundle
+      length - the length of the bundle
+      record - the record to be filled
+
+  Return value:
+
+      bool - true if the bundle is valid, or false otherwise
+*/
+
+bool decode_provision_bundle(uint8_t *bundle,
+                             int length,
+                             ProvisionRecord *record);
+
+/*
+  read_provision_bundle:
+
+      This function reads and decodes the bundle in a file.
+
+  Parameters:
+
+      path - the path of the bundle
+      record - the record to be filled
+
+  Return value:
+
+      bool - true if the file holds a valid bundle, or false otherwise
+*/
+
+bool read_provision_bundle(char *path, ProvisionRecord *record);
+
+/*
+  write_provision_bundle:
+
+      This function encodes a record and writes it to a file.
+
+  Parameters:
+
+      path - the path of the bundle, which is replaced if it exists and
+             left with PROVISION_FILE_MODE
+      record - the record
+
+  Return value:
+
+      bool - true on success, or false otherwise
+*/
+
+bool write_provision_bundle(char *path, ProvisionRecord *record);
+
+/*
+  format_provision_uuid:
+
+      This function formats the UUID of a record as the 32 hexadecimal
+      digits of lbeacon_uuid.
+
+  Parameters:
+
+      record - the record
+      uuid - the buffer of 2 * PROVISION_UUID_LENGTH + 1 bytes to be
+             filled
+
+  Return value:
+
+      None
+*/
+
+void format_provision_uuid(ProvisionRecord *record, char *uuid);
+
+/*
+  format_provision_key:
+
+      This function formats the privacy key of a record as the 32
+      hexadecimal digits of privacy_key in the config.
+
+  Parameters:
+
+      record - the record
+      key - the buffer of 2 * PROVISION_KEY_LENGTH + 1 bytes to be filled
+
+  Return value:
+
+      None
+*/
+
+void format_provision_key(ProvisionRecord *record, char *key);
+
+/*
+  format_provision_address:
+
+      This function formats a BD address, most significant byte first.
+
+  Parameters:
+
+      address - the address, least significant byte first
+      text - the buffer of PROVISION_ADDRESS_TEXT_LENGTH bytes to be filled
+
+  Return value:
+
+      None
+*/
+
+void format_provision_address(uint8_t *address, char *text);
+
+#endif
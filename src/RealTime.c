@@ -0,0 +1,205 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used by the Tag to run with real-time
+      scheduling and to measure the jitter of its timer wakeups.
+
+ File Name:
+
+      RealTime.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "RealTime.h"
+#include "Energy.h"
+
+#define Debugging
+
+/* Touch the stack in advance, so that the pages are mapped and locked by
+   mlockall before the real-time path needs them */
+static void prefault_stack(void){
+    unsigned char stack[PREFAULT_STACK_SIZE];
+    /* Written through a volatile pointer, so that the stores are kept
+       although the array is never read */
+    volatile unsigned char *page = stack;
+    long page_size = sysconf(_SC_PAGESIZE);
+    int i;
+
+    if(page_size <= 0){
+        page_size = PREFAULT_STACK_SIZE;
+    }
+
+    for(i = 0 ; i < PREFAULT_STACK_SIZE ; i += page_size){
+        page[i] = 0;
+    }
+}
+
+ErrorCode enable_realtime_mode(int priority, int cpu){
+    struct sched_param parameter;
+    cpu_set_t cpu_set;
+
+    memset(&parameter, 0, sizeof(parameter));
+    parameter.sched_priority = priority;
+
+    if(-1 == sched_setscheduler(0, SCHED_FIFO, &parameter)){
+        zlog_error(category_health_report,
+                   "Unable to set SCHED_FIFO priority %d: %s",
+                   priority, strerror(errno));
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to set SCHED_FIFO priority %d: %s",
+                   priority, strerror(errno));
+#endif
+        return E_ADVERTISE_MODE;
+    }
+
+    if(-1 == mlockall(MCL_CURRENT | MCL_FUTURE)){
+        zlog_error(category_health_report,
+                   "Unable to lock memory: %s", strerror(errno));
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to lock memory: %s", strerror(errno));
+#endif
+        return E_ADVERTISE_MODE;
+    }
+
+    if(cpu >= 0){
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+
+        if(-1 == sched_setaffinity(0, sizeof(cpu_set), &cpu_set)){
+            zlog_error(category_health_report,
+                       "Unable to pin to CPU %d: %s", cpu, strerror(errno));
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "Unable to pin to CPU %d: %s", cpu, strerror(errno));
+#endif
+            return E_ADVERTISE_MODE;
+        }
+    }
+
+    prefault_stack();
+
+    return WORK_SUCCESSFULLY;
+}
+
+void wait_for_next_period(struct timespec *deadline,
+                          long period_in_micro_seconds,
+                          JitterHistogram *histogram){
+    struct timespec now;
+    long latency_in_micro_seconds = 0;
+
+    while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                   deadline, NULL)){
+        /* A signal such as SIGINT ends the wait early */
+        if(false == ready_to_work){
+            break;
+        }
+    }
+    account_wakeup();
+
+    if(NULL != histogram){
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        latency_in_micro_seconds =
+            ((now.tv_sec - deadline->tv_sec) * NANO_SECONDS_PER_SECOND +
+             (now.tv_nsec - deadline->tv_nsec)) / 1000;
+        if(latency_in_micro_seconds < 0){
+            latency_in_micro_seconds = 0;
+        }
+
+        if(latency_in_micro_seconds < JITTER_HISTOGRAM_BUCKETS){
+            histogram->buckets[latency_in_micro_seconds]++;
+        }else{
+            histogram->overflow++;
+        }
+        if(latency_in_micro_seconds > histogram->max_latency_in_micro_seconds){
+            histogram->max_latency_in_micro_seconds = latency_in_micro_seconds;
+        }
+        histogram->sum_latency_in_micro_seconds += latency_in_micro_seconds;
+        histogram->number_of_samples++;
+    }
+
+    deadline->tv_nsec += period_in_micro_seconds * 1000;
+    while(deadline->tv_nsec >= NANO_SECONDS_PER_SECOND){
+        deadline->tv_nsec -= NANO_SECONDS_PER_SECOND;
+        deadline->tv_sec++;
+    }
+}
+
+void measure_wakeup_jitter(int number_of_loops, JitterHistogram *histogram){
+    struct timespec deadline;
+    int i;
+
+    memset(histogram, 0, sizeof(*histogram));
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec++;
+
+    for(i = 0 ; i < number_of_loops && true == ready_to_work ; i++){
+        wait_for_next_period(&deadline,
+                             JITTER_PROBE_PERIOD_IN_MICRO_SECONDS,
+                             histogram);
+    }
+}
+
+long jitter_percentile(JitterHistogram *histogram, double fraction){
+    long threshold = histogram->number_of_samples * fraction;
+    long count = 0;
+    long i;
+
+    for(i = 0 ; i < JITTER_HISTOGRAM_BUCKETS ; i++){
+        count += histogram->buckets[i];
+        if(count > threshold){
+            return i;
+        }
+    }
+
+    return JITTER_HISTOGRAM_BUCKETS;
+}
+
+void print_jitter_histogram(char *label, JitterHistogram *histogram){
+    long i;
+
+    if(0 == histogram->number_of_samples){
+        printf("%s: no samples\n", label);
+        return;
+    }
+
+    printf("%s: samples %ld avg %lld us p50 %ld us p99 %ld us "
+           "p99.9 %ld us max %ld us\n",
+           label,
+           histogram->number_of_samples,
+           histogram->sum_latency_in_micro_seconds /
+               histogram->number_of_samples,
+           jitter_percentile(histogram, 0.5),
+           jitter_percentile(histogram, 0.99),
+           jitter_percentile(histogram, 0.999),
+           histogram->max_latency_in_micro_seconds);
+
+    for(i = 0 ; i < JITTER_HISTOGRAM_BUCKETS ; i++){
+        if(histogram->buckets[i]){
+            printf("%s %06ld %ld\n", label, i, histogram->buckets[i]);
+        }
+    }
+    if(histogram->overflow){
+        printf("%s overflow %ld\n", label, histogram->overflow);
+    }
+}
@@ -0,0 +1,195 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to run with real-time scheduling and to measure the jitter
+    of its timer wakeups.
+
+File Name:
+
+    RealTime.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    On gateways that run other load next to the Tag, the real-time mode
+    raises the Tag to SCHED_FIFO, locks its memory, pins it to a CPU and
+    prefaults its stack. The cyclictest-style probe records how late the
+    timer wakeups of the Tag are, in normal and in real-time mode.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+/* sched_setaffinity and the CPU_* macros are GNU extensions */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "Tag.h"
+
+/*
+  CONSTANTS
+*/
+
+/* Number of bytes of stack touched in advance so that page faults do not
+   happen on the real-time path */
+#define PREFAULT_STACK_SIZE (64 * 1024)
+
+/* Number of 1 us buckets of the wakeup jitter histogram. Wakeups later than
+   the last bucket are counted as overflow. */
+#define JITTER_HISTOGRAM_BUCKETS 1000
+
+/* Period in micro seconds of the timer used by the jitter probe */
+#define JITTER_PROBE_PERIOD_IN_MICRO_SECONDS 1000
+
+/* Priority used by the jitter probe when real-time mode is not configured */
+#define DEFAULT_REALTIME_PRIORITY 80
+
+/* Number of nano seconds in one second */
+#define NANO_SECONDS_PER_SECOND 1000000000L
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The histogram of how late timer wakeups are */
+typedef struct JitterHistogram {
+
+    /* Number of wakeups in each 1 us bucket of lateness */
+    long buckets[JITTER_HISTOGRAM_BUCKETS];
+
+    /* Number of wakeups later than the last bucket */
+    long overflow;
+
+    long number_of_samples;
+
+    long max_latency_in_micro_seconds;
+
+    long long sum_latency_in_micro_seconds;
+
+} JitterHistogram;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  enable_realtime_mode:
+
+      This function switches the calling process to SCHED_FIFO with the
+      specified priority, locks its current and future memory, pins it to
+      the specified CPU and prefaults its stack.
+
+  Parameters:
+
+      priority - the SCHED_FIFO priority
+      cpu - the CPU to which the process is pinned, or a negative value to
+            keep the current affinity
+
+  Return value:
+
+      ErrorCode - E_ADVERTISE_MODE if the process cannot be switched to
+                  real-time mode, or WORK_SUCCESSFULLY otherwise
+*/
+
+ErrorCode enable_realtime_mode(int priority, int cpu);
+
+/*
+  wait_for_next_period:
+
+      This function sleeps until the absolute deadline, records how late
+      the wakeup is into the histogram, and advances the deadline by one
+      period.
+
+  Parameters:
+
+      deadline - the absolute CLOCK_MONOTONIC deadline of the wakeup
+      period_in_micro_seconds - the period of the timer
+      histogram - the histogram of wakeup jitter, or NULL
+
+  Return value:
+
+      None
+*/
+
+void wait_for_next_period(struct timespec *deadline,
+                          long period_in_micro_seconds,
+                          JitterHistogram *histogram);
+
+/*
+  measure_wakeup_jitter:
+
+      This function runs a cyclictest-style probe, i.e., it wakes up
+      periodically on an absolute timer and records how late each wakeup
+      is into the histogram.
+
+  Parameters:
+
+      number_of_loops - the number of wakeups to measure
+      histogram - the histogram of wakeup jitter
+
+  Return value:
+
+      None
+*/
+
+void measure_wakeup_jitter(int number_of_loops, JitterHistogram *histogram);
+
+/*
+  print_jitter_histogram:
+
+      This function prints the summary and the non-empty buckets of the
+      histogram to the standard output.
+
+  Parameters:
+
+      label - the name of the measurement
+      histogram - the histogram of wakeup jitter
+
+  Return value:
+
+      None
+*/
+
+void print_jitter_histogram(char *label, JitterHistogram *histogram);
+
+/*
+  jitter_percentile:
+
+      This function returns the wakeup latency below which the specified
+      fraction of wakeups falls.
+
+  Parameters:
+
+      histogram - the histogram of wakeup jitter
+      fraction - the fraction between 0 and 1
+
+  Return value:
+
+      long - the latency in micro seconds, or JITTER_HISTOGRAM_BUCKETS if
+             the percentile falls into the overflow
+*/
+
+long jitter_percentile(JitterHistogram *histogram, double fraction);
+
+#endif
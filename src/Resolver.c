@@ -0,0 +1,283 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs of the resolver library, which
+      resolves the private addresses of tags on the server.
+
+ File Name:
+
+      Resolver.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Resolver.h"
+
+static uint64_t pack_address(uint8_t *address){
+    uint64_t value = 0;
+    int i;
+
+    for(i = 0 ; i < IDENTITY_ADDRESS_LENGTH ; i++){
+        value |= (uint64_t)address[i] << (8 * i);
+    }
+
+    return value;
+}
+
+/* The private addresses are outputs of the PRF, so the multiplication only
+   spreads the two fixed type bits */
+static size_t get_home_index(Resolver *resolver, uint64_t address){
+    return (address * 0x9E3779B97F4A7C15ULL >> 32) &
+           (resolver->table_size - 1);
+}
+
+static PrivateIdentity *get_identity(Resolver *resolver,
+                                     int tag_index,
+                                     int epoch_slot){
+    return &resolver->identities[tag_index * RESOLVER_NUMBER_OF_EPOCHS +
+                                 epoch_slot];
+}
+
+static bool parse_public_address(char *text, uint8_t *address){
+    unsigned int bytes[IDENTITY_ADDRESS_LENGTH];
+    int i;
+
+    if(IDENTITY_ADDRESS_LENGTH != sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x",
+                                         &bytes[5], &bytes[4], &bytes[3],
+                                         &bytes[2], &bytes[1], &bytes[0])){
+        return false;
+    }
+    for(i = 0 ; i < IDENTITY_ADDRESS_LENGTH ; i++){
+        address[i] = bytes[i];
+    }
+
+    return true;
+}
+
+int load_resolver_tags(char *path, ResolverTag **tags){
+    char line[RESOLVER_LINE_LENGTH];
+    char address[RESOLVER_LINE_LENGTH];
+    char key[RESOLVER_LINE_LENGTH];
+    ResolverTag *resized = NULL;
+    int number_of_tags = 0;
+    int capacity = 0;
+    FILE *file = NULL;
+
+    *tags = NULL;
+
+    file = fopen(path, "r");
+    if(NULL == file){
+        return -1;
+    }
+
+    while(NULL != fgets(line, sizeof(line), file)){
+        if('#' == line[0] || 2 != sscanf(line, "%s %s", address, key)){
+            continue;
+        }
+
+        if(number_of_tags == capacity){
+            capacity = capacity ? 2 * capacity : 1024;
+            resized = realloc(*tags, capacity * sizeof(ResolverTag));
+            if(NULL == resized){
+                number_of_tags = -1;
+                break;
+            }
+            *tags = resized;
+        }
+
+        if(!parse_public_address(address,
+                                 (*tags)[number_of_tags].public_address) ||
+           !parse_identity_key(key, (*tags)[number_of_tags].key)){
+            number_of_tags = -1;
+            break;
+        }
+        number_of_tags++;
+    }
+
+    fclose(file);
+
+    if(number_of_tags < 0){
+        free(*tags);
+        *tags = NULL;
+    }
+
+    return number_of_tags;
+}
+
+static void insert_entry(Resolver *resolver, int tag_index, int epoch_slot){
+    PrivateIdentity *identity = get_identity(resolver, tag_index, epoch_slot);
+    uint64_t address = pack_address(identity->address);
+    size_t index = get_home_index(resolver, address);
+
+    while(resolver->entries[index].tag_index >= 0){
+        index = (index + 1) & (resolver->table_size - 1);
+    }
+
+    resolver->entries[index].address = address;
+    resolver->entries[index].tag_index = tag_index;
+    resolver->entries[index].epoch_slot = epoch_slot;
+}
+
+/* Derive the identities of the epochs around the epoch which are not
+   precomputed yet, and rebuild the index */
+static void index_epochs(Resolver *resolver, uint32_t epoch){
+    PrivateIdentity *identity = NULL;
+    uint32_t indexed_epoch = 0;
+    size_t index = 0;
+    int tag_index = 0;
+    int epoch_slot = 0;
+    int i;
+
+    for(i = 0 ; i < RESOLVER_NUMBER_OF_EPOCHS ; i++){
+        indexed_epoch = epoch - 1 + i;
+        epoch_slot = indexed_epoch % RESOLVER_NUMBER_OF_EPOCHS;
+
+        for(tag_index = 0 ; tag_index < resolver->number_of_tags ;
+            tag_index++){
+            identity = get_identity(resolver, tag_index, epoch_slot);
+            if(0 == resolver->epoch || identity->epoch != indexed_epoch){
+                derive_private_identity(resolver->tags[tag_index].key,
+                                        indexed_epoch, identity);
+            }
+        }
+    }
+
+    for(index = 0 ; index < resolver->table_size ; index++){
+        resolver->entries[index].tag_index = -1;
+    }
+    for(tag_index = 0 ; tag_index < resolver->number_of_tags ; tag_index++){
+        for(epoch_slot = 0 ; epoch_slot < RESOLVER_NUMBER_OF_EPOCHS ;
+            epoch_slot++){
+            insert_entry(resolver, tag_index, epoch_slot);
+        }
+    }
+
+    resolver->epoch = epoch;
+}
+
+int init_resolver(Resolver *resolver,
+                  ResolverTag *tags,
+                  int number_of_tags,
+                  int rotation_interval_in_seconds,
+                  time_t now){
+    size_t number_of_addresses = 0;
+
+    memset(resolver, 0, sizeof(Resolver));
+
+    if(number_of_tags <= 0 || rotation_interval_in_seconds <= 0){
+        return -1;
+    }
+
+    resolver->tags = tags;
+    resolver->number_of_tags = number_of_tags;
+    resolver->rotation_interval_in_seconds = rotation_interval_in_seconds;
+
+    number_of_addresses =
+        (size_t)number_of_tags * RESOLVER_NUMBER_OF_EPOCHS;
+    resolver->table_size = 1;
+    while(resolver->table_size < 2 * number_of_addresses){
+        resolver->table_size *= 2;
+    }
+
+    resolver->identities = calloc(number_of_addresses,
+                                  sizeof(PrivateIdentity));
+    resolver->entries = calloc(resolver->table_size, sizeof(ResolverEntry));
+    if(NULL == resolver->identities || NULL == resolver->entries){
+        free_resolver(resolver);
+        return -1;
+    }
+
+    index_epochs(resolver,
+                 get_identity_epoch(now, rotation_interval_in_seconds));
+
+    return 0;
+}
+
+void update_resolver(Resolver *resolver, time_t now){
+    uint32_t epoch =
+        get_identity_epoch(now, resolver->rotation_interval_in_seconds);
+
+    if(epoch != resolver->epoch){
+        index_epochs(resolver, epoch);
+    }
+}
+
+int resolve_private_address(Resolver *resolver,
+                            uint8_t *address,
+                            uint8_t *coordinates,
+                            uint32_t *epoch){
+    uint64_t packed_address = pack_address(address);
+    size_t index = get_home_index(resolver, packed_address);
+    ResolverEntry *entry = NULL;
+    PrivateIdentity *identity = NULL;
+    int i;
+
+    while(resolver->entries[index].tag_index >= 0){
+        entry = &resolver->entries[index];
+
+        if(entry->address == packed_address){
+            identity = get_identity(resolver, entry->tag_index,
+                                    entry->epoch_slot);
+            if(NULL != coordinates){
+                for(i = 0 ; i < IDENTITY_COORDINATES_LENGTH ; i++){
+                    coordinates[i] ^= identity->coordinate_mask[i];
+                }
+            }
+            if(NULL != epoch){
+                *epoch = identity->epoch;
+            }
+            return entry->tag_index;
+        }
+
+        index = (index + 1) & (resolver->table_size - 1);
+    }
+
+    return -1;
+}
+
+int unmask_private_fields(Resolver *resolver,
+                          int tag_index,
+                          uint32_t epoch,
+                          uint8_t *fields){
+    PrivateIdentity *identity = NULL;
+    int i;
+
+    if(tag_index < 0 || tag_index >= resolver->number_of_tags){
+        return -1;
+    }
+
+    identity = get_identity(resolver, tag_index,
+                            epoch % RESOLVER_NUMBER_OF_EPOCHS);
+    if(identity->epoch != epoch){
+        return -1;
+    }
+
+    for(i = 0 ; i < IDENTITY_FIELDS_LENGTH ; i++){
+        fields[i] ^= identity->field_mask[i];
+    }
+
+    return 0;
+}
+
+void free_resolver(Resolver *resolver){
+    free(resolver->identities);
+    free(resolver->entries);
+    resolver->identities = NULL;
+    resolver->entries = NULL;
+}
@@ -0,0 +1,251 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions of the
+    resolver library, which the server links to resolve the private
+    addresses of tags to their public addresses.
+
+File Name:
+
+    Resolver.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    The resolver holds the keys of all tags, read from a key file with one
+    tag per line: the public BD address and the key in 32 hexadecimal
+    digits. For every tag it precomputes the private identities of the
+    previous, the current and the next epoch, which covers the skew of
+    the clocks of the tags and the server around an epoch boundary, and
+    indexes their private addresses in a table with open addressing. A
+    private address is resolved by one lookup, whatever the number of
+    tags. When the epoch advances only the identities of the new epoch are
+    derived, and the index is rebuilt from the precomputed addresses. The
+    library depends on Identity.c only, not on BlueZ or zlog.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "Identity.h"
+
+/*
+  CONSTANTS
+*/
+
+/* Number of epochs indexed around the current epoch of the server */
+#define RESOLVER_NUMBER_OF_EPOCHS 3
+
+/* Maximum length of a line of the key file */
+#define RESOLVER_LINE_LENGTH 128
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* A Tag known to the resolver */
+typedef struct ResolverTag {
+
+    /* The public BD address, least significant byte first like
+       bdaddr_t */
+    uint8_t public_address[IDENTITY_ADDRESS_LENGTH];
+
+    uint8_t key[IDENTITY_KEY_LENGTH];
+
+} ResolverTag;
+
+/* An entry of the index */
+typedef struct ResolverEntry {
+
+    /* The private address in the 48 low bits */
+    uint64_t address;
+
+    /* The index of the Tag, or -1 if the entry is free */
+    int tag_index;
+
+    /* The slot of the epoch in the precomputed identities */
+    int epoch_slot;
+
+} ResolverEntry;
+
+/* The resolver */
+typedef struct Resolver {
+
+    ResolverTag *tags;
+
+    int number_of_tags;
+
+    int rotation_interval_in_seconds;
+
+    /* The current epoch, or 0 before the first update */
+    uint32_t epoch;
+
+    /* The identities of every Tag, RESOLVER_NUMBER_OF_EPOCHS per Tag and
+       indexed by the epoch modulo RESOLVER_NUMBER_OF_EPOCHS */
+    PrivateIdentity *identities;
+
+    /* The index, a power of two of at least twice the number of indexed
+       addresses */
+    ResolverEntry *entries;
+
+    size_t table_size;
+
+} Resolver;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  load_resolver_tags:
+
+      This function reads the key file. Empty lines and lines starting
+      with # are skipped.
+
+  Parameters:
+
+      path - the path of the key file
+      tags - the array of tags to be allocated and filled, which the caller
+             frees
+
+  Return value:
+
+      int - the number of tags, or -1 if the file cannot be read or holds
+            a malformed line
+*/
+
+int load_resolver_tags(char *path, ResolverTag **tags);
+
+/*
+  init_resolver:
+
+      This function allocates the precomputed identities and the index of
+      the resolver for the given tags, and indexes the epochs around the
+      given time.
+
+  Parameters:
+
+      resolver - the resolver
+      tags - the tags, which must outlive the resolver
+      number_of_tags - the number of tags
+      rotation_interval_in_seconds - the rotation interval of the tags
+      now - the seconds since the Unix epoch
+
+  Return value:
+
+      int - 0 on success, or -1 if the arguments are invalid or memory is
+            exhausted
+*/
+
+int init_resolver(Resolver *resolver,
+                  ResolverTag *tags,
+                  int number_of_tags,
+                  int rotation_interval_in_seconds,
+                  time_t now);
+
+/*
+  update_resolver:
+
+      This function advances the index to the epoch of the given time.
+      Nothing is done within the current epoch.
+
+  Parameters:
+
+      resolver - the resolver
+      now - the seconds since the Unix epoch
+
+  Return value:
+
+      None
+*/
+
+void update_resolver(Resolver *resolver, time_t now);
+
+/*
+  resolve_private_address:
+
+      This function looks a private address up in the index, and unmasks
+      the coordinates received with it.
+
+  Parameters:
+
+      resolver - the resolver
+      address - the private address, least significant byte first
+      coordinates - the coordinates received with the address, which are
+                    unmasked in place, or NULL
+      epoch - the epoch of the private address to be filled, or NULL
+
+  Return value:
+
+      int - the index of the Tag, or -1 if the address belongs to no Tag in
+            the indexed epochs
+*/
+
+int resolve_private_address(Resolver *resolver,
+                            uint8_t *address,
+                            uint8_t *coordinates,
+                            uint32_t *epoch);
+
+/*
+  unmask_private_fields:
+
+      This function unmasks the measured power, major, minor and sensor
+      summary received from a Tag resolved in an indexed epoch.
+
+  Parameters:
+
+      resolver - the resolver
+      tag_index - the index of the Tag returned by resolve_private_address
+      epoch - the epoch returned by resolve_private_address
+      fields - the IDENTITY_FIELDS_LENGTH bytes received, in the order of
+               the default payload template, which are unmasked in place
+
+  Return value:
+
+      int - 0 on success, or -1 if the epoch is no longer indexed
+*/
+
+int unmask_private_fields(Resolver *resolver,
+                          int tag_index,
+                          uint32_t epoch,
+                          uint8_t *fields);
+
+/*
+  free_resolver:
+
+      This function frees the precomputed identities and the index.
+
+  Parameters:
+
+      resolver - the resolver
+
+  Return value:
+
+      None
+*/
+
+void free_resolver(Resolver *resolver);
+
+#endif
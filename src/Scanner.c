@@ -0,0 +1,453 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs executed by the loopback scanner of
+      the Tag, which verifies from the box itself that the Tag is on the
+      air at the configured advertising interval.
+
+ File Name:
+
+      Scanner.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Scanner.h"
+#include "State.h"
+#include "Energy.h"
+#include "Privacy.h"
+
+#define Debugging
+
+/* HCI socket of the scanner dongle */
+static int scanner_device_handle = -1;
+
+static bdaddr_t tag_identity;
+
+static int report_interval_in_seconds = 0;
+
+static pthread_t scanner_thread;
+
+static bool scanner_running = false;
+
+static uint64_t get_time_in_ns(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+bool parse_tag_report(le_advertising_info *info,
+                      bdaddr_t *identity,
+                      int *sequence_number){
+    int offset = 0;
+
+    if(0 != memcmp(&info->bdaddr, identity, sizeof(bdaddr_t))){
+        return false;
+    }
+
+    /* The Tag lays out its advertising data by the compiled template, so
+       the fixed bytes, such as the manufacturer specific data with the
+       company identifier 0x000F of the default template, are checked at
+       their offsets before the sequence number is read from its slot */
+    if(!match_payload_template(&g_payload_template,
+                               info->data,
+                               info->length)){
+        return false;
+    }
+
+    *sequence_number = -1;
+    offset = find_payload_slot(&g_payload_template, PAYLOAD_SLOT_SEQUENCE);
+    if(offset >= 0 && offset < info->length){
+        *sequence_number = info->data[offset];
+    }
+
+    return true;
+}
+
+void record_tag_packet(ScannerStatistics *statistics,
+                       uint64_t reception_time_in_ns,
+                       int rssi){
+    uint64_t arrival_in_ms = 0;
+
+    if(0 == statistics->number_of_packets){
+        statistics->rssi_min = rssi;
+        statistics->rssi_max = rssi;
+    }
+    statistics->number_of_packets++;
+    statistics->rssi_sum += rssi;
+    if(rssi < statistics->rssi_min){
+        statistics->rssi_min = rssi;
+    }
+    if(rssi > statistics->rssi_max){
+        statistics->rssi_max = rssi;
+    }
+
+    /* The same advertising event is received on more than one channel when
+       the scanner changes channel in the middle of the event */
+    if(0 != statistics->last_event_time_in_ns){
+        arrival_in_ms = (reception_time_in_ns -
+                         statistics->last_event_time_in_ns) / 1000000;
+        if(arrival_in_ms < SCANNER_EVENT_GAP_IN_MILLI_SECONDS){
+            return;
+        }
+
+        if(arrival_in_ms / SCANNER_BUCKET_IN_MILLI_SECONDS <
+           SCANNER_NUMBER_OF_BUCKETS){
+            statistics->arrival_histogram[
+                arrival_in_ms / SCANNER_BUCKET_IN_MILLI_SECONDS]++;
+        }else{
+            statistics->number_of_arrival_overflows++;
+        }
+    }
+
+    statistics->number_of_events++;
+    statistics->last_event_time_in_ns = reception_time_in_ns;
+}
+
+int arrival_percentile(ScannerStatistics *statistics, double fraction){
+    uint64_t number_of_arrivals = 0;
+    uint64_t count = 0;
+    int i;
+
+    for(i = 0 ; i < SCANNER_NUMBER_OF_BUCKETS ; i++){
+        number_of_arrivals += statistics->arrival_histogram[i];
+    }
+    number_of_arrivals += statistics->number_of_arrival_overflows;
+
+    for(i = 0 ; i < SCANNER_NUMBER_OF_BUCKETS ; i++){
+        count += statistics->arrival_histogram[i];
+        if(count > 0 && count >= fraction * number_of_arrivals){
+            return (i + 1) * SCANNER_BUCKET_IN_MILLI_SECONDS;
+        }
+    }
+
+    return -1;
+}
+
+/* Account the first reception of a new payload against the time at which
+   the payload was handed to the advertising dongle */
+static void record_update_latency(ScannerStatistics *statistics,
+                                  int sequence_number,
+                                  uint64_t reception_time_in_ns,
+                                  uint64_t scanner_start_time_in_ns){
+    PersistentState *state = NULL;
+    uint64_t update_time_in_ns = 0;
+    int current_sequence_number = 0;
+
+    TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+    current_sequence_number = g_advertising.payload.sequence_number & 0xFF;
+    state = get_persistent_state();
+    if(NULL != state){
+        update_time_in_ns = state->last_update_time_in_ns;
+    }
+    pthread_mutex_unlock(&g_advertising.lock);
+
+    /* Updates before the scanner started, e.g. by an earlier run of the
+       Tag, have no meaningful latency */
+    if(sequence_number != current_sequence_number ||
+       update_time_in_ns < scanner_start_time_in_ns ||
+       update_time_in_ns > reception_time_in_ns){
+        return;
+    }
+
+    statistics->number_of_updates_received++;
+    statistics->total_update_latency_in_ns +=
+        reception_time_in_ns - update_time_in_ns;
+    if(reception_time_in_ns - update_time_in_ns >
+       statistics->max_update_latency_in_ns){
+        statistics->max_update_latency_in_ns =
+            reception_time_in_ns - update_time_in_ns;
+    }
+}
+
+static void report_statistics(ScannerStatistics *statistics,
+                              uint64_t duration_in_ns){
+    double duration_in_seconds = duration_in_ns / 1e9;
+    double expected_event_interval_in_us = 0;
+    double expected_events = 0;
+
+    /* The controller adds a random advertising delay of 0 to 10 ms to
+       every advertising interval */
+    TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+    expected_event_interval_in_us =
+        (g_advertising.min_interval_in_units_0625_ms +
+         g_advertising.max_interval_in_units_0625_ms) / 2.0 *
+        MICRO_SECONDS_PER_INTERVAL_UNIT +
+        MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS / 2.0;
+    pthread_mutex_unlock(&g_advertising.lock);
+
+    expected_events = duration_in_ns / 1000.0 / expected_event_interval_in_us;
+
+    zlog_info(category_health_report,
+              "Scanner: %.2f packets/s, %.2f events/s, delivery %.3f, "
+              "inter-arrival p50 %d ms p99 %d ms overflow %llu, "
+              "RSSI avg %lld min %d max %d dBm, "
+              "updates %llu latency avg %llu us max %llu us",
+              statistics->number_of_packets / duration_in_seconds,
+              statistics->number_of_events / duration_in_seconds,
+              expected_events > 0 ?
+                  statistics->number_of_events / expected_events : 0,
+              arrival_percentile(statistics, 0.5),
+              arrival_percentile(statistics, 0.99),
+              (unsigned long long)statistics->number_of_arrival_overflows,
+              (long long)(statistics->number_of_packets ?
+                  statistics->rssi_sum /
+                  (int64_t)statistics->number_of_packets : 0),
+              statistics->rssi_min,
+              statistics->rssi_max,
+              (unsigned long long)statistics->number_of_updates_received,
+              (unsigned long long)(statistics->number_of_updates_received ?
+                  statistics->total_update_latency_in_ns / 1000 /
+                  statistics->number_of_updates_received : 0),
+              (unsigned long long)
+                  (statistics->max_update_latency_in_ns / 1000));
+}
+
+static void *scan_tag(void *argument){
+    static ScannerStatistics statistics;
+    uint8_t buffer[HCI_MAX_EVENT_SIZE];
+    struct pollfd poll_descriptor;
+    evt_le_meta_event *meta_event = NULL;
+    le_advertising_info *info = NULL;
+    uint64_t scanner_start_time_in_ns = 0;
+    uint64_t report_start_time_in_ns = 0;
+    uint64_t now_in_ns = 0;
+    bdaddr_t address;
+    uint8_t *report = NULL;
+    int last_sequence_number = -1;
+    int sequence_number = 0;
+    int number_of_reports = 0;
+    ssize_t length = 0;
+    int i;
+
+    TRACE_THREAD_START();
+    set_energy_subsystem(SUBSYSTEM_SCANNER);
+
+    memset(&statistics, 0, sizeof(statistics));
+    scanner_start_time_in_ns = get_time_in_ns();
+    report_start_time_in_ns = scanner_start_time_in_ns;
+
+    poll_descriptor.fd = scanner_device_handle;
+    poll_descriptor.events = POLLIN;
+
+    while(true == ready_to_work){
+
+        now_in_ns = get_time_in_ns();
+        if(now_in_ns - report_start_time_in_ns >=
+           report_interval_in_seconds * 1000000000ULL){
+            report_statistics(&statistics,
+                              now_in_ns - report_start_time_in_ns);
+            memset(&statistics, 0, sizeof(statistics));
+            report_start_time_in_ns = now_in_ns;
+        }
+
+        if(poll(&poll_descriptor, 1, SCANNER_POLL_TIMEOUT_IN_MS) <= 0){
+            account_wakeup();
+            continue;
+        }
+        account_wakeup();
+
+        length = read(scanner_device_handle, buffer, sizeof(buffer));
+        account_syscalls(1);
+        now_in_ns = get_time_in_ns();
+        if(length < 1 + HCI_EVENT_HDR_SIZE + 2 ||
+           HCI_EVENT_PKT != buffer[0]){
+            continue;
+        }
+
+        meta_event = (evt_le_meta_event *)(buffer + 1 + HCI_EVENT_HDR_SIZE);
+        if(EVT_LE_ADVERTISING_REPORT != meta_event->subevent){
+            continue;
+        }
+
+        /* A Tag with a private identity is on the air with the private
+           address of the epoch */
+        if(!get_private_address(&address)){
+            memcpy(&address, &tag_identity, sizeof(bdaddr_t));
+        }
+
+        /* Each report is followed by its RSSI */
+        number_of_reports = meta_event->data[0];
+        report = meta_event->data + 1;
+        for(i = 0 ; i < number_of_reports ; i++){
+            info = (le_advertising_info *)report;
+            if(report + sizeof(le_advertising_info) + info->length + 1 >
+               buffer + length){
+                break;
+            }
+
+            if(parse_tag_report(info, &address, &sequence_number)){
+                record_tag_packet(&statistics, now_in_ns,
+                                  (int8_t)info->data[info->length]);
+
+                if(sequence_number != last_sequence_number){
+                    record_update_latency(&statistics, sequence_number,
+                                          now_in_ns,
+                                          scanner_start_time_in_ns);
+                    last_sequence_number = sequence_number;
+                }
+            }
+
+            report += sizeof(le_advertising_info) + info->length + 1;
+        }
+    }
+
+    return NULL;
+}
+
+static ErrorCode set_scan_enable(int device_handle, bool enable){
+    uint8_t status = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    le_set_scan_enable_cp scan_enable;
+
+    memset(&scan_enable, 0, sizeof(scan_enable));
+    scan_enable.enable = enable ? 0x01 : 0x00;
+    /* Every packet counts, so duplicates are not filtered */
+    scan_enable.filter_dup = 0x00;
+
+    return_value = send_hci_request(device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_SET_SCAN_ENABLE,
+                                    &scan_enable,
+                                    LE_SET_SCAN_ENABLE_CP_SIZE,
+                                    &status, 1);
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+
+    return status ? E_ADVERTISE_STATUS : WORK_SUCCESSFULLY;
+}
+
+ErrorCode start_loopback_scanner(Config *config, bdaddr_t *identity){
+    uint8_t status = 0;
+    int retry_time = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    le_set_scan_parameters_cp scan_parameters;
+    struct hci_filter filter;
+
+    if(config->scanner_dongle_id < 0){
+        return WORK_SUCCESSFULLY;
+    }
+    if(config->scanner_dongle_id == config->advertise_dongle_id){
+        zlog_error(category_health_report,
+                   "Loopback scanner needs a second dongle");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Loopback scanner needs a second dongle");
+#endif
+        return E_OPEN_DEVICE;
+    }
+
+    memcpy(&tag_identity, identity, sizeof(bdaddr_t));
+    report_interval_in_seconds = config->scanner_report_interval_in_seconds;
+    if(report_interval_in_seconds <= 0){
+        report_interval_in_seconds = 1;
+    }
+
+    retry_time = SOCKET_OPEN_RETRY;
+    while(retry_time--){
+        scanner_device_handle = hci_open_dev(config->scanner_dongle_id);
+
+        if(scanner_device_handle >= 0){
+            break;
+        }
+    }
+
+    if(scanner_device_handle < 0){
+        zlog_error(category_health_report,
+                   "Error openning socket for loopback scanner");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Error openning socket for loopback scanner");
+#endif
+        return E_OPEN_DEVICE;
+    }
+
+    /* A scan left enabled by an earlier run rejects new parameters */
+    set_scan_enable(scanner_device_handle, false);
+
+    memset(&scan_parameters, 0, sizeof(scan_parameters));
+    scan_parameters.type = SCANNER_TYPE_PASSIVE;
+    scan_parameters.interval = htobs(SCANNER_INTERVAL_IN_UNITS_0625_MS);
+    scan_parameters.window = htobs(SCANNER_WINDOW_IN_UNITS_0625_MS);
+    scan_parameters.own_bdaddr_type = LE_PUBLIC_ADDRESS;
+    scan_parameters.filter = 0x00;
+
+    return_value = send_hci_request(scanner_device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_SET_SCAN_PARAMETERS,
+                                    &scan_parameters,
+                                    LE_SET_SCAN_PARAMETERS_CP_SIZE,
+                                    &status, 1);
+    if(WORK_SUCCESSFULLY == return_value && status){
+        return_value = E_ADVERTISE_STATUS;
+    }
+    if(WORK_SUCCESSFULLY == return_value){
+        return_value = set_scan_enable(scanner_device_handle, true);
+    }
+    if(WORK_SUCCESSFULLY != return_value){
+        zlog_error(category_health_report,
+                   "Unable to start LE scan on dongle %d",
+                   config->scanner_dongle_id);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to start LE scan on dongle %d",
+                   config->scanner_dongle_id);
+#endif
+        hci_close_dev(scanner_device_handle);
+        scanner_device_handle = -1;
+        return return_value;
+    }
+
+    /* Only LE meta events reach the scanner thread */
+    hci_filter_clear(&filter);
+    hci_filter_set_ptype(HCI_EVENT_PKT, &filter);
+    hci_filter_set_event(EVT_LE_META_EVENT, &filter);
+    setsockopt(scanner_device_handle, SOL_HCI, HCI_FILTER,
+               &filter, sizeof(filter));
+
+    if(0 != pthread_create(&scanner_thread, NULL, scan_tag, NULL)){
+        zlog_error(category_health_report,
+                   "Unable to start the thread of the loopback scanner");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to start the thread of the loopback scanner");
+#endif
+        stop_loopback_scanner();
+        return E_START_THREAD;
+    }
+    scanner_running = true;
+
+    return WORK_SUCCESSFULLY;
+}
+
+void stop_loopback_scanner(void){
+    if(scanner_running){
+        pthread_join(scanner_thread, NULL);
+        scanner_running = false;
+    }
+
+    if(scanner_device_handle >= 0){
+        set_scan_enable(scanner_device_handle, false);
+        hci_close_dev(scanner_device_handle);
+        scanner_device_handle = -1;
+    }
+}
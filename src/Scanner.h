@@ -0,0 +1,209 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to scan for its own advertising on a second dongle and to
+    report whether the Tag is on the air as configured.
+
+File Name:
+
+    Scanner.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    The loopback scanner runs a passive LE scan without duplicate
+    filtering on a second dongle, and keeps the advertising reports which
+    carry the manufacturer data of the Tag (company identifier 0x000F)
+    from the BD address of the advertising dongle. Packets received within
+    a short gap belong to one advertising event. Every report interval the
+    scanner logs the packets and advertising events per second, the
+    delivery rate against the configured interval, the inter-arrival
+    histogram of advertising events, the RSSI, and the latency from an
+    update of the payload to its first reception.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <poll.h>
+
+#include "Tag.h"
+#include "Planner.h"
+#include "Template.h"
+
+/*
+  CONSTANTS
+*/
+
+/* Scan interval and window in units of 0.625 ms. Equal values scan
+   continuously. */
+#define SCANNER_INTERVAL_IN_UNITS_0625_MS 0x0010
+#define SCANNER_WINDOW_IN_UNITS_0625_MS 0x0010
+
+/* Passive scanning, which sends no scan requests to the Tag */
+#define SCANNER_TYPE_PASSIVE 0x00
+
+/* Packets received within this gap belong to one advertising event */
+#define SCANNER_EVENT_GAP_IN_MILLI_SECONDS 15
+
+/* Width in milliseconds of a bucket of the inter-arrival histogram */
+#define SCANNER_BUCKET_IN_MILLI_SECONDS 10
+
+/* Number of buckets of the inter-arrival histogram. Longer inter-arrival
+   times count as overflow. */
+#define SCANNER_NUMBER_OF_BUCKETS 500
+
+/* Time in milliseconds to wait for an event before checking ready_to_work
+   and the report deadline */
+#define SCANNER_POLL_TIMEOUT_IN_MS 500
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The statistics of one report interval of the loopback scanner */
+typedef struct ScannerStatistics {
+
+    uint64_t number_of_packets;
+
+    uint64_t number_of_events;
+
+    /* CLOCK_MONOTONIC time of the last received advertising event */
+    uint64_t last_event_time_in_ns;
+
+    /* RSSI in dBm of the received packets */
+    int64_t rssi_sum;
+    int rssi_min;
+    int rssi_max;
+
+    /* Inter-arrival times of advertising events */
+    uint64_t arrival_histogram[SCANNER_NUMBER_OF_BUCKETS];
+    uint64_t number_of_arrival_overflows;
+
+    /* Latency from an update of the payload to its first reception */
+    uint64_t number_of_updates_received;
+    uint64_t total_update_latency_in_ns;
+    uint64_t max_update_latency_in_ns;
+
+} ScannerStatistics;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  parse_tag_report:
+
+      This function tells whether an advertising report is from the Tag,
+      whose advertising data matches the fixed bytes of the compiled
+      payload template, and extracts the sequence number of the payload at
+      the offset of the sequence slot of the template.
+
+  Parameters:
+
+      info - the advertising report
+      identity - the BD address of the advertising dongle of the Tag
+      sequence_number - the sequence number to be filled, or -1 if the
+                        payload carries no sequence number
+
+  Return value:
+
+      bool - true if the advertising report is from the Tag
+*/
+
+bool parse_tag_report(le_advertising_info *info,
+                      bdaddr_t *identity,
+                      int *sequence_number);
+
+/*
+  record_tag_packet:
+
+      This function accounts a packet received from the Tag.
+
+  Parameters:
+
+      statistics - the statistics of the report interval
+      reception_time_in_ns - the CLOCK_MONOTONIC time of the reception
+      rssi - the RSSI in dBm of the packet
+
+  Return value:
+
+      None
+*/
+
+void record_tag_packet(ScannerStatistics *statistics,
+                       uint64_t reception_time_in_ns,
+                       int rssi);
+
+/*
+  arrival_percentile:
+
+      This function returns the inter-arrival time below which a fraction
+      of the advertising events arrived.
+
+  Parameters:
+
+      statistics - the statistics of the report interval
+      fraction - the fraction of advertising events, between 0 and 1
+
+  Return value:
+
+      int - the upper bound in milliseconds of the bucket holding the
+            percentile, or -1 if the percentile lies in the overflow
+*/
+
+int arrival_percentile(ScannerStatistics *statistics, double fraction);
+
+/*
+  start_loopback_scanner:
+
+      This function starts the LE scan on the scanner dongle and the
+      thread which receives and reports the advertising of the Tag.
+
+  Parameters:
+
+      config - the pointer to the config struct of the Tag
+      identity - the BD address of the advertising dongle of the Tag
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode start_loopback_scanner(Config *config, bdaddr_t *identity);
+
+/*
+  stop_loopback_scanner:
+
+      This function waits for the scanner thread to notice that
+      ready_to_work is cleared, and stops the LE scan.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      None
+*/
+
+void stop_loopback_scanner(void);
+
+#endif
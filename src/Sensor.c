@@ -0,0 +1,432 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs executed by the Tag to sample its
+      sensors and feed the aggregated summary into the advertising payload.
+
+ File Name:
+
+      Sensor.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Sensor.h"
+#include "Energy.h"
+#include "Transport.h"
+#include "Template.h"
+
+#define Debugging
+
+/* Four floats processed at once. GCC lowers the vector extensions to NEON
+   on the Raspberry Pi and to SSE on x86. */
+typedef float v4sf __attribute__ ((vector_size (16)));
+typedef int v4si __attribute__ ((vector_size (16)));
+
+/* File descriptors of the sysfs attributes of the accelerometer and the
+   temperature source, kept open and re-read with pread */
+static int acceleration_files[3] = {-1, -1, -1};
+static int temperature_file = -1;
+
+/* Scale of the raw accelerometer attributes in m/s^2 */
+static float acceleration_scale = 1.0f;
+
+/* Recorded trace replayed instead of the live sources */
+static FILE *trace_file = NULL;
+
+/* HCI socket used by the data-only update path */
+static int sensor_device_handle = -1;
+
+static int sampling_rate_in_hz = 0;
+
+static pthread_t sensor_thread;
+
+static bool sensor_running = false;
+
+static SensorWindow sensor_window;
+
+static void sum_and_square_sum(const float *samples,
+                               float *sum,
+                               float *square_sum){
+    v4sf vector_sum = {0, 0, 0, 0};
+    v4sf vector_square_sum = {0, 0, 0, 0};
+    v4sf value;
+    int i;
+
+    for(i = 0 ; i < SENSOR_WINDOW_SIZE ; i += SENSOR_VECTOR_WIDTH){
+        memcpy(&value, samples + i, sizeof(value));
+        vector_sum += value;
+        vector_square_sum += value * value;
+    }
+
+    *sum = vector_sum[0] + vector_sum[1] + vector_sum[2] + vector_sum[3];
+    *square_sum = vector_square_sum[0] + vector_square_sum[1] +
+                  vector_square_sum[2] + vector_square_sum[3];
+}
+
+static void min_and_max(const float *samples, float *min, float *max){
+    v4sf vector_min;
+    v4sf vector_max;
+    v4sf value;
+    v4si mask;
+    int i;
+
+    memcpy(&vector_min, samples, sizeof(vector_min));
+    vector_max = vector_min;
+
+    for(i = SENSOR_VECTOR_WIDTH ; i < SENSOR_WINDOW_SIZE ;
+        i += SENSOR_VECTOR_WIDTH){
+        memcpy(&value, samples + i, sizeof(value));
+
+        /* Lane-wise select through comparison masks, which C vector
+           extensions support without the ternary operator */
+        mask = value < vector_min;
+        vector_min = (v4sf)(((v4si)value & mask) | ((v4si)vector_min & ~mask));
+        mask = value > vector_max;
+        vector_max = (v4sf)(((v4si)value & mask) | ((v4si)vector_max & ~mask));
+    }
+
+    *min = fminf(fminf(vector_min[0], vector_min[1]),
+                 fminf(vector_min[2], vector_min[3]));
+    *max = fmaxf(fmaxf(vector_max[0], vector_max[1]),
+                 fmaxf(vector_max[2], vector_max[3]));
+}
+
+static float variance(const float *samples){
+    float sum = 0;
+    float square_sum = 0;
+    float mean = 0;
+
+    sum_and_square_sum(samples, &sum, &square_sum);
+    mean = sum / SENSOR_WINDOW_SIZE;
+
+    return square_sum / SENSOR_WINDOW_SIZE - mean * mean;
+}
+
+void aggregate_sensor_window(SensorWindow *window,
+                             MotionState previous_state,
+                             SensorSummary *summary){
+    float energy = 0;
+    float temperature_min = 0;
+    float temperature_max = 0;
+
+    energy = variance(window->acceleration_x) +
+             variance(window->acceleration_y) +
+             variance(window->acceleration_z);
+
+    if(MOTION_MOVING == previous_state){
+        summary->motion_state = energy < SENSOR_STILL_THRESHOLD ?
+                                MOTION_STILL : MOTION_MOVING;
+    }else{
+        summary->motion_state = energy > SENSOR_MOVING_THRESHOLD ?
+                                MOTION_MOVING : MOTION_STILL;
+    }
+
+    summary->motion_energy = lroundf(energy / SENSOR_ENERGY_STEP);
+    if(summary->motion_energy > 255){
+        summary->motion_energy = 255;
+    }
+
+    min_and_max(window->temperature, &temperature_min, &temperature_max);
+    summary->temperature_min = lroundf(floorf(temperature_min));
+    summary->temperature_max = lroundf(ceilf(temperature_max));
+}
+
+bool is_summary_changed(SensorSummary *published, SensorSummary *summary){
+    return published->motion_state != summary->motion_state ||
+           abs(published->motion_energy - summary->motion_energy) >=
+               SENSOR_ENERGY_DELTA ||
+           abs(published->temperature_min - summary->temperature_min) >=
+               SENSOR_TEMPERATURE_DELTA ||
+           abs(published->temperature_max - summary->temperature_max) >=
+               SENSOR_TEMPERATURE_DELTA;
+}
+
+static bool read_attribute(int file, float *value){
+    char attribute[SENSOR_ATTRIBUTE_SIZE];
+    ssize_t length = 0;
+
+    length = pread(file, attribute, sizeof(attribute) - 1, 0);
+    account_syscalls(1);
+    if(length <= 0){
+        return false;
+    }
+    attribute[length] = '\0';
+    *value = strtof(attribute, NULL);
+
+    return true;
+}
+
+static int open_attribute(char *directory, char *name){
+    char path[SENSOR_PATH_SIZE * 2];
+
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+
+    return open(path, O_RDONLY);
+}
+
+/* Read one sample from the recorded trace, which has one line per sample
+   of acceleration along X, Y and Z in m/s^2 and temperature in degree
+   Celsius. The trace is replayed from the start at its end. */
+static bool read_trace_sample(float *x, float *y, float *z, float *t){
+    char line[CONFIG_BUFFER_SIZE];
+    int retry_time = 2;
+
+    while(retry_time--){
+        while(NULL != fgets(line, sizeof(line), trace_file)){
+            if(4 == sscanf(line, "%f %f %f %f", x, y, z, t)){
+                return true;
+            }
+        }
+        rewind(trace_file);
+    }
+
+    return false;
+}
+
+static bool read_live_sample(float *x, float *y, float *z, float *t){
+    if(!read_attribute(acceleration_files[0], x) ||
+       !read_attribute(acceleration_files[1], y) ||
+       !read_attribute(acceleration_files[2], z)){
+        return false;
+    }
+    *x *= acceleration_scale;
+    *y *= acceleration_scale;
+    *z *= acceleration_scale;
+
+    if(temperature_file < 0 || !read_attribute(temperature_file, t)){
+        *t = 0;
+    }else{
+        *t *= SENSOR_TEMPERATURE_SCALE;
+    }
+
+    return true;
+}
+
+static void publish_summary(SensorSummary *summary){
+    AdvertisingPayload *payload = &g_advertising.payload;
+
+    TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+
+    payload->has_sensor_summary = true;
+    payload->motion_state = summary->motion_state;
+    payload->motion_energy = summary->motion_energy;
+    payload->temperature_min = summary->temperature_min;
+    payload->temperature_max = summary->temperature_max;
+    payload->dirty_slots |= PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_SENSOR_SUMMARY);
+
+    if(WORK_SUCCESSFULLY != update_advertising_data(sensor_device_handle)){
+        zlog_error(category_health_report,
+                   "Unable to publish sensor summary");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to publish sensor summary");
+#endif
+    }
+
+    pthread_mutex_unlock(&g_advertising.lock);
+}
+
+static void *sample_sensors(void *argument){
+    struct timespec deadline;
+    SensorSummary published;
+    SensorSummary summary;
+    bool has_published = false;
+    int index = 0;
+    bool is_sampled = false;
+
+    TRACE_THREAD_START();
+    set_energy_subsystem(SUBSYSTEM_SENSOR);
+
+    memset(&published, 0, sizeof(published));
+    memset(&sensor_window, 0, sizeof(sensor_window));
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    while(true == ready_to_work){
+        wait_for_next_period(&deadline, 1000000 / sampling_rate_in_hz, NULL);
+
+        index = sensor_window.number_of_samples;
+        if(NULL != trace_file){
+            is_sampled = read_trace_sample(
+                &sensor_window.acceleration_x[index],
+                &sensor_window.acceleration_y[index],
+                &sensor_window.acceleration_z[index],
+                &sensor_window.temperature[index]);
+        }else{
+            is_sampled = read_live_sample(
+                &sensor_window.acceleration_x[index],
+                &sensor_window.acceleration_y[index],
+                &sensor_window.acceleration_z[index],
+                &sensor_window.temperature[index]);
+        }
+        if(!is_sampled){
+            continue;
+        }
+
+        sensor_window.number_of_samples++;
+        if(sensor_window.number_of_samples < SENSOR_WINDOW_SIZE){
+            continue;
+        }
+        sensor_window.number_of_samples = 0;
+
+        aggregate_sensor_window(&sensor_window, published.motion_state,
+                                &summary);
+
+        /* Only meaningful changes reach the dongle, which keeps HCI
+           traffic low */
+        if(!has_published || is_summary_changed(&published, &summary)){
+            publish_summary(&summary);
+            published = summary;
+            has_published = true;
+        }
+    }
+
+    return NULL;
+}
+
+ErrorCode start_sensor_pipeline(Config *config){
+    char *axes[] = {"in_accel_x_raw", "in_accel_y_raw", "in_accel_z_raw"};
+    int retry_time = 0;
+    int scale_file = -1;
+    int i;
+
+    if(config->sensor_sampling_rate_in_hz <= 0){
+        return WORK_SUCCESSFULLY;
+    }
+    if(config->sensor_sampling_rate_in_hz > SENSOR_MAX_SAMPLING_RATE_IN_HZ){
+        zlog_error(category_health_report,
+                   "Invalid sensor sampling rate %d Hz",
+                   config->sensor_sampling_rate_in_hz);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Invalid sensor sampling rate %d Hz",
+                   config->sensor_sampling_rate_in_hz);
+#endif
+        return E_ADVERTISE_MODE;
+    }
+    sampling_rate_in_hz = config->sensor_sampling_rate_in_hz;
+
+    if(strlen(config->sensor_trace_file) > 0){
+        trace_file = fopen(config->sensor_trace_file, "r");
+        if(NULL == trace_file){
+            zlog_error(category_health_report,
+                       "Unable to open sensor trace %s",
+                       config->sensor_trace_file);
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "Unable to open sensor trace %s",
+                       config->sensor_trace_file);
+#endif
+            return E_OPEN_FILE;
+        }
+    }else{
+        for(i = 0 ; i < 3 ; i++){
+            acceleration_files[i] =
+                open_attribute(config->sensor_accelerometer_path, axes[i]);
+            if(acceleration_files[i] < 0){
+                zlog_error(category_health_report,
+                           "Unable to open accelerometer %s/%s",
+                           config->sensor_accelerometer_path, axes[i]);
+#ifdef Debugging
+                zlog_error(category_debug,
+                           "Unable to open accelerometer %s/%s",
+                           config->sensor_accelerometer_path, axes[i]);
+#endif
+                stop_sensor_pipeline();
+                return E_OPEN_FILE;
+            }
+        }
+
+        scale_file = open_attribute(config->sensor_accelerometer_path,
+                                    "in_accel_scale");
+        if(scale_file >= 0){
+            read_attribute(scale_file, &acceleration_scale);
+            close(scale_file);
+        }
+
+        /* The temperature source is optional */
+        if(strlen(config->sensor_temperature_path) > 0){
+            temperature_file = open(config->sensor_temperature_path,
+                                    O_RDONLY);
+        }
+    }
+
+    retry_time = SOCKET_OPEN_RETRY;
+    while(retry_time--){
+        sensor_device_handle = open_hci_device(g_advertising.dongle_device_id);
+
+        if(sensor_device_handle >= 0){
+            break;
+        }
+    }
+
+    if(sensor_device_handle < 0){
+        zlog_error(category_health_report,
+                   "Error openning socket for sensor pipeline");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Error openning socket for sensor pipeline");
+#endif
+        stop_sensor_pipeline();
+        return E_OPEN_DEVICE;
+    }
+
+    if(0 != pthread_create(&sensor_thread, NULL, sample_sensors, NULL)){
+        zlog_error(category_health_report,
+                   "Unable to start the thread of the sensor pipeline");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to start the thread of the sensor pipeline");
+#endif
+        stop_sensor_pipeline();
+        return E_START_THREAD;
+    }
+    sensor_running = true;
+
+    return WORK_SUCCESSFULLY;
+}
+
+void stop_sensor_pipeline(void){
+    int i;
+
+    if(sensor_running){
+        pthread_join(sensor_thread, NULL);
+        sensor_running = false;
+    }
+
+    for(i = 0 ; i < 3 ; i++){
+        if(acceleration_files[i] >= 0){
+            close(acceleration_files[i]);
+            acceleration_files[i] = -1;
+        }
+    }
+    if(temperature_file >= 0){
+        close(temperature_file);
+        temperature_file = -1;
+    }
+    if(NULL != trace_file){
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    if(sensor_device_handle >= 0){
+        close_hci_device(sensor_device_handle);
+        sensor_device_handle = -1;
+    }
+}
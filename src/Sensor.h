@@ -0,0 +1,216 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to sample the accelerometer and temperature sources,
+    aggregate the samples on the device, and feed compact summary fields
+    into the advertising payload.
+
+File Name:
+
+    Sensor.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    Samples are read from IIO or thermal sysfs files, or replayed from a
+    recorded trace for testing, into a window of samples. When the window
+    is full, vectorized kernels compute the motion energy, the still or
+    moving state and the minimum and maximum temperature. The summary is
+    handed to the dongle through the data-only update path only when it
+    changes meaningfully.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include <fcntl.h>
+#include <math.h>
+
+#include "Tag.h"
+#include "RealTime.h"
+
+/*
+  CONSTANTS
+*/
+
+/* Highest sampling rate in Hz accepted from the config. The sampling
+   period is computed in whole micro seconds and the sysfs attributes of
+   the accelerometer are not updated faster, so the thread would only spin
+   at higher rates. */
+#define SENSOR_MAX_SAMPLING_RATE_IN_HZ 1000
+
+/* Number of samples aggregated into one summary. It must be a multiple of
+   the vector width of the kernels. */
+#define SENSOR_WINDOW_SIZE 64
+
+/* Number of floats processed at once by the vectorized kernels */
+#define SENSOR_VECTOR_WIDTH 4
+
+/* Maximum number of characters in the path of a sensor source */
+#define SENSOR_PATH_SIZE 128
+
+/* Number of characters read from a sysfs attribute */
+#define SENSOR_ATTRIBUTE_SIZE 32
+
+/* Scale of thermal and IIO temperature attributes, in millidegree Celsius */
+#define SENSOR_TEMPERATURE_SCALE 0.001f
+
+/* Motion energy in (m/s^2)^2 above which the Tag is moving */
+#define SENSOR_MOVING_THRESHOLD 0.05f
+
+/* Motion energy in (m/s^2)^2 below which a moving Tag is still again, so
+   that the state does not flap around a single threshold */
+#define SENSOR_STILL_THRESHOLD 0.02f
+
+/* Motion energy in (m/s^2)^2 represented by one step of the motion energy
+   field of the payload */
+#define SENSOR_ENERGY_STEP 0.01f
+
+/* Number of steps of the motion energy field that count as a meaningful
+   change of the summary */
+#define SENSOR_ENERGY_DELTA 8
+
+/* Number of degree Celsius of temperature that count as a meaningful
+   change of the summary */
+#define SENSOR_TEMPERATURE_DELTA 1
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The still or moving state of the Tag */
+typedef enum _MotionState{
+
+    MOTION_STILL = 0,
+    MOTION_MOVING = 1
+
+} MotionState;
+
+/* The window of samples being aggregated */
+typedef struct SensorWindow {
+
+    /* Acceleration in m/s^2 along the X, Y and Z axes */
+    float acceleration_x[SENSOR_WINDOW_SIZE] __attribute__ ((aligned (16)));
+    float acceleration_y[SENSOR_WINDOW_SIZE] __attribute__ ((aligned (16)));
+    float acceleration_z[SENSOR_WINDOW_SIZE] __attribute__ ((aligned (16)));
+
+    /* Temperature in degree Celsius */
+    float temperature[SENSOR_WINDOW_SIZE] __attribute__ ((aligned (16)));
+
+    int number_of_samples;
+
+} SensorWindow;
+
+/* The compact summary of one window carried by the payload */
+typedef struct SensorSummary {
+
+    MotionState motion_state;
+
+    /* Motion energy in steps of SENSOR_ENERGY_STEP, saturated at 255 */
+    int motion_energy;
+
+    /* Minimum and maximum temperature in degree Celsius */
+    int temperature_min;
+    int temperature_max;
+
+} SensorSummary;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  aggregate_sensor_window:
+
+      This function computes the summary of a full window of samples. The
+      motion energy is the sum of the variances of the three axes, so the
+      constant gravity vector does not count as motion.
+
+  Parameters:
+
+      window - the full window of samples
+      previous_state - the motion state of the previous window, used for
+                       hysteresis
+      summary - the summary to be filled
+
+  Return value:
+
+      None
+*/
+
+void aggregate_sensor_window(SensorWindow *window,
+                             MotionState previous_state,
+                             SensorSummary *summary);
+
+/*
+  is_summary_changed:
+
+      This function tells whether a summary differs meaningfully from the
+      summary published in the payload.
+
+  Parameters:
+
+      published - the summary published in the payload
+      summary - the summary of the latest window
+
+  Return value:
+
+      bool - true if the summary should be published
+*/
+
+bool is_summary_changed(SensorSummary *published, SensorSummary *summary);
+
+/*
+  start_sensor_pipeline:
+
+      This function opens the sensor sources or the recorded trace, opens a
+      HCI socket for the data-only update path, and starts the sampling
+      thread. Sampling rates above SENSOR_MAX_SAMPLING_RATE_IN_HZ are
+      rejected.
+
+  Parameters:
+
+      config - the pointer to the config struct of the Tag
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode start_sensor_pipeline(Config *config);
+
+/*
+  stop_sensor_pipeline:
+
+      This function waits for the sampling thread to notice that
+      ready_to_work is cleared and closes the sensor sources.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      None
+*/
+
+void stop_sensor_pipeline(void);
+
+#endif
@@ -0,0 +1,265 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used by the Tag to keep its
+      advertising state in a memory-mapped state file.
+
+ File Name:
+
+      State.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "State.h"
+
+#define Debugging
+
+/* The mapped state file */
+static PersistentState *persistent_state = NULL;
+
+uint32_t crc32_checksum(const void *buffer, size_t length){
+    const uint8_t *bytes = (const uint8_t *)buffer;
+    uint32_t crc = 0xFFFFFFFF;
+    size_t i;
+    int bit;
+
+    for(i = 0 ; i < length ; i++){
+        crc ^= bytes[i];
+        for(bit = 0 ; bit < 8 ; bit++){
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
+
+/* The checksum covers every byte following the checksum field */
+static uint32_t state_checksum(PersistentState *state){
+    size_t offset = offsetof(PersistentState, checksum) +
+                    sizeof(state->checksum);
+
+    return crc32_checksum((uint8_t *)state + offset,
+                          sizeof(PersistentState) - offset);
+}
+
+ErrorCode map_persistent_state(char *file_name){
+    int state_file = -1;
+    int retry_time = 0;
+    void *mapping = NULL;
+
+    retry_time = FILE_OPEN_RETRY;
+    while(retry_time--){
+        state_file = open(file_name, O_RDWR | O_CREAT, 0644);
+
+        if(-1 != state_file){
+            break;
+        }
+    }
+
+    if(-1 == state_file){
+        zlog_error(category_health_report,
+                   "Unable to open state file");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to open state file");
+#endif
+        return E_OPEN_FILE;
+    }
+
+    if(-1 == ftruncate(state_file, sizeof(PersistentState))){
+        close(state_file);
+        return E_OPEN_FILE;
+    }
+
+    mapping = mmap(NULL, sizeof(PersistentState), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, state_file, 0);
+    close(state_file);
+
+    if(MAP_FAILED == mapping){
+        zlog_error(category_health_report,
+                   "Unable to map state file: %s", strerror(errno));
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to map state file: %s", strerror(errno));
+#endif
+        return E_OPEN_FILE;
+    }
+
+    persistent_state = (PersistentState *)mapping;
+
+    return WORK_SUCCESSFULLY;
+}
+
+void unmap_persistent_state(void){
+    if(NULL == persistent_state){
+        return;
+    }
+
+    msync(persistent_state, sizeof(PersistentState), MS_SYNC);
+    munmap(persistent_state, sizeof(PersistentState));
+    persistent_state = NULL;
+}
+
+PersistentState *get_persistent_state(void){
+    return persistent_state;
+}
+
+bool is_persistent_state_valid(bdaddr_t *bdaddr, uint32_t config_checksum){
+    if(NULL == persistent_state){
+        return false;
+    }
+
+    if(STATE_MAGIC != persistent_state->magic ||
+       STATE_VERSION != persistent_state->version ||
+       sizeof(PersistentState) != persistent_state->length){
+        return false;
+    }
+
+    /* A crash in the middle of an update leaves a bad checksum */
+    if(state_checksum(persistent_state) != persistent_state->checksum){
+        return false;
+    }
+
+    if(0 != memcmp(&persistent_state->controller_bdaddr, bdaddr,
+                   sizeof(bdaddr_t)) ||
+       config_checksum != persistent_state->config_checksum){
+        return false;
+    }
+
+    /* Both the parameters and the data must have been saved */
+    return 0 < persistent_state->min_interval_in_units_0625_ms &&
+           0 < persistent_state->advertising_data_length &&
+           LENGTH_OF_ADVERTISING_DATA >=
+               persistent_state->advertising_data_length;
+}
+
+void reset_persistent_state(bdaddr_t *bdaddr, uint32_t config_checksum){
+    uint64_t cold_start_to_air_in_us = 0;
+    uint64_t warm_start_to_air_in_us = 0;
+
+    if(NULL == persistent_state){
+        return;
+    }
+
+    /* Keep the start-to-air times of earlier runs for comparison */
+    if(STATE_MAGIC == persistent_state->magic &&
+       STATE_VERSION == persistent_state->version){
+        cold_start_to_air_in_us = persistent_state->cold_start_to_air_in_us;
+        warm_start_to_air_in_us = persistent_state->warm_start_to_air_in_us;
+    }
+
+    memset(persistent_state, 0, sizeof(PersistentState));
+    persistent_state->magic = STATE_MAGIC;
+    persistent_state->version = STATE_VERSION;
+    persistent_state->length = sizeof(PersistentState);
+    memcpy(&persistent_state->controller_bdaddr, bdaddr, sizeof(bdaddr_t));
+    persistent_state->config_checksum = config_checksum;
+    persistent_state->cold_start_to_air_in_us = cold_start_to_air_in_us;
+    persistent_state->warm_start_to_air_in_us = warm_start_to_air_in_us;
+    persistent_state->checksum = state_checksum(persistent_state);
+}
+
+void restore_persistent_state(PersistentState *state){
+    if(NULL == persistent_state){
+        return;
+    }
+
+    *persistent_state = *state;
+    persistent_state->checksum = state_checksum(persistent_state);
+    msync(persistent_state, sizeof(PersistentState), MS_SYNC);
+}
+
+void save_advertising_parameters(AdvertisingState *advertising){
+    if(NULL == persistent_state){
+        return;
+    }
+
+    persistent_state->dongle_device_id = advertising->dongle_device_id;
+    persistent_state->min_interval_in_units_0625_ms =
+        advertising->min_interval_in_units_0625_ms;
+    persistent_state->max_interval_in_units_0625_ms =
+        advertising->max_interval_in_units_0625_ms;
+    persistent_state->tx_power_in_dbm = advertising->tx_power_in_dbm;
+    persistent_state->extended_advertising =
+        advertising->extended_advertising;
+
+    persistent_state->checksum = state_checksum(persistent_state);
+
+    /* The parameters change only at start and on commands of the control
+       plane, which can afford to wait for the SD card */
+    msync(persistent_state, sizeof(PersistentState), MS_SYNC);
+}
+
+void save_advertising_data(AdvertisingPayload *payload,
+                           le_set_advertising_data_cp *advertising_data){
+    struct timespec now;
+    uint64_t now_in_ns = 0;
+    bool is_flushed = false;
+
+    if(NULL == persistent_state){
+        return;
+    }
+
+    persistent_state->payload = *payload;
+    persistent_state->advertising_data_length = advertising_data->length;
+    memcpy(persistent_state->advertising_data, advertising_data->data,
+           LENGTH_OF_ADVERTISING_DATA);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    now_in_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    persistent_state->number_of_updates++;
+    persistent_state->last_update_time_in_ns = now_in_ns;
+
+    /* The flush time of a previous boot is ahead of the clock */
+    if(now_in_ns < persistent_state->last_flush_time_in_ns ||
+       now_in_ns - persistent_state->last_flush_time_in_ns >=
+           STATE_FLUSH_INTERVAL_IN_MS * 1000000ULL){
+        persistent_state->last_flush_time_in_ns = now_in_ns;
+        is_flushed = true;
+    }
+
+    persistent_state->checksum = state_checksum(persistent_state);
+
+    /* The page cache keeps the state across a crash of the Tag. MS_ASYNC
+       only marks the pages dirty on Linux, so a power loss takes back the
+       updates since the last synchronous flush, plus those the kernel has
+       not written back yet if the updates stop within the flush interval.
+       Rate limiting keeps the update path from waiting on the SD card on
+       every update. */
+    if(is_flushed){
+        msync(persistent_state, sizeof(PersistentState), MS_SYNC);
+    }
+}
+
+void save_start_to_air_time(bool is_warm_start, uint64_t start_to_air_in_us){
+    if(NULL == persistent_state){
+        return;
+    }
+
+    if(is_warm_start){
+        persistent_state->number_of_warm_starts++;
+        persistent_state->warm_start_to_air_in_us = start_to_air_in_us;
+    }else{
+        persistent_state->cold_start_to_air_in_us = start_to_air_in_us;
+    }
+
+    persistent_state->checksum = state_checksum(persistent_state);
+    msync(persistent_state, sizeof(PersistentState), MS_SYNC);
+}
@@ -0,0 +1,310 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to keep its advertising state in a memory-mapped file, so
+    that a restarted Tag resumes advertising straight from it.
+
+File Name:
+
+    State.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    The state file holds the last encoded payload, the advertising
+    parameters, the counters and the identity of the controller. It is
+    versioned and checksummed, and it is only used by a restarted Tag when
+    the dongle and the config are the ones which produced it. Otherwise
+    the Tag starts cold and rebuilds the state.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef STATE_H
+#define STATE_H
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Tag.h"
+
+/*
+  CONSTANTS
+*/
+
+/* File path of the state file of the Tag */
+#define STATE_FILE_NAME "../bin/Tag.state"
+
+/* Magic number at the start of the state file */
+#define STATE_MAGIC 0x54535441
+
+/* Version of the layout of the state file. It must be increased whenever
+   PersistentState or AdvertisingPayload changes. */
+#define STATE_VERSION 4
+
+/* Minimum time in milliseconds between two synchronous flushes of the
+   state file on an update of the advertising data */
+#define STATE_FLUSH_INTERVAL_IN_MS 1000
+
+/* Maximum number of bytes of advertising data */
+#define LENGTH_OF_ADVERTISING_DATA 31
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The layout of the state file */
+typedef struct PersistentState {
+
+    uint32_t magic;
+
+    uint32_t version;
+
+    /* Number of bytes of the state, i.e., sizeof(PersistentState) */
+    uint32_t length;
+
+    /* CRC-32 of the bytes following this field */
+    uint32_t checksum;
+
+    /* BD address of the dongle which advertised the state */
+    bdaddr_t controller_bdaddr;
+
+    /* CRC-32 of the config which produced the state */
+    uint32_t config_checksum;
+
+    int32_t dongle_device_id;
+
+    int32_t min_interval_in_units_0625_ms;
+
+    int32_t max_interval_in_units_0625_ms;
+
+    int32_t tx_power_in_dbm;
+
+    uint8_t extended_advertising;
+
+    /* The last advertising data handed to the dongle */
+    uint8_t advertising_data_length;
+    uint8_t advertising_data[LENGTH_OF_ADVERTISING_DATA];
+
+    /* The fields from which the advertising data was encoded */
+    AdvertisingPayload payload;
+
+    /* Number of starts of the Tag resumed from the state */
+    uint32_t number_of_warm_starts;
+
+    /* Number of updates of the advertising data */
+    uint64_t number_of_updates;
+
+    /* CLOCK_MONOTONIC time of the last update of the advertising data */
+    uint64_t last_update_time_in_ns;
+
+    /* CLOCK_MONOTONIC time of the last synchronous flush of the state file
+       on an update of the advertising data */
+    uint64_t last_flush_time_in_ns;
+
+    /* Time from process start to advertising of the last cold and warm
+       starts */
+    uint64_t cold_start_to_air_in_us;
+    uint64_t warm_start_to_air_in_us;
+
+} PersistentState;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  map_persistent_state:
+
+      This function opens or creates the state file and maps it into
+      memory.
+
+  Parameters:
+
+      file_name - the name of the state file
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode map_persistent_state(char *file_name);
+
+/*
+  unmap_persistent_state:
+
+      This function flushes the state file and unmaps it.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      None
+*/
+
+void unmap_persistent_state(void);
+
+/*
+  get_persistent_state:
+
+      This function returns the mapped state.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      PersistentState * - the mapped state, or NULL if the state file is not
+                          mapped
+*/
+
+PersistentState *get_persistent_state(void);
+
+/*
+  is_persistent_state_valid:
+
+      This function validates the magic number, version, length and
+      checksum of the state, and checks that the state was produced by the
+      same dongle and the same config.
+
+  Parameters:
+
+      bdaddr - the BD address of the dongle
+      config_checksum - the CRC-32 of the current config
+
+  Return value:
+
+      bool - true if a restarted Tag can resume from the state
+*/
+
+bool is_persistent_state_valid(bdaddr_t *bdaddr, uint32_t config_checksum);
+
+/*
+  reset_persistent_state:
+
+      This function starts a new state for a cold start.
+
+  Parameters:
+
+      bdaddr - the BD address of the dongle
+      config_checksum - the CRC-32 of the current config
+
+  Return value:
+
+      None
+*/
+
+void reset_persistent_state(bdaddr_t *bdaddr, uint32_t config_checksum);
+
+/*
+  restore_persistent_state:
+
+      This function replaces the state with the state handed over by the
+      previous Tag during an upgrade.
+
+  Parameters:
+
+      state - the state handed over by the previous Tag
+
+  Return value:
+
+      None
+*/
+
+void restore_persistent_state(PersistentState *state);
+
+/*
+  save_advertising_parameters:
+
+      This function copies the advertising parameters into the state and
+      updates its checksum. Bursts of the control plane are transient and
+      are not saved. The caller must hold g_advertising.lock.
+
+  Parameters:
+
+      advertising - the advertising state of the Tag
+
+  Return value:
+
+      None
+*/
+
+void save_advertising_parameters(AdvertisingState *advertising);
+
+/*
+  save_advertising_data:
+
+      This function copies the payload and the advertising data handed to
+      the dongle into the state, counts the update and updates the checksum
+      of the state. The state file is flushed synchronously at most once
+      every STATE_FLUSH_INTERVAL_IN_MS. The caller must hold
+      g_advertising.lock.
+
+  Parameters:
+
+      payload - the fields from which the advertising data was encoded
+      advertising_data - the advertising data handed to the dongle
+
+  Return value:
+
+      None
+*/
+
+void save_advertising_data(AdvertisingPayload *payload,
+                           le_set_advertising_data_cp *advertising_data);
+
+/*
+  save_start_to_air_time:
+
+      This function records the time from process start to advertising.
+
+  Parameters:
+
+      is_warm_start - whether the Tag resumed from the state
+      start_to_air_in_us - the time from process start to advertising
+
+  Return value:
+
+      None
+*/
+
+void save_start_to_air_time(bool is_warm_start, uint64_t start_to_air_in_us);
+
+/*
+  crc32_checksum:
+
+      This function computes the CRC-32 (IEEE 802.3) of a buffer.
+
+  Parameters:
+
+      buffer - the buffer
+      length - the number of bytes of the buffer
+
+  Return value:
+
+      uint32_t - the CRC-32 of the buffer
+*/
+
+uint32_t crc32_checksum(const void *buffer, size_t length);
+
+#endif
@@ -0,0 +1,1081 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used by the Tag to keep its
+      advertising in its slot of the frame of the sync beacon, and the
+      simulation of a synchronized fleet.
+
+ File Name:
+
+      Sync.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Sync.h"
+#include "Energy.h"
+#include "Transport.h"
+
+#define Debugging
+
+/* Handle of the advertising dongle, which also scans for the sync
+   beacon */
+static int sync_device_handle = -1;
+
+static bdaddr_t sync_beacon;
+
+static SyncSchedule sync_schedule;
+
+static int realign_interval_in_frames = 0;
+
+static int max_resync_interval_in_seconds = 0;
+
+static pthread_t sync_thread;
+
+static bool sync_running = false;
+
+static int64_t get_time_in_us(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Map an offset into (-frame_period / 2, frame_period / 2] */
+static double wrap_offset(double offset_in_us, double frame_period_in_us){
+    offset_in_us = fmod(offset_in_us, frame_period_in_us);
+    if(offset_in_us > frame_period_in_us / 2){
+        offset_in_us -= frame_period_in_us;
+    }else if(offset_in_us <= -frame_period_in_us / 2){
+        offset_in_us += frame_period_in_us;
+    }
+
+    return offset_in_us;
+}
+
+/* Map an offset into [0, frame_period) */
+static double reduce_offset(double offset_in_us, double frame_period_in_us){
+    offset_in_us = fmod(offset_in_us, frame_period_in_us);
+    if(offset_in_us < 0){
+        offset_in_us += frame_period_in_us;
+    }
+
+    return offset_in_us;
+}
+
+/* The part of the slot by which an offset error may move the first
+   advertising event after a restart without leaving the slot */
+static double get_slot_margin(SyncSchedule *schedule){
+    int64_t margin = (schedule->slot_width_in_us -
+                      MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS) / 2;
+
+    if(margin <= 0){
+        margin = schedule->slot_width_in_us / 4;
+    }
+
+    return margin;
+}
+
+ErrorCode plan_sync_schedule(bdaddr_t *bdaddr,
+                             int frame_period_in_units_0625_ms,
+                             int slot_width_in_ms,
+                             int slot_index,
+                             SyncSchedule *schedule){
+    int interval = 0;
+
+    memset(schedule, 0, sizeof(SyncSchedule));
+
+    if(slot_width_in_ms <= 0 ||
+       frame_period_in_units_0625_ms <
+           MIN_ADVERTISING_INTERVAL_IN_UNITS_0625_MS ||
+       frame_period_in_units_0625_ms >
+           MAX_ADVERTISING_INTERVAL_IN_UNITS_0625_MS){
+        return E_ADVERTISE_MODE;
+    }
+
+    schedule->frame_period_in_us =
+        (int64_t)frame_period_in_units_0625_ms *
+        MICRO_SECONDS_PER_INTERVAL_UNIT;
+    schedule->slot_width_in_us = (int64_t)slot_width_in_ms * 1000;
+    schedule->number_of_slots =
+        schedule->frame_period_in_us / schedule->slot_width_in_us;
+
+    /* Slot 0 belongs to the beacon */
+    if(schedule->number_of_slots < 2 ||
+       0 == slot_index || slot_index >= schedule->number_of_slots){
+        return E_ADVERTISE_MODE;
+    }
+
+    if(slot_index < 0){
+        slot_index = 1 + hash_bdaddr(bdaddr) %
+                         (schedule->number_of_slots - 1);
+    }
+    schedule->slot_index = slot_index;
+
+    /* The first advertising event follows the restart by the advDelay */
+    schedule->restart_offset_in_us =
+        slot_index * schedule->slot_width_in_us +
+        (schedule->slot_width_in_us -
+         MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS) / 2;
+
+    /* Every later event adds the advDelay to the interval, so the interval
+       is shortened by its mean */
+    interval = frame_period_in_units_0625_ms -
+               MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS / 2 /
+               MICRO_SECONDS_PER_INTERVAL_UNIT;
+    if(interval < MIN_ADVERTISING_INTERVAL_IN_UNITS_0625_MS){
+        interval = MIN_ADVERTISING_INTERVAL_IN_UNITS_0625_MS;
+    }
+    schedule->advertising_interval_in_units_0625_ms = interval;
+
+    return WORK_SUCCESSFULLY;
+}
+
+bool parse_sync_report(le_advertising_info *info,
+                       bdaddr_t *beacon,
+                       int *frame_period_in_ms){
+    uint8_t *data = info->data;
+    int length = 0;
+    int i = 0;
+
+    if(0 != memcmp(&info->bdaddr, beacon, sizeof(bdaddr_t))){
+        return false;
+    }
+
+    /* Walk the AD structures for the manufacturer specific data */
+    while(i < info->length){
+        length = data[i];
+        if(0 == length || i + 1 + length > info->length){
+            return false;
+        }
+
+        if(EIR_MANUFACTURE_SPECIFIC_DATA == data[i + 1] &&
+           length - 1 >= SYNC_MANUFACTURER_DATA_LENGTH &&
+           SYNC_COMPANY_IDENTIFIER == (data[i + 2] | (data[i + 3] << 8)) &&
+           SYNC_MARKER_0 == data[i + 4] &&
+           SYNC_MARKER_1 == data[i + 5]){
+            *frame_period_in_ms = data[i + 6] | (data[i + 7] << 8);
+            return true;
+        }
+
+        i += 1 + length;
+    }
+
+    return false;
+}
+
+double estimate_sync_offset(int64_t *reception_times_in_us,
+                            int number_of_samples,
+                            int64_t frame_period_in_us){
+    double reference = 0;
+    double latest = 0;
+    double sample = 0;
+    int i;
+
+    /* A sync advertisement sent at the start of a frame is received at
+       local time t, so the beacon was at the start of a frame at t minus
+       the advDelay, and the offset is -t plus the advDelay */
+    reference = reduce_offset(-(double)reception_times_in_us[0],
+                              frame_period_in_us);
+
+    for(i = 1 ; i < number_of_samples ; i++){
+        sample = wrap_offset(-(double)reception_times_in_us[i] - reference,
+                             frame_period_in_us);
+        if(sample > latest){
+            latest = sample;
+        }
+    }
+
+    return reduce_offset(reference + latest +
+                         MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS /
+                         (number_of_samples + 1.0),
+                         frame_period_in_us);
+}
+
+void init_sync_clock(SyncClock *clock, bool track_skew){
+    memset(clock, 0, sizeof(SyncClock));
+    clock->track_skew = track_skew;
+    clock->resync_interval_in_seconds = SYNC_MIN_RESYNC_INTERVAL_IN_SECONDS;
+}
+
+void update_sync_clock(SyncClock *clock,
+                       SyncSchedule *schedule,
+                       int64_t local_time_in_us,
+                       double measured_offset_in_us,
+                       int max_resync_interval_in_seconds){
+    double frame_period = schedule->frame_period_in_us;
+    double margin = get_slot_margin(schedule);
+    double predicted = 0;
+    double error = 0;
+    double max_skew = SYNC_MAX_SKEW_IN_PPM / 1e6;
+    int64_t elapsed_in_us = 0;
+
+    clock->number_of_misses = 0;
+
+    if(!clock->is_locked){
+        clock->is_locked = true;
+        clock->reference_time_in_us = local_time_in_us;
+        clock->offset_in_us = measured_offset_in_us;
+        clock->skew = 0;
+        clock->last_error_in_us = 0;
+        clock->resync_interval_in_seconds =
+            SYNC_MIN_RESYNC_INTERVAL_IN_SECONDS;
+        return;
+    }
+
+    elapsed_in_us = local_time_in_us - clock->reference_time_in_us;
+    predicted = clock->offset_in_us + clock->skew * elapsed_in_us;
+    error = wrap_offset(measured_offset_in_us - predicted, frame_period);
+
+    /* Second order loop: the offset follows the measurement partly, and
+       the remaining error is read as a skew over the elapsed time */
+    clock->offset_in_us = reduce_offset(predicted +
+                                        SYNC_PLL_OFFSET_GAIN * error,
+                                        frame_period);
+    if(clock->track_skew && elapsed_in_us > 0){
+        clock->skew += SYNC_PLL_SKEW_GAIN * error / elapsed_in_us;
+        if(clock->skew > max_skew){
+            clock->skew = max_skew;
+        }else if(clock->skew < -max_skew){
+            clock->skew = -max_skew;
+        }
+    }
+    clock->reference_time_in_us = local_time_in_us;
+    clock->last_error_in_us = error;
+
+    /* Scan less often while the prediction keeps the Tag well inside its
+       slot, and more often when it does not */
+    if(fabs(error) < margin / 2){
+        clock->resync_interval_in_seconds *= 2;
+        if(clock->resync_interval_in_seconds >
+           max_resync_interval_in_seconds){
+            clock->resync_interval_in_seconds =
+                max_resync_interval_in_seconds;
+        }
+    }else if(fabs(error) > margin){
+        clock->resync_interval_in_seconds /= 2;
+    }
+    if(clock->resync_interval_in_seconds <
+       SYNC_MIN_RESYNC_INTERVAL_IN_SECONDS){
+        clock->resync_interval_in_seconds =
+            SYNC_MIN_RESYNC_INTERVAL_IN_SECONDS;
+    }
+}
+
+int64_t get_next_frame_time(SyncClock *clock,
+                            SyncSchedule *schedule,
+                            int64_t local_time_in_us,
+                            int64_t frame_offset_in_us){
+    double frame_period = schedule->frame_period_in_us;
+    double reference = clock->reference_time_in_us;
+    double beacon_time = 0;
+    double target = 0;
+
+    /* The time of the beacon modulo the frame period */
+    beacon_time = local_time_in_us + clock->offset_in_us +
+                  clock->skew * (local_time_in_us - reference);
+
+    target = ceil((beacon_time - frame_offset_in_us) / frame_period) *
+             frame_period + frame_offset_in_us;
+
+    /* Solve local + offset + skew * (local - reference) = target */
+    return llround((target - clock->offset_in_us + clock->skew * reference) /
+                   (1 + clock->skew));
+}
+
+static ErrorCode set_sync_scan_enable(bool enable){
+    uint8_t status = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    le_set_scan_enable_cp scan_enable;
+
+    memset(&scan_enable, 0, sizeof(scan_enable));
+    scan_enable.enable = enable ? 0x01 : 0x00;
+    scan_enable.filter_dup = 0x00;
+
+    return_value = send_hci_request(sync_device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_SET_SCAN_ENABLE,
+                                    &scan_enable,
+                                    LE_SET_SCAN_ENABLE_CP_SIZE,
+                                    &status, 1);
+    if(WORK_SUCCESSFULLY != return_value){
+        return return_value;
+    }
+
+    return status ? E_ADVERTISE_STATUS : WORK_SUCCESSFULLY;
+}
+
+/* Sleep until the local time in steps, so that ready_to_work is checked
+   while the next restart or scan is far away */
+static bool sleep_until(int64_t local_time_in_us){
+    struct timespec deadline;
+    int64_t now_in_us = 0;
+    int64_t wakeup_in_us = 0;
+
+    while(true == ready_to_work){
+        now_in_us = get_time_in_us();
+        if(now_in_us >= local_time_in_us){
+            return true;
+        }
+
+        wakeup_in_us = local_time_in_us;
+        if(wakeup_in_us - now_in_us >
+           INTERVAL_FOR_BUSY_WAITING_CHECK_IN_MICRO_SECONDS){
+            wakeup_in_us = now_in_us +
+                           INTERVAL_FOR_BUSY_WAITING_CHECK_IN_MICRO_SECONDS;
+        }
+
+        deadline.tv_sec = wakeup_in_us / 1000000;
+        deadline.tv_nsec = (wakeup_in_us % 1000000) * 1000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        account_wakeup();
+    }
+
+    return false;
+}
+
+/* Collect the reception times of sync advertisements until the end of the
+   window or until enough of them are collected */
+static void collect_sync_samples(int64_t window_end_in_us,
+                                 int64_t *reception_times_in_us,
+                                 int max_number_of_samples,
+                                 int *number_of_samples){
+    uint8_t buffer[HCI_MAX_EVENT_SIZE];
+    struct timespec reception_time;
+    evt_le_meta_event *meta_event = NULL;
+    le_advertising_info *info = NULL;
+    uint8_t *report = NULL;
+    int64_t now_in_us = 0;
+    int64_t reception_time_in_us = 0;
+    int frame_period_in_ms = 0;
+    int number_of_reports = 0;
+    int length = 0;
+    int i;
+
+    while(true == ready_to_work &&
+          *number_of_samples < max_number_of_samples){
+        now_in_us = get_time_in_us();
+        if(now_in_us >= window_end_in_us){
+            return;
+        }
+
+        length = receive_hci_event(sync_device_handle, buffer,
+                                   sizeof(buffer),
+                                   (window_end_in_us - now_in_us) / 1000 + 1,
+                                   &reception_time);
+        account_wakeup();
+        if(length < 1 + HCI_EVENT_HDR_SIZE + 2 ||
+           HCI_EVENT_PKT != buffer[0] ||
+           EVT_LE_META_EVENT != buffer[1]){
+            continue;
+        }
+
+        meta_event = (evt_le_meta_event *)(buffer + 1 + HCI_EVENT_HDR_SIZE);
+        if(EVT_LE_ADVERTISING_REPORT != meta_event->subevent){
+            continue;
+        }
+
+        reception_time_in_us = (int64_t)reception_time.tv_sec * 1000000 +
+                               reception_time.tv_nsec / 1000;
+
+        number_of_reports = meta_event->data[0];
+        report = meta_event->data + 1;
+        for(i = 0 ; i < number_of_reports ; i++){
+            info = (le_advertising_info *)report;
+            if(report + sizeof(le_advertising_info) + info->length + 1 >
+               buffer + length){
+                break;
+            }
+            report += sizeof(le_advertising_info) + info->length + 1;
+
+            if(!parse_sync_report(info, &sync_beacon, &frame_period_in_ms)){
+                continue;
+            }
+
+            if((int64_t)frame_period_in_ms * 1000 !=
+               sync_schedule.frame_period_in_us){
+                zlog_error(category_health_report,
+                           "Sync beacon frame %d ms differs from the "
+                           "advertising interval", frame_period_in_ms);
+#ifdef Debugging
+                zlog_error(category_debug,
+                           "Sync beacon frame %d ms differs from the "
+                           "advertising interval", frame_period_in_ms);
+#endif
+                continue;
+            }
+
+            /* The same sync advertisement is received on more than one
+               channel */
+            if(*number_of_samples > 0 &&
+               reception_time_in_us -
+               reception_times_in_us[*number_of_samples - 1] <
+               SCANNER_EVENT_GAP_IN_MILLI_SECONDS * 1000){
+                continue;
+            }
+
+            reception_times_in_us[*number_of_samples] = reception_time_in_us;
+            (*number_of_samples)++;
+            break;
+        }
+    }
+}
+
+/* Scan for the sync beacon. Without a lock the scan runs until enough sync
+   advertisements are received. With a lock only short windows around the
+   predicted sync advertisements are scanned. */
+static void scan_sync_beacon(SyncClock *clock,
+                             int64_t *reception_times_in_us,
+                             int *number_of_samples){
+    int64_t guard_in_us = 0;
+    int64_t expected_in_us = 0;
+    int i;
+
+    *number_of_samples = 0;
+
+    if(!clock->is_locked){
+        if(WORK_SUCCESSFULLY == set_sync_scan_enable(true)){
+            collect_sync_samples(get_time_in_us() +
+                                 SYNC_ACQUISITION_TIMEOUT_IN_MS * 1000LL,
+                                 reception_times_in_us,
+                                 SYNC_SAMPLES_PER_SCAN,
+                                 number_of_samples);
+            set_sync_scan_enable(false);
+        }
+        return;
+    }
+
+    guard_in_us = SYNC_WINDOW_GUARD_IN_MICRO_SECONDS +
+                  2 * (int64_t)fabs(clock->last_error_in_us);
+
+    for(i = 0 ; i < SYNC_SAMPLES_PER_SCAN ; i++){
+        expected_in_us = get_next_frame_time(clock, &sync_schedule,
+                                             get_time_in_us() + guard_in_us,
+                                             0);
+        if(!sleep_until(expected_in_us - guard_in_us)){
+            return;
+        }
+
+        if(WORK_SUCCESSFULLY != set_sync_scan_enable(true)){
+            return;
+        }
+        collect_sync_samples(expected_in_us +
+                             MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS +
+                             guard_in_us,
+                             reception_times_in_us,
+                             *number_of_samples + 1,
+                             number_of_samples);
+        set_sync_scan_enable(false);
+    }
+}
+
+static void resync(SyncClock *clock){
+    int64_t reception_times_in_us[SYNC_SAMPLES_PER_SCAN];
+    int number_of_samples = 0;
+    bool was_locked = clock->is_locked;
+
+    scan_sync_beacon(clock, reception_times_in_us, &number_of_samples);
+
+    if(0 == number_of_samples){
+        clock->number_of_misses++;
+        if(clock->is_locked && clock->number_of_misses >= SYNC_MAX_MISSES){
+            zlog_error(category_health_report,
+                       "Lost sync beacon, advertising unsynchronized");
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "Lost sync beacon, advertising unsynchronized");
+#endif
+            init_sync_clock(clock, true);
+        }
+        return;
+    }
+
+    update_sync_clock(clock, &sync_schedule,
+                      reception_times_in_us[number_of_samples - 1],
+                      estimate_sync_offset(reception_times_in_us,
+                                           number_of_samples,
+                                           sync_schedule.frame_period_in_us),
+                      max_resync_interval_in_seconds);
+
+    zlog_info(category_health_report,
+              "Sync %s slot %d: samples %d, error %.0f us, skew %.2f ppm, "
+              "next sync in %d s",
+              was_locked ? "tracking" : "locked",
+              sync_schedule.slot_index,
+              number_of_samples,
+              clock->last_error_in_us,
+              clock->skew * 1e6,
+              clock->resync_interval_in_seconds);
+}
+
+static void *align_advertising(void *argument){
+    SyncClock clock;
+    int64_t next_resync_in_us = 0;
+    int64_t next_restart_in_us = 0;
+    bool has_interval = false;
+
+    TRACE_THREAD_START();
+    set_energy_subsystem(SUBSYSTEM_SYNC);
+
+    init_sync_clock(&clock, true);
+    next_resync_in_us = get_time_in_us();
+
+    while(true == ready_to_work){
+
+        if(get_time_in_us() >= next_resync_in_us){
+            resync(&clock);
+
+            /* The frame period is the interval of the events only after
+               the interval is shortened by the mean advDelay */
+            if(clock.is_locked && !has_interval){
+                TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK,
+                                 &g_advertising.lock);
+                has_interval = WORK_SUCCESSFULLY == set_advertising_interval(
+                    sync_device_handle,
+                    sync_schedule.advertising_interval_in_units_0625_ms,
+                    sync_schedule.advertising_interval_in_units_0625_ms);
+                pthread_mutex_unlock(&g_advertising.lock);
+            }
+
+            if(clock.is_locked){
+                next_restart_in_us = get_next_frame_time(
+                    &clock, &sync_schedule,
+                    get_time_in_us() + SYNC_REALIGN_LEAD_IN_MICRO_SECONDS,
+                    sync_schedule.restart_offset_in_us);
+            }
+
+            next_resync_in_us = get_time_in_us() +
+                (clock.is_locked ? clock.resync_interval_in_seconds :
+                                   SYNC_MIN_RESYNC_INTERVAL_IN_SECONDS) *
+                1000000LL;
+        }
+
+        if(clock.is_locked && next_restart_in_us <= next_resync_in_us){
+            if(!sleep_until(next_restart_in_us)){
+                break;
+            }
+
+            TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+            if(WORK_SUCCESSFULLY != restart_advertising(sync_device_handle)){
+                zlog_error(category_health_report,
+                           "Unable to restart advertising at slot %d",
+                           sync_schedule.slot_index);
+#ifdef Debugging
+                zlog_error(category_debug,
+                           "Unable to restart advertising at slot %d",
+                           sync_schedule.slot_index);
+#endif
+            }
+            pthread_mutex_unlock(&g_advertising.lock);
+
+            /* The restart after realign_interval_in_frames frames */
+            next_restart_in_us = get_next_frame_time(
+                &clock, &sync_schedule,
+                next_restart_in_us +
+                (realign_interval_in_frames - 1) *
+                    sync_schedule.frame_period_in_us +
+                sync_schedule.frame_period_in_us / 2,
+                sync_schedule.restart_offset_in_us);
+            continue;
+        }
+
+        sleep_until(next_resync_in_us);
+    }
+
+    return NULL;
+}
+
+ErrorCode start_beacon_sync(Config *config, bdaddr_t *identity){
+    uint8_t status = 0;
+    int retry_time = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    le_set_scan_parameters_cp scan_parameters;
+    struct hci_filter filter;
+
+    if(0 == strlen(config->sync_beacon_address)){
+        return WORK_SUCCESSFULLY;
+    }
+
+    if(str2ba(config->sync_beacon_address, &sync_beacon) < 0 ||
+       config->sync_realign_interval_in_frames <= 0 ||
+       WORK_SUCCESSFULLY != plan_sync_schedule(
+           identity,
+           config->advertise_interval_in_units_0625_ms,
+           config->sync_slot_width_in_ms,
+           config->sync_slot_index,
+           &sync_schedule)){
+        zlog_error(category_health_report,
+                   "Invalid beacon sync config");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Invalid beacon sync config");
+#endif
+        return E_ADVERTISE_MODE;
+    }
+
+    realign_interval_in_frames = config->sync_realign_interval_in_frames;
+    max_resync_interval_in_seconds =
+        config->sync_max_resync_interval_in_seconds;
+    if(max_resync_interval_in_seconds < SYNC_MIN_RESYNC_INTERVAL_IN_SECONDS){
+        max_resync_interval_in_seconds = SYNC_MIN_RESYNC_INTERVAL_IN_SECONDS;
+    }
+
+    retry_time = SOCKET_OPEN_RETRY;
+    while(retry_time--){
+        sync_device_handle = open_hci_device(g_advertising.dongle_device_id);
+
+        if(sync_device_handle >= 0){
+            break;
+        }
+    }
+
+    if(sync_device_handle < 0){
+        zlog_error(category_health_report,
+                   "Error openning socket for beacon sync");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Error openning socket for beacon sync");
+#endif
+        return E_OPEN_DEVICE;
+    }
+
+    /* The advertising dongle scans passively between its advertising
+       events */
+    set_sync_scan_enable(false);
+
+    memset(&scan_parameters, 0, sizeof(scan_parameters));
+    scan_parameters.type = SCANNER_TYPE_PASSIVE;
+    scan_parameters.interval = htobs(SCANNER_INTERVAL_IN_UNITS_0625_MS);
+    scan_parameters.window = htobs(SCANNER_WINDOW_IN_UNITS_0625_MS);
+    scan_parameters.own_bdaddr_type = LE_PUBLIC_ADDRESS;
+    scan_parameters.filter = 0x00;
+
+    return_value = send_hci_request(sync_device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_SET_SCAN_PARAMETERS,
+                                    &scan_parameters,
+                                    LE_SET_SCAN_PARAMETERS_CP_SIZE,
+                                    &status, 1);
+    if(WORK_SUCCESSFULLY == return_value && status){
+        return_value = E_ADVERTISE_STATUS;
+    }
+    if(WORK_SUCCESSFULLY != return_value){
+        zlog_error(category_health_report,
+                   "Unable to set scan parameters for beacon sync");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to set scan parameters for beacon sync");
+#endif
+        close_hci_device(sync_device_handle);
+        sync_device_handle = -1;
+        return return_value;
+    }
+
+    /* A raw HCI socket of BlueZ delivers only LE meta events to the sync
+       thread between its commands. The shared handle of an exclusive
+       transport does not filter. */
+    hci_filter_clear(&filter);
+    hci_filter_set_ptype(HCI_EVENT_PKT, &filter);
+    hci_filter_set_event(EVT_LE_META_EVENT, &filter);
+    setsockopt(sync_device_handle, SOL_HCI, HCI_FILTER,
+               &filter, sizeof(filter));
+
+    zlog_info(category_health_report,
+              "Beacon sync to %s, slot %d of %d, width %d ms",
+              config->sync_beacon_address,
+              sync_schedule.slot_index,
+              sync_schedule.number_of_slots,
+              config->sync_slot_width_in_ms);
+
+    if(0 != pthread_create(&sync_thread, NULL, align_advertising, NULL)){
+        zlog_error(category_health_report,
+                   "Unable to start the thread of the beacon sync");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to start the thread of the beacon sync");
+#endif
+        stop_beacon_sync();
+        return E_START_THREAD;
+    }
+    sync_running = true;
+
+    return WORK_SUCCESSFULLY;
+}
+
+void stop_beacon_sync(void){
+    if(sync_running){
+        pthread_join(sync_thread, NULL);
+        sync_running = false;
+    }
+
+    if(sync_device_handle >= 0){
+        set_sync_scan_enable(false);
+        close_hci_device(sync_device_handle);
+        sync_device_handle = -1;
+    }
+}
+
+static int compare_slot_error(const void *lhs, const void *rhs){
+    int64_t left = *(const int64_t *)lhs;
+    int64_t right = *(const int64_t *)rhs;
+
+    return (left > right) - (left < right);
+}
+
+/* A simulated Tag. Its local clock runs at local = (beacon - offset) /
+   (1 + skew) against the clock of the beacon, which is the simulated
+   time. */
+typedef struct SimulatedTag {
+
+    SyncSchedule schedule;
+
+    SyncClock clock;
+
+    double offset_in_us;
+
+    double skew;
+
+    /* Simulated time of the next advertising event, the next scan and
+       the next restart */
+    int64_t next_event_in_us;
+    int64_t next_resync_in_us;
+    int64_t next_restart_in_us;
+
+} SimulatedTag;
+
+static int64_t to_local_time(SimulatedTag *tag, int64_t time_in_us){
+    return llround((time_in_us - tag->offset_in_us) / (1 + tag->skew));
+}
+
+static int64_t to_simulated_time(SimulatedTag *tag, int64_t local_in_us){
+    return llround(local_in_us * (1 + tag->skew) + tag->offset_in_us);
+}
+
+/* Scan for the sync advertisements after the given time like
+   scan_sync_beacon, and return the time at which the scan ends */
+static int64_t simulate_scan(SimulatedTag *tag,
+                             int64_t time_in_us,
+                             unsigned int *seed,
+                             int max_resync_interval_in_seconds){
+    int64_t reception_times_in_us[SYNC_SAMPLES_PER_SCAN];
+    int64_t frame_period = tag->schedule.frame_period_in_us;
+    int64_t beacon_in_us = 0;
+    int64_t reception_in_us = 0;
+    int64_t expected_in_us = 0;
+    int64_t guard_in_us = 0;
+    int number_of_samples = 0;
+    int i;
+
+    guard_in_us = SYNC_WINDOW_GUARD_IN_MICRO_SECONDS +
+                  2 * (int64_t)fabs(tag->clock.last_error_in_us);
+
+    for(i = 0 ; i < SYNC_SAMPLES_PER_SCAN ; i++){
+        beacon_in_us = (time_in_us / frame_period + 1 + i) * frame_period +
+                       rand_r(seed) %
+                       (MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS + 1);
+        reception_in_us = to_local_time(
+            tag, beacon_in_us +
+                 rand_r(seed) % SIMULATED_HOST_LATENCY_IN_MICRO_SECONDS);
+
+        /* A locked Tag only hears the advertisements in its windows */
+        if(tag->clock.is_locked){
+            expected_in_us = get_next_frame_time(
+                &tag->clock, &tag->schedule,
+                reception_in_us - frame_period / 2, 0);
+            if(reception_in_us < expected_in_us - guard_in_us ||
+               reception_in_us > expected_in_us + guard_in_us +
+                                 MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS){
+                continue;
+            }
+        }
+        reception_times_in_us[number_of_samples++] = reception_in_us;
+    }
+
+    time_in_us = beacon_in_us + MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS;
+
+    if(0 == number_of_samples){
+        tag->clock.number_of_misses++;
+        if(tag->clock.is_locked &&
+           tag->clock.number_of_misses >= SYNC_MAX_MISSES){
+            init_sync_clock(&tag->clock, tag->clock.track_skew);
+        }
+        return time_in_us;
+    }
+
+    update_sync_clock(&tag->clock, &tag->schedule,
+                      reception_times_in_us[number_of_samples - 1],
+                      estimate_sync_offset(reception_times_in_us,
+                                           number_of_samples,
+                                           frame_period),
+                      max_resync_interval_in_seconds);
+
+    return time_in_us;
+}
+
+ErrorCode simulate_sync_fleet(int number_of_tags,
+                              Config *config,
+                              int realign_interval_in_frames,
+                              bool track_skew,
+                              bool assign_slots,
+                              int duration_in_seconds,
+                              SyncSimulationResult *result){
+    unsigned int seed = SIMULATION_RANDOM_SEED;
+    int64_t duration_in_us = (int64_t)duration_in_seconds * 1000000;
+    int64_t *events = NULL;
+    int64_t *slot_errors = NULL;
+    int64_t frame_period = 0;
+    int64_t slot_middle = 0;
+    int64_t position = 0;
+    int64_t now_in_us = 0;
+    int64_t restart_in_us = 0;
+    size_t events_per_tag = 0;
+    size_t number_of_events = 0;
+    size_t number_of_in_slot = 0;
+    size_t number_of_collided = 0;
+    long number_of_scans = 0;
+    int max_resync = config->sync_max_resync_interval_in_seconds;
+    int interval_in_us = 0;
+    int number_of_slots = 0;
+    int tag_index;
+    SimulatedTag tag;
+    bdaddr_t bdaddr;
+
+    memset(result, 0, sizeof(SyncSimulationResult));
+    memset(&bdaddr, 0, sizeof(bdaddr));
+
+    if(number_of_tags <= 0 || duration_in_seconds <= 0 ||
+       realign_interval_in_frames <= 0 ||
+       WORK_SUCCESSFULLY != plan_sync_schedule(
+           &bdaddr, config->advertise_interval_in_units_0625_ms,
+           config->sync_slot_width_in_ms, -1, &tag.schedule)){
+        return E_ADVERTISE_MODE;
+    }
+    if(max_resync < SYNC_MIN_RESYNC_INTERVAL_IN_SECONDS){
+        max_resync = SYNC_MIN_RESYNC_INTERVAL_IN_SECONDS;
+    }
+
+    /* Restarts add at most one event per frame */
+    frame_period = tag.schedule.frame_period_in_us;
+    number_of_slots = tag.schedule.number_of_slots;
+    events_per_tag = 2 * (duration_in_us / frame_period + 1);
+
+    events = (int64_t *)malloc(sizeof(int64_t) * events_per_tag *
+                               number_of_tags);
+    slot_errors = (int64_t *)malloc(sizeof(int64_t) * events_per_tag *
+                                    number_of_tags);
+    if(NULL == events || NULL == slot_errors){
+        free(events);
+        free(slot_errors);
+        return E_ADVERTISE_MODE;
+    }
+
+    for(tag_index = 0 ; tag_index < number_of_tags ; tag_index++){
+
+        /* Addresses follow the C1: prefix assigned by change_mac.sh */
+        memset(&bdaddr, 0, sizeof(bdaddr));
+        bdaddr.b[5] = 0xC1;
+        bdaddr.b[0] = tag_index & 0xFF;
+        bdaddr.b[1] = (tag_index >> 8) & 0xFF;
+        bdaddr.b[2] = rand_r(&seed) & 0xFF;
+
+        plan_sync_schedule(&bdaddr,
+                           config->advertise_interval_in_units_0625_ms,
+                           config->sync_slot_width_in_ms,
+                           assign_slots ?
+                               1 + tag_index % (number_of_slots - 1) : -1,
+                           &tag.schedule);
+        init_sync_clock(&tag.clock, track_skew);
+
+        tag.offset_in_us = rand_r(&seed) % frame_period;
+        tag.skew = ((double)rand_r(&seed) / RAND_MAX * 2 - 1) *
+                   SIMULATED_SKEW_IN_PPM / 1e6;
+
+        /* Unsynchronized until the first scan ends */
+        interval_in_us = config->advertise_interval_in_units_0625_ms *
+                         MICRO_SECONDS_PER_INTERVAL_UNIT;
+        tag.next_event_in_us =
+            rand_r(&seed) % SIMULATED_BOOT_WINDOW_IN_MICRO_SECONDS;
+        tag.next_resync_in_us = tag.next_event_in_us;
+        tag.next_restart_in_us = INT64_MAX;
+
+        slot_middle = tag.schedule.slot_index * tag.schedule.slot_width_in_us +
+                      tag.schedule.slot_width_in_us / 2;
+
+        while(true){
+            now_in_us = tag.next_event_in_us;
+            if(tag.next_resync_in_us < now_in_us){
+                now_in_us = tag.next_resync_in_us;
+            }
+            if(tag.next_restart_in_us < now_in_us){
+                now_in_us = tag.next_restart_in_us;
+            }
+            if(now_in_us >= duration_in_us){
+                break;
+            }
+
+            if(now_in_us == tag.next_event_in_us){
+                if(number_of_events < events_per_tag * number_of_tags){
+                    events[number_of_events] = now_in_us;
+                    position = (int64_t)wrap_offset(now_in_us - slot_middle,
+                                                    frame_period);
+                    slot_errors[number_of_events] =
+                        position < 0 ? -position : position;
+                    if(position >= -tag.schedule.slot_width_in_us / 2 &&
+                       position + ADVERTISING_PDU_AIR_TIME_IN_MICRO_SECONDS <=
+                       tag.schedule.slot_width_in_us / 2){
+                        number_of_in_slot++;
+                    }
+                    number_of_events++;
+                }
+
+                tag.next_event_in_us += interval_in_us +
+                    rand_r(&seed) %
+                    (MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS + 1);
+                continue;
+            }
+
+            if(now_in_us == tag.next_resync_in_us){
+                now_in_us = simulate_scan(&tag, now_in_us, &seed,
+                                          max_resync);
+                number_of_scans++;
+
+                if(tag.clock.is_locked){
+                    interval_in_us =
+                        tag.schedule.advertising_interval_in_units_0625_ms *
+                        MICRO_SECONDS_PER_INTERVAL_UNIT;
+                    tag.next_restart_in_us = to_simulated_time(
+                        &tag, get_next_frame_time(
+                            &tag.clock, &tag.schedule,
+                            to_local_time(&tag, now_in_us) +
+                            SYNC_REALIGN_LEAD_IN_MICRO_SECONDS,
+                            tag.schedule.restart_offset_in_us));
+                }else{
+                    tag.next_restart_in_us = INT64_MAX;
+                }
+                tag.next_resync_in_us = now_in_us +
+                    (tag.clock.is_locked ?
+                     tag.clock.resync_interval_in_seconds :
+                     SYNC_MIN_RESYNC_INTERVAL_IN_SECONDS) * 1000000LL;
+                continue;
+            }
+
+            /* The restart cancels the pending advertising event, and the
+               controller starts a new one after the advDelay */
+            restart_in_us = now_in_us +
+                rand_r(&seed) % SIMULATED_HOST_LATENCY_IN_MICRO_SECONDS;
+            tag.next_event_in_us = restart_in_us +
+                rand_r(&seed) % (MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS + 1);
+            tag.next_restart_in_us = to_simulated_time(
+                &tag, get_next_frame_time(
+                    &tag.clock, &tag.schedule,
+                    to_local_time(&tag, now_in_us) +
+                    (realign_interval_in_frames - 1) * frame_period +
+                    frame_period / 2,
+                    tag.schedule.restart_offset_in_us));
+        }
+    }
+
+    if(number_of_events > 0){
+        number_of_collided = count_collided_events(events, number_of_events);
+        qsort(slot_errors, number_of_events, sizeof(int64_t),
+              compare_slot_error);
+
+        result->delivery_rate =
+            (double)(number_of_events - number_of_collided) /
+            number_of_events;
+        result->in_slot_rate = (double)number_of_in_slot / number_of_events;
+        result->slot_error_p50_in_us = slot_errors[number_of_events / 2];
+        result->slot_error_p99_in_us =
+            slot_errors[(size_t)(number_of_events * 0.99)];
+    }
+    result->scans_per_hour = (double)number_of_scans / number_of_tags /
+                             duration_in_seconds * 3600;
+
+    free(events);
+    free(slot_errors);
+
+    return WORK_SUCCESSFULLY;
+}
+
+void print_sync_simulation(int number_of_tags, Config *config){
+    int realign_intervals[] = {1, 2, 4, 8};
+    int duration_in_seconds = 14400;
+    bool track_skew[] = {true, true, false};
+    bool assign_slots[] = {false, true, true};
+    SyncSimulationResult result;
+    SyncSchedule schedule;
+    bdaddr_t bdaddr;
+    size_t i, j;
+
+    memset(&bdaddr, 0, sizeof(bdaddr));
+    if(WORK_SUCCESSFULLY != plan_sync_schedule(
+           &bdaddr, config->advertise_interval_in_units_0625_ms,
+           config->sync_slot_width_in_ms, -1, &schedule)){
+        printf("No slot schedule for interval %d x 0.625 ms and slot "
+               "width %d ms\n",
+               config->advertise_interval_in_units_0625_ms,
+               config->sync_slot_width_in_ms);
+        return;
+    }
+
+    printf("Synchronized fleet of %d tags, %d slots of %d ms, skew up to "
+           "%d ppm, %d s simulated\n",
+           number_of_tags, schedule.number_of_slots - 1,
+           config->sync_slot_width_in_ms, SIMULATED_SKEW_IN_PPM,
+           duration_in_seconds);
+    printf("%-8s %-8s %-8s %-12s %-12s %-10s %-10s %-10s\n",
+           "realign", "slots", "pll", "err_p50_us", "err_p99_us", "in_slot",
+           "delivery", "scans/h");
+    printf("%-8s %-8s %-8s %-12s %-12s %-10s %-10.4f %-10s\n",
+           "-", "planned", "-", "-", "-", "-",
+           simulate_fleet_delivery_rate(
+               number_of_tags,
+               config->advertise_interval_in_units_0625_ms,
+               config->advertise_interval_spread_in_units_0625_ms,
+               true,
+               config->advertise_use_interval_range,
+               MAX_ADVERTISING_DELAY_IN_MICRO_SECONDS,
+               duration_in_seconds),
+           "-");
+
+    for(i = 0 ; i < sizeof(track_skew) / sizeof(track_skew[0]) ; i++){
+        for(j = 0 ; j < sizeof(realign_intervals) /
+                        sizeof(realign_intervals[0]) ; j++){
+            if(WORK_SUCCESSFULLY != simulate_sync_fleet(
+                   number_of_tags, config, realign_intervals[j],
+                   track_skew[i], assign_slots[i], duration_in_seconds,
+                   &result)){
+                printf("Simulation failed\n");
+                return;
+            }
+
+            printf("%-8d %-8s %-8s %-12lld %-12lld %-10.4f %-10.4f "
+                   "%-10.1f\n",
+                   realign_intervals[j],
+                   assign_slots[i] ? "assigned" : "derived",
+                   track_skew[i] ? "skew" : "offset",
+                   (long long)result.slot_error_p50_in_us,
+                   (long long)result.slot_error_p99_in_us,
+                   result.in_slot_rate,
+                   result.delivery_rate,
+                   result.scans_per_hour);
+        }
+    }
+}
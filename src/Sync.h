@@ -0,0 +1,426 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to align its advertising to a slot of the frame of a
+    designated LBeacon, and to simulate the slot error and the delivery
+    rate of a synchronized fleet.
+
+File Name:
+
+    Sync.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    The sync beacon is a LBeacon which sends a sync advertisement at the
+    start of every frame, whose period is the advertising interval of the
+    fleet. The advertisement carries the frame period in its manufacturer
+    specific data. The Tag scans briefly for a few sync advertisements,
+    estimates the offset between its clock and the clock of the beacon,
+    and feeds the estimate into a second order PLL which tracks both the
+    offset and the skew of the two clocks. The interval between scans is
+    doubled while the PLL predicts the offset well and halved when it does
+    not, so that a locked Tag scans only every few minutes.
+
+    Each frame is divided into slots of equal width. Slot 0 belongs to the
+    beacon, and the Tag takes the slot derived from its identity or the
+    configured one. The controller adds a pseudo-random advDelay of 0 to
+    10 ms to every advertising event, so the advertising events of a Tag
+    wander off its slot as a random walk. The Tag advertises with the
+    frame period shortened by the mean advDelay and restarts advertising
+    at its slot every few frames, which pulls the walk back into the slot.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <math.h>
+#include <time.h>
+
+#include "Tag.h"
+#include "Planner.h"
+#include "Scanner.h"
+
+/*
+  CONSTANTS
+*/
+
+/* Company identifier and marker of the manufacturer specific data of the
+   sync advertisement, followed by the frame period in milliseconds */
+#define SYNC_COMPANY_IDENTIFIER 0x000F
+#define SYNC_MARKER_0 0x42
+#define SYNC_MARKER_1 0x53
+
+/* Length of the manufacturer specific data of the sync advertisement:
+   company identifier, marker and frame period */
+#define SYNC_MANUFACTURER_DATA_LENGTH 6
+
+/* Number of sync advertisements collected by one scan */
+#define SYNC_SAMPLES_PER_SCAN 4
+
+/* Time in milliseconds to scan for the sync beacon while the PLL is not
+   locked */
+#define SYNC_ACQUISITION_TIMEOUT_IN_MS 10000
+
+/* Margin in micro seconds added to both sides of the scan window around a
+   predicted sync advertisement, on top of the last offset error */
+#define SYNC_WINDOW_GUARD_IN_MICRO_SECONDS 5000
+
+/* Bounds of the interval in seconds between scans of a locked Tag. The
+   upper bound is configured. */
+#define SYNC_MIN_RESYNC_INTERVAL_IN_SECONDS 15
+
+/* Number of scans in a row without a sync advertisement after which the
+   Tag gives up the lock and stops realigning */
+#define SYNC_MAX_MISSES 3
+
+/* Gains of the offset and the skew of the PLL */
+#define SYNC_PLL_OFFSET_GAIN 0.7
+#define SYNC_PLL_SKEW_GAIN 0.3
+
+/* Bound of the skew in parts per million tracked by the PLL */
+#define SYNC_MAX_SKEW_IN_PPM 200
+
+/* Time in micro seconds ahead of a slot at which the Tag decides to
+   restart advertising at the slot */
+#define SYNC_REALIGN_LEAD_IN_MICRO_SECONDS 2000
+
+/* Maximum skew in parts per million between the clocks of the simulated
+   tags and the beacon */
+#define SIMULATED_SKEW_IN_PPM 50
+
+/* Upper bound in micro seconds of the latency from the wakeup of a
+   simulated Tag to its HCI command reaching the controller, and from a
+   received advertisement to its timestamp */
+#define SIMULATED_HOST_LATENCY_IN_MICRO_SECONDS 1000
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The slot of the Tag in the frame of the sync beacon */
+typedef struct SyncSchedule {
+
+    /* Period in micro seconds of the frame, which is the advertising
+       interval of the fleet */
+    int64_t frame_period_in_us;
+
+    int64_t slot_width_in_us;
+
+    int number_of_slots;
+
+    /* The slot of the Tag, between 1 and number_of_slots - 1 */
+    int slot_index;
+
+    /* Offset in micro seconds in the frame at which advertising is
+       restarted, so that the first advertising event after the restart
+       falls in the middle of the slot on average */
+    int64_t restart_offset_in_us;
+
+    /* Advertising interval in units of 0.625ms which keeps the advertising
+       events at the frame period on average */
+    int advertising_interval_in_units_0625_ms;
+
+} SyncSchedule;
+
+/* The estimate of the clock of the sync beacon, maintained by the PLL */
+typedef struct SyncClock {
+
+    bool is_locked;
+
+    /* Whether the PLL tracks the skew, or only the offset */
+    bool track_skew;
+
+    /* Local CLOCK_MONOTONIC time in micro seconds of the last update */
+    int64_t reference_time_in_us;
+
+    /* The time of the beacon minus the local time at the reference time,
+       modulo the frame period */
+    double offset_in_us;
+
+    /* Rate of the clock of the beacon relative to the local clock, minus
+       one */
+    double skew;
+
+    /* Offset error of the last update against the prediction */
+    double last_error_in_us;
+
+    int resync_interval_in_seconds;
+
+    int number_of_misses;
+
+} SyncClock;
+
+/* The outcome of one run of the synchronized fleet simulation */
+typedef struct SyncSimulationResult {
+
+    /* Fraction of advertising events received without collision */
+    double delivery_rate;
+
+    /* Fraction of advertising events which start in the slot of the Tag */
+    double in_slot_rate;
+
+    /* Percentiles of the distance in micro seconds between an advertising
+       event and the middle of the slot of the Tag */
+    int64_t slot_error_p50_in_us;
+    int64_t slot_error_p99_in_us;
+
+    /* Scans of the sync beacon per Tag per hour */
+    double scans_per_hour;
+
+} SyncSimulationResult;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  plan_sync_schedule:
+
+      This function divides the frame into slots, and takes the configured
+      slot or derives the slot from the BD address of the dongle.
+
+  Parameters:
+
+      bdaddr - the BD address of the dongle used to advertise
+      frame_period_in_units_0625_ms - the advertising interval of the fleet
+      slot_width_in_ms - the width of a slot
+      slot_index - the configured slot, or -1 to derive it from bdaddr
+      schedule - the pointer to the schedule to be filled
+
+  Return value:
+
+      ErrorCode - E_ADVERTISE_MODE if the frame holds no slot for tags or
+                  the configured slot is outside the frame, or
+                  WORK_SUCCESSFULLY otherwise
+*/
+
+ErrorCode plan_sync_schedule(bdaddr_t *bdaddr,
+                             int frame_period_in_units_0625_ms,
+                             int slot_width_in_ms,
+                             int slot_index,
+                             SyncSchedule *schedule);
+
+/*
+  parse_sync_report:
+
+      This function tells whether an advertising report is a sync
+      advertisement of the sync beacon.
+
+  Parameters:
+
+      info - the advertising report
+      beacon - the BD address of the sync beacon
+      frame_period_in_ms - the frame period carried by the advertisement
+
+  Return value:
+
+      bool - true if the advertising report is a sync advertisement
+*/
+
+bool parse_sync_report(le_advertising_info *info,
+                       bdaddr_t *beacon,
+                       int *frame_period_in_ms);
+
+/*
+  estimate_sync_offset:
+
+      This function estimates the offset between the clock of the beacon
+      and the local clock from the reception times of sync advertisements.
+      The advDelay only delays a sync advertisement, so the earliest
+      reception relative to the frame is the best, and the expected
+      minimum of the advDelay is added back.
+
+  Parameters:
+
+      reception_times_in_us - the local reception times
+      number_of_samples - the number of reception times
+      frame_period_in_us - the frame period
+
+  Return value:
+
+      double - the offset in micro seconds, modulo the frame period
+*/
+
+double estimate_sync_offset(int64_t *reception_times_in_us,
+                            int number_of_samples,
+                            int64_t frame_period_in_us);
+
+/*
+  init_sync_clock:
+
+      This function resets the PLL to the unlocked state.
+
+  Parameters:
+
+      clock - the clock estimate
+      track_skew - whether the PLL tracks the skew of the clocks
+
+  Return value:
+
+      None
+*/
+
+void init_sync_clock(SyncClock *clock, bool track_skew);
+
+/*
+  update_sync_clock:
+
+      This function feeds a measured offset into the PLL and adapts the
+      interval to the next scan to the error of the prediction. The first
+      measurement locks the PLL.
+
+  Parameters:
+
+      clock - the clock estimate
+      schedule - the slot of the Tag
+      local_time_in_us - the local time of the measurement
+      measured_offset_in_us - the offset from estimate_sync_offset
+      max_resync_interval_in_seconds - the upper bound of the interval to
+                                       the next scan
+
+  Return value:
+
+      None
+*/
+
+void update_sync_clock(SyncClock *clock,
+                       SyncSchedule *schedule,
+                       int64_t local_time_in_us,
+                       double measured_offset_in_us,
+                       int max_resync_interval_in_seconds);
+
+/*
+  get_next_frame_time:
+
+      This function predicts the local time at which the beacon reaches
+      the given offset in its next frame after the given local time.
+
+  Parameters:
+
+      clock - the locked clock estimate
+      schedule - the slot of the Tag
+      local_time_in_us - the local time after which the frame offset is
+                         reached
+      frame_offset_in_us - the offset in the frame of the beacon
+
+  Return value:
+
+      int64_t - the predicted local time in micro seconds
+*/
+
+int64_t get_next_frame_time(SyncClock *clock,
+                            SyncSchedule *schedule,
+                            int64_t local_time_in_us,
+                            int64_t frame_offset_in_us);
+
+/*
+  start_beacon_sync:
+
+      This function starts the thread which keeps the advertising of the
+      Tag in its slot of the frame of the sync beacon. Nothing is started
+      if no sync beacon is configured.
+
+  Parameters:
+
+      config - the pointer to the config struct of the Tag
+      identity - the BD address of the advertising dongle of the Tag
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode start_beacon_sync(Config *config, bdaddr_t *identity);
+
+/*
+  stop_beacon_sync:
+
+      This function waits for the sync thread to notice that ready_to_work
+      is cleared, and stops the LE scan. Advertising stays enabled with the
+      last interval.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      None
+*/
+
+void stop_beacon_sync(void);
+
+/*
+  simulate_sync_fleet:
+
+      This function simulates a fleet of tags synchronized to a sync beacon
+      on the controller model of simulate_fleet_delivery_rate. Every Tag
+      runs the PLL on its own clock, which is skewed against the clock of
+      the beacon, and restarts advertising at its slot.
+
+  Parameters:
+
+      number_of_tags - the number of tags in the fleet
+      config - the pointer to the config struct of the Tag
+      realign_interval_in_frames - the number of frames between restarts
+      track_skew - whether the PLL tracks the skew of the clocks
+      assign_slots - whether the tags take distinct configured slots in
+                     turn, or derive their slots from their BD addresses
+      duration_in_seconds - the simulated time
+      result - the pointer to the result to be filled
+
+  Return value:
+
+      ErrorCode - E_ADVERTISE_MODE if the config gives no valid slot
+                  schedule or the simulation cannot allocate its event
+                  table, or WORK_SUCCESSFULLY otherwise
+*/
+
+ErrorCode simulate_sync_fleet(int number_of_tags,
+                              Config *config,
+                              int realign_interval_in_frames,
+                              bool track_skew,
+                              bool assign_slots,
+                              int duration_in_seconds,
+                              SyncSimulationResult *result);
+
+/*
+  print_sync_simulation:
+
+      This function runs the synchronized fleet simulation over a range of
+      realign intervals, with derived and assigned slots and with and
+      without skew tracking, and prints the slot error, the delivery rate
+      and the scan rate next to the delivery rate of the planned,
+      unsynchronized fleet.
+
+  Parameters:
+
+      number_of_tags - the number of tags in the fleet
+      config - the pointer to the config struct of the Tag
+
+  Return value:
+
+      None
+*/
+
+void print_sync_simulation(int number_of_tags, Config *config);
+
+#endif
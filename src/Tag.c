@@ -28,10 +28,34 @@
 */
 
 #include "Tag.h"
-#include "zlog.h"
+#include "Planner.h"
+#include "Power.h"
+#include "Capability.h"
+#include "RealTime.h"
+#include "Control.h"
+#include "Sensor.h"
+#include "Scanner.h"
+#include "State.h"
+#include "Upgrade.h"
+#include "Energy.h"
+#include "Template.h"
+#include "Transport.h"
+#include "Sync.h"
+#include "Locator.h"
+#include "Privacy.h"
 
 #define Debugging
 
+bool ready_to_work;
+
+zlog_category_t *category_health_report, *category_debug;
+
+Config g_config;
+
+char lbeacon_uuid[LENGTH_OF_UUID];
+
+AdvertisingState g_advertising = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
 ErrorCode single_running_instance(char *file_name){
     int retry_time = 0;
     int lock_file = 0;
@@ -89,77 +113,348 @@ ErrorCode single_running_instance(char *file_name){
 }
 
 
+/* The kinds of values of the config items */
+typedef enum _ConfigItemType {
+    CONFIG_INTEGER,
+    CONFIG_BOOL,
+    CONFIG_DOUBLE,
+    CONFIG_STRING
+} ConfigItemType;
+
+/* A config item, the field of Config it fills and its default value */
+typedef struct ConfigItem {
+    char *key;
+    ConfigItemType type;
+    size_t offset;
+    size_t size;
+    /* The value of a missing item, or NULL if the item is required */
+    char *default_value;
+} ConfigItem;
+
+#define CONFIG_ITEM(key, type, field, default_value) \
+    { key, type, offsetof(Config, field), sizeof(((Config *)0)->field), \
+      default_value }
+
+/* Items 1 to 3 were the whole config of the first Tags. Every later item
+   has a default, so that a binary installed by the upgrade path, which
+   keeps the config of the installed release, starts with the items the
+   config lacks. */
+static const ConfigItem config_items[] = {
+    CONFIG_ITEM("advertise_dongle_id", CONFIG_INTEGER,
+                advertise_dongle_id, NULL),
+    CONFIG_ITEM("advertise_interval_in_uints_0625_ms", CONFIG_INTEGER,
+                advertise_interval_in_units_0625_ms, NULL),
+    CONFIG_ITEM("advertise_rssi_value", CONFIG_INTEGER,
+                advertise_rssi_value, NULL),
+    CONFIG_ITEM("advertise_interval_spread_in_units_0625_ms", CONFIG_INTEGER,
+                advertise_interval_spread_in_units_0625_ms, "32"),
+    CONFIG_ITEM("advertise_use_interval_range", CONFIG_BOOL,
+                advertise_use_interval_range, "0"),
+    CONFIG_ITEM("advertise_tx_power_in_dbm", CONFIG_INTEGER,
+                advertise_tx_power_in_dbm, "127"),
+    CONFIG_ITEM("advertise_zone_id", CONFIG_INTEGER,
+                advertise_zone_id, "0"),
+    CONFIG_ITEM("zone_power_schedule", CONFIG_STRING,
+                zone_power_schedule, ""),
+    CONFIG_ITEM("realtime_priority", CONFIG_INTEGER,
+                realtime_priority, "0"),
+    CONFIG_ITEM("realtime_cpu_affinity", CONFIG_INTEGER,
+                realtime_cpu_affinity, "-1"),
+    CONFIG_ITEM("sensor_sampling_rate_in_hz", CONFIG_INTEGER,
+                sensor_sampling_rate_in_hz, "0"),
+    CONFIG_ITEM("sensor_accelerometer_path", CONFIG_STRING,
+                sensor_accelerometer_path,
+                "/sys/bus/iio/devices/iio:device0"),
+    CONFIG_ITEM("sensor_temperature_path", CONFIG_STRING,
+                sensor_temperature_path,
+                "/sys/class/thermal/thermal_zone0/temp"),
+    CONFIG_ITEM("sensor_trace_file", CONFIG_STRING,
+                sensor_trace_file, ""),
+    CONFIG_ITEM("scanner_dongle_id", CONFIG_INTEGER,
+                scanner_dongle_id, "-1"),
+    CONFIG_ITEM("scanner_report_interval_in_seconds", CONFIG_INTEGER,
+                scanner_report_interval_in_seconds, "10"),
+    CONFIG_ITEM("energy_wakeup_cost_in_uas", CONFIG_DOUBLE,
+                energy_wakeup_cost_in_uas, "20"),
+    CONFIG_ITEM("energy_hci_command_cost_in_uas", CONFIG_DOUBLE,
+                energy_hci_command_cost_in_uas, "10"),
+    CONFIG_ITEM("energy_advertising_event_cost_in_uas", CONFIG_DOUBLE,
+                energy_advertising_event_cost_in_uas, "15"),
+    CONFIG_ITEM("energy_baseline_current_in_ua", CONFIG_DOUBLE,
+                energy_baseline_current_in_ua, "0"),
+    CONFIG_ITEM("energy_report_interval_in_seconds", CONFIG_INTEGER,
+                energy_report_interval_in_seconds, "3600"),
+    CONFIG_ITEM("payload_template", CONFIG_STRING,
+                payload_template, ""),
+    CONFIG_ITEM("hci_transport", CONFIG_INTEGER,
+                hci_transport, "0"),
+    CONFIG_ITEM("hci_uart_device", CONFIG_STRING,
+                hci_uart_device, "/dev/ttyAMA0"),
+    CONFIG_ITEM("hci_uart_baud_rate", CONFIG_INTEGER,
+                hci_uart_baud_rate, "115200"),
+    CONFIG_ITEM("sync_beacon_address", CONFIG_STRING,
+                sync_beacon_address, ""),
+    CONFIG_ITEM("sync_slot_width_in_ms", CONFIG_INTEGER,
+                sync_slot_width_in_ms, "20"),
+    CONFIG_ITEM("sync_slot_index", CONFIG_INTEGER,
+                sync_slot_index, "-1"),
+    CONFIG_ITEM("sync_realign_interval_in_frames", CONFIG_INTEGER,
+                sync_realign_interval_in_frames, "2"),
+    CONFIG_ITEM("sync_max_resync_interval_in_seconds", CONFIG_INTEGER,
+                sync_max_resync_interval_in_seconds, "900"),
+    CONFIG_ITEM("locator_dongle_id", CONFIG_INTEGER,
+                locator_dongle_id, "-1"),
+    CONFIG_ITEM("locator_scan_window_in_ms", CONFIG_INTEGER,
+                locator_scan_window_in_ms, "1000"),
+    CONFIG_ITEM("locator_scan_period_in_seconds", CONFIG_INTEGER,
+                locator_scan_period_in_seconds, "10"),
+    CONFIG_ITEM("locator_weighted_position", CONFIG_INTEGER,
+                locator_weighted_position, "0"),
+    CONFIG_ITEM("locator_trace_file", CONFIG_STRING,
+                locator_trace_file, ""),
+    CONFIG_ITEM("privacy_key", CONFIG_STRING,
+                privacy_key, ""),
+    CONFIG_ITEM("privacy_rotation_interval_in_seconds", CONFIG_INTEGER,
+                privacy_rotation_interval_in_seconds, "900"),
+    CONFIG_ITEM("trace_file", CONFIG_STRING,
+                trace_file, ""),
+    CONFIG_ITEM("trace_format", CONFIG_INTEGER,
+                trace_format, "0"),
+    CONFIG_ITEM("provision_bundle", CONFIG_STRING,
+                provision_bundle, "")
+};
+
+#define NUMBER_OF_CONFIG_ITEMS \
+    (sizeof(config_items) / sizeof(config_items[0]))
+
+static const ConfigItem *find_config_item(char *key) {
+    int i;
+
+    for (i = 0; i < NUMBER_OF_CONFIG_ITEMS; i++) {
+        if (0 == strcmp(config_items[i].key, key)) {
+            return &config_items[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Copy the value into the field of the item. The whole buffer of a string
+   is cleared, so that the checksum of the config depends only on the
+   values. */
+static bool set_config_value(Config *config, const ConfigItem *item,
+                             char *value) {
+    char *field = (char *)config + item->offset;
+
+    switch (item->type) {
+        case CONFIG_INTEGER:
+            *(int *)field = atoi(value);
+            break;
+        case CONFIG_BOOL:
+            *(bool *)field = (0 != atoi(value));
+            break;
+        case CONFIG_DOUBLE:
+            *(double *)field = atof(value);
+            break;
+        case CONFIG_STRING:
+            if (strlen(value) >= item->size) {
+                zlog_error(category_health_report,
+                           "Config item %s is too long", item->key);
+#ifdef Debugging
+                zlog_error(category_debug,
+                           "Config item %s is too long", item->key);
+#endif
+                return false;
+            }
+            memset(field, 0, item->size);
+            memcpy(field, value, strlen(value));
+            break;
+    }
+
+    return true;
+}
+
+/* Read one line of the config file, which must be a key=value item of a
+   known key not read before. An empty line is skipped. */
+static bool read_config_line(Config *config, char *line, int line_number,
+                             bool *is_read) {
+    char item_line[CONFIG_BUFFER_SIZE];
+    char *line_end = NULL;
+    char *delimiter = NULL;
+    const ConfigItem *item = NULL;
+    int line_length = 0;
+
+    line_end = strchr(line, '\n');
+    if (NULL == line_end) {
+        line_end = line + strlen(line);
+    }
+
+    line_length = line_end - line;
+    while (line_length > 0 &&
+           ('\r' == line[line_length - 1] || ' ' == line[line_length - 1])) {
+        line_length--;
+    }
+    if (0 == line_length) {
+        return true;
+    }
+
+    if (line_length >= CONFIG_BUFFER_SIZE) {
+        zlog_error(category_health_report,
+                   "Config line %d is too long", line_number);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Config line %d is too long", line_number);
+#endif
+        return false;
+    }
+
+    memcpy(item_line, line, line_length);
+    item_line[line_length] = '\0';
+
+    delimiter = strstr(item_line, DELIMITER);
+    if (NULL == delimiter) {
+        zlog_error(category_health_report,
+                   "Config line %d is not in the form key%svalue",
+                   line_number, DELIMITER);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Config line %d is not in the form key%svalue",
+                   line_number, DELIMITER);
+#endif
+        return false;
+    }
+    *delimiter = '\0';
+
+    item = find_config_item(item_line);
+    if (NULL == item) {
+        zlog_error(category_health_report,
+                   "Config line %d holds unknown item %s",
+                   line_number, item_line);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Config line %d holds unknown item %s",
+                   line_number, item_line);
+#endif
+        return false;
+    }
+
+    if (is_read[item - config_items]) {
+        zlog_error(category_health_report,
+                   "Config item %s is repeated on line %d",
+                   item->key, line_number);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Config item %s is repeated on line %d",
+                   item->key, line_number);
+#endif
+        return false;
+    }
+    is_read[item - config_items] = true;
+
+    return set_config_value(config, item, delimiter + strlen(DELIMITER));
+}
+
 ErrorCode get_config(Config *config, char *file_name) {
     /* Return value is a struct containing all config information */
     int retry_time = 0;
-    FILE *file = NULL;
+    int file = -1;
+
+    /* The config file is read at once into a static buffer, so that no
+       stdio stream is allocated, and parsed into a static config, so that
+       a config which fails leaves the current one alone */
+    static char config_file[CONFIG_FILE_SIZE];
+    static Config new_config;
+    bool is_read[NUMBER_OF_CONFIG_ITEMS];
+    bool is_valid = true;
+    char *line = NULL;
+    int line_number = 0;
+    ssize_t length = 0;
+    ssize_t read_length = 0;
+    int i;
 
-    /* Create spaces for storing the string of the current line being read */
-    char config_setting[CONFIG_BUFFER_SIZE];
-    char *config_message = NULL;
+    TRACE_BEGIN(TRACEPOINT_CONFIG_LOAD, 0);
 
     retry_time = FILE_OPEN_RETRY;
     while(retry_time--){
-        file = fopen(file_name, "r");
+        file = open(file_name, O_RDONLY);
 
-        if(NULL != file){
+        if(-1 != file){
             break;
         }
     }
 
-    if (NULL == file) {
+    if (-1 == file) {
         zlog_error(category_health_report,
                    "Error openning file");
 #ifdef Debugging
         zlog_error(category_debug,
                    "Error openning file");
 #endif
+        TRACE_END(TRACEPOINT_CONFIG_LOAD, E_OPEN_FILE);
         return E_OPEN_FILE;
     }
 
+    while (length < CONFIG_FILE_SIZE - 1) {
+        read_length = read(file, config_file + length,
+                           CONFIG_FILE_SIZE - 1 - length);
+        if (read_length <= 0) {
+            break;
+        }
+        length += read_length;
+    }
+    config_file[length] = '\0';
+
+    close(file);
+
+    memset(&new_config, 0, sizeof(new_config));
+    memset(is_read, 0, sizeof(is_read));
+
     /* Keep reading each line and store into the config struct */
-    /* item 1 */
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message = strstr((char *)config_setting, DELIMITER);
-    config_message = config_message + strlen(DELIMITER);
-    trim_string_tail(config_message);
-    config->advertise_dongle_id = atoi(config_message);
-
-    /* item 2 */
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message = strstr((char *)config_setting, DELIMITER);
-    config_message = config_message + strlen(DELIMITER);
-    trim_string_tail(config_message);
-    config->advertise_interval_in_units_0625_ms = atoi(config_message);
-    
-    /* item 3 */
-    fgets(config_setting, sizeof(config_setting), file);
-    config_message = strstr((char *)config_setting, DELIMITER);
-    config_message = config_message + strlen(DELIMITER);
-    trim_string_tail(config_message);
-    config->advertise_rssi_value = atoi(config_message);
+    for (line = config_file; is_valid && '\0' != *line;
+         line = strchr(line, '\n') ? strchr(line, '\n') + 1 :
+                                     line + strlen(line)) {
+        line_number++;
+        is_valid = read_config_line(&new_config, line, line_number, is_read);
+    }
+
+    for (i = 0; is_valid && i < NUMBER_OF_CONFIG_ITEMS; i++) {
+        if (is_read[i]) {
+            continue;
+        }
+
+        if (NULL == config_items[i].default_value) {
+            zlog_error(category_health_report,
+                       "Config item %s is missing", config_items[i].key);
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "Config item %s is missing", config_items[i].key);
+#endif
+            is_valid = false;
+        } else {
+            set_config_value(&new_config, &config_items[i],
+                             config_items[i].default_value);
+        }
+    }
+
+    if (!is_valid) {
+        TRACE_END(TRACEPOINT_CONFIG_LOAD, E_OPEN_FILE);
+        return E_OPEN_FILE;
+    }
+
+    *config = new_config;
 
-    fclose(file);
+    TRACE_END(TRACEPOINT_CONFIG_LOAD, WORK_SUCCESSFULLY);
 
     return WORK_SUCCESSFULLY;
 }
 
-unsigned int *uuid_str_to_data(char *uuid) {
+void uuid_str_to_data(char *uuid, uint8_t *data) {
     char conversion[] = "0123456789ABCDEF";
     int uuid_length = strlen(uuid);
-    unsigned int *data =
-        (unsigned int *)malloc(sizeof(unsigned int) * uuid_length);
-
-    if (data == NULL) {
-        /* Error handling */
-        perror("Failed to allocate memory");
-        return NULL;
-    }
-
-    unsigned int *data_pointer = data;
+    uint8_t *data_pointer = data;
     char *uuid_counter = uuid;
 
-    for (; uuid_counter < uuid + uuid_length;
+    for (; uuid_counter + 1 < uuid + uuid_length;
 
          data_pointer++, uuid_counter += 2) {
         *data_pointer =
@@ -167,8 +462,6 @@ unsigned int *uuid_str_to_data(char *uuid) {
             (strchr(conversion, toupper(*(uuid_counter + 1))) - conversion);
 
     }
-
-    return data;
 }
 
 void trim_string_tail(char *message) {
@@ -190,272 +483,654 @@ void trim_string_tail(char *message) {
 }
 
 
-void ctrlc_handler(int stop) { ready_to_work = false; }
+void ctrlc_handler(int stop) {
+    TRACE_INSTANT(TRACEPOINT_SIGNAL, stop);
 
-ErrorCode enable_advertising(int dongle_device_id,
-                             int advertising_interval_in_units_0625_ms,
-                             char *advertising_uuid,
-                             int major_number,
-                             int minor_number,
-                             int rssi_value) {
-#ifdef Debugging
-    zlog_debug(category_debug, ">> enable_advertising ");
-#endif
-    int device_handle = 0;
-    int retry_time = 0;
-    uint8_t status;
+    ready_to_work = false;
+}
+
+ErrorCode send_hci_request(int device_handle,
+                           uint16_t ogf,
+                           uint16_t ocf,
+                           void *cparam,
+                           int clen,
+                           void *rparam,
+                           int rlen) {
     struct hci_request request;
     int return_value = 0;
-    uint8_t segment_length = 1;
-    unsigned int *xy_coordinates = NULL;
-    int uuid_iterator;
-    char uuid_identifier[17];
-    int index = 0;
-    int i;
 
-#ifdef Debugging
-    zlog_info(category_debug, "Using dongle id [%d] uuid [%s]\n", 
-              dongle_device_id, advertising_uuid);
-#endif
-    //dongle_device_id = hci_get_route(NULL);
-    if (dongle_device_id < 0){
+    memset(&request, 0, sizeof(request));
+    request.ogf = ogf;
+    request.ocf = ocf;
+    request.cparam = cparam;
+    request.clen = clen;
+    request.rparam = rparam;
+    request.rlen = rlen; /* length of request.rparam */
+
+    account_hci_command();
+
+    return_value = send_hci_command(device_handle, &request,
+                                HCI_SEND_REQUEST_TIMEOUT_IN_MS);
+
+    if (return_value < 0) {
+        /* Error handling */
         zlog_error(category_health_report,
-                   "Error openning the device");
+                   "Can't send request 0x%02x|0x%04x %s (%d)", ogf, ocf,
+                   strerror(errno), errno);
 #ifdef Debugging
         zlog_error(category_debug,
-                   "Error openning the device");
+                   "Can't send request 0x%02x|0x%04x %s (%d)", ogf, ocf,
+                   strerror(errno), errno);
 #endif
-        return E_OPEN_DEVICE;
+        return E_SEND_REQUEST_TIMEOUT;
     }
 
-    retry_time = SOCKET_OPEN_RETRY;
-    while(retry_time--){
-        device_handle = hci_open_dev(dongle_device_id);
+    return WORK_SUCCESSFULLY;
+}
 
-        if(device_handle >= 0){
-            break;
-        }
+void set_payload_coordinates(AdvertisingPayload *payload,
+                             char *advertising_uuid) {
+    uint8_t xy_coordinates[LENGTH_OF_COORDINATES];
+    int uuid_iterator;
+    char uuid_identifier[17];
+    int index = 0;
+    int i;
+
+    /* 8 bytes: LBeacon UUID identifier.
+    4 bytes for X coordinate and 4 bytes for Y coordinate.
+    */
+    memset(uuid_identifier, 0, sizeof(uuid_identifier));
+    for(i  = 12 ; i < 20 ; i++){
+        uuid_identifier[index] = *(advertising_uuid+i);
+        index++;
+    }
+    for(i = 24 ; i < 32 ; i++){
+        uuid_identifier[index] = *(advertising_uuid+i);
+        index++;
     }
+    uuid_str_to_data(uuid_identifier, xy_coordinates);
 
-    if (device_handle < 0) {
-        zlog_error(category_health_report,
-                   "Error openning socket");
-#ifdef Debugging
-        zlog_error(category_debug,
-                   "Error openning socket");
-#endif
-        return E_OPEN_DEVICE;
+    for (uuid_iterator = 0;
+         uuid_iterator < strlen(uuid_identifier) / 2 &&
+         uuid_iterator < LENGTH_OF_COORDINATES;
+         uuid_iterator++) {
+
+        payload->coordinates[uuid_iterator] = xy_coordinates[uuid_iterator];
     }
+}
+
+void set_payload_identity(AdvertisingPayload *payload,
+                          PrivateIdentity *identity) {
+    memcpy(payload->coordinate_mask, identity->coordinate_mask,
+           LENGTH_OF_COORDINATES);
+    memcpy(payload->field_mask, identity->field_mask, LENGTH_OF_FIELD_MASK);
+
+    /* A sequence number counting on from the previous epoch would link
+       the identities of the two epochs */
+    payload->sequence_number = identity->sequence_start;
+
+    payload->dirty_slots |=
+        PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_COORDINATES) |
+        PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_MEASURED_POWER) |
+        PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_MAJOR) |
+        PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_MINOR) |
+        PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_SEQUENCE) |
+        PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_SENSOR_SUMMARY);
+}
+
+static ErrorCode set_legacy_advertising_parameters(
+    int device_handle,
+    int min_interval_in_units_0625_ms,
+    int max_interval_in_units_0625_ms) {
 
+    uint8_t status = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
     le_set_advertising_parameters_cp advertising_parameters_copy;
+
     memset(&advertising_parameters_copy, 0,
            sizeof(advertising_parameters_copy));
     advertising_parameters_copy.min_interval = 
-        advertising_interval_in_units_0625_ms;
+        htobs(min_interval_in_units_0625_ms);
     advertising_parameters_copy.max_interval = 
-        advertising_interval_in_units_0625_ms;
+        htobs(max_interval_in_units_0625_ms);
     /* advertising non-connectable */
     advertising_parameters_copy.advtype = 3;
+    advertising_parameters_copy.own_bdaddr_type =
+        g_advertising.own_address_type;
     /*set bitmap to 111 (i.e., circulate on channels 37,38,39) */
     advertising_parameters_copy.chan_map = 7; /* all three advertising
                                               channels*/
 
-    memset(&request, 0, sizeof(request));
-    request.ogf = OGF_LE_CTL;
-    request.ocf = OCF_LE_SET_ADVERTISING_PARAMETERS;
-    request.cparam = &advertising_parameters_copy;
-    request.clen = LE_SET_ADVERTISING_PARAMETERS_CP_SIZE;
-    request.rparam = &status;
-    request.rlen = 1; /* length of request.rparam */
-
-    return_value = hci_send_req(device_handle, &request,
-                                HCI_SEND_REQUEST_TIMEOUT_IN_MS);
+    return_value = send_hci_request(device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_SET_ADVERTISING_PARAMETERS,
+                                    &advertising_parameters_copy,
+                                    LE_SET_ADVERTISING_PARAMETERS_CP_SIZE,
+                                    &status, 1);
+    if (WORK_SUCCESSFULLY != return_value) {
+        return return_value;
+    }
 
-    if (return_value < 0) {
-        /* Error handling */
-        hci_close_dev(device_handle);
+    if (status) {
         zlog_error(category_health_report,
-                   "Can't send request %s (%d)", strerror(errno),
-                   errno);
+                   "LE set advertising parameters returned status %d",
+                   status);
 #ifdef Debugging
         zlog_error(category_debug,
-                   "Can't send request %s (%d)", strerror(errno),
-                   errno);
+                   "LE set advertising parameters returned status %d",
+                   status);
 #endif
-        return E_SEND_REQUEST_TIMEOUT;
+        return E_ADVERTISE_STATUS;
     }
 
+    return WORK_SUCCESSFULLY;
+}
+
+static ErrorCode set_legacy_advertise_enable(int device_handle,
+                                             bool enable) {
+    uint8_t status = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
     le_set_advertise_enable_cp advertisement_copy;
+
     memset(&advertisement_copy, 0, sizeof(advertisement_copy));
-    advertisement_copy.enable = 0x01;
+    advertisement_copy.enable = enable ? 0x01 : 0x00;
+
+    return_value = send_hci_request(device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_SET_ADVERTISE_ENABLE,
+                                    &advertisement_copy,
+                                    LE_SET_ADVERTISE_ENABLE_CP_SIZE,
+                                    &status, 1);
+    if (WORK_SUCCESSFULLY != return_value) {
+        return return_value;
+    }
 
-    memset(&request, 0, sizeof(request));
-    request.ogf = OGF_LE_CTL;
-    request.ocf = OCF_LE_SET_ADVERTISE_ENABLE;
-    request.cparam = &advertisement_copy;
-    request.clen = LE_SET_ADVERTISE_ENABLE_CP_SIZE;
-    request.rparam = &status;
-    request.rlen = 1; /* length of request.rparam */
+    if (status) {
+        zlog_error(category_health_report,
+                   "LE set advertise enable returned status %d", status);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "LE set advertise enable returned status %d", status);
+#endif
+        return E_ADVERTISE_STATUS;
+    }
 
-    return_value = hci_send_req(device_handle, &request,
-                                HCI_SEND_REQUEST_TIMEOUT_IN_MS);
+    return WORK_SUCCESSFULLY;
+}
 
-    if (return_value < 0) {
+static ErrorCode send_advertising_data(
+    int device_handle,
+    le_set_advertising_data_cp *advertisement_data_copy) {
+
+    uint8_t status = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    if (g_advertising.extended_advertising) {
+        return set_extended_advertising_data(device_handle,
+                                             advertisement_data_copy);
+    }
+
+    return_value = send_hci_request(device_handle,
+                                    OGF_LE_CTL,
+                                    OCF_LE_SET_ADVERTISING_DATA,
+                                    advertisement_data_copy,
+                                    LE_SET_ADVERTISING_DATA_CP_SIZE,
+                                    &status, 1);
+    if (WORK_SUCCESSFULLY != return_value) {
+        return return_value;
+    }
+
+    if (status) {
         /* Error handling */
-        hci_close_dev(device_handle);
         zlog_error(category_health_report,
-                   "Can't send request %s (%d)", strerror(errno),
-                   errno);
+                   "LE set advertise returned status %d", status);
 #ifdef Debugging
         zlog_error(category_debug,
-                   "Can't send request %s (%d)", strerror(errno),
-                   errno);
+                   "LE set advertise returned status %d", status);
 #endif
-        return E_SEND_REQUEST_TIMEOUT;
+        return E_ADVERTISE_STATUS;
     }
 
-    le_set_advertising_data_cp advertisement_data_copy;
-    memset(&advertisement_data_copy, 0, sizeof(advertisement_data_copy));
+    return WORK_SUCCESSFULLY;
+}
 
-    /* The Advertising data consists of one or more Advertising Data (AD)
-    elements. Each element is formatted as follows:
+ErrorCode update_advertising_data(int device_handle) {
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    le_set_advertising_data_cp *advertisement_data_copy = NULL;
+
+    /* Only the slots of the compiled template are written, and the
+       template image is handed to the dongle as it is */
+    g_advertising.payload.sequence_number++;
+    g_advertising.payload.dirty_slots |=
+        PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_SEQUENCE);
+    advertisement_data_copy = patch_payload_template(&g_payload_template,
+                                                     &g_advertising.payload);
+
+    return_value = send_advertising_data(device_handle,
+                                         advertisement_data_copy);
+    if (WORK_SUCCESSFULLY != return_value) {
+        return return_value;
+    }
 
-    1st byte: length of the element (excluding the length byte itself)
-    2nd byte: AD type – specifies what data is included in the element
-    AD data - one or more bytes - the meaning is defined by AD type
-    */
+    /* Keep the data on the air in the state file for a warm restart */
+    save_advertising_data(&g_advertising.payload, advertisement_data_copy);
 
-    /* 1. Fill the EIR_FLAGS type (0x01 in Bluetooth AD type)
-    related information
-    */
-    segment_length = 1;
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] =
-        htobs(EIR_FLAGS);
-    segment_length++;
-
-    /* FLAG information is carried in bits within the flag are as listed below,
-    and we choose to use
-    0x1A (i.e., 00011010) setting.
-    bit 0: LE Limited Discoverable Mode
-    bit 1: LE General Discoverable Mode
-    bit 2: BR/EDR Not Supported
-    bit 3: Simultaneous LE and BR/EDR to Same Device Capable (Controller)
-    bit 4: Simultaneous LE and BR/EDR to Same Device Capable (Host)
-    bit 5-7: Reserved
-    */
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] =
-        htobs(0x04);
-    segment_length++;
+    return WORK_SUCCESSFULLY;
+}
 
-    /* Fill the length for EIR_FLAGS type (0x01 in Bluetooth AD type) */
-    advertisement_data_copy
-        .data[advertisement_data_copy.length] =
-        htobs(segment_length - 1);
+ErrorCode set_advertising_interval(int device_handle,
+                                   int min_interval_in_units_0625_ms,
+                                   int max_interval_in_units_0625_ms) {
+    uint8_t status = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    ErrorCode enable_return_value = WORK_SUCCESSFULLY;
+    TxPowerSetting tx_power_setting;
+
+    /* Advertising parameters cannot be changed while advertising is
+    enabled */
+    if (g_advertising.extended_advertising) {
+        return_value = set_extended_advertise_enable(device_handle, false);
+        if (WORK_SUCCESSFULLY == return_value) {
+            memset(&tx_power_setting, 0, sizeof(tx_power_setting));
+            return_value = set_extended_advertising_parameters(
+                device_handle,
+                min_interval_in_units_0625_ms,
+                max_interval_in_units_0625_ms,
+                g_advertising.tx_power_in_dbm,
+                &tx_power_setting,
+                &status);
+        }
+    } else {
+        return_value = set_legacy_advertise_enable(device_handle, false);
+        if (WORK_SUCCESSFULLY == return_value) {
+            return_value = set_legacy_advertising_parameters(
+                device_handle,
+                min_interval_in_units_0625_ms,
+                max_interval_in_units_0625_ms);
+        }
+    }
 
-    advertisement_data_copy.length += segment_length;
+    /* Advertising is enabled again after a failure as well, so that the
+       Tag stays on the air with the previous interval */
+    if (g_advertising.extended_advertising) {
+        enable_return_value = set_extended_advertise_enable(device_handle,
+                                                            true);
+    } else {
+        enable_return_value = set_legacy_advertise_enable(device_handle,
+                                                          true);
+    }
 
-    /* 2. Fill the EIR_MANUFACTURE_SPECIFIC_DATA (0xFF in Bluetooth AD type)
-    related information
-    */
-    segment_length = 1;
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] =
-        htobs(EIR_MANUFACTURE_SPECIFIC_DATA);
-    segment_length++;
-
-    /* The first two bytes of EIR_MANUFACTURE_SPECIFIC_DATA type is the company
-    identifier
-    https://www.bluetooth.com/specifications/assigned-numbers/company-identifiers
-
-    For Raspberry Pi, we should use 0x000F to specify the manufacturer as
-    Broadcom Corporation.
-    */
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] =
-        htobs(0x0F);
-    segment_length++;
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] =
-        htobs(0x00);
-    segment_length++;
+    if (WORK_SUCCESSFULLY != return_value) {
+        return return_value;
+    }
 
-    /* 8 bytes: LBeacon UUID identifier.
-    4 bytes for X coordinate and 4 bytes for Y coordinate.
-    */
-    memset(uuid_identifier, 0, sizeof(uuid_identifier));
-    for(i  = 12 ; i < 20 ; i++){
-        uuid_identifier[index] = *(advertising_uuid+i);
-        index++;
+    g_advertising.min_interval_in_units_0625_ms =
+        min_interval_in_units_0625_ms;
+    g_advertising.max_interval_in_units_0625_ms =
+        max_interval_in_units_0625_ms;
+
+    return enable_return_value;
+}
+
+ErrorCode restart_advertising(int device_handle) {
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    if (g_advertising.extended_advertising) {
+        return_value = set_extended_advertise_enable(device_handle, false);
+        if (WORK_SUCCESSFULLY == return_value) {
+            return_value = set_extended_advertise_enable(device_handle, true);
+        }
+    } else {
+        return_value = set_legacy_advertise_enable(device_handle, false);
+        if (WORK_SUCCESSFULLY == return_value) {
+            return_value = set_legacy_advertise_enable(device_handle, true);
+        }
     }
-    for(i = 24 ; i < 32 ; i++){
-        uuid_identifier[index] = *(advertising_uuid+i);
-        index++;
+
+    return return_value;
+}
+
+static ErrorCode set_random_address(int device_handle, bdaddr_t *address) {
+    uint8_t status = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    le_set_random_address_cp random_address_copy;
+    le_set_advertising_set_random_address_cp set_random_address_copy;
+
+    if (g_advertising.extended_advertising) {
+        memset(&set_random_address_copy, 0, sizeof(set_random_address_copy));
+        set_random_address_copy.handle = EXTENDED_ADVERTISING_HANDLE;
+        bacpy(&set_random_address_copy.bdaddr, address);
+
+        return_value = send_hci_request(
+            device_handle,
+            OGF_LE_CTL,
+            OCF_LE_SET_ADVERTISING_SET_RANDOM_ADDRESS,
+            &set_random_address_copy,
+            sizeof(set_random_address_copy),
+            &status, 1);
+    } else {
+        memset(&random_address_copy, 0, sizeof(random_address_copy));
+        bacpy(&random_address_copy.bdaddr, address);
+
+        return_value = send_hci_request(device_handle,
+                                        OGF_LE_CTL,
+                                        OCF_LE_SET_RANDOM_ADDRESS,
+                                        &random_address_copy,
+                                        LE_SET_RANDOM_ADDRESS_CP_SIZE,
+                                        &status, 1);
+    }
+    if (WORK_SUCCESSFULLY != return_value) {
+        return return_value;
+    }
+
+    if (status) {
+        zlog_error(category_health_report,
+                   "LE set random address returned status %d", status);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "LE set random address returned status %d", status);
+#endif
+        return E_ADVERTISE_STATUS;
+    }
+
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode set_private_address(int device_handle, bdaddr_t *address) {
+    uint8_t status = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    ErrorCode enable_return_value = WORK_SUCCESSFULLY;
+    TxPowerSetting tx_power_setting;
+
+    /* The random address cannot be changed while advertising is enabled */
+    if (g_advertising.extended_advertising) {
+        return_value = set_extended_advertise_enable(device_handle, false);
+    } else {
+        return_value = set_legacy_advertise_enable(device_handle, false);
+    }
+
+    if (WORK_SUCCESSFULLY == return_value) {
+        return_value = set_random_address(device_handle, address);
+    }
+
+    /* The first private address switches the advertising parameters to
+       the random address */
+    if (WORK_SUCCESSFULLY == return_value &&
+        LE_RANDOM_ADDRESS != g_advertising.own_address_type) {
+        g_advertising.own_address_type = LE_RANDOM_ADDRESS;
+
+        if (g_advertising.extended_advertising) {
+            memset(&tx_power_setting, 0, sizeof(tx_power_setting));
+            return_value = set_extended_advertising_parameters(
+                device_handle,
+                g_advertising.min_interval_in_units_0625_ms,
+                g_advertising.max_interval_in_units_0625_ms,
+                g_advertising.tx_power_in_dbm,
+                &tx_power_setting,
+                &status);
+        } else {
+            return_value = set_legacy_advertising_parameters(
+                device_handle,
+                g_advertising.min_interval_in_units_0625_ms,
+                g_advertising.max_interval_in_units_0625_ms);
+        }
+
+        if (WORK_SUCCESSFULLY != return_value) {
+            g_advertising.own_address_type = LE_PUBLIC_ADDRESS;
+        }
+    }
+
+    /* The coordinates are masked for the new address */
+    if (WORK_SUCCESSFULLY == return_value) {
+        return_value = update_advertising_data(device_handle);
+    }
+
+    /* Advertising is enabled again after a failure as well, so that the
+       Tag stays on the air */
+    if (g_advertising.extended_advertising) {
+        enable_return_value = set_extended_advertise_enable(device_handle,
+                                                            true);
+    } else {
+        enable_return_value = set_legacy_advertise_enable(device_handle,
+                                                          true);
+    }
+
+    return WORK_SUCCESSFULLY != return_value ?
+           return_value : enable_return_value;
+}
+
+/* With a privacy key the Tag goes on the air with the private address and
+   the coordinate mask of the current epoch, never with its public
+   address. The minimal build cannot rotate identities, so it refuses to
+   advertise instead. */
+static ErrorCode get_startup_identity(PrivateIdentity *identity,
+                                      bool *is_private) {
+#ifdef MINIMAL_FOOTPRINT
+    *is_private = false;
+
+    if (0 != strlen(g_config.privacy_key)) {
+        zlog_error(category_health_report,
+                   "Privacy is not supported by the minimal build");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Privacy is not supported by the minimal build");
+#endif
+        return E_ADVERTISE_MODE;
+    }
+
+    return WORK_SUCCESSFULLY;
+#else
+    return get_initial_identity(&g_config, identity, is_private);
+#endif
+}
+
+ErrorCode enable_advertising(int dongle_device_id,
+                             int min_interval_in_units_0625_ms,
+                             int max_interval_in_units_0625_ms,
+                             char *advertising_uuid,
+                             int major_number,
+                             int minor_number,
+                             int rssi_value,
+                             int tx_power_in_dbm) {
+#ifdef Debugging
+    zlog_debug(category_debug, ">> enable_advertising ");
+#endif
+    int device_handle = 0;
+    int retry_time = 0;
+    uint8_t status;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    TxPowerSetting tx_power_setting;
+    ControllerCapability capability;
+    PrivateIdentity identity;
+    bool is_private = false;
+
+#ifdef Debugging
+    zlog_info(category_debug, "Using dongle id [%d] uuid [%s]\n", 
+              dongle_device_id, advertising_uuid);
+#endif
+    //dongle_device_id = hci_get_route(NULL);
+    if (dongle_device_id < 0){
+        zlog_error(category_health_report,
+                   "Error openning the device");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Error openning the device");
+#endif
+        return E_OPEN_DEVICE;
+    }
+
+    memset(&identity, 0, sizeof(identity));
+    return_value = get_startup_identity(&identity, &is_private);
+    if (WORK_SUCCESSFULLY != return_value) {
+        return return_value;
+    }
+
+    retry_time = SOCKET_OPEN_RETRY;
+    while(retry_time--){
+        device_handle = open_hci_device(dongle_device_id);
+
+        if(device_handle >= 0){
+            break;
+        }
+    }
+
+    if (device_handle < 0) {
+        zlog_error(category_health_report,
+                   "Error openning socket");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Error openning socket");
+#endif
+        return E_OPEN_DEVICE;
     }
-    xy_coordinates = uuid_str_to_data(uuid_identifier);
 
-    for (uuid_iterator = 0;
-         uuid_iterator < strlen(uuid_identifier) / 2;
-         uuid_iterator++) {
+    /* The capability holds the TX power range and the default TX power,
+    which is the TX power at which advertise_rssi_value is calibrated */
+    return_value = get_controller_capability(device_handle,
+                                             dongle_device_id,
+                                             CAPABILITY_FILE_NAME,
+                                             &capability);
+    if (WORK_SUCCESSFULLY != return_value) {
+        close_hci_device(device_handle);
+        return return_value;
+    }
+    memset(&tx_power_setting, 0, sizeof(tx_power_setting));
+    get_capability_tx_power_range(&capability, &tx_power_setting);
+
+    TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+
+    g_advertising.dongle_device_id = dongle_device_id;
+    g_advertising.min_interval_in_units_0625_ms =
+        min_interval_in_units_0625_ms;
+    g_advertising.max_interval_in_units_0625_ms =
+        max_interval_in_units_0625_ms;
+    g_advertising.extended_advertising = false;
+    g_advertising.own_address_type =
+        is_private ? LE_RANDOM_ADDRESS : LE_PUBLIC_ADDRESS;
+
+    /* A controller which supports extended advertising disallows legacy
+    advertising commands once an extended one was sent, so it is driven by
+    extended commands only, which also carry the TX power */
+    if (has_extended_advertising(&capability)) {
+        status = 0;
+        return_value = set_extended_advertising_parameters(
+            device_handle,
+            min_interval_in_units_0625_ms,
+            max_interval_in_units_0625_ms,
+            tx_power_in_dbm,
+            &tx_power_setting,
+            &status);
+
+        /* Advertise at the default TX power when the controller rejects
+        the requested one */
+        if (WORK_SUCCESSFULLY != return_value &&
+            TX_POWER_NO_PREFERENCE != tx_power_in_dbm) {
+#ifdef Debugging
+            zlog_info(category_debug,
+                      "TX power %d dBm rejected (status %d), advertising "
+                      "at the default TX power", tx_power_in_dbm, status);
+#endif
+            status = 0;
+            return_value = set_extended_advertising_parameters(
+                device_handle,
+                min_interval_in_units_0625_ms,
+                max_interval_in_units_0625_ms,
+                TX_POWER_NO_PREFERENCE,
+                &tx_power_setting,
+                &status);
+        }
+        if (WORK_SUCCESSFULLY != return_value) {
+            zlog_error(category_health_report,
+                       "LE set extended advertising parameters returned "
+                       "status %d", status);
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "LE set extended advertising parameters returned "
+                       "status %d", status);
+#endif
+            pthread_mutex_unlock(&g_advertising.lock);
+            close_hci_device(device_handle);
+            return return_value;
+        }
 
-        advertisement_data_copy
-            .data[advertisement_data_copy.length + segment_length] =
-            htobs(xy_coordinates[uuid_iterator]);
+        g_advertising.extended_advertising = true;
+    } else {
+
+        return_value = set_legacy_advertising_parameters(
+            device_handle,
+            min_interval_in_units_0625_ms,
+            max_interval_in_units_0625_ms);
+        if (WORK_SUCCESSFULLY != return_value) {
+            pthread_mutex_unlock(&g_advertising.lock);
+            close_hci_device(device_handle);
+            return return_value;
+        }
 
-        segment_length++;
+        /* Legacy-only controllers may still expose the TX power through
+        a vendor specific command. On failure the Tag keeps advertising at
+        the controller default TX power. */
+        if (TX_POWER_NO_PREFERENCE != tx_power_in_dbm &&
+            has_vendor_tx_power(&capability)) {
+            set_vendor_tx_power(device_handle, tx_power_in_dbm,
+                                &tx_power_setting);
+        }
     }
 
-    /* 1 bytes: Push-button information */
-    int is_button_pressed = 0;
-    advertisement_data_copy
-        .data[advertisement_data_copy.length + segment_length] =
-        htobs(is_button_pressed & 0x00FF);
-    segment_length++;
-
-    /* Fill the length for EIR_MANUFACTURE_SPECIFIC_DATA type
-    (0xFF in Bluetooth AD type) */
-    advertisement_data_copy.data[advertisement_data_copy.length] =
-        htobs(segment_length - 1);
+    /* The random address is set once the advertising set exists, and
+    before advertising is enabled */
+    if (is_private) {
+        return_value = set_random_address(device_handle,
+                                          (bdaddr_t *)identity.address);
+        if (WORK_SUCCESSFULLY != return_value) {
+            pthread_mutex_unlock(&g_advertising.lock);
+            close_hci_device(device_handle);
+            return return_value;
+        }
+    }
 
-    advertisement_data_copy.length += segment_length;
+    g_advertising.tx_power_in_dbm = tx_power_setting.selected_tx_power_in_dbm;
+
+    /* Fill the payload of the Tag */
+    memset(&g_advertising.payload, 0, sizeof(g_advertising.payload));
+    set_payload_coordinates(&g_advertising.payload, advertising_uuid);
+    g_advertising.payload.button_state = 0;
+    g_advertising.payload.measured_power =
+        calibrate_measured_power(rssi_value, &tx_power_setting);
+    g_advertising.payload.major_number = major_number;
+    g_advertising.payload.minor_number = minor_number;
+    if (is_private) {
+        set_payload_identity(&g_advertising.payload, &identity);
+    }
+    g_advertising.payload.dirty_slots = ALL_PAYLOAD_SLOTS;
 
-    memset(&request, 0, sizeof(request));
-    request.ogf = OGF_LE_CTL;
-    request.ocf = OCF_LE_SET_ADVERTISING_DATA;
-    request.cparam = &advertisement_data_copy;
-    request.clen = LE_SET_ADVERTISING_DATA_CP_SIZE;
-    request.rparam = &status;
-    request.rlen = 1; /* length of request.rparam */
+    zlog_info(category_health_report,
+              "Advertising at %d dBm (method %d), measured power %d dBm",
+              tx_power_setting.selected_tx_power_in_dbm,
+              tx_power_setting.method,
+              g_advertising.payload.measured_power);
+
+    save_advertising_parameters(&g_advertising);
+
+    return_value = update_advertising_data(device_handle);
+
+    /* Advertising is enabled only once the address and the data of the
+    Tag are in place, which an advertising set also requires */
+    if (WORK_SUCCESSFULLY == return_value) {
+        if (g_advertising.extended_advertising) {
+            return_value = set_extended_advertise_enable(device_handle, true);
+        } else {
+            return_value = set_legacy_advertise_enable(device_handle, true);
+        }
+    }
 
-    return_value = hci_send_req(device_handle, &request,
-                                HCI_SEND_REQUEST_TIMEOUT_IN_MS);
+    pthread_mutex_unlock(&g_advertising.lock);
 
-    hci_close_dev(device_handle);
+    close_hci_device(device_handle);
 
-    if (return_value < 0) {
-        /* Error handling */
-        zlog_error(category_health_report,
-                   "Can't send request %s (%d)", strerror(errno),
-                   errno);
-#ifdef Debugging
-        zlog_error(category_debug,
-                   "Can't send request %s (%d)", strerror(errno),
-                   errno);
-#endif
-        return E_SEND_REQUEST_TIMEOUT;
+    if (WORK_SUCCESSFULLY != return_value) {
+        return return_value;
     }
 
-    if (status) {
-        /* Error handling */
-        zlog_error(category_health_report,
-                   "LE set advertise returned status %d", status);
-#ifdef Debugging
-        zlog_error(category_debug,
-                   "LE set advertise returned status %d", status);
-#endif
-        return E_ADVERTISE_STATUS;
-    }
 #ifdef Debugging
     zlog_debug(category_debug, "<< enable_advertising ");
 #endif
@@ -490,7 +1165,7 @@ ErrorCode disable_advertising(int dongle_device_id) {
 
     retry_time = SOCKET_OPEN_RETRY;
     while(retry_time--){
-        device_handle = hci_open_dev(dongle_device_id);
+        device_handle = open_hci_device(dongle_device_id);
 
         if(device_handle >= 0){
             break;
@@ -507,6 +1182,22 @@ ErrorCode disable_advertising(int dongle_device_id) {
         return E_OPEN_DEVICE;
     }
 
+    /* Advertising enabled with extended commands must be disabled with
+       extended commands as well */
+    if (g_advertising.extended_advertising) {
+        return_value = set_extended_advertise_enable(device_handle, false);
+        close_hci_device(device_handle);
+
+        if (WORK_SUCCESSFULLY != return_value) {
+            return E_ADVERTISE_MODE;
+        }
+#ifdef Debugging
+        zlog_debug(category_debug,
+                   "<< disable_advertising ");
+#endif
+        return WORK_SUCCESSFULLY;
+    }
+
     memset(&advertisement_copy, 0, sizeof(advertisement_copy));
 
     memset(&request, 0, sizeof(request));
@@ -517,10 +1208,10 @@ ErrorCode disable_advertising(int dongle_device_id) {
     request.rparam = &status;
     request.rlen = 1; /* length of request.rparam */
 
-    return_value = hci_send_req(device_handle, &request,
+    return_value = send_hci_command(device_handle, &request,
                                 HCI_SEND_REQUEST_TIMEOUT_IN_MS);
 
-    hci_close_dev(device_handle);
+    close_hci_device(device_handle);
 
     if (return_value < 0) {
         /* Error handling */
@@ -555,9 +1246,369 @@ ErrorCode disable_advertising(int dongle_device_id) {
     return WORK_SUCCESSFULLY;
 }
 
+/* Resume advertising straight from the state file, without reading the TX
+   power range, rebuilding the payload or waiting for the start phase. The
+   dongle may still be advertising after a crash of the Tag, in which case
+   it rejects the parameters with Command Disallowed and keeps the ones it
+   has, which are the saved ones. With a privacy key the saved data of an
+   earlier epoch is not replayed: advertising is disabled, and the address
+   and the data of the current epoch are set before it is enabled. */
+static ErrorCode resume_advertising(PersistentState *state) {
+    int device_handle = 0;
+    int retry_time = 0;
+    uint8_t status = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+    TxPowerSetting tx_power_setting;
+    le_set_advertising_data_cp advertisement_data_copy;
+    PrivateIdentity identity;
+    bool is_private = false;
+
+    memset(&identity, 0, sizeof(identity));
+    return_value = get_startup_identity(&identity, &is_private);
+    if (WORK_SUCCESSFULLY != return_value) {
+        return return_value;
+    }
+
+    retry_time = SOCKET_OPEN_RETRY;
+    while(retry_time--){
+        device_handle = open_hci_device(state->dongle_device_id);
+
+        if(device_handle >= 0){
+            break;
+        }
+    }
+
+    if (device_handle < 0) {
+        zlog_error(category_health_report,
+                   "Error openning socket");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Error openning socket");
+#endif
+        return E_OPEN_DEVICE;
+    }
+
+    TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+
+    g_advertising.dongle_device_id = state->dongle_device_id;
+    g_advertising.min_interval_in_units_0625_ms =
+        state->min_interval_in_units_0625_ms;
+    g_advertising.max_interval_in_units_0625_ms =
+        state->max_interval_in_units_0625_ms;
+    g_advertising.tx_power_in_dbm = state->tx_power_in_dbm;
+    g_advertising.extended_advertising = state->extended_advertising;
+    g_advertising.own_address_type =
+        is_private ? LE_RANDOM_ADDRESS : LE_PUBLIC_ADDRESS;
+    g_advertising.payload = state->payload;
+    g_advertising.payload.dirty_slots = ALL_PAYLOAD_SLOTS;
+
+    if (is_private) {
+        set_payload_identity(&g_advertising.payload, &identity);
+
+        if (g_advertising.extended_advertising) {
+            set_extended_advertise_enable(device_handle, false);
+        } else {
+            set_legacy_advertise_enable(device_handle, false);
+        }
+    }
+
+    memset(&advertisement_data_copy, 0, sizeof(advertisement_data_copy));
+    advertisement_data_copy.length = state->advertising_data_length;
+    memcpy(advertisement_data_copy.data, state->advertising_data,
+           LENGTH_OF_ADVERTISING_DATA);
+
+    memset(&tx_power_setting, 0, sizeof(tx_power_setting));
+    if (g_advertising.extended_advertising) {
+        set_extended_advertising_parameters(
+            device_handle,
+            g_advertising.min_interval_in_units_0625_ms,
+            g_advertising.max_interval_in_units_0625_ms,
+            g_advertising.tx_power_in_dbm,
+            &tx_power_setting,
+            &status);
+    } else {
+        set_legacy_advertising_parameters(
+            device_handle,
+            g_advertising.min_interval_in_units_0625_ms,
+            g_advertising.max_interval_in_units_0625_ms);
+
+        if (TX_POWER_NO_PREFERENCE != g_config.advertise_tx_power_in_dbm) {
+            set_vendor_tx_power(device_handle, g_advertising.tx_power_in_dbm,
+                                &tx_power_setting);
+        }
+    }
+
+    if (is_private) {
+        return_value = set_random_address(device_handle,
+                                          (bdaddr_t *)identity.address);
+        if (WORK_SUCCESSFULLY == return_value) {
+            return_value = update_advertising_data(device_handle);
+        }
+    } else {
+        /* The saved data goes out as it is, so the sequence number
+        continues where the previous run stopped */
+        return_value = send_advertising_data(device_handle,
+                                             &advertisement_data_copy);
+    }
+
+    /* A controller before Bluetooth 5.0 which is still advertising after a
+       crash rejects the enable, and the caller then starts cold */
+    if (WORK_SUCCESSFULLY == return_value) {
+        if (g_advertising.extended_advertising) {
+            return_value = set_extended_advertise_enable(device_handle, true);
+        } else {
+            return_value = set_legacy_advertise_enable(device_handle, true);
+        }
+    }
+
+    pthread_mutex_unlock(&g_advertising.lock);
+
+    close_hci_device(device_handle);
+
+    return return_value;
+}
+
+/* Start the threads which update the payload and verify the advertising,
+   after advertising is enabled or taken over */
+static void start_workers(int device_handle,
+                          bdaddr_t *dongle_bdaddr,
+                          bool has_dongle_bdaddr) {
+
+#ifdef MINIMAL_FOOTPRINT
+    /* The minimal build only advertises the fixed frame, from the main
+       thread */
+    if(device_handle >= 0){
+        close_hci_device(device_handle);
+    }
+#else
+
+    /* Let other processes push payload fields through the control plane */
+    if(WORK_SUCCESSFULLY != start_control_plane(
+           g_config.advertise_dongle_id, device_handle)){
+        zlog_error(category_health_report,
+                   "Unable to start control plane");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to start control plane");
+#endif
+    }
+
+    /* Feed the summary of the sensors into the payload */
+    if(WORK_SUCCESSFULLY != start_sensor_pipeline(&g_config)){
+        zlog_error(category_health_report,
+                   "Unable to start sensor pipeline");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to start sensor pipeline");
+#endif
+    }
+
+    /* Anyone without the key of the Tag sees a new address every epoch */
+    if(WORK_SUCCESSFULLY != start_privacy(&g_config)){
+        zlog_error(category_health_report,
+                   "Unable to start privacy");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to start privacy");
+#endif
+    }
+
+    /* A moving Tag advertises the position of the LBeacons around it
+       instead of the fixed coordinates */
+    if(WORK_SUCCESSFULLY != start_locator(&g_config)){
+        zlog_error(category_health_report,
+                   "Unable to start locator");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to start locator");
+#endif
+    }
+
+    /* Verify from the box itself that the Tag is on the air */
+    if(has_dongle_bdaddr){
+        if(WORK_SUCCESSFULLY != start_loopback_scanner(&g_config,
+                                                       dongle_bdaddr)){
+            zlog_error(category_health_report,
+                       "Unable to start loopback scanner");
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "Unable to start loopback scanner");
+#endif
+        }
+
+        /* Keep the advertising in the slot of the Tag in the frame of the
+           sync beacon */
+        if(WORK_SUCCESSFULLY != start_beacon_sync(&g_config,
+                                                  dongle_bdaddr)){
+            zlog_error(category_health_report,
+                       "Unable to start beacon sync");
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "Unable to start beacon sync");
+#endif
+        }
+    }
+#endif
+}
+
+/* Stop the threads started by start_workers. ready_to_work must be cleared
+   before. */
+static void stop_workers(void) {
+#ifndef MINIMAL_FOOTPRINT
+    stop_beacon_sync();
+    stop_privacy();
+    stop_locator();
+    stop_loopback_scanner();
+    stop_sensor_pipeline();
+    stop_control_plane();
+#endif
+}
+
+/* The bundle of a provisioned Tag replaces the fields of the config which
+   differ from Tag to Tag, so that all tags of a fleet share the config
+   file. A bundle without a privacy key leaves privacy off. */
+static ErrorCode apply_provision_bundle(Config *config,
+                                        ProvisionRecord *record) {
+    static const uint8_t no_key[PROVISION_KEY_LENGTH];
+    char address[PROVISION_ADDRESS_TEXT_LENGTH];
+
+    if(!read_provision_bundle(config->provision_bundle, record)){
+        zlog_error(category_health_report,
+                   "Invalid provisioning bundle %s",
+                   config->provision_bundle);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Invalid provisioning bundle %s",
+                   config->provision_bundle);
+#endif
+        return E_OPEN_FILE;
+    }
+
+    format_provision_uuid(record, lbeacon_uuid);
+
+    memset(config->privacy_key, 0, sizeof(config->privacy_key));
+    if(0 != memcmp(record->key, no_key, sizeof(no_key))){
+        format_provision_key(record, config->privacy_key);
+    }
+
+    if(record->sync_slot_index >= 0){
+        config->sync_slot_index = record->sync_slot_index;
+    }
+
+    format_provision_address(record->address, address);
+    zlog_info(category_health_report,
+              "Provisioned as Tag %u with address %s",
+              record->serial_number, address);
+
+    return WORK_SUCCESSFULLY;
+}
+
 int main(int argc, char **argv) {
     ErrorCode return_value = WORK_SUCCESSFULLY;
     struct sigaction sigint_handler;
+    AdvertisingPlan advertising_plan;
+    bdaddr_t dongle_bdaddr;
+    bdaddr_t planning_bdaddr;
+    ZonePower zone_power_schedule[MAX_NUMBER_OF_ZONES];
+    ZonePower *zone_power = NULL;
+    int number_of_zones = 0;
+#ifndef MINIMAL_FOOTPRINT
+    int number_of_simulated_tags = 0;
+    int number_of_latency_commands = 0;
+    char *locator_trace_file = NULL;
+#endif
+    int number_of_jitter_loops = 0;
+    int energy_updates_per_hour = -1;
+    int option;
+    struct timespec loop_deadline;
+    static JitterHistogram loop_jitter, probe_jitter;
+    struct timespec start_time, air_time;
+    uint64_t start_to_air_in_us = 0;
+    struct rusage usage;
+    uint32_t config_checksum = 0;
+    bool is_warm_start = false;
+    bool has_dongle_bdaddr = false;
+    ProvisionRecord provision_record;
+    bool is_provisioned = false;
+    PersistentState *state = NULL;
+    struct sigaction upgrade_signal_handler;
+    static char binary_path[PATH_MAX];
+#ifdef MINIMAL_FOOTPRINT
+    static char stdout_buffer[BUFSIZ];
+#endif
+    int handoff_socket = -1;
+    int handoff_device_handle = -1;
+    pid_t previous_pid = 0;
+    struct timespec handoff_time;
+    EnergyModel energy_model;
+    int energy_report_loops = 0;
+    int number_of_loops = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    TRACE_THREAD_START();
+
+    /* The binary is executed again by path on an upgrade, after the new
+       binary is copied over it */
+    if(NULL == realpath(argv[0], binary_path)){
+        strncpy(binary_path, argv[0], sizeof(binary_path) - 1);
+    }
+
+    /* -s <number of tags> runs the fleet simulation of the interval and
+       phase planner and of the beacon sync, and -j <number of loops> runs
+       the wakeup jitter probe in normal and real-time mode, and -e <number
+       of updates per hour> prints the energy estimate over advertising
+       intervals, and -t <number of commands> compares the HCI round trip
+       latency of BlueZ and the configured transport, and -r <trace file>
+       replays a recorded locator trace as a benchmark, instead of
+       advertising. -u <socket> is given by the previous Tag to the new
+       binary on an upgrade. */
+#ifdef MINIMAL_FOOTPRINT
+    /* The simulations and benchmarks, which allocate their samples, are
+       left out of the minimal build, and stdout is buffered in a static
+       buffer instead of one allocated at the first printf */
+    setvbuf(stdout, stdout_buffer, _IOLBF, sizeof(stdout_buffer));
+    while((option = getopt(argc, argv, "j:e:u:")) != -1){
+#else
+    while((option = getopt(argc, argv, "s:j:e:t:r:u:")) != -1){
+#endif
+        switch(option){
+#ifndef MINIMAL_FOOTPRINT
+            case 's':
+                number_of_simulated_tags = atoi(optarg);
+                break;
+            case 't':
+                number_of_latency_commands = atoi(optarg);
+                break;
+            case 'r':
+                locator_trace_file = optarg;
+                break;
+#endif
+            case 'j':
+                number_of_jitter_loops = atoi(optarg);
+                break;
+            case 'e':
+                energy_updates_per_hour = atoi(optarg);
+                break;
+            case 'u':
+                handoff_socket = atoi(optarg);
+                break;
+            default:
+#ifdef MINIMAL_FOOTPRINT
+                fprintf(stderr,
+                        "Usage: %s [-j number_of_loops] "
+                        "[-e number_of_updates_per_hour]\n",
+                        argv[0]);
+#else
+                fprintf(stderr,
+                        "Usage: %s [-s number_of_tags] [-j number_of_loops] "
+                        "[-e number_of_updates_per_hour] "
+                        "[-t number_of_commands] [-r trace_file]\n",
+                        argv[0]);
+#endif
+                return E_ADVERTISE_MODE;
+        }
+    }
 
     /*Initialize the global flag */
     ready_to_work = true;
@@ -582,8 +1633,69 @@ int main(int argc, char **argv) {
 #endif
     }
 
-    /* Ensure there is only single running instance */
-    return_value = single_running_instance(TAG_LOCK_FILE);
+#ifndef MINIMAL_FOOTPRINT
+    if(number_of_simulated_tags > 0){
+        if(WORK_SUCCESSFULLY != get_config(&g_config, CONFIG_FILE_NAME)){
+            return E_OPEN_FILE;
+        }
+        print_fleet_simulation(number_of_simulated_tags, &g_config);
+        print_sync_simulation(number_of_simulated_tags, &g_config);
+        return WORK_SUCCESSFULLY;
+    }
+#endif
+
+    if(energy_updates_per_hour >= 0){
+        if(WORK_SUCCESSFULLY != get_config(&g_config, CONFIG_FILE_NAME)){
+            return E_OPEN_FILE;
+        }
+        print_energy_table(&g_config, energy_updates_per_hour);
+        return WORK_SUCCESSFULLY;
+    }
+
+#ifndef MINIMAL_FOOTPRINT
+    if(number_of_latency_commands > 0){
+        if(WORK_SUCCESSFULLY != get_config(&g_config, CONFIG_FILE_NAME) ||
+           WORK_SUCCESSFULLY != init_hci_transport(&g_config)){
+            return E_OPEN_FILE;
+        }
+        print_transport_latency(&g_config, number_of_latency_commands);
+        return WORK_SUCCESSFULLY;
+    }
+
+    if(NULL != locator_trace_file){
+        if(WORK_SUCCESSFULLY != get_config(&g_config, CONFIG_FILE_NAME)){
+            return E_OPEN_FILE;
+        }
+        return print_locator_benchmark(locator_trace_file, &g_config);
+    }
+#endif
+
+    if(number_of_jitter_loops > 0){
+        if(WORK_SUCCESSFULLY != get_config(&g_config, CONFIG_FILE_NAME)){
+            return E_OPEN_FILE;
+        }
+        measure_wakeup_jitter(number_of_jitter_loops, &probe_jitter);
+        print_jitter_histogram("normal", &probe_jitter);
+
+        if(WORK_SUCCESSFULLY != enable_realtime_mode(
+               g_config.realtime_priority > 0 ?
+                   g_config.realtime_priority : DEFAULT_REALTIME_PRIORITY,
+               g_config.realtime_cpu_affinity)){
+            fprintf(stderr, "Unable to enter real-time mode\n");
+            return E_ADVERTISE_MODE;
+        }
+        measure_wakeup_jitter(number_of_jitter_loops, &probe_jitter);
+        print_jitter_histogram("realtime", &probe_jitter);
+        return WORK_SUCCESSFULLY;
+    }
+
+    /* Ensure there is only single running instance. On an upgrade the
+       previous Tag holds the lock until the new Tag has taken over. */
+    if(handoff_socket < 0){
+        TRACE_BEGIN(TRACEPOINT_LOCK_FILE, 0);
+        return_value = single_running_instance(TAG_LOCK_FILE);
+        TRACE_END(TRACEPOINT_LOCK_FILE, return_value);
+    }
     if(WORK_SUCCESSFULLY != return_value){
         zlog_error(category_health_report,
                    "Error openning lock file");
@@ -613,6 +1725,23 @@ int main(int argc, char **argv) {
         return E_OPEN_FILE;
     }
 
+    if(WORK_SUCCESSFULLY != init_hci_transport(&g_config)){
+        return E_OPEN_DEVICE;
+    }
+
+    /* Enter real-time mode before bring-up, so that bring-up and payload
+       updates are not delayed by other load on the gateway */
+    if(g_config.realtime_priority > 0){
+        if(WORK_SUCCESSFULLY == enable_realtime_mode(
+               g_config.realtime_priority,
+               g_config.realtime_cpu_affinity)){
+            zlog_info(category_health_report,
+                      "Real-time mode with priority %d on CPU %d",
+                      g_config.realtime_priority,
+                      g_config.realtime_cpu_affinity);
+        }
+    }
+
     /* Register handler function for SIGINT signal */
     sigint_handler.sa_handler = ctrlc_handler;
     sigemptyset(&sigint_handler.sa_mask);
@@ -627,21 +1756,300 @@ int main(int argc, char **argv) {
 #endif
     }
 
+    /* Register handler function for the upgrade signal */
+    upgrade_signal_handler.sa_handler = upgrade_handler;
+    sigemptyset(&upgrade_signal_handler.sa_mask);
+    upgrade_signal_handler.sa_flags = 0;
+
+    if (-1 == sigaction(UPGRADE_SIGNAL, &upgrade_signal_handler, NULL)) {
+        zlog_error(category_health_report,
+                   "Error registering signal handler for SIGUSR2");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Error registering signal handler for SIGUSR2");
+#endif
+    }
+
     memset(lbeacon_uuid, 0, sizeof(lbeacon_uuid));
     strcpy(lbeacon_uuid, "00000000000000000000000000000000");
-    
-    return_value = enable_advertising(
-        g_config.advertise_dongle_id,
-        g_config.advertise_interval_in_units_0625_ms,
-        lbeacon_uuid,
-        MAJOR_VER,
-        MINOR_VER,
-        g_config.advertise_rssi_value);
-            
-    while(true == ready_to_work){
-        usleep(INTERVAL_FOR_BUSY_WAITING_CHECK_IN_MICRO_SECONDS);
+
+    if(0 != strlen(g_config.provision_bundle)){
+        if(WORK_SUCCESSFULLY != apply_provision_bundle(&g_config,
+                                                       &provision_record)){
+            return E_OPEN_FILE;
+        }
+        is_provisioned = true;
+    }
+
+    /* Dense zones advertise with less TX power and a longer interval, as
+       listed in the per-zone power schedule */
+    if(WORK_SUCCESSFULLY == parse_zone_power_schedule(
+           g_config.zone_power_schedule,
+           zone_power_schedule,
+           &number_of_zones)){
+
+        zone_power = find_zone_power(g_config.advertise_zone_id,
+                                     zone_power_schedule,
+                                     number_of_zones);
+        if(NULL != zone_power){
+            g_config.advertise_tx_power_in_dbm = zone_power->tx_power_in_dbm;
+            g_config.advertise_interval_in_units_0625_ms =
+                zone_power->interval_in_units_0625_ms;
+
+            zlog_info(category_health_report,
+                      "Zone %d schedule: %d dBm, interval %d",
+                      zone_power->zone_id,
+                      zone_power->tx_power_in_dbm,
+                      zone_power->interval_in_units_0625_ms);
+        }
+    }
+
+    /* The payload layout is compiled once, and updates only patch its
+       slots */
+    if(WORK_SUCCESSFULLY != compile_payload_template(g_config.payload_template,
+                                                     &g_payload_template)){
+        zlog_error(category_health_report,
+                   "Unable to compile payload template, use the default");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to compile payload template, use the default");
+#endif
+        compile_payload_template("", &g_payload_template);
+    }
+
+    /* Derive a distinct interval offset and start phase from the BD address
+       so that tags powered on together by rc.local do not advertise in
+       lockstep */
+    memset(&dongle_bdaddr, 0, sizeof(dongle_bdaddr));
+    has_dongle_bdaddr = true;
+
+    /* On an upgrade only the previous Tag can open an exclusive transport,
+       so the BD address comes with its state */
+    if(handoff_socket >= 0){
+        has_dongle_bdaddr = false;
+    }else if(read_hci_bdaddr(g_config.advertise_dongle_id,
+                             &dongle_bdaddr) < 0){
+        has_dongle_bdaddr = false;
+        zlog_error(category_health_report,
+                   "Unable to read BD address of dongle %d",
+                   g_config.advertise_dongle_id);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to read BD address of dongle %d",
+                   g_config.advertise_dongle_id);
+#endif
+    }
+
+    /* The scanners look a provisioned Tag up by the address of its bundle,
+       which change_mac.sh sets on the dongle */
+    if(is_provisioned && has_dongle_bdaddr &&
+       0 != memcmp(&dongle_bdaddr, provision_record.address,
+                   PROVISION_ADDRESS_LENGTH)){
+        zlog_error(category_health_report,
+                   "BD address of dongle %d differs from the provisioned "
+                   "address", g_config.advertise_dongle_id);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "BD address of dongle %d differs from the provisioned "
+                   "address", g_config.advertise_dongle_id);
+#endif
+    }
+
+    /* A restarted Tag resumes from the state file when the state was
+       produced by the same dongle and the same config */
+    config_checksum = crc32_checksum(&g_config, sizeof(g_config));
+    if(WORK_SUCCESSFULLY == map_persistent_state(STATE_FILE_NAME)){
+        state = get_persistent_state();
+        is_warm_start = has_dongle_bdaddr &&
+                        is_persistent_state_valid(&dongle_bdaddr,
+                                                  config_checksum);
+    }
+
+    /* On an upgrade the dongle keeps advertising, and the new Tag only
+       adopts the state of the previous Tag */
+    if(handoff_socket >= 0){
+        previous_pid = getppid();
+        return_value = take_over_from_handoff(handoff_socket,
+                                              &handoff_device_handle);
+        if(WORK_SUCCESSFULLY == return_value){
+            return_value = wait_for_previous_exit(previous_pid);
+        }
+        if(WORK_SUCCESSFULLY != return_value){
+            if(handoff_device_handle >= 0){
+                close_hci_device(handoff_device_handle);
+            }
+            return return_value;
+        }
+        is_warm_start = true;
+
+        state = get_persistent_state();
+        if(NULL != state){
+            memcpy(&dongle_bdaddr, &state->controller_bdaddr,
+                   sizeof(bdaddr_t));
+            has_dongle_bdaddr = true;
+        }
+    }else if(is_warm_start){
+        TRACE_BEGIN(TRACEPOINT_RESUME_ADVERTISING, 0);
+        return_value = resume_advertising(state);
+        TRACE_END(TRACEPOINT_RESUME_ADVERTISING, return_value);
+        if(WORK_SUCCESSFULLY != return_value){
+            zlog_error(category_health_report,
+                       "Unable to resume from state file, starting cold");
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "Unable to resume from state file, starting cold");
+#endif
+            is_warm_start = false;
+        }
+    }
+
+    if(!is_warm_start){
+        reset_persistent_state(&dongle_bdaddr, config_checksum);
+
+        /* Without the BD address of the dongle every unit would plan from
+           the all-zero address, so the plan is derived from the address of
+           the bundle or the identity of the gateway instead */
+        memcpy(&planning_bdaddr, &dongle_bdaddr, sizeof(planning_bdaddr));
+        if(!has_dongle_bdaddr){
+            if(is_provisioned){
+                memcpy(&planning_bdaddr, provision_record.address,
+                       PROVISION_ADDRESS_LENGTH);
+            }else if(WORK_SUCCESSFULLY !=
+                     read_unit_identity(&planning_bdaddr)){
+                zlog_error(category_health_report,
+                           "Unable to read an identity for the planner");
+#ifdef Debugging
+                zlog_error(category_debug,
+                           "Unable to read an identity for the planner");
+#endif
+            }
+        }
+
+        return_value = plan_advertising_schedule(
+            &planning_bdaddr,
+            g_config.advertise_interval_in_units_0625_ms,
+            g_config.advertise_interval_spread_in_units_0625_ms,
+            g_config.advertise_use_interval_range,
+            &advertising_plan);
+        if(WORK_SUCCESSFULLY != return_value){
+            zlog_error(category_health_report,
+                       "Invalid advertising interval %d",
+                       g_config.advertise_interval_in_units_0625_ms);
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "Invalid advertising interval %d",
+                       g_config.advertise_interval_in_units_0625_ms);
+#endif
+            return return_value;
+        }
+
+#ifdef Debugging
+        zlog_info(category_debug,
+                  "Planned interval [%d, %d] phase %d us",
+                  advertising_plan.min_interval_in_units_0625_ms,
+                  advertising_plan.max_interval_in_units_0625_ms,
+                  advertising_plan.start_phase_in_micro_seconds);
+#endif
+        TRACE_BEGIN(TRACEPOINT_START_PHASE,
+                    advertising_plan.start_phase_in_micro_seconds);
+        usleep(advertising_plan.start_phase_in_micro_seconds);
+        TRACE_END(TRACEPOINT_START_PHASE, 0);
+
+        TRACE_BEGIN(TRACEPOINT_ENABLE_ADVERTISING, 0);
+        return_value = enable_advertising(
+            g_config.advertise_dongle_id,
+            advertising_plan.min_interval_in_units_0625_ms,
+            advertising_plan.max_interval_in_units_0625_ms,
+            lbeacon_uuid,
+            MAJOR_VER,
+            MINOR_VER,
+            g_config.advertise_rssi_value,
+            g_config.advertise_tx_power_in_dbm);
+        TRACE_END(TRACEPOINT_ENABLE_ADVERTISING, return_value);
     }
+
+    if(WORK_SUCCESSFULLY == return_value && handoff_socket < 0){
+        clock_gettime(CLOCK_MONOTONIC, &air_time);
+        start_to_air_in_us =
+            (air_time.tv_sec - start_time.tv_sec) * 1000000ULL +
+            (air_time.tv_nsec - start_time.tv_nsec) / 1000;
+        save_start_to_air_time(is_warm_start, start_to_air_in_us);
+
+        /* The peak resident set at bring-up compares the footprint of the
+           default and the minimal build */
+        getrusage(RUSAGE_SELF, &usage);
+
+        if(NULL != state){
+            zlog_info(category_health_report,
+                      "%s start to air %llu us (last cold %llu us, "
+                      "last warm %llu us), sequence %d, peak RSS %ld kB",
+                      is_warm_start ? "Warm" : "Cold",
+                      (unsigned long long)start_to_air_in_us,
+                      (unsigned long long)state->cold_start_to_air_in_us,
+                      (unsigned long long)state->warm_start_to_air_in_us,
+                      g_advertising.payload.sequence_number,
+                      usage.ru_maxrss);
+        }
+    }
+
+    if(WORK_SUCCESSFULLY == return_value){
+        start_workers(handoff_device_handle, &dongle_bdaddr,
+                      has_dongle_bdaddr);
+    }
+
+    get_energy_model(&g_config, &energy_model);
+    energy_report_loops = g_config.energy_report_interval_in_seconds *
+                          (1000000 /
+                           INTERVAL_FOR_BUSY_WAITING_CHECK_IN_MICRO_SECONDS);
+    report_energy_accounting(&energy_model);
+
+    while(true){
+        clock_gettime(CLOCK_MONOTONIC, &loop_deadline);
+        while(true == ready_to_work){
+            wait_for_next_period(&loop_deadline,
+                                 INTERVAL_FOR_BUSY_WAITING_CHECK_IN_MICRO_SECONDS,
+                                 &loop_jitter);
+
+            if(energy_report_loops > 0 &&
+               ++number_of_loops >= energy_report_loops){
+                report_energy_accounting(&energy_model);
+                number_of_loops = 0;
+            }
+        }
+
+        zlog_info(category_health_report,
+                  "Main loop wakeups %ld, jitter p99 %ld us, max %ld us",
+                  loop_jitter.number_of_samples,
+                  jitter_percentile(&loop_jitter, 0.99),
+                  loop_jitter.max_latency_in_micro_seconds);
+        stop_workers();
+        report_energy_accounting(&energy_model);
+
+        if(!upgrade_requested || WORK_SUCCESSFULLY != return_value){
+            break;
+        }
+        upgrade_requested = false;
+
+        /* Leave advertising enabled for the new binary */
+        clock_gettime(CLOCK_MONOTONIC, &handoff_time);
+        if(WORK_SUCCESSFULLY == hand_off_to_binary(
+               binary_path,
+               g_config.advertise_dongle_id,
+               (uint64_t)handoff_time.tv_sec * 1000000000ULL +
+               handoff_time.tv_nsec)){
+            unmap_persistent_state();
+            TRACE_EXPORT(g_config.trace_file, g_config.trace_format);
+            return WORK_SUCCESSFULLY;
+        }
+
+        ready_to_work = true;
+        start_workers(-1, &dongle_bdaddr, has_dongle_bdaddr);
+    }
+
     disable_advertising(g_config.advertise_dongle_id);
+    unmap_persistent_state();
+
+    TRACE_EXPORT(g_config.trace_file, g_config.trace_format);
 
     return WORK_SUCCESSFULLY;
 }
@@ -38,16 +38,27 @@ Authors:
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <signal.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
 #include <bluetooth/hci_lib.h>
 #include <sys/file.h>
+#include <pthread.h>
+#include <unistd.h>
 
+#ifdef MINIMAL_FOOTPRINT
+#include "Logger.h"
+#else
 #include "zlog.h"
+#endif
 #include "Version.h"
+#include "Trace.h"
+#include "Provision.h"
+#include "Identity.h"
 
 /*
   CONSTANTS
@@ -81,7 +92,10 @@ Authors:
 #define SOCKET_OPEN_RETRY 5
 
 /* Maximum number of characters in each line of config file */
-#define CONFIG_BUFFER_SIZE 64
+#define CONFIG_BUFFER_SIZE 256
+
+/* Maximum size of the config file in bytes */
+#define CONFIG_FILE_SIZE (64 * CONFIG_BUFFER_SIZE)
 
 /* Parameter that marks the start of the config file */
 #define DELIMITER "="
@@ -112,6 +126,18 @@ https://www.bluetooth.com/specifications/assigned-numbers/generic-access-profile
 /* Number of characters in the uuid of a Bluetooth device */
 #define LENGTH_OF_UUID 33
 
+/* Number of bytes of X and Y coordinates inside payload of advertising
+   packet */
+#define LENGTH_OF_COORDINATES 8
+
+/* Number of bytes of the fields of the payload masked by a private
+   identity, and the offsets of the fields in the mask */
+#define LENGTH_OF_FIELD_MASK IDENTITY_FIELDS_LENGTH
+#define FIELD_MASK_MEASURED_POWER 0
+#define FIELD_MASK_MAJOR 1
+#define FIELD_MASK_MINOR 2
+#define FIELD_MASK_SENSOR_SUMMARY 3
+
 /* Number of characters in a Bluetooth MAC address */
 #define LENGTH_OF_MAC_ADDRESS 18
 
@@ -128,6 +154,8 @@ typedef enum _ErrorCode{
     E_ADVERTISE_STATUS = 4,
     E_ADVERTISE_MODE = 5,
     E_SEND_REQUEST_TIMEOUT = 6,
+    E_CONTROL_REQUEST = 7,
+    E_START_THREAD = 8,
     
     MAX_ERROR_CODE
 
@@ -147,18 +175,222 @@ typedef struct Config {
     
     /* The rssi value used to advertise */
     int advertise_rssi_value;
+
+    /* Width in units of 0.625ms of the range from which the interval offset
+       of the Tag is derived */
+    int advertise_interval_spread_in_units_0625_ms;
+
+    /* Whether the controller may choose the advertising interval within the
+       planned range instead of pinning min_interval and max_interval */
+    bool advertise_use_interval_range;
+
+    /* The TX power in dBm used to advertise, or 127 to keep the controller
+       default */
+    int advertise_tx_power_in_dbm;
+
+    /* The zone in which the Tag is deployed */
+    int advertise_zone_id;
+
+    /* The per-zone power schedule, a comma-separated list of
+       zone_id:tx_power_in_dbm:interval_in_units_0625_ms entries */
+    char zone_power_schedule[CONFIG_BUFFER_SIZE];
+
+    /* The SCHED_FIFO priority of the Tag, or 0 to keep normal scheduling */
+    int realtime_priority;
+
+    /* The CPU to which the Tag is pinned in real-time mode, or -1 to keep
+       the current affinity */
+    int realtime_cpu_affinity;
+
+    /* Sampling rate in Hz of the sensor pipeline, or 0 to disable it */
+    int sensor_sampling_rate_in_hz;
+
+    /* The IIO device directory of the accelerometer */
+    char sensor_accelerometer_path[CONFIG_BUFFER_SIZE];
+
+    /* The sysfs attribute of the temperature in millidegree Celsius */
+    char sensor_temperature_path[CONFIG_BUFFER_SIZE];
+
+    /* The recorded sensor trace replayed instead of the live sources, or
+       empty */
+    char sensor_trace_file[CONFIG_BUFFER_SIZE];
+
+    /* The id of the second dongle scanning for the advertising of the Tag,
+       or -1 to disable the loopback scanner */
+    int scanner_dongle_id;
+
+    /* Time interval in seconds between reports of the loopback scanner */
+    int scanner_report_interval_in_seconds;
+
+    /* Charge in micro-ampere-seconds of a wakeup of the host CPU */
+    double energy_wakeup_cost_in_uas;
+
+    /* Charge in micro-ampere-seconds of a HCI command round trip */
+    double energy_hci_command_cost_in_uas;
+
+    /* Charge in micro-ampere-seconds of an advertising event */
+    double energy_advertising_event_cost_in_uas;
+
+    /* Current in micro-amperes drawn regardless of the activity */
+    double energy_baseline_current_in_ua;
+
+    /* Time interval in seconds between energy accounting reports */
+    int energy_report_interval_in_seconds;
+
+    /* The layout of the advertising data, or empty for the default layout
+       of the Tag. See Template.h for the syntax. */
+    char payload_template[CONFIG_BUFFER_SIZE];
+
+    /* The transport to the advertising dongle: 0 for BlueZ, 1 for a HCI
+       user channel socket and 2 for H4 over the UART */
+    int hci_transport;
+
+    /* The serial port of the controller for the UART transport */
+    char hci_uart_device[CONFIG_BUFFER_SIZE];
+
+    /* Baud rate of the serial port for the UART transport */
+    int hci_uart_baud_rate;
+
+    /* The BD address of the LBeacon whose sync advertisements mark the
+       frames of the fleet, or empty to advertise unsynchronized */
+    char sync_beacon_address[LENGTH_OF_MAC_ADDRESS];
+
+    /* Width in milliseconds of a slot of the frame */
+    int sync_slot_width_in_ms;
+
+    /* The slot of the Tag, or -1 to derive it from the BD address */
+    int sync_slot_index;
+
+    /* Number of frames between restarts of advertising at the slot */
+    int sync_realign_interval_in_frames;
+
+    /* Upper bound in seconds of the interval between scans for the sync
+       beacon */
+    int sync_max_resync_interval_in_seconds;
+
+    /* The dongle which scans for the LBeacons around the Tag, or -1 to
+       advertise the coordinates of lbeacon_uuid */
+    int locator_dongle_id;
+
+    /* Length in milliseconds of a scan for LBeacons */
+    int locator_scan_window_in_ms;
+
+    /* Time interval in seconds between the starts of scans for LBeacons */
+    int locator_scan_period_in_seconds;
+
+    /* 1 to advertise the RSSI-weighted position of the nearest LBeacons,
+       or 0 to advertise the coordinates of the nearest LBeacon */
+    int locator_weighted_position;
+
+    /* The file to which the received advertising reports are recorded for
+       the replay benchmark, or empty */
+    char locator_trace_file[CONFIG_BUFFER_SIZE];
+
+    /* The key of the rotating private identity in 32 hexadecimal digits,
+       or empty to advertise with the public address */
+    char privacy_key[CONFIG_BUFFER_SIZE];
+
+    /* Time interval in seconds between rotations of the private identity */
+    int privacy_rotation_interval_in_seconds;
+
+    /* The file, or the directory for CTF, to which the tracepoints are
+       exported on exit in a build with tracing, or empty */
+    char trace_file[CONFIG_BUFFER_SIZE];
+
+    /* The TraceFormat of the export */
+    int trace_format;
+
+    /* The provisioning bundle of the Tag, whose UUID, privacy key and sync
+       slot replace the ones of the config, or empty */
+    char provision_bundle[CONFIG_BUFFER_SIZE];
    
 } Config;
 
+/* The fields of the payload of advertising packet */
+typedef struct AdvertisingPayload {
+
+    /* 4 bytes for X coordinate and 4 bytes for Y coordinate */
+    uint8_t coordinates[LENGTH_OF_COORDINATES];
+
+    /* Push-button information */
+    int button_state;
+
+    /* Calibrated RSSI in dBm at 1 m at the selected TX power */
+    int measured_power;
+
+    int major_number;
+
+    int minor_number;
+
+    /* Sequence number of the payload, increased on every update of the
+       advertising data and carried across restarts by the state file. A
+       private identity restarts it in every epoch. */
+    int sequence_number;
+
+    /* Mask XORed into the coordinates on the air, all zeros unless the Tag
+       advertises a private identity */
+    uint8_t coordinate_mask[LENGTH_OF_COORDINATES];
+
+    /* Mask XORed into the measured power, major, minor and sensor summary
+       on the air, all zeros unless the Tag advertises a private identity */
+    uint8_t field_mask[LENGTH_OF_FIELD_MASK];
+
+    /* Whether the summary of the sensor pipeline is carried */
+    bool has_sensor_summary;
+
+    /* Still (0) or moving (1) state of the Tag */
+    int motion_state;
+
+    /* Motion energy in steps of 0.01 (m/s^2)^2, saturated at 255 */
+    int motion_energy;
+
+    /* Minimum and maximum temperature in degree Celsius */
+    int temperature_min;
+    int temperature_max;
+
+    /* Bits PAYLOAD_SLOT_BIT of the slots whose fields changed since the
+       payload was last written into the payload template */
+    unsigned int dirty_slots;
+
+} AdvertisingPayload;
+
+/* The advertising state of the Tag shared by the threads which update the
+   payload */
+typedef struct AdvertisingState {
+
+    int dongle_device_id;
+
+    /* Time interval in units of 0.625ms between advertising */
+    int min_interval_in_units_0625_ms;
+    int max_interval_in_units_0625_ms;
+
+    /* TX power in dBm selected by the dongle */
+    int tx_power_in_dbm;
+
+    /* Whether advertising was enabled with the extended advertising
+       commands */
+    bool extended_advertising;
+
+    /* LE_PUBLIC_ADDRESS, or LE_RANDOM_ADDRESS once the Tag advertises a
+       private address */
+    uint8_t own_address_type;
+
+    AdvertisingPayload payload;
+
+    /* Lock serializing payload updates and HCI commands on the dongle */
+    pthread_mutex_t lock;
+
+} AdvertisingState;
+
 
 /* A global flag that is initially set to true by the main thread. It is set
    to false by any thread when the thread encounters a fatal error,
    indicating that it is about to exit. In addition, if user presses Ctrl+C,
    the ready_to_work will be set as false to stop all threadts. */
-bool ready_to_work;
+extern bool ready_to_work;
 
 /* The pointer to the category of the log file */
-zlog_category_t *category_health_report, *category_debug;
+extern zlog_category_t *category_health_report, *category_debug;
 
 
 /*
@@ -182,10 +414,13 @@ extern int errno;
 */
 
 /* Struct for storing config information from the input file */
-Config g_config;
+extern Config g_config;
 
 /* UUID of LBeacon inside payload of advertising packet */
-char lbeacon_uuid[LENGTH_OF_UUID];
+extern char lbeacon_uuid[LENGTH_OF_UUID];
+
+/* The advertising state of the Tag */
+extern AdvertisingState g_advertising;
 
 /*
   FUNCTIONS
@@ -214,7 +449,9 @@ ErrorCode single_running_instance(char *file_name);
 
       This function reads the specified config file line by line until the
       end of file and copies the data in the lines into the Config struct
-      global variable.
+      global variable. Every line must be a key=value item of a known key,
+      given at most once, in any order. Items 1 to 3 are required, and
+      every other item takes its default value when it is missing.
 
   Parameters:
       config - Pointer to config struct including file path, coordinates, etc.
@@ -223,7 +460,10 @@ ErrorCode single_running_instance(char *file_name);
   Return value:
 
       ErrorCode - indicate the result of execution, the expected return code
-                  is WORK_SUCCESSFULLY
+                  is WORK_SUCCESSFULLY, or E_OPEN_FILE if the file cannot be
+                  read, a line is malformed, unknown, repeated or too long,
+                  or a required item is missing. The config is left
+                  unchanged on failure.
 */
 
 ErrorCode get_config(Config *config, char *file_name);
@@ -231,17 +471,18 @@ ErrorCode get_config(Config *config, char *file_name);
 /*
   uuid_str_to_data:
 
-     Convert uuid from string to unsigned integer.
+     Convert uuid from string to bytes.
 
   Parameters:
 
      uuid - The uuid in string type.
+     data - The buffer of strlen(uuid) / 2 bytes for the converted uuid.
 
   Return value:
 
-     unsigned int - The converted uuid in unsigned int type.
+     None
  */
-unsigned int *uuid_str_to_data(char *uuid);
+void uuid_str_to_data(char *uuid, uint8_t *data);
 
 
 /*
@@ -277,22 +518,189 @@ void trim_string_tail(char *message);
  */
 void ctrlc_handler(int stop);
 
+/*
+  send_hci_request:
+
+      This function sends a HCI command to the dongle and waits for the
+      Command Complete event carrying its return parameters.
+
+  Parameters:
+
+      device_handle - the handle of the open HCI socket
+      ogf - opcode group field
+      ocf - opcode command field
+      cparam - the command parameters
+      clen - the length of the command parameters
+      rparam - the buffer of the return parameters, starting with the status
+      rlen - the length of the buffer of the return parameters
+
+  Return value:
+
+      ErrorCode - E_SEND_REQUEST_TIMEOUT if the command cannot be sent or
+                  is not completed in time, or WORK_SUCCESSFULLY otherwise.
+                  The status returned by the dongle is left in rparam.
+*/
+
+ErrorCode send_hci_request(int device_handle,
+                           uint16_t ogf,
+                           uint16_t ocf,
+                           void *cparam,
+                           int clen,
+                           void *rparam,
+                           int rlen);
+
+/*
+  set_payload_coordinates:
+
+      This function fills the X and Y coordinates of the payload from the
+      UUID of LBeacon.
+
+  Parameters:
+
+      payload - the payload to be filled
+      advertising_uuid - universally unique identifier of advertiser
+
+  Return value:
+
+      None
+*/
+
+void set_payload_coordinates(AdvertisingPayload *payload,
+                             char *advertising_uuid);
+
+/*
+  set_payload_identity:
+
+      This function sets the masks of the payload to the ones of a private
+      identity, and restarts the sequence number from the one of its
+      epoch. The caller must hold g_advertising.lock.
+
+  Parameters:
+
+      payload - the payload to be updated
+      identity - the private identity on the air
+
+  Return value:
+
+      None
+*/
+
+void set_payload_identity(AdvertisingPayload *payload,
+                          PrivateIdentity *identity);
+
+/*
+  update_advertising_data:
+
+      This function patches the current payload of the Tag into the
+      compiled payload template and hands it to the dongle while
+      advertising stays enabled. It is the data-only update path used to
+      change the payload at runtime. The caller must hold
+      g_advertising.lock.
+
+  Parameters:
+
+      device_handle - the handle of the open HCI socket
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode update_advertising_data(int device_handle);
+
+/*
+  set_advertising_interval:
+
+      This function disables advertising, sets the new advertising
+      interval and enables advertising again, also when the interval
+      cannot be set. The caller must hold g_advertising.lock.
+
+  Parameters:
+
+      device_handle - the handle of the open HCI socket
+      min_interval_in_units_0625_ms - the lower bound of the advertising
+                                      interval
+      max_interval_in_units_0625_ms - the upper bound of the advertising
+                                      interval
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode set_advertising_interval(int device_handle,
+                                   int min_interval_in_units_0625_ms,
+                                   int max_interval_in_units_0625_ms);
+
+/*
+  restart_advertising:
+
+      This function disables advertising and enables it again with the
+      current parameters and data, so that the controller starts a new
+      advertising event right away. The caller must hold
+      g_advertising.lock.
+
+  Parameters:
+
+      device_handle - the handle of the open HCI socket
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode restart_advertising(int device_handle);
+
+/*
+  set_private_address:
+
+      This function disables advertising, sets the random address, switches
+      the advertising parameters to the random address on the first call,
+      updates the advertising data and enables advertising again. The
+      caller must hold g_advertising.lock.
+
+  Parameters:
+
+      device_handle - the handle of the open HCI socket
+      address - the private address
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode set_private_address(int device_handle, bdaddr_t *address);
+
 /*
   enable_advertising:
 
       This function enables the LBeacon to start advertising, sets the time
-      interval for advertising, and calibrates the RSSI value.
+      interval and the TX power for advertising, and embeds the RSSI value
+      calibrated to the selected TX power into the payload. With a privacy
+      key the Tag goes on the air with the private address and the masked
+      coordinates of the current epoch.
 
   Parameters:
 
       dongle_device_id - the bluetooth dongle device which the LBeacon uses
                          to advertise
-      advertising_interval_in_units_0625_ms - the time interval in units of 0.625ms 
-                                              during which the LBeacon can advertise
+      min_interval_in_units_0625_ms - the lower bound of the time interval in
+                                      units of 0.625ms during which the
+                                      LBeacon can advertise
+      max_interval_in_units_0625_ms - the upper bound of the time interval in
+                                      units of 0.625ms during which the
+                                      LBeacon can advertise
       advertising_uuid - universally unique identifier of advertiser
       major_number - major version number of LBeacon
       minor_number - minor version number of LBeacon
-      rssi_value - RSSI value of the bluetooth device
+      rssi_value - RSSI value of the bluetooth device measured at 1 m at
+                   the default TX power of the controller
+      tx_power_in_dbm - the requested TX power, or TX_POWER_NO_PREFERENCE
+                        to keep the controller default
 
   Return value:
 
@@ -301,11 +709,13 @@ void ctrlc_handler(int stop);
 */
 
 ErrorCode enable_advertising(int dongle_device_id,
-                             int advertising_interval_in_units_0625_ms,
+                             int min_interval_in_units_0625_ms,
+                             int max_interval_in_units_0625_ms,
                              char *advertising_uuid,
                              int major_number,
                              int minor_number,
-                             int rssi_value);
+                             int rssi_value,
+                             int tx_power_in_dbm);
 
 /*
   disable_advertising:
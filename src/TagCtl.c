@@ -0,0 +1,276 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the command line client of the control plane of
+      the Tag. It sets payload fields, triggers bursts, queries the state of
+      the Tag, and benchmarks the latency from client write to Command
+      Complete through the control socket and the control ring.
+
+ File Name:
+
+      TagCtl.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+      Usage:
+
+          TagCtl button <value>
+          TagCtl coordinates <16 hexadecimal digits>
+          TagCtl power <measured power in dBm>
+          TagCtl burst <duration in ms>
+          TagCtl query
+          TagCtl bench socket|ring <number of requests>
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Control.h"
+
+/* Time in micro seconds to wait before retrying a push into a full ring */
+#define RING_FULL_RETRY_IN_MICRO_SECONDS 100
+
+/* Time in seconds to wait for the Tag to drain the ring in a benchmark */
+#define RING_DRAIN_TIMEOUT_IN_SECONDS 10
+
+static void print_usage(char *program){
+    fprintf(stderr,
+            "Usage: %s button <value>\n"
+            "       %s coordinates <16 hexadecimal digits>\n"
+            "       %s power <measured power in dBm>\n"
+            "       %s burst <duration in ms>\n"
+            "       %s query\n"
+            "       %s bench socket|ring <number of requests>\n",
+            program, program, program, program, program, program);
+}
+
+static void print_state(ControlReply *reply){
+    int i;
+
+    printf("error_code %d\n", reply->error_code);
+    printf("interval [%d, %d] x 0.625 ms%s\n",
+           reply->min_interval_in_units_0625_ms,
+           reply->max_interval_in_units_0625_ms,
+           reply->burst_active ? " (burst)" : "");
+    printf("tx_power %d dBm%s\n", reply->tx_power_in_dbm,
+           reply->extended_advertising ? " (extended advertising)" : "");
+    printf("coordinates ");
+    for(i = 0 ; i < LENGTH_OF_COORDINATES ; i++){
+        printf("%02X", reply->payload.coordinates[i]);
+    }
+    printf("\nbutton %d\nmeasured_power %d dBm\nversion %d.%d\n"
+           "sequence %d\n",
+           reply->payload.button_state,
+           reply->payload.measured_power,
+           reply->payload.major_number,
+           reply->payload.minor_number,
+           reply->payload.sequence_number);
+    if(reply->payload.has_sensor_summary){
+        printf("motion %s energy %d temperature [%d, %d] C\n",
+               reply->payload.motion_state ? "moving" : "still",
+               reply->payload.motion_energy,
+               reply->payload.temperature_min,
+               reply->payload.temperature_max);
+    }
+    printf("requests %llu avg latency %llu ns max latency %llu ns\n",
+           (unsigned long long)reply->statistics.number_of_requests,
+           (unsigned long long)(reply->statistics.number_of_requests ?
+               reply->statistics.total_latency_in_ns /
+               reply->statistics.number_of_requests : 0),
+           (unsigned long long)reply->statistics.max_latency_in_ns);
+}
+
+static int compare_latency(const void *lhs, const void *rhs){
+    uint64_t left = *(const uint64_t *)lhs;
+    uint64_t right = *(const uint64_t *)rhs;
+
+    return (left > right) - (left < right);
+}
+
+static int benchmark_socket(int control_socket, int number_of_requests){
+    ControlRequest request;
+    ControlReply reply;
+    uint64_t *latencies = NULL;
+    int i;
+
+    latencies = (uint64_t *)malloc(sizeof(uint64_t) * number_of_requests);
+    if(NULL == latencies){
+        return E_CONTROL_REQUEST;
+    }
+
+    for(i = 0 ; i < number_of_requests ; i++){
+        memset(&request, 0, sizeof(request));
+        request.command = CONTROL_SET_FIELD;
+        request.field = PAYLOAD_FIELD_BUTTON;
+        request.length = 1;
+        request.value[0] = i & 1;
+
+        if(WORK_SUCCESSFULLY != control_send_request(control_socket,
+                                                     &request, &reply)){
+            fprintf(stderr, "Request %d failed with error %d\n",
+                    i, reply.error_code);
+            free(latencies);
+            return E_CONTROL_REQUEST;
+        }
+        latencies[i] = reply.latency_in_ns;
+    }
+
+    qsort(latencies, number_of_requests, sizeof(uint64_t), compare_latency);
+
+    printf("socket: requests %d min %llu ns p50 %llu ns p99 %llu ns "
+           "max %llu ns\n",
+           number_of_requests,
+           (unsigned long long)latencies[0],
+           (unsigned long long)latencies[number_of_requests / 2],
+           (unsigned long long)latencies[number_of_requests * 99 / 100],
+           (unsigned long long)latencies[number_of_requests - 1]);
+
+    free(latencies);
+
+    return WORK_SUCCESSFULLY;
+}
+
+static int benchmark_ring(int control_socket, int number_of_requests){
+    ControlRing *ring = NULL;
+    ControlRequest request;
+    ControlReply before, after;
+    uint64_t deadline_in_ns = 0;
+    uint64_t applied = 0;
+    int i;
+
+    ring = control_ring_map(false);
+    if(NULL == ring){
+        fprintf(stderr,
+                "Unable to map control ring, or another client uses it\n");
+        return E_OPEN_FILE;
+    }
+
+    memset(&request, 0, sizeof(request));
+    request.command = CONTROL_QUERY_STATE;
+    control_send_request(control_socket, &request, &before);
+
+    for(i = 0 ; i < number_of_requests ; i++){
+        memset(&request, 0, sizeof(request));
+        request.command = CONTROL_SET_FIELD;
+        request.field = PAYLOAD_FIELD_BUTTON;
+        request.length = 1;
+        request.value[0] = i & 1;
+
+        while(!control_ring_push(ring, &request)){
+            usleep(RING_FULL_RETRY_IN_MICRO_SECONDS);
+        }
+    }
+
+    /* Wait for the Tag to apply every request */
+    deadline_in_ns = get_monotonic_time_in_ns() +
+                     RING_DRAIN_TIMEOUT_IN_SECONDS * 1000000000ULL;
+    do{
+        memset(&request, 0, sizeof(request));
+        request.command = CONTROL_QUERY_STATE;
+        control_send_request(control_socket, &request, &after);
+        applied = after.statistics.number_of_requests -
+                  before.statistics.number_of_requests;
+    }while(applied < number_of_requests &&
+           get_monotonic_time_in_ns() < deadline_in_ns);
+
+    printf("ring: requests %d applied %llu avg %llu ns max %llu ns\n",
+           number_of_requests,
+           (unsigned long long)applied,
+           (unsigned long long)(applied ?
+               (after.statistics.total_latency_in_ns -
+                before.statistics.total_latency_in_ns) / applied : 0),
+           (unsigned long long)after.statistics.max_latency_in_ns);
+
+    control_ring_unmap(ring);
+
+    return WORK_SUCCESSFULLY;
+}
+
+int main(int argc, char **argv){
+    int control_socket = -1;
+    int return_value = WORK_SUCCESSFULLY;
+    ControlRequest request;
+    ControlReply reply;
+    unsigned int byte = 0;
+    int i;
+
+    if(argc < 2){
+        print_usage(argv[0]);
+        return E_CONTROL_REQUEST;
+    }
+
+    control_socket = control_connect(CONTROL_SOCKET_PATH);
+    if(control_socket < 0){
+        fprintf(stderr, "Unable to connect to %s: %s\n",
+                CONTROL_SOCKET_PATH, strerror(errno));
+        return E_OPEN_SOCKET;
+    }
+
+    memset(&request, 0, sizeof(request));
+
+    if(0 == strcmp(argv[1], "button") && argc == 3){
+        request.command = CONTROL_SET_FIELD;
+        request.field = PAYLOAD_FIELD_BUTTON;
+        request.length = 1;
+        request.value[0] = atoi(argv[2]);
+    }else if(0 == strcmp(argv[1], "coordinates") && argc == 3 &&
+             2 * LENGTH_OF_COORDINATES == strlen(argv[2])){
+        request.command = CONTROL_SET_FIELD;
+        request.field = PAYLOAD_FIELD_COORDINATES;
+        request.length = LENGTH_OF_COORDINATES;
+        for(i = 0 ; i < LENGTH_OF_COORDINATES ; i++){
+            sscanf(argv[2] + 2 * i, "%2x", &byte);
+            request.value[i] = byte;
+        }
+    }else if(0 == strcmp(argv[1], "power") && argc == 3){
+        request.command = CONTROL_SET_FIELD;
+        request.field = PAYLOAD_FIELD_MEASURED_POWER;
+        request.length = 1;
+        request.value[0] = (uint8_t)(int8_t)atoi(argv[2]);
+    }else if(0 == strcmp(argv[1], "burst") && argc == 3){
+        request.command = CONTROL_TRIGGER_BURST;
+        request.burst_duration_in_ms = atoi(argv[2]);
+    }else if(0 == strcmp(argv[1], "query") && argc == 2){
+        request.command = CONTROL_QUERY_STATE;
+    }else if(0 == strcmp(argv[1], "bench") && argc == 4 &&
+             atoi(argv[3]) > 0){
+        if(0 == strcmp(argv[2], "socket")){
+            return_value = benchmark_socket(control_socket, atoi(argv[3]));
+        }else if(0 == strcmp(argv[2], "ring")){
+            return_value = benchmark_ring(control_socket, atoi(argv[3]));
+        }else{
+            print_usage(argv[0]);
+            return_value = E_CONTROL_REQUEST;
+        }
+        close(control_socket);
+        return return_value;
+    }else{
+        print_usage(argv[0]);
+        close(control_socket);
+        return E_CONTROL_REQUEST;
+    }
+
+    return_value = control_send_request(control_socket, &request, &reply);
+    if(E_OPEN_SOCKET == return_value){
+        fprintf(stderr, "Unable to exchange request with the Tag\n");
+    }else{
+        print_state(&reply);
+    }
+
+    close(control_socket);
+
+    return return_value;
+}
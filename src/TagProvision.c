@@ -0,0 +1,534 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains a command line tool which provisions a fleet of
+      tags: it generates a unique identity for every Tag and writes the
+      provisioning bundles of the tags and the tables of the server.
+
+ File Name:
+
+      TagProvision.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+      Usage:
+
+          TagProvision -n number_of_tags -o output_directory
+                       [-f first_serial_number] [-c columns] [-d spacing]
+                       [-s number_of_sync_slots] [-j number_of_threads] [-p]
+
+      Every Tag gets the next serial number, a static BD address with the
+      prefix C1 of change_mac.sh, a LBeacon UUID and, with -p, a privacy
+      key. The address, the 8 bytes of the UUID which identify the Tag and
+      the key are drawn from /dev/urandom and checked to be unique in hash sets
+      shared by the threads, and a duplicate is drawn again. The other 8
+      bytes of the UUID are the X and Y coordinates of the Tag on a grid of
+      the given number of columns and spacing, as 32 bits big endian
+      integers. With -s the tags are assigned the sync slots round robin.
+
+      The output directory receives:
+
+          bundles/tag_<serial_number>.bundle - the bundle of each Tag, to
+              be installed as provision_bundle in the config of the Tag
+          keys.txt - with -p, the public addresses and keys of the tags,
+              the key file of the resolver
+          lookup.txt - the address, serial number, UUID and sync slot of
+              every Tag sorted by address, for the scanners to look the
+              tags up by address
+
+      The bundles and keys.txt hold the privacy keys, so they are written
+      with PROVISION_FILE_MODE and the bundles directory is only open to
+      its owner.
+
+      The threads generate the tags of contiguous ranges and write their
+      bundles, so that writing the files of a large fleet is spread over
+      the threads as well.
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "Provision.h"
+
+/* The most significant byte of the static addresses, as set by
+   change_mac.sh */
+#define TAG_PROVISION_ADDRESS_PREFIX 0xC1
+
+/* Number of random bytes read from /dev/urandom at once by a thread */
+#define TAG_PROVISION_RANDOM_POOL_SIZE 4096
+
+/* Maximum number of threads */
+#define TAG_PROVISION_MAX_NUMBER_OF_THREADS 64
+
+/* Maximum length of a path in the output directory */
+#define TAG_PROVISION_PATH_LENGTH 512
+
+/* A set of 64 bits values, 0 marking a free slot. Values are inserted by
+   the threads concurrently with compare and swap. */
+typedef struct UniqueSet {
+
+    uint64_t *values;
+
+    /* A power of two of at least twice the number of values */
+    size_t size;
+
+} UniqueSet;
+
+/* The tags generated by a thread */
+typedef struct ProvisionWorker {
+
+    pthread_t thread;
+
+    int first_index;
+
+    int number_of_tags;
+
+    uint8_t random_pool[TAG_PROVISION_RANDOM_POOL_SIZE];
+
+    int random_offset;
+
+    /* Number of duplicates drawn again */
+    int number_of_redraws;
+
+    bool has_failed;
+
+} ProvisionWorker;
+
+static ProvisionRecord *records = NULL;
+
+static int number_of_tags = 0;
+
+static uint32_t first_serial_number = 1;
+
+static int columns = 100;
+
+static uint32_t spacing = 1;
+
+static int number_of_sync_slots = 0;
+
+static bool has_privacy_keys = false;
+
+static char *output_directory = NULL;
+
+static int random_file = -1;
+
+static UniqueSet address_set;
+
+static UniqueSet identifier_set;
+
+static UniqueSet key_set;
+
+static double get_time_in_seconds(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool init_unique_set(UniqueSet *set, int number_of_values){
+    set->size = 1024;
+    while(set->size < 2 * (size_t)number_of_values){
+        set->size *= 2;
+    }
+
+    set->values = calloc(set->size, sizeof(uint64_t));
+
+    return NULL != set->values;
+}
+
+/* Insert a value other than 0, and tell whether it was not in the set.
+   The slot is read by the compare and swap itself, so that a thread never
+   sees a value half written by another one. */
+static bool insert_unique(UniqueSet *set, uint64_t value){
+    size_t index = (value * 0x9E3779B97F4A7C15ULL >> 32) & (set->size - 1);
+    uint64_t previous = 0;
+
+    while(true){
+        previous = __sync_val_compare_and_swap(&set->values[index], 0, value);
+
+        if(0 == previous){
+            return true;
+        }
+        if(previous == value){
+            return false;
+        }
+
+        index = (index + 1) & (set->size - 1);
+    }
+}
+
+static uint64_t pack_bytes(const uint8_t *data, int length){
+    uint64_t value = 0;
+    int i;
+
+    for(i = 0 ; i < length ; i++){
+        value |= (uint64_t)data[i] << (8 * i);
+    }
+
+    return value;
+}
+
+static bool get_random_bytes(ProvisionWorker *worker,
+                             uint8_t *data,
+                             int length){
+    ssize_t received = 0;
+    int size = 0;
+
+    while(length > 0){
+        if(TAG_PROVISION_RANDOM_POOL_SIZE == worker->random_offset){
+            size = 0;
+            while(size < TAG_PROVISION_RANDOM_POOL_SIZE){
+                received = read(random_file, worker->random_pool + size,
+                                TAG_PROVISION_RANDOM_POOL_SIZE - size);
+                if(received < 0 && EINTR == errno){
+                    continue;
+                }
+                if(received <= 0){
+                    return false;
+                }
+                size += received;
+            }
+            worker->random_offset = 0;
+        }
+
+        *data++ = worker->random_pool[worker->random_offset++];
+        length--;
+    }
+
+    return true;
+}
+
+static void put_big_endian(uint8_t *data, uint32_t value){
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static bool generate_record(ProvisionWorker *worker,
+                            int index,
+                            ProvisionRecord *record){
+    uint8_t identifier[8];
+
+    memset(record, 0, sizeof(ProvisionRecord));
+    record->serial_number = first_serial_number + index;
+
+    while(true){
+        if(!get_random_bytes(worker, record->address,
+                             PROVISION_ADDRESS_LENGTH - 1)){
+            return false;
+        }
+        record->address[PROVISION_ADDRESS_LENGTH - 1] =
+            TAG_PROVISION_ADDRESS_PREFIX;
+        if(insert_unique(&address_set,
+                         pack_bytes(record->address,
+                                    PROVISION_ADDRESS_LENGTH))){
+            break;
+        }
+        worker->number_of_redraws++;
+    }
+
+    while(true){
+        if(!get_random_bytes(worker, identifier, sizeof(identifier))){
+            return false;
+        }
+        if(0 != pack_bytes(identifier, sizeof(identifier)) &&
+           insert_unique(&identifier_set,
+                         pack_bytes(identifier, sizeof(identifier)))){
+            break;
+        }
+        worker->number_of_redraws++;
+    }
+
+    /* The first 8 bytes of the key are enough to tell two keys apart */
+    while(has_privacy_keys){
+        if(!get_random_bytes(worker, record->key, PROVISION_KEY_LENGTH)){
+            return false;
+        }
+        if(0 != pack_bytes(record->key, 8) &&
+           insert_unique(&key_set, pack_bytes(record->key, 8))){
+            break;
+        }
+        worker->number_of_redraws++;
+    }
+
+    /* Bytes 6 to 9 and 12 to 15 of the UUID are the coordinates read by
+       set_payload_coordinates, and the others identify the Tag */
+    memcpy(record->uuid, identifier, 6);
+    put_big_endian(record->uuid + 6, (index % columns) * spacing);
+    memcpy(record->uuid + 10, identifier + 6, 2);
+    put_big_endian(record->uuid + 12, (index / columns) * spacing);
+
+    record->sync_slot_index = number_of_sync_slots > 0 ?
+                              index % number_of_sync_slots : -1;
+
+    return true;
+}
+
+static void *generate_tags(void *argument){
+    ProvisionWorker *worker = (ProvisionWorker *)argument;
+    char path[TAG_PROVISION_PATH_LENGTH];
+    ProvisionRecord *record = NULL;
+    int i;
+
+    worker->random_offset = TAG_PROVISION_RANDOM_POOL_SIZE;
+
+    for(i = worker->first_index ;
+        i < worker->first_index + worker->number_of_tags ;
+        i++){
+
+        record = &records[i];
+
+        if(!generate_record(worker, i, record)){
+            fprintf(stderr, "Unable to read /dev/urandom\n");
+            worker->has_failed = true;
+            break;
+        }
+
+        snprintf(path, sizeof(path), "%s/bundles/tag_%u.bundle",
+                 output_directory, record->serial_number);
+        if(!write_provision_bundle(path, record)){
+            perror(path);
+            worker->has_failed = true;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int compare_address(const void *left, const void *right){
+    const ProvisionRecord *left_record = *(const ProvisionRecord **)left;
+    const ProvisionRecord *right_record = *(const ProvisionRecord **)right;
+    uint64_t left_address = pack_bytes(left_record->address,
+                                       PROVISION_ADDRESS_LENGTH);
+    uint64_t right_address = pack_bytes(right_record->address,
+                                        PROVISION_ADDRESS_LENGTH);
+
+    return (left_address > right_address) - (left_address < right_address);
+}
+
+static bool write_keys(void){
+    char path[TAG_PROVISION_PATH_LENGTH];
+    char address[PROVISION_ADDRESS_TEXT_LENGTH];
+    char key[2 * PROVISION_KEY_LENGTH + 1];
+    FILE *file = NULL;
+    int key_file = -1;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/keys.txt", output_directory);
+    key_file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    PROVISION_FILE_MODE);
+    if(key_file < 0 || -1 == fchmod(key_file, PROVISION_FILE_MODE) ||
+       NULL == (file = fdopen(key_file, "w"))){
+        perror(path);
+        if(key_file >= 0){
+            close(key_file);
+        }
+        return false;
+    }
+
+    fprintf(file, "# address key\n");
+    for(i = 0 ; i < number_of_tags ; i++){
+        format_provision_address(records[i].address, address);
+        format_provision_key(&records[i], key);
+        fprintf(file, "%s %s\n", address, key);
+    }
+
+    return 0 == fclose(file);
+}
+
+static bool write_lookup_table(void){
+    char path[TAG_PROVISION_PATH_LENGTH];
+    char address[PROVISION_ADDRESS_TEXT_LENGTH];
+    char uuid[2 * PROVISION_UUID_LENGTH + 1];
+    ProvisionRecord **sorted_records = NULL;
+    FILE *file = NULL;
+    int i;
+
+    sorted_records = malloc(number_of_tags * sizeof(ProvisionRecord *));
+    if(NULL == sorted_records){
+        return false;
+    }
+    for(i = 0 ; i < number_of_tags ; i++){
+        sorted_records[i] = &records[i];
+    }
+    qsort(sorted_records, number_of_tags, sizeof(ProvisionRecord *),
+          compare_address);
+
+    snprintf(path, sizeof(path), "%s/lookup.txt", output_directory);
+    file = fopen(path, "w");
+    if(NULL == file){
+        perror(path);
+        free(sorted_records);
+        return false;
+    }
+
+    fprintf(file, "# address serial_number uuid sync_slot_index\n");
+    for(i = 0 ; i < number_of_tags ; i++){
+        format_provision_address(sorted_records[i]->address, address);
+        format_provision_uuid(sorted_records[i], uuid);
+        fprintf(file, "%s %u %s %d\n", address,
+                sorted_records[i]->serial_number, uuid,
+                sorted_records[i]->sync_slot_index);
+    }
+
+    free(sorted_records);
+
+    return 0 == fclose(file);
+}
+
+static bool make_directory(char *path, mode_t mode){
+    return 0 == mkdir(path, mode) || EEXIST == errno;
+}
+
+int main(int argc, char **argv){
+    ProvisionWorker *workers = NULL;
+    char path[TAG_PROVISION_PATH_LENGTH];
+    int number_of_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int number_of_redraws = 0;
+    bool has_failed = false;
+    double start = 0;
+    double generation_in_seconds = 0;
+    int first_index = 0;
+    int option;
+    int i;
+
+    while((option = getopt(argc, argv, "n:o:f:c:d:s:j:p")) != -1){
+        switch(option){
+            case 'n':
+                number_of_tags = atoi(optarg);
+                break;
+            case 'o':
+                output_directory = optarg;
+                break;
+            case 'f':
+                first_serial_number = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                columns = atoi(optarg);
+                break;
+            case 'd':
+                spacing = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                number_of_sync_slots = atoi(optarg);
+                break;
+            case 'j':
+                number_of_threads = atoi(optarg);
+                break;
+            case 'p':
+                has_privacy_keys = true;
+                break;
+            default:
+                number_of_tags = 0;
+                break;
+        }
+    }
+
+    if(number_of_tags <= 0 || NULL == output_directory || columns <= 0 ||
+       number_of_sync_slots < 0 || number_of_sync_slots > INT16_MAX){
+        fprintf(stderr, "Usage: %s -n number_of_tags -o output_directory "
+                "[-f first_serial_number] [-c columns] [-d spacing] "
+                "[-s number_of_sync_slots] [-j number_of_threads] [-p]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if(number_of_threads < 1){
+        number_of_threads = 1;
+    }
+    if(number_of_threads > TAG_PROVISION_MAX_NUMBER_OF_THREADS){
+        number_of_threads = TAG_PROVISION_MAX_NUMBER_OF_THREADS;
+    }
+    if(number_of_threads > number_of_tags){
+        number_of_threads = number_of_tags;
+    }
+
+    snprintf(path, sizeof(path), "%s/bundles", output_directory);
+    if(!make_directory(output_directory, 0755) ||
+       !make_directory(path, 0700)){
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    random_file = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if(random_file < 0){
+        perror("/dev/urandom");
+        return EXIT_FAILURE;
+    }
+
+    records = malloc(number_of_tags * sizeof(ProvisionRecord));
+    workers = calloc(number_of_threads, sizeof(ProvisionWorker));
+    if(NULL == records || NULL == workers ||
+       !init_unique_set(&address_set, number_of_tags) ||
+       !init_unique_set(&identifier_set, number_of_tags) ||
+       !init_unique_set(&key_set, number_of_tags)){
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    start = get_time_in_seconds();
+
+    for(i = 0 ; i < number_of_threads ; i++){
+        workers[i].first_index = first_index;
+        workers[i].number_of_tags = number_of_tags / number_of_threads +
+                                    (i < number_of_tags % number_of_threads);
+        first_index += workers[i].number_of_tags;
+
+        if(0 != pthread_create(&workers[i].thread, NULL, generate_tags,
+                               &workers[i])){
+            fprintf(stderr, "Unable to start thread %d\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for(i = 0 ; i < number_of_threads ; i++){
+        pthread_join(workers[i].thread, NULL);
+        has_failed = has_failed || workers[i].has_failed;
+        number_of_redraws += workers[i].number_of_redraws;
+    }
+
+    generation_in_seconds = get_time_in_seconds() - start;
+
+    if(has_failed || (has_privacy_keys && !write_keys()) ||
+       !write_lookup_table()){
+        fprintf(stderr, "Unable to provision the tags\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("Provisioned %d tags with %d threads in %.3f s, tables written "
+           "in %.3f s, %d duplicates drawn again\n",
+           number_of_tags, number_of_threads, generation_in_seconds,
+           get_time_in_seconds() - start - generation_in_seconds,
+           number_of_redraws);
+
+    close(random_file);
+    free(address_set.values);
+    free(identifier_set.values);
+    free(key_set.values);
+    free(workers);
+    free(records);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,280 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains a command line tool which resolves the private
+      address of a Tag with the resolver library, and measures the
+      resolver.
+
+ File Name:
+
+      TagResolver.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+      Usage:
+
+          TagResolver keys_file private_address [masked_coordinates
+                      [masked_fields]]
+          TagResolver -b number_of_tags
+
+      The first form prints the public address of the Tag which advertises
+      with the private address at the current time, and the coordinates
+      unmasked if the 16 hexadecimal digits of the masked coordinates are
+      given. The 14 hexadecimal digits of the masked measured power, major,
+      minor and sensor summary are unmasked likewise. The second form builds the resolver for random keys, and
+      prints the time to build the index and to advance it by one epoch
+      and the rate of resolutions, half of them of unknown addresses.
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include <time.h>
+
+#include "Resolver.h"
+
+/* Rotation interval in seconds assumed by the tool */
+#define TAG_RESOLVER_ROTATION_INTERVAL_IN_SECONDS 900
+
+/* Number of resolutions measured by the benchmark */
+#define TAG_RESOLVER_NUMBER_OF_LOOKUPS 10000000
+
+static double get_time_in_seconds(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool parse_address(char *text, uint8_t *address){
+    unsigned int bytes[IDENTITY_ADDRESS_LENGTH];
+    int i;
+
+    if(IDENTITY_ADDRESS_LENGTH != sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x",
+                                         &bytes[5], &bytes[4], &bytes[3],
+                                         &bytes[2], &bytes[1], &bytes[0])){
+        return false;
+    }
+    for(i = 0 ; i < IDENTITY_ADDRESS_LENGTH ; i++){
+        address[i] = bytes[i];
+    }
+
+    return true;
+}
+
+static bool parse_bytes(char *text, uint8_t *bytes, int length){
+    unsigned int byte = 0;
+    int i;
+
+    if(2 * length != strlen(text)){
+        return false;
+    }
+    for(i = 0 ; i < length ; i++){
+        if(1 != sscanf(&text[2 * i], "%2x", &byte)){
+            return false;
+        }
+        bytes[i] = byte;
+    }
+
+    return true;
+}
+
+static void print_bytes(uint8_t *bytes, int length){
+    int i;
+
+    for(i = 0 ; i < length ; i++){
+        printf("%02x", bytes[i]);
+    }
+}
+
+static void print_address(uint8_t *address){
+    printf("%02X:%02X:%02X:%02X:%02X:%02X",
+           address[5], address[4], address[3],
+           address[2], address[1], address[0]);
+}
+
+static int resolve(char *keys_file, char *address_text,
+                   char *coordinates_text, char *fields_text){
+    uint8_t address[IDENTITY_ADDRESS_LENGTH];
+    uint8_t coordinates[IDENTITY_COORDINATES_LENGTH];
+    uint8_t fields[IDENTITY_FIELDS_LENGTH];
+    ResolverTag *tags = NULL;
+    Resolver resolver;
+    uint32_t epoch = 0;
+    int number_of_tags = 0;
+    int tag_index = 0;
+
+    if(!parse_address(address_text, address) ||
+       (NULL != coordinates_text &&
+        !parse_bytes(coordinates_text, coordinates,
+                     IDENTITY_COORDINATES_LENGTH)) ||
+       (NULL != fields_text &&
+        !parse_bytes(fields_text, fields, IDENTITY_FIELDS_LENGTH))){
+        fprintf(stderr, "Malformed address, coordinates or fields\n");
+        return 1;
+    }
+
+    number_of_tags = load_resolver_tags(keys_file, &tags);
+    if(number_of_tags <= 0){
+        fprintf(stderr, "Unable to load keys from %s\n", keys_file);
+        free(tags);
+        return 1;
+    }
+
+    if(0 != init_resolver(&resolver, tags, number_of_tags,
+                          TAG_RESOLVER_ROTATION_INTERVAL_IN_SECONDS,
+                          time(NULL))){
+        fprintf(stderr, "Unable to build the resolver\n");
+        free(tags);
+        return 1;
+    }
+
+    tag_index = resolve_private_address(
+        &resolver, address,
+        NULL != coordinates_text ? coordinates : NULL, &epoch);
+    if(tag_index < 0){
+        printf("unresolved\n");
+    }else{
+        print_address(tags[tag_index].public_address);
+        printf(" epoch %u", epoch);
+        if(NULL != coordinates_text){
+            printf(" coordinates ");
+            print_bytes(coordinates, IDENTITY_COORDINATES_LENGTH);
+        }
+        if(NULL != fields_text &&
+           0 == unmask_private_fields(&resolver, tag_index, epoch, fields)){
+            printf(" fields ");
+            print_bytes(fields, IDENTITY_FIELDS_LENGTH);
+        }
+        printf("\n");
+    }
+
+    free_resolver(&resolver);
+    free(tags);
+
+    return tag_index < 0 ? 2 : 0;
+}
+
+static int benchmark(int number_of_tags){
+    ResolverTag *tags = NULL;
+    uint8_t *addresses = NULL;
+    uint8_t *address = NULL;
+    Resolver resolver;
+    PrivateIdentity identity;
+    time_t now = time(NULL);
+    uint32_t epoch = 0;
+    double start = 0;
+    double build_in_seconds = 0;
+    double update_in_seconds = 0;
+    double lookup_in_seconds = 0;
+    long resolved = 0;
+    long i;
+    int j;
+
+    if(number_of_tags <= 0){
+        fprintf(stderr, "Invalid number of tags\n");
+        return 1;
+    }
+
+    tags = malloc(number_of_tags * sizeof(ResolverTag));
+    addresses = malloc((size_t)number_of_tags * IDENTITY_ADDRESS_LENGTH);
+    if(NULL == tags || NULL == addresses){
+        fprintf(stderr, "Out of memory\n");
+        free(tags);
+        free(addresses);
+        return 1;
+    }
+
+    srand(now);
+    for(i = 0 ; i < number_of_tags ; i++){
+        for(j = 0 ; j < IDENTITY_ADDRESS_LENGTH ; j++){
+            tags[i].public_address[j] = rand();
+        }
+        for(j = 0 ; j < IDENTITY_KEY_LENGTH ; j++){
+            tags[i].key[j] = rand();
+        }
+    }
+
+    start = get_time_in_seconds();
+    if(0 != init_resolver(&resolver, tags, number_of_tags,
+                          TAG_RESOLVER_ROTATION_INTERVAL_IN_SECONDS, now)){
+        fprintf(stderr, "Unable to build the resolver\n");
+        free(tags);
+        free(addresses);
+        return 1;
+    }
+    build_in_seconds = get_time_in_seconds() - start;
+
+    start = get_time_in_seconds();
+    update_resolver(&resolver, now + TAG_RESOLVER_ROTATION_INTERVAL_IN_SECONDS);
+    update_in_seconds = get_time_in_seconds() - start;
+
+    /* The addresses of the current epoch, every second one turned into an
+       unknown address */
+    epoch = resolver.epoch;
+    for(i = 0 ; i < number_of_tags ; i++){
+        derive_private_identity(tags[i].key, epoch, &identity);
+        memcpy(&addresses[i * IDENTITY_ADDRESS_LENGTH], identity.address,
+               IDENTITY_ADDRESS_LENGTH);
+        if(i % 2){
+            addresses[i * IDENTITY_ADDRESS_LENGTH] ^= 0x5A;
+        }
+    }
+
+    start = get_time_in_seconds();
+    for(i = 0 ; i < TAG_RESOLVER_NUMBER_OF_LOOKUPS ; i++){
+        address = &addresses[(i % number_of_tags) * IDENTITY_ADDRESS_LENGTH];
+        if(resolve_private_address(&resolver, address, NULL, NULL) >= 0){
+            resolved++;
+        }
+    }
+    lookup_in_seconds = get_time_in_seconds() - start;
+
+    printf("tags %d, table %zu entries, build %.1f ms, "
+           "epoch update %.1f ms\n",
+           number_of_tags, resolver.table_size,
+           build_in_seconds * 1000, update_in_seconds * 1000);
+    printf("%d lookups, %ld resolved, %.1f ns/lookup, %.1fM lookups/s\n",
+           TAG_RESOLVER_NUMBER_OF_LOOKUPS, resolved,
+           lookup_in_seconds * 1e9 / TAG_RESOLVER_NUMBER_OF_LOOKUPS,
+           TAG_RESOLVER_NUMBER_OF_LOOKUPS / lookup_in_seconds / 1e6);
+
+    free_resolver(&resolver);
+    free(tags);
+    free(addresses);
+
+    return 0;
+}
+
+int main(int argc, char **argv){
+    if(3 == argc && 0 == strcmp(argv[1], "-b")){
+        return benchmark(atoi(argv[2]));
+    }
+
+    if(3 <= argc && 5 >= argc){
+        return resolve(argv[1], argv[2], 4 <= argc ? argv[3] : NULL,
+                       5 == argc ? argv[4] : NULL);
+    }
+
+    fprintf(stderr,
+            "Usage: %s keys_file private_address [masked_coordinates "
+            "[masked_fields]]\n"
+            "       %s -b number_of_tags\n",
+            argv[0], argv[0]);
+
+    return 1;
+}
@@ -0,0 +1,334 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used by the Tag to compile the
+      payload template and to patch the payload into it.
+
+ File Name:
+
+      Template.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include <ctype.h>
+
+#include "Template.h"
+
+#define Debugging
+
+PayloadTemplate g_payload_template;
+
+static const char *slot_names[NUMBER_OF_PAYLOAD_SLOT_TYPES] = {
+    "coordinates", "button", "measured_power", "major", "minor",
+    "sequence", "sensor_summary"
+};
+
+static const int slot_sizes[NUMBER_OF_PAYLOAD_SLOT_TYPES] = {
+    LENGTH_OF_COORDINATES, 1, 1, 1, 1, 1, 4
+};
+
+static int find_slot_type(char *name){
+    int type;
+
+    for(type = 0 ; type < NUMBER_OF_PAYLOAD_SLOT_TYPES ; type++){
+        if(0 == strcmp(name, slot_names[type])){
+            return type;
+        }
+    }
+
+    return -1;
+}
+
+static bool is_hex_bytes(char *item){
+    size_t length = strlen(item);
+    size_t i;
+
+    if(0 == length || 0 != length % 2){
+        return false;
+    }
+    for(i = 0 ; i < length ; i++){
+        if(!isxdigit((unsigned char)item[i])){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static ErrorCode report_malformed_template(char *item){
+    zlog_error(category_health_report,
+               "Malformed payload template item [%s]", item);
+#ifdef Debugging
+    zlog_error(category_debug,
+               "Malformed payload template item [%s]", item);
+#endif
+    return E_ADVERTISE_MODE;
+}
+
+ErrorCode compile_payload_template(char *description,
+                                   PayloadTemplate *payload_template){
+    char buffer[CONFIG_BUFFER_SIZE];
+    char *structure = NULL;
+    char *item = NULL;
+    char *structure_save_pointer = NULL;
+    char *item_save_pointer = NULL;
+    uint8_t *data = payload_template->image.data;
+    PayloadSlot *slot = NULL;
+    unsigned int value = 0;
+    int length = 0;
+    int length_offset = 0;
+    int type = 0;
+    size_t i;
+
+    memset(payload_template, 0, sizeof(PayloadTemplate));
+    payload_template->sensor_summary_length_offset = -1;
+
+    memset(buffer, 0, sizeof(buffer));
+    strncpy(buffer, 0 == strlen(description) ?
+                    DEFAULT_PAYLOAD_TEMPLATE : description,
+            sizeof(buffer) - 1);
+
+    for(structure = strtok_r(buffer, PAYLOAD_TEMPLATE_STRUCTURE_DELIMITER,
+                             &structure_save_pointer);
+        structure != NULL;
+        structure = strtok_r(NULL, PAYLOAD_TEMPLATE_STRUCTURE_DELIMITER,
+                             &structure_save_pointer)){
+
+        /* 1st byte: length of the AD structure, 2nd byte: AD type */
+        item = strtok_r(structure, PAYLOAD_TEMPLATE_ITEM_DELIMITER,
+                        &item_save_pointer);
+        if(NULL == item || 2 != strlen(item) || !is_hex_bytes(item) ||
+           payload_template->sensor_summary_length_offset >= 0 ||
+           length + 2 > MAX_ADVERTISING_DATA_LENGTH){
+            return report_malformed_template(structure);
+        }
+        sscanf(item, "%2x", &value);
+        length_offset = length;
+        data[length + 1] = value;
+        length += 2;
+
+        for(item = strtok_r(NULL, PAYLOAD_TEMPLATE_ITEM_DELIMITER,
+                            &item_save_pointer);
+            item != NULL;
+            item = strtok_r(NULL, PAYLOAD_TEMPLATE_ITEM_DELIMITER,
+                            &item_save_pointer)){
+
+            /* Nothing may follow the sensor summary, which is dropped until
+               the sensor pipeline publishes it */
+            if(payload_template->sensor_summary_length_offset >= 0){
+                return report_malformed_template(item);
+            }
+
+            type = find_slot_type(item);
+            if(type >= 0){
+                if(payload_template->number_of_slots >=
+                       MAX_NUMBER_OF_PAYLOAD_SLOTS ||
+                   length + slot_sizes[type] > MAX_ADVERTISING_DATA_LENGTH){
+                    return report_malformed_template(item);
+                }
+
+                slot = &payload_template->slots[
+                           payload_template->number_of_slots];
+                slot->type = type;
+                slot->offset = length;
+                slot->size = slot_sizes[type];
+                payload_template->number_of_slots++;
+                length += slot_sizes[type];
+
+                if(PAYLOAD_SLOT_SENSOR_SUMMARY == type){
+                    payload_template->sensor_summary_length_offset =
+                        length_offset;
+                }
+                continue;
+            }
+
+            /* Fixed bytes in hex */
+            if(!is_hex_bytes(item) ||
+               length + strlen(item) / 2 > MAX_ADVERTISING_DATA_LENGTH){
+                return report_malformed_template(item);
+            }
+            for(i = 0 ; i < strlen(item) ; i += 2){
+                sscanf(item + i, "%2x", &value);
+                data[length] = value;
+                length++;
+            }
+        }
+
+        data[length_offset] = length - length_offset - 1;
+    }
+
+    if(0 == length){
+        return report_malformed_template(description);
+    }
+
+    payload_template->full_length = length;
+    payload_template->image.length = length;
+
+    return WORK_SUCCESSFULLY;
+}
+
+le_set_advertising_data_cp *patch_payload_template(
+    PayloadTemplate *payload_template,
+    AdvertisingPayload *payload){
+
+    uint8_t *data = payload_template->image.data;
+    PayloadSlot *slot = NULL;
+    int sensor_summary_size = slot_sizes[PAYLOAD_SLOT_SENSOR_SUMMARY];
+    int i, j;
+
+    TRACE_BEGIN(TRACEPOINT_PAYLOAD_ENCODE, payload->sequence_number);
+
+    for(i = 0 ; i < payload_template->number_of_slots ; i++){
+        slot = &payload_template->slots[i];
+        if(0 == (payload->dirty_slots & PAYLOAD_SLOT_BIT(slot->type))){
+            continue;
+        }
+
+        switch(slot->type){
+            case PAYLOAD_SLOT_COORDINATES:
+                for(j = 0 ; j < LENGTH_OF_COORDINATES ; j++){
+                    data[slot->offset + j] = payload->coordinates[j] ^
+                                             payload->coordinate_mask[j];
+                }
+                break;
+            case PAYLOAD_SLOT_BUTTON:
+                data[slot->offset] = payload->button_state & 0x00FF;
+                break;
+            case PAYLOAD_SLOT_MEASURED_POWER:
+                data[slot->offset] =
+                    (uint8_t)(int8_t)payload->measured_power ^
+                    payload->field_mask[FIELD_MASK_MEASURED_POWER];
+                break;
+            case PAYLOAD_SLOT_MAJOR:
+                data[slot->offset] = (payload->major_number & 0x00FF) ^
+                                     payload->field_mask[FIELD_MASK_MAJOR];
+                break;
+            case PAYLOAD_SLOT_MINOR:
+                data[slot->offset] = (payload->minor_number & 0x00FF) ^
+                                     payload->field_mask[FIELD_MASK_MINOR];
+                break;
+            case PAYLOAD_SLOT_SEQUENCE:
+                data[slot->offset] = payload->sequence_number & 0x00FF;
+                break;
+            case PAYLOAD_SLOT_SENSOR_SUMMARY:
+                if(!payload->has_sensor_summary){
+                    memset(&data[slot->offset], 0, slot->size);
+                    break;
+                }
+                data[slot->offset] = payload->motion_state & 0x00FF;
+                data[slot->offset + 1] = payload->motion_energy & 0x00FF;
+                data[slot->offset + 2] =
+                    (uint8_t)(int8_t)payload->temperature_min;
+                data[slot->offset + 3] =
+                    (uint8_t)(int8_t)payload->temperature_max;
+                for(j = 0 ; j < slot->size ; j++){
+                    data[slot->offset + j] ^=
+                        payload->field_mask[FIELD_MASK_SENSOR_SUMMARY + j];
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    /* The sensor summary ends the advertising data, so leaving it out only
+       shortens its AD structure and the advertising data */
+    if(payload_template->sensor_summary_length_offset >= 0 &&
+       0 != (payload->dirty_slots &
+             PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_SENSOR_SUMMARY))){
+        if(payload->has_sensor_summary){
+            data[payload_template->sensor_summary_length_offset] =
+                payload_template->full_length -
+                payload_template->sensor_summary_length_offset - 1;
+            payload_template->image.length = payload_template->full_length;
+        }else{
+            data[payload_template->sensor_summary_length_offset] =
+                payload_template->full_length -
+                payload_template->sensor_summary_length_offset - 1 -
+                sensor_summary_size;
+            payload_template->image.length =
+                payload_template->full_length - sensor_summary_size;
+        }
+    }
+
+    payload->dirty_slots = 0;
+
+    TRACE_END(TRACEPOINT_PAYLOAD_ENCODE, payload_template->image.length);
+
+    return &payload_template->image;
+}
+
+bool match_payload_template(PayloadTemplate *payload_template,
+                            uint8_t *data,
+                            int length){
+    uint8_t *image = payload_template->image.data;
+    PayloadSlot *slot = NULL;
+    bool is_slot = false;
+    int offset = 0;
+    int i;
+
+    if(length != payload_template->full_length &&
+       (payload_template->sensor_summary_length_offset < 0 ||
+        length != payload_template->full_length -
+                  slot_sizes[PAYLOAD_SLOT_SENSOR_SUMMARY])){
+        return false;
+    }
+
+    for(offset = 0 ; offset < length ; offset++){
+        /* The length of the AD structure with the sensor summary depends
+           on whether the summary is carried, so it is checked against the
+           length of the advertising data rather than the image, which the
+           advertising thread may be patching */
+        if(offset == payload_template->sensor_summary_length_offset){
+            if(data[offset] != length - offset - 1){
+                return false;
+            }
+            continue;
+        }
+
+        is_slot = false;
+        for(i = 0 ; i < payload_template->number_of_slots ; i++){
+            slot = &payload_template->slots[i];
+            if(offset >= slot->offset && offset < slot->offset + slot->size){
+                is_slot = true;
+                break;
+            }
+        }
+
+        if(!is_slot && data[offset] != image[offset]){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int find_payload_slot(PayloadTemplate *payload_template,
+                      PayloadSlotType type){
+    int i;
+
+    for(i = 0 ; i < payload_template->number_of_slots ; i++){
+        if(type == payload_template->slots[i].type){
+            return payload_template->slots[i].offset;
+        }
+    }
+
+    return -1;
+}
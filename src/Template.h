@@ -0,0 +1,230 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to compile the payload template in the config into a
+    pre-rendered advertising data image.
+
+File Name:
+
+    Template.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    The payload template describes the AD structures of the advertising
+    data. Each AD structure is listed as its AD type in hex followed by
+    fixed bytes in hex and named slots, separated by commas, and the AD
+    structures are separated by semicolons, e.g.
+
+        01,04;ff,0f00,coordinates,button,measured_power,major,minor,
+        sequence,sensor_summary
+
+    which is the layout of the Tag when the template is left empty. The
+    template is compiled once at start into the advertising data with the
+    AD lengths and fixed bytes in place, and a table of the offset and size
+    of every slot. An update of the payload writes only the bytes of the
+    slots, and the image is handed to the dongle as it is. The
+    sensor_summary slot is carried only once the sensor pipeline has
+    published a summary, so it must be the last item of the template.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include "Tag.h"
+
+/*
+  CONSTANTS
+*/
+
+/* The template used when the config leaves the payload template empty */
+#define DEFAULT_PAYLOAD_TEMPLATE \
+    "01,04;ff,0f00,coordinates,button,measured_power,major,minor," \
+    "sequence,sensor_summary"
+
+#define PAYLOAD_TEMPLATE_STRUCTURE_DELIMITER ";"
+
+#define PAYLOAD_TEMPLATE_ITEM_DELIMITER ","
+
+/* Maximum number of slots in a payload template */
+#define MAX_NUMBER_OF_PAYLOAD_SLOTS 16
+
+/* Maximum length of the advertising data of legacy advertising */
+#define MAX_ADVERTISING_DATA_LENGTH 31
+
+/* Bit of a slot type in the dirty slots of the payload */
+#define PAYLOAD_SLOT_BIT(type) (1U << (type))
+
+#define ALL_PAYLOAD_SLOTS ((1U << NUMBER_OF_PAYLOAD_SLOT_TYPES) - 1)
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The typed slots of the payload template */
+typedef enum _PayloadSlotType{
+
+    /* 8 bytes: X and Y coordinates */
+    PAYLOAD_SLOT_COORDINATES = 0,
+    /* 1 byte: push-button state */
+    PAYLOAD_SLOT_BUTTON = 1,
+    /* 1 byte: measured power in dBm as a signed byte */
+    PAYLOAD_SLOT_MEASURED_POWER = 2,
+    /* 1 byte: major version number */
+    PAYLOAD_SLOT_MAJOR = 3,
+    /* 1 byte: minor version number */
+    PAYLOAD_SLOT_MINOR = 4,
+    /* 1 byte: sequence number of the payload */
+    PAYLOAD_SLOT_SEQUENCE = 5,
+    /* 4 bytes: motion state, motion energy, minimum and maximum temperature,
+       carried only once the sensor pipeline has published a summary */
+    PAYLOAD_SLOT_SENSOR_SUMMARY = 6,
+
+    NUMBER_OF_PAYLOAD_SLOT_TYPES
+
+} PayloadSlotType;
+
+/* A slot of the compiled payload template */
+typedef struct PayloadSlot {
+
+    PayloadSlotType type;
+
+    /* Offset of the slot in the advertising data */
+    int offset;
+
+    int size;
+
+} PayloadSlot;
+
+/* The compiled payload template */
+typedef struct PayloadTemplate {
+
+    /* The advertising data with the AD lengths and fixed bytes filled in */
+    le_set_advertising_data_cp image;
+
+    /* Length of the advertising data with the sensor summary carried */
+    int full_length;
+
+    PayloadSlot slots[MAX_NUMBER_OF_PAYLOAD_SLOTS];
+
+    int number_of_slots;
+
+    /* Offset of the length byte of the AD structure which ends with the
+       sensor summary, or -1 if the template carries no sensor summary */
+    int sensor_summary_length_offset;
+
+} PayloadTemplate;
+
+/*
+  GLOBAL VARIABLES
+*/
+
+/* The compiled payload template of the Tag, patched under
+   g_advertising.lock */
+extern PayloadTemplate g_payload_template;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  compile_payload_template:
+
+      This function compiles the description of a payload template into
+      the pre-rendered advertising data and the table of slots.
+
+  Parameters:
+
+      description - the payload template, or an empty string for
+                    DEFAULT_PAYLOAD_TEMPLATE
+      payload_template - the compiled payload template
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode compile_payload_template(char *description,
+                                   PayloadTemplate *payload_template);
+
+/*
+  patch_payload_template:
+
+      This function writes the fields of the payload into the slots of the
+      compiled template, which leaves the advertising data ready to be sent.
+      Only the slots marked in the dirty slots of the payload are written,
+      and the dirty slots are cleared.
+
+  Parameters:
+
+      payload_template - the compiled payload template
+      payload - the fields of the payload
+
+  Return value:
+
+      le_set_advertising_data_cp * - the advertising data in the template
+*/
+
+le_set_advertising_data_cp *patch_payload_template(
+    PayloadTemplate *payload_template,
+    AdvertisingPayload *payload);
+
+/*
+  match_payload_template:
+
+      This function tells whether advertising data is laid out by the
+      compiled template, that is, whether every byte outside the slots,
+      such as the AD types and the company identifier of the manufacturer
+      specific data, is the byte of the template.
+
+  Parameters:
+
+      payload_template - the compiled payload template
+      data - the advertising data
+      length - the length of the advertising data
+
+  Return value:
+
+      bool - true if the advertising data matches the template
+*/
+
+bool match_payload_template(PayloadTemplate *payload_template,
+                            uint8_t *data,
+                            int length);
+
+/*
+  find_payload_slot:
+
+      This function returns the offset of a slot in the advertising data.
+
+  Parameters:
+
+      payload_template - the compiled payload template
+      type - the type of the slot
+
+  Return value:
+
+      int - the offset of the slot, or -1 if the template has no such slot
+*/
+
+int find_payload_slot(PayloadTemplate *payload_template,
+                      PayloadSlotType type);
+
+#endif
@@ -0,0 +1,455 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used to record the tracepoints of
+      the Tag and to export them.
+
+ File Name:
+
+      Trace.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Trace.h"
+
+#ifdef TRACING
+
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "Tag.h"
+
+#define Debugging
+
+/* A buffered writer on a file descriptor, which formats without stdio */
+typedef struct TraceWriter {
+
+    int file;
+
+    int length;
+
+    bool has_failed;
+
+    char buffer[TRACE_EXPORT_BUFFER_SIZE];
+
+} TraceWriter;
+
+static const char *tracepoint_names[NUMBER_OF_TRACEPOINTS] = {
+    "config_load", "lock_file", "advertising_lock", "socket_open",
+    "hci_command", "hci_submit", "payload_encode", "signal",
+    "start_phase", "enable_advertising", "resume_advertising"
+};
+
+static const char chrome_phases[] = {'B', 'E', 'i'};
+
+static TraceRing trace_rings[TRACE_MAX_NUMBER_OF_THREADS];
+
+/* Events of threads without a ring */
+static uint32_t number_of_dropped_events = 0;
+
+static __thread TraceRing *thread_ring = NULL;
+
+/* The key whose destructor releases the ring of an exiting thread */
+static pthread_key_t trace_ring_key;
+
+static pthread_once_t trace_ring_key_once = PTHREAD_ONCE_INIT;
+
+/* The writer is only used by the exporting thread */
+static TraceWriter trace_writer;
+
+static void release_trace_ring(void *ring){
+    sigset_t all_signals;
+    sigset_t old_signals;
+
+    /* A signal handler must not record into the ring once another thread
+       may have claimed it */
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+    thread_ring = NULL;
+    __atomic_store_n(&((TraceRing *)ring)->state, TRACE_RING_RELEASED,
+                     __ATOMIC_RELEASE);
+
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+}
+
+static void create_trace_ring_key(void){
+    pthread_key_create(&trace_ring_key, release_trace_ring);
+}
+
+/* Take the first ring in the given state */
+static TraceRing *take_trace_ring(uint32_t state){
+    uint32_t expected = 0;
+    int i;
+
+    for(i = 0 ; i < TRACE_MAX_NUMBER_OF_THREADS ; i++){
+        expected = state;
+        if(__atomic_compare_exchange_n(&trace_rings[i].state, &expected,
+                                       TRACE_RING_CLAIMED, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            return &trace_rings[i];
+        }
+    }
+
+    return NULL;
+}
+
+void claim_trace_ring(void){
+    sigset_t all_signals;
+    sigset_t old_signals;
+    TraceRing *ring = NULL;
+
+    pthread_once(&trace_ring_key_once, create_trace_ring_key);
+
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+    if(NULL == thread_ring){
+        /* The events of an exited thread are kept as long as a free ring
+           is left */
+        ring = take_trace_ring(TRACE_RING_FREE);
+        if(NULL == ring){
+            ring = take_trace_ring(TRACE_RING_RELEASED);
+        }
+
+        if(NULL != ring){
+            ring->thread_id = syscall(SYS_gettid);
+            ring->head = 0;
+            pthread_setspecific(trace_ring_key, ring);
+            thread_ring = ring;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+}
+
+void record_tracepoint(Tracepoint tracepoint,
+                       TracePhase phase,
+                       int32_t argument){
+    struct timespec now;
+    TraceEvent *event = NULL;
+    uint32_t slot = 0;
+
+    if(NULL == thread_ring){
+        __sync_fetch_and_add(&number_of_dropped_events, 1);
+        return;
+    }
+
+    /* The slot is taken atomically, since a signal handler may record an
+       event in the middle of this one */
+    slot = __sync_fetch_and_add(&thread_ring->head, 1);
+    event = &thread_ring->events[slot & (TRACE_RING_SIZE - 1)];
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    event->timestamp_in_ns = (uint64_t)now.tv_sec * 1000000000ULL +
+                             now.tv_nsec;
+    event->tracepoint = tracepoint;
+    event->phase = phase;
+    event->argument = argument;
+}
+
+static void flush_trace_writer(TraceWriter *writer){
+    int offset = 0;
+    ssize_t written = 0;
+
+    while(offset < writer->length){
+        written = write(writer->file, writer->buffer + offset,
+                        writer->length - offset);
+        if(written <= 0){
+            writer->has_failed = true;
+            break;
+        }
+        offset += written;
+    }
+
+    writer->length = 0;
+}
+
+static bool open_trace_writer(TraceWriter *writer, char *path){
+    writer->file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    writer->length = 0;
+    writer->has_failed = false;
+
+    return -1 != writer->file;
+}
+
+static bool close_trace_writer(TraceWriter *writer){
+    flush_trace_writer(writer);
+
+    if(0 != close(writer->file)){
+        writer->has_failed = true;
+    }
+
+    return !writer->has_failed;
+}
+
+static void write_trace_bytes(TraceWriter *writer, void *data, int length){
+    if(writer->length + length > TRACE_EXPORT_BUFFER_SIZE){
+        flush_trace_writer(writer);
+    }
+
+    memcpy(writer->buffer + writer->length, data, length);
+    writer->length += length;
+}
+
+static void write_trace_text(TraceWriter *writer, const char *format, ...){
+    va_list arguments;
+    int length = 0;
+
+    /* A formatted line never nears the size of the buffer, so it is
+       formatted again after a flush when it does not fit */
+    va_start(arguments, format);
+    length = vsnprintf(writer->buffer + writer->length,
+                       TRACE_EXPORT_BUFFER_SIZE - writer->length,
+                       format, arguments);
+    va_end(arguments);
+
+    if(writer->length + length >= TRACE_EXPORT_BUFFER_SIZE){
+        flush_trace_writer(writer);
+
+        va_start(arguments, format);
+        length = vsnprintf(writer->buffer, TRACE_EXPORT_BUFFER_SIZE,
+                           format, arguments);
+        va_end(arguments);
+    }
+
+    writer->length += length;
+}
+
+/* Whether a ring holds the events of a running or an exited thread */
+static bool is_trace_ring_used(TraceRing *ring){
+    return TRACE_RING_FREE != __atomic_load_n(&ring->state,
+                                              __ATOMIC_ACQUIRE);
+}
+
+/* The kept events of a ring are the last TRACE_RING_SIZE ones */
+static uint32_t get_first_slot(TraceRing *ring){
+    return ring->head > TRACE_RING_SIZE ? ring->head - TRACE_RING_SIZE : 0;
+}
+
+static bool export_chrome_json(char *path){
+    TraceWriter *writer = &trace_writer;
+    TraceRing *ring = NULL;
+    TraceEvent *event = NULL;
+    bool is_first = true;
+    uint32_t slot = 0;
+    int i;
+
+    if(!open_trace_writer(writer, path)){
+        return false;
+    }
+
+    write_trace_text(writer, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    for(i = 0 ; i < TRACE_MAX_NUMBER_OF_THREADS ; i++){
+        ring = &trace_rings[i];
+        if(!is_trace_ring_used(ring)){
+            continue;
+        }
+
+        for(slot = get_first_slot(ring) ; slot < ring->head ; slot++){
+            event = &ring->events[slot & (TRACE_RING_SIZE - 1)];
+
+            /* Chrome takes the time stamps in micro seconds */
+            write_trace_text(writer,
+                             "%s\n{\"name\":\"%s\",\"cat\":\"tag\","
+                             "\"ph\":\"%c\",%s\"ts\":%llu.%03llu,"
+                             "\"pid\":%d,\"tid\":%d,"
+                             "\"args\":{\"argument\":%d}}",
+                             is_first ? "" : ",",
+                             tracepoint_names[event->tracepoint],
+                             chrome_phases[event->phase],
+                             TRACE_PHASE_INSTANT == event->phase ?
+                                 "\"s\":\"t\"," : "",
+                             (unsigned long long)
+                                 (event->timestamp_in_ns / 1000),
+                             (unsigned long long)
+                                 (event->timestamp_in_ns % 1000),
+                             getpid(), ring->thread_id, event->argument);
+            is_first = false;
+        }
+    }
+
+    write_trace_text(writer, "\n]}\n");
+
+    return close_trace_writer(writer);
+}
+
+static bool export_ctf(char *path){
+    TraceWriter *writer = &trace_writer;
+    char file_name[CONFIG_BUFFER_SIZE + 16];
+    TraceRing *ring = NULL;
+    TraceEvent *event = NULL;
+    uint32_t magic = TRACE_CTF_MAGIC;
+    uint32_t stream_id = 0;
+    uint32_t thread_id = 0;
+    uint16_t event_id = 0;
+    uint32_t slot = 0;
+    int i;
+
+    if(0 != mkdir(path, 0755) && EEXIST != errno){
+        return false;
+    }
+
+    /* The metadata describes the layout of the streams in TSDL */
+    snprintf(file_name, sizeof(file_name), "%s/metadata", path);
+    if(!open_trace_writer(writer, file_name)){
+        return false;
+    }
+
+    write_trace_text(writer,
+        "/* CTF 1.8 */\n"
+        "typealias integer { size = 8; align = 8; signed = false; } "
+        ":= uint8_t;\n"
+        "typealias integer { size = 16; align = 8; signed = false; } "
+        ":= uint16_t;\n"
+        "typealias integer { size = 32; align = 8; signed = false; } "
+        ":= uint32_t;\n"
+        "typealias integer { size = 32; align = 8; signed = true; } "
+        ":= int32_t;\n"
+        "trace {\n"
+        "    major = 1;\n"
+        "    minor = 8;\n"
+        "    byte_order = %s;\n"
+        "    packet.header := struct {\n"
+        "        uint32_t magic;\n"
+        "        uint32_t stream_id;\n"
+        "    };\n"
+        "};\n"
+        "clock {\n"
+        "    name = monotonic;\n"
+        "    freq = 1000000000;\n"
+        "};\n"
+        "typealias integer { size = 64; align = 8; signed = false; "
+        "map = clock.monotonic.value; } := uint64_clock_monotonic_t;\n"
+        "stream {\n"
+        "    id = 0;\n"
+        "    event.header := struct {\n"
+        "        uint16_t id;\n"
+        "        uint64_clock_monotonic_t timestamp;\n"
+        "    };\n"
+        "    packet.context := struct {\n"
+        "        uint32_t tid;\n"
+        "    };\n"
+        "};\n",
+        __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? "le" : "be");
+
+    for(i = 0 ; i < NUMBER_OF_TRACEPOINTS ; i++){
+        write_trace_text(writer,
+            "event {\n"
+            "    name = \"%s\";\n"
+            "    id = %d;\n"
+            "    stream_id = 0;\n"
+            "    fields := struct {\n"
+            "        enum : uint8_t { begin = 0, end = 1, instant = 2 } "
+            "phase;\n"
+            "        int32_t argument;\n"
+            "    };\n"
+            "};\n",
+            tracepoint_names[i], i);
+    }
+
+    if(!close_trace_writer(writer)){
+        return false;
+    }
+
+    /* One stream with a single packet per thread */
+    for(i = 0 ; i < TRACE_MAX_NUMBER_OF_THREADS ; i++){
+        ring = &trace_rings[i];
+        if(!is_trace_ring_used(ring)){
+            continue;
+        }
+
+        snprintf(file_name, sizeof(file_name), "%s/stream_%d", path, i);
+        if(!open_trace_writer(writer, file_name)){
+            return false;
+        }
+
+        thread_id = ring->thread_id;
+        write_trace_bytes(writer, &magic, sizeof(magic));
+        write_trace_bytes(writer, &stream_id, sizeof(stream_id));
+        write_trace_bytes(writer, &thread_id, sizeof(thread_id));
+
+        for(slot = get_first_slot(ring) ; slot < ring->head ; slot++){
+            event = &ring->events[slot & (TRACE_RING_SIZE - 1)];
+
+            event_id = event->tracepoint;
+            write_trace_bytes(writer, &event_id, sizeof(event_id));
+            write_trace_bytes(writer, &event->timestamp_in_ns,
+                              sizeof(event->timestamp_in_ns));
+            write_trace_bytes(writer, &event->phase, sizeof(event->phase));
+            write_trace_bytes(writer, &event->argument,
+                              sizeof(event->argument));
+        }
+
+        if(!close_trace_writer(writer)){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int export_trace(char *path, int format){
+    bool is_exported = false;
+    uint32_t number_of_events = 0;
+    int number_of_rings = 0;
+    int i;
+
+    if(0 == strlen(path)){
+        return 0;
+    }
+
+    if(TRACE_FORMAT_CTF == format){
+        is_exported = export_ctf(path);
+    }else{
+        is_exported = export_chrome_json(path);
+    }
+
+    if(!is_exported){
+        zlog_error(category_health_report,
+                   "Unable to export trace to %s", path);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unable to export trace to %s", path);
+#endif
+        return -1;
+    }
+
+    for(i = 0 ; i < TRACE_MAX_NUMBER_OF_THREADS ; i++){
+        if(is_trace_ring_used(&trace_rings[i])){
+            number_of_events += trace_rings[i].head -
+                                get_first_slot(&trace_rings[i]);
+            number_of_rings++;
+        }
+    }
+
+    zlog_info(category_health_report,
+              "Exported %u trace events of %d threads to %s, "
+              "%u events of threads without a ring dropped",
+              number_of_events, number_of_rings, path,
+              number_of_dropped_events);
+
+    return 0;
+}
+
+#endif
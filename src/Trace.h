@@ -0,0 +1,291 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains the tracepoints of the Tag and declarations
+    of functions used to record and export them.
+
+File Name:
+
+    Trace.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    The tracepoints are built in only with -DTRACING, e.g. with
+    "make TRACE_FLAGS=-DTRACING", and compile to nothing otherwise. A
+    tracepoint records a binary event of 16 bytes with a nanosecond
+    timestamp of CLOCK_MONOTONIC into the ring of the calling thread. A
+    thread claims its ring with TRACE_THREAD_START when it starts, and the
+    ring is released when the thread exits, so that a later thread may
+    reuse it. The rings are static, so tracing neither allocates nor takes
+    a lock, and a signal handler may record an event. A full ring
+    overwrites its oldest events. On exit the Tag exports the rings to trace_file in the config,
+    as Chrome trace JSON for chrome://tracing or Perfetto, or as a CTF 1.8
+    trace directory for babeltrace and Trace Compass.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+  CONSTANTS
+*/
+
+/* Number of events in the ring of a thread, a power of two */
+#define TRACE_RING_SIZE 2048
+
+/* Number of rings. Events of threads started while every ring is claimed
+   are dropped. */
+#define TRACE_MAX_NUMBER_OF_THREADS 16
+
+/* Size of the buffer in which an export is formatted */
+#define TRACE_EXPORT_BUFFER_SIZE 4096
+
+/* Magic number of a CTF packet */
+#define TRACE_CTF_MAGIC 0xC1FC1FC1
+
+/*
+  ENUMS
+*/
+
+/* The tracepoints */
+typedef enum Tracepoint {
+
+    /* Reading of the config file */
+    TRACEPOINT_CONFIG_LOAD = 0,
+
+    /* Taking the lock file of the single running instance */
+    TRACEPOINT_LOCK_FILE = 1,
+
+    /* Wait for the lock of the advertising state */
+    TRACEPOINT_ADVERTISING_LOCK = 2,
+
+    /* Opening a HCI socket, once per attempt. The argument is the dongle
+       at the begin and the handle or -1 at the end. */
+    TRACEPOINT_SOCKET_OPEN = 3,
+
+    /* A HCI command from the call to the response. The argument is the
+       opcode at the begin and the result at the end. */
+    TRACEPOINT_HCI_COMMAND = 4,
+
+    /* A HCI command written to an exclusive transport, with the opcode */
+    TRACEPOINT_HCI_SUBMIT = 5,
+
+    /* Patching the payload template */
+    TRACEPOINT_PAYLOAD_ENCODE = 6,
+
+    /* A received signal, with the signal number */
+    TRACEPOINT_SIGNAL = 7,
+
+    /* Sleep for the planned start phase */
+    TRACEPOINT_START_PHASE = 8,
+
+    /* Bring-up of advertising */
+    TRACEPOINT_ENABLE_ADVERTISING = 9,
+
+    /* Resuming advertising from the state file */
+    TRACEPOINT_RESUME_ADVERTISING = 10,
+
+    NUMBER_OF_TRACEPOINTS = 11
+
+} Tracepoint;
+
+/* The phases of an event */
+typedef enum TracePhase {
+
+    TRACE_PHASE_BEGIN = 0,
+
+    TRACE_PHASE_END = 1,
+
+    TRACE_PHASE_INSTANT = 2
+
+} TracePhase;
+
+/* The states of a ring */
+typedef enum TraceRingState {
+
+    TRACE_RING_FREE = 0,
+
+    TRACE_RING_CLAIMED = 1,
+
+    /* Released by an exited thread, with its events kept until the ring
+       is claimed again */
+    TRACE_RING_RELEASED = 2
+
+} TraceRingState;
+
+/* The formats of an export */
+typedef enum TraceFormat {
+
+    TRACE_FORMAT_CHROME_JSON = 0,
+
+    TRACE_FORMAT_CTF = 1
+
+} TraceFormat;
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* A recorded event */
+typedef struct TraceEvent {
+
+    uint64_t timestamp_in_ns;
+
+    uint16_t tracepoint;
+
+    uint8_t phase;
+
+    uint8_t reserved;
+
+    int32_t argument;
+
+} TraceEvent;
+
+/* The ring of a thread */
+typedef struct TraceRing {
+
+    /* The TraceRingState of the ring */
+    uint32_t state;
+
+    /* The thread id of the kernel */
+    int32_t thread_id;
+
+    /* The number of events recorded, of which the last TRACE_RING_SIZE
+       are kept */
+    uint32_t head;
+
+    TraceEvent events[TRACE_RING_SIZE];
+
+} TraceRing;
+
+/*
+  MACROS
+*/
+
+#ifdef TRACING
+
+#define TRACE_BEGIN(tracepoint, argument) \
+    record_tracepoint(tracepoint, TRACE_PHASE_BEGIN, argument)
+
+#define TRACE_END(tracepoint, argument) \
+    record_tracepoint(tracepoint, TRACE_PHASE_END, argument)
+
+#define TRACE_INSTANT(tracepoint, argument) \
+    record_tracepoint(tracepoint, TRACE_PHASE_INSTANT, argument)
+
+#define TRACE_MUTEX_LOCK(tracepoint, mutex) \
+    do { \
+        record_tracepoint(tracepoint, TRACE_PHASE_BEGIN, 0); \
+        pthread_mutex_lock(mutex); \
+        record_tracepoint(tracepoint, TRACE_PHASE_END, 0); \
+    } while(0)
+
+#define TRACE_EXPORT(path, format) export_trace(path, format)
+
+#define TRACE_THREAD_START() claim_trace_ring()
+
+#else
+
+#define TRACE_BEGIN(tracepoint, argument) do {} while(0)
+
+#define TRACE_END(tracepoint, argument) do {} while(0)
+
+#define TRACE_INSTANT(tracepoint, argument) do {} while(0)
+
+#define TRACE_MUTEX_LOCK(tracepoint, mutex) pthread_mutex_lock(mutex)
+
+#define TRACE_EXPORT(path, format) do {} while(0)
+
+#define TRACE_THREAD_START() do {} while(0)
+
+#endif
+
+/*
+  FUNCTIONS
+*/
+
+#ifdef TRACING
+
+/*
+  claim_trace_ring:
+
+      This function claims a ring for the calling thread, a free ring if
+      any, or else a ring released by an exited thread. The ring is
+      released when the thread exits. Signals are blocked while the ring
+      is claimed, so that a signal handler cannot claim a second ring for
+      the thread.
+
+  Parameters:
+
+      None
+
+  Return value:
+
+      None
+*/
+
+void claim_trace_ring(void);
+
+/*
+  record_tracepoint:
+
+      This function records an event into the ring of the calling thread.
+      The event is dropped if the thread has no ring. It is
+      async-signal-safe.
+
+  Parameters:
+
+      tracepoint - the tracepoint
+      phase - the phase of the event
+      argument - the argument of the tracepoint
+
+  Return value:
+
+      None
+*/
+
+void record_tracepoint(Tracepoint tracepoint,
+                       TracePhase phase,
+                       int32_t argument);
+
+/*
+  export_trace:
+
+      This function writes the events of all rings. It must be called
+      after the threads which record events are stopped. Nothing is
+      written if the path is empty.
+
+  Parameters:
+
+      path - the path of the JSON file, or of the CTF directory
+      format - the TraceFormat of the export
+
+  Return value:
+
+      int - 0 on success, or -1 otherwise
+*/
+
+int export_trace(char *path, int format);
+
+#endif
+
+#endif
@@ -0,0 +1,817 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used by the Tag to frame HCI
+      commands and parse HCI events over the transport to the advertising
+      dongle.
+
+ File Name:
+
+      Transport.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Transport.h"
+
+#define Debugging
+
+static const char *transport_names[NUMBER_OF_HCI_TRANSPORTS] = {
+    "bluez", "user_channel", "uart"
+};
+
+static HciTransportType transport_type = HCI_TRANSPORT_BLUEZ;
+
+/* The advertising dongle, which is the only one on the configured
+   transport */
+static int transport_dongle_device_id = -1;
+
+static char uart_device[CONFIG_BUFFER_SIZE];
+
+static int uart_baud_rate = 0;
+
+/* The handle of the exclusive transport. It stays open for the life of the
+   Tag, because closing a user channel hands the controller back to the
+   kernel, which resets it and stops advertising. */
+static int shared_device_handle = -1;
+
+/* Commands on the shared handle are sent one at a time, so that every
+   thread reads the events of its own command */
+static pthread_mutex_t transport_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* An LE meta event read from the shared handle by a thread which waited
+   for its command, kept for receive_hci_event */
+typedef struct PendingEvent {
+
+    struct timespec reception_time;
+
+    /* The event with its H4 packet type */
+    int length;
+    uint8_t packet[H4_MAX_EVENT_PACKET_SIZE];
+
+} PendingEvent;
+
+/* Ring of pending events, guarded by transport_lock */
+static PendingEvent pending_events[HCI_PENDING_EVENT_QUEUE_SIZE];
+static int first_pending_event = 0;
+static int number_of_pending_events = 0;
+
+ErrorCode init_hci_transport(Config *config){
+    if(config->hci_transport < 0 ||
+       config->hci_transport >= NUMBER_OF_HCI_TRANSPORTS){
+        zlog_error(category_health_report,
+                   "Unknown HCI transport %d", config->hci_transport);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unknown HCI transport %d", config->hci_transport);
+#endif
+        return E_OPEN_DEVICE;
+    }
+
+    transport_type = config->hci_transport;
+    transport_dongle_device_id = config->advertise_dongle_id;
+
+    memset(uart_device, 0, sizeof(uart_device));
+    strncpy(uart_device, config->hci_uart_device, sizeof(uart_device) - 1);
+    uart_baud_rate = config->hci_uart_baud_rate;
+
+    zlog_info(category_health_report,
+              "HCI transport %s", transport_names[transport_type]);
+
+    return WORK_SUCCESSFULLY;
+}
+
+static bool is_exclusive_dongle(int dongle_device_id){
+    return HCI_TRANSPORT_BLUEZ != transport_type &&
+           dongle_device_id == transport_dongle_device_id;
+}
+
+static bool is_exclusive_handle(int device_handle){
+    return shared_device_handle >= 0 &&
+           device_handle == shared_device_handle;
+}
+
+static int open_user_channel(int dongle_device_id){
+    struct sockaddr_hci address;
+    int control_socket = -1;
+    int device_handle = -1;
+
+    /* The kernel hands the controller over only while it is down */
+    control_socket = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC,
+                            BTPROTO_HCI);
+    if(control_socket >= 0){
+        ioctl(control_socket, HCIDEVDOWN, dongle_device_id);
+        close(control_socket);
+    }
+
+    device_handle = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC,
+                           BTPROTO_HCI);
+    if(device_handle < 0){
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.hci_family = AF_BLUETOOTH;
+    address.hci_dev = dongle_device_id;
+    address.hci_channel = HCI_CHANNEL_USER;
+
+    if(bind(device_handle, (struct sockaddr *)&address,
+            sizeof(address)) < 0){
+        close(device_handle);
+        return -1;
+    }
+
+    return device_handle;
+}
+
+static speed_t get_uart_speed(int baud_rate){
+    switch(baud_rate){
+        case 115200:
+            return B115200;
+        case 230400:
+            return B230400;
+        case 460800:
+            return B460800;
+        case 921600:
+            return B921600;
+        case 1000000:
+            return B1000000;
+        case 2000000:
+            return B2000000;
+        case 3000000:
+            return B3000000;
+        default:
+            return B0;
+    }
+}
+
+static int open_uart(void){
+    struct termios attributes;
+    speed_t speed = get_uart_speed(uart_baud_rate);
+    int device_handle = -1;
+
+    if(B0 == speed){
+        zlog_error(category_health_report,
+                   "Unsupported UART baud rate %d", uart_baud_rate);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Unsupported UART baud rate %d", uart_baud_rate);
+#endif
+        return -1;
+    }
+
+    device_handle = open(uart_device, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if(device_handle < 0){
+        return -1;
+    }
+
+    /* H4 runs 8N1 with RTS/CTS flow control */
+    if(tcgetattr(device_handle, &attributes) < 0){
+        close(device_handle);
+        return -1;
+    }
+    cfmakeraw(&attributes);
+    attributes.c_cflag |= CLOCAL | CREAD | CRTSCTS;
+    cfsetispeed(&attributes, speed);
+    cfsetospeed(&attributes, speed);
+
+    if(tcsetattr(device_handle, TCSANOW, &attributes) < 0){
+        close(device_handle);
+        return -1;
+    }
+    tcflush(device_handle, TCIOFLUSH);
+
+    return device_handle;
+}
+
+int open_hci_device(int dongle_device_id){
+    int device_handle = -1;
+
+    TRACE_BEGIN(TRACEPOINT_SOCKET_OPEN, dongle_device_id);
+
+    if(!is_exclusive_dongle(dongle_device_id)){
+        device_handle = hci_open_dev(dongle_device_id);
+        TRACE_END(TRACEPOINT_SOCKET_OPEN, device_handle);
+        return device_handle;
+    }
+
+    pthread_mutex_lock(&transport_lock);
+
+    if(shared_device_handle < 0){
+        if(HCI_TRANSPORT_USER_CHANNEL == transport_type){
+            shared_device_handle = open_user_channel(dongle_device_id);
+        }else{
+            shared_device_handle = open_uart();
+        }
+
+        if(shared_device_handle < 0){
+            zlog_error(category_health_report,
+                       "Unable to open HCI transport %s: %s (%d)",
+                       transport_names[transport_type],
+                       strerror(errno), errno);
+#ifdef Debugging
+            zlog_error(category_debug,
+                       "Unable to open HCI transport %s: %s (%d)",
+                       transport_names[transport_type],
+                       strerror(errno), errno);
+#endif
+        }
+    }
+    device_handle = shared_device_handle;
+
+    pthread_mutex_unlock(&transport_lock);
+
+    TRACE_END(TRACEPOINT_SOCKET_OPEN, device_handle);
+
+    return device_handle;
+}
+
+void close_hci_device(int device_handle){
+    if(is_exclusive_handle(device_handle)){
+        return;
+    }
+
+    hci_close_dev(device_handle);
+}
+
+void adopt_hci_device(int device_handle){
+    if(HCI_TRANSPORT_BLUEZ == transport_type){
+        return;
+    }
+
+    pthread_mutex_lock(&transport_lock);
+    shared_device_handle = device_handle;
+    pthread_mutex_unlock(&transport_lock);
+}
+
+static int get_remaining_time_in_ms(struct timespec *deadline){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (deadline->tv_sec - now.tv_sec) * 1000 +
+           (deadline->tv_nsec - now.tv_nsec) / 1000000;
+}
+
+static bool wait_readable(int device_handle, struct timespec *deadline){
+    struct pollfd poll_descriptor;
+    int timeout_in_ms = 0;
+    int return_value = 0;
+
+    poll_descriptor.fd = device_handle;
+    poll_descriptor.events = POLLIN;
+
+    while(true){
+        timeout_in_ms = get_remaining_time_in_ms(deadline);
+        if(timeout_in_ms < 0){
+            errno = ETIMEDOUT;
+            return false;
+        }
+
+        return_value = poll(&poll_descriptor, 1, timeout_in_ms);
+        if(return_value > 0){
+            return true;
+        }
+        if(0 == return_value){
+            errno = ETIMEDOUT;
+            return false;
+        }
+        if(EINTR != errno){
+            return false;
+        }
+    }
+}
+
+/* The UART is a byte stream, so a packet is read piece by piece as its
+   header tells its length */
+static bool read_exact(int device_handle,
+                       uint8_t *buffer,
+                       int length,
+                       struct timespec *deadline){
+    ssize_t received = 0;
+
+    while(length > 0){
+        if(!wait_readable(device_handle, deadline)){
+            return false;
+        }
+
+        received = read(device_handle, buffer, length);
+        if(received < 0 && (EINTR == errno || EAGAIN == errno)){
+            continue;
+        }
+        if(received <= 0){
+            errno = EIO;
+            return false;
+        }
+        buffer += received;
+        length -= received;
+    }
+
+    return true;
+}
+
+static bool skip_bytes(int device_handle,
+                       int length,
+                       struct timespec *deadline){
+    uint8_t buffer[H4_MAX_EVENT_PACKET_SIZE];
+    int size = 0;
+
+    while(length > 0){
+        size = length < sizeof(buffer) ? length : sizeof(buffer);
+        if(!read_exact(device_handle, buffer, size, deadline)){
+            return false;
+        }
+        length -= size;
+    }
+
+    return true;
+}
+
+/* Read the next event from the UART into buffer, without the packet type,
+   and drop data packets */
+static int read_uart_event(int device_handle,
+                           uint8_t *buffer,
+                           struct timespec *deadline){
+    uint8_t packet_type = 0;
+    uint8_t header[4];
+    int length = 0;
+
+    while(true){
+        if(!read_exact(device_handle, &packet_type, 1, deadline)){
+            return -1;
+        }
+
+        switch(packet_type){
+            case HCI_EVENT_PKT:
+                if(!read_exact(device_handle, buffer, HCI_EVENT_HDR_SIZE,
+                               deadline) ||
+                   !read_exact(device_handle, buffer + HCI_EVENT_HDR_SIZE,
+                               buffer[1], deadline)){
+                    return -1;
+                }
+                return HCI_EVENT_HDR_SIZE + buffer[1];
+
+            case HCI_ACLDATA_PKT:
+                if(!read_exact(device_handle, header, 4, deadline)){
+                    return -1;
+                }
+                length = header[2] | (header[3] << 8);
+                break;
+
+            case HCI_SCODATA_PKT:
+                if(!read_exact(device_handle, header, 3, deadline)){
+                    return -1;
+                }
+                length = header[2];
+                break;
+
+            default:
+                /* Out of sync, look for the next packet type */
+                continue;
+        }
+
+        if(!skip_bytes(device_handle, length, deadline)){
+            return -1;
+        }
+    }
+}
+
+/* Read the next event from the user channel into buffer, without the
+   packet type. Every read returns one whole packet. */
+static int read_user_channel_event(int device_handle,
+                                   uint8_t *buffer,
+                                   struct timespec *deadline){
+    uint8_t packet[H4_MAX_PACKET_SIZE];
+    ssize_t length = 0;
+
+    while(true){
+        if(!wait_readable(device_handle, deadline)){
+            return -1;
+        }
+
+        length = read(device_handle, packet, sizeof(packet));
+        if(length < 0 && (EINTR == errno || EAGAIN == errno)){
+            continue;
+        }
+        if(length <= 0){
+            errno = EIO;
+            return -1;
+        }
+
+        if(HCI_EVENT_PKT == packet[0] &&
+           length >= 1 + HCI_EVENT_HDR_SIZE &&
+           length == 1 + HCI_EVENT_HDR_SIZE + packet[2]){
+            memcpy(buffer, packet + 1, length - 1);
+            return length - 1;
+        }
+    }
+}
+
+static bool write_all(int device_handle, uint8_t *buffer, int length){
+    ssize_t written = 0;
+
+    while(length > 0){
+        written = write(device_handle, buffer, length);
+        if(written < 0 && EINTR == errno){
+            continue;
+        }
+        if(written <= 0){
+            return false;
+        }
+        buffer += written;
+        length -= written;
+    }
+
+    return true;
+}
+
+/* Keep an event without its packet type for receive_hci_event. The oldest
+   event is dropped when the ring is full. */
+static void queue_pending_event(uint8_t *event, int length){
+    PendingEvent *pending_event = NULL;
+
+    if(HCI_PENDING_EVENT_QUEUE_SIZE == number_of_pending_events){
+        first_pending_event =
+            (first_pending_event + 1) % HCI_PENDING_EVENT_QUEUE_SIZE;
+        number_of_pending_events--;
+    }
+
+    pending_event = &pending_events[
+        (first_pending_event + number_of_pending_events) %
+        HCI_PENDING_EVENT_QUEUE_SIZE];
+    clock_gettime(CLOCK_MONOTONIC, &pending_event->reception_time);
+    pending_event->packet[0] = HCI_EVENT_PKT;
+    memcpy(pending_event->packet + 1, event, length);
+    pending_event->length = 1 + length;
+    number_of_pending_events++;
+}
+
+static int exchange_command(int device_handle,
+                            struct hci_request *request,
+                            int timeout_in_ms){
+    uint8_t packet[H4_MAX_COMMAND_PACKET_SIZE];
+    uint8_t event[H4_MAX_EVENT_PACKET_SIZE];
+    hci_command_hdr *command_header = NULL;
+    hci_event_hdr *event_header = NULL;
+    evt_cmd_complete *complete = NULL;
+    evt_cmd_status *status = NULL;
+    struct timespec deadline;
+    uint16_t opcode = htobs(cmd_opcode_pack(request->ogf, request->ocf));
+    int length = 0;
+
+    if(request->clen < 0 || request->clen > 255){
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* H4 command: packet type, opcode, parameter length and parameters */
+    packet[0] = HCI_COMMAND_PKT;
+    command_header = (hci_command_hdr *)(packet + 1);
+    command_header->opcode = opcode;
+    command_header->plen = request->clen;
+    if(request->clen > 0){
+        memcpy(packet + 1 + HCI_COMMAND_HDR_SIZE, request->cparam,
+               request->clen);
+    }
+
+    if(!write_all(device_handle, packet,
+                  1 + HCI_COMMAND_HDR_SIZE + request->clen)){
+        return -1;
+    }
+
+    TRACE_INSTANT(TRACEPOINT_HCI_SUBMIT, btohs(opcode));
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_in_ms / 1000;
+    deadline.tv_nsec += (timeout_in_ms % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L){
+        deadline.tv_nsec -= 1000000000L;
+        deadline.tv_sec++;
+    }
+
+    while(true){
+        if(HCI_TRANSPORT_UART == transport_type){
+            length = read_uart_event(device_handle, event, &deadline);
+        }else{
+            length = read_user_channel_event(device_handle, event,
+                                             &deadline);
+        }
+        if(length < 0){
+            return -1;
+        }
+
+        event_header = (hci_event_hdr *)event;
+        if(EVT_LE_META_EVENT == event_header->evt){
+            queue_pending_event(event, length);
+            continue;
+        }
+        length -= HCI_EVENT_HDR_SIZE;
+
+        switch(event_header->evt){
+            case EVT_CMD_STATUS:
+                status = (evt_cmd_status *)(event + HCI_EVENT_HDR_SIZE);
+                if(length < EVT_CMD_STATUS_SIZE || opcode != status->opcode){
+                    continue;
+                }
+                if(EVT_CMD_STATUS != request->event){
+                    if(status->status){
+                        errno = EIO;
+                        return -1;
+                    }
+                    continue;
+                }
+                request->rlen = length < request->rlen ?
+                                length : request->rlen;
+                memcpy(request->rparam, status, request->rlen);
+                return 0;
+
+            case EVT_CMD_COMPLETE:
+                complete = (evt_cmd_complete *)(event + HCI_EVENT_HDR_SIZE);
+                if(length < EVT_CMD_COMPLETE_SIZE ||
+                   opcode != complete->opcode){
+                    continue;
+                }
+                length -= EVT_CMD_COMPLETE_SIZE;
+                request->rlen = length < request->rlen ?
+                                length : request->rlen;
+                memcpy(request->rparam,
+                       event + HCI_EVENT_HDR_SIZE + EVT_CMD_COMPLETE_SIZE,
+                       request->rlen);
+                return 0;
+
+            default:
+                /* Events of no interest */
+                continue;
+        }
+    }
+}
+
+int send_hci_command(int device_handle,
+                     struct hci_request *request,
+                     int timeout_in_ms){
+    int return_value = 0;
+
+    TRACE_BEGIN(TRACEPOINT_HCI_COMMAND,
+                cmd_opcode_pack(request->ogf, request->ocf));
+
+    if(!is_exclusive_handle(device_handle)){
+        return_value = hci_send_req(device_handle, request, timeout_in_ms);
+    }else{
+        pthread_mutex_lock(&transport_lock);
+        return_value = exchange_command(device_handle, request,
+                                        timeout_in_ms);
+        pthread_mutex_unlock(&transport_lock);
+    }
+
+    TRACE_END(TRACEPOINT_HCI_COMMAND, return_value);
+
+    return return_value;
+}
+
+int receive_hci_event(int device_handle,
+                      uint8_t *buffer,
+                      int size,
+                      int timeout_in_ms,
+                      struct timespec *reception_time){
+    uint8_t event[H4_MAX_EVENT_PACKET_SIZE];
+    struct pollfd poll_descriptor;
+    struct timespec deadline, slice_deadline, read_deadline;
+    PendingEvent *pending_event = NULL;
+    int length = 0;
+
+    if(!is_exclusive_handle(device_handle)){
+        poll_descriptor.fd = device_handle;
+        poll_descriptor.events = POLLIN;
+
+        length = poll(&poll_descriptor, 1, timeout_in_ms);
+        if(length <= 0){
+            if(0 == length){
+                errno = ETIMEDOUT;
+            }
+            return -1;
+        }
+
+        length = read(device_handle, buffer, size);
+        clock_gettime(CLOCK_MONOTONIC, reception_time);
+        return length;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_in_ms / 1000;
+    deadline.tv_nsec += (timeout_in_ms % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L){
+        deadline.tv_nsec -= 1000000000L;
+        deadline.tv_sec++;
+    }
+
+    while(true){
+        pthread_mutex_lock(&transport_lock);
+
+        if(number_of_pending_events > 0){
+            pending_event = &pending_events[first_pending_event];
+            length = pending_event->length < size ?
+                     pending_event->length : size;
+            memcpy(buffer, pending_event->packet, length);
+            *reception_time = pending_event->reception_time;
+
+            first_pending_event =
+                (first_pending_event + 1) % HCI_PENDING_EVENT_QUEUE_SIZE;
+            number_of_pending_events--;
+
+            pthread_mutex_unlock(&transport_lock);
+            return length;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &slice_deadline);
+        slice_deadline.tv_nsec += HCI_EVENT_WAIT_SLICE_IN_MS * 1000000L;
+        if(slice_deadline.tv_nsec >= 1000000000L){
+            slice_deadline.tv_nsec -= 1000000000L;
+            slice_deadline.tv_sec++;
+        }
+        if(slice_deadline.tv_sec > deadline.tv_sec ||
+           (slice_deadline.tv_sec == deadline.tv_sec &&
+            slice_deadline.tv_nsec > deadline.tv_nsec)){
+            slice_deadline = deadline;
+        }
+
+        if(!wait_readable(device_handle, &slice_deadline)){
+            pthread_mutex_unlock(&transport_lock);
+
+            if(ETIMEDOUT != errno){
+                return -1;
+            }
+            if(get_remaining_time_in_ms(&deadline) <= 0){
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            continue;
+        }
+
+        /* Once the event starts to arrive it is read as a whole, so that
+           the UART does not lose the packet boundaries */
+        clock_gettime(CLOCK_MONOTONIC, reception_time);
+        read_deadline = *reception_time;
+        read_deadline.tv_sec += HCI_SEND_REQUEST_TIMEOUT_IN_MS / 1000;
+
+        if(HCI_TRANSPORT_UART == transport_type){
+            length = read_uart_event(device_handle, event, &read_deadline);
+        }else{
+            length = read_user_channel_event(device_handle, event,
+                                             &read_deadline);
+        }
+        pthread_mutex_unlock(&transport_lock);
+
+        if(length < 0){
+            return -1;
+        }
+        length = 1 + length < size ? 1 + length : size;
+        buffer[0] = HCI_EVENT_PKT;
+        memcpy(buffer + 1, event, length - 1);
+        return length;
+    }
+}
+
+int read_hci_bdaddr(int dongle_device_id, bdaddr_t *bdaddr){
+    struct hci_request request;
+    read_bd_addr_rp response;
+    int device_handle = -1;
+    int return_value = 0;
+
+    if(!is_exclusive_dongle(dongle_device_id)){
+        return hci_devba(dongle_device_id, bdaddr);
+    }
+
+    device_handle = open_hci_device(dongle_device_id);
+    if(device_handle < 0){
+        return -1;
+    }
+
+    memset(&request, 0, sizeof(request));
+    memset(&response, 0, sizeof(response));
+    request.ogf = OGF_INFO_PARAM;
+    request.ocf = OCF_READ_BD_ADDR;
+    request.rparam = &response;
+    request.rlen = sizeof(response);
+
+    return_value = send_hci_command(device_handle, &request,
+                                    HCI_SEND_REQUEST_TIMEOUT_IN_MS);
+    close_hci_device(device_handle);
+
+    if(return_value < 0 || response.status){
+        return -1;
+    }
+    memcpy(bdaddr, &response.bdaddr, sizeof(bdaddr_t));
+
+    return 0;
+}
+
+/* The latency benchmark allocates its samples, and is left out of the
+   minimal build */
+#ifndef MINIMAL_FOOTPRINT
+
+static int compare_latency(const void *left, const void *right){
+    long left_latency = *(const long *)left;
+    long right_latency = *(const long *)right;
+
+    return (left_latency > right_latency) - (left_latency < right_latency);
+}
+
+static void measure_round_trips(const char *label,
+                                int device_handle,
+                                int number_of_commands){
+    struct hci_request request;
+    read_local_version_rp response;
+    struct timespec start, end;
+    long *latencies = NULL;
+    int number_of_samples = 0;
+    int number_of_failures = 0;
+    int i;
+
+    latencies = malloc(sizeof(long) * number_of_commands);
+    if(NULL == latencies){
+        return;
+    }
+
+    for(i = 0 ; i < number_of_commands ; i++){
+        memset(&request, 0, sizeof(request));
+        request.ogf = OGF_INFO_PARAM;
+        request.ocf = OCF_READ_LOCAL_VERSION;
+        request.rparam = &response;
+        request.rlen = READ_LOCAL_VERSION_RP_SIZE;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(send_hci_command(device_handle, &request,
+                            HCI_SEND_REQUEST_TIMEOUT_IN_MS) < 0 ||
+           response.status){
+            number_of_failures++;
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        latencies[number_of_samples] =
+            (end.tv_sec - start.tv_sec) * 1000000 +
+            (end.tv_nsec - start.tv_nsec) / 1000;
+        number_of_samples++;
+    }
+
+    if(0 == number_of_samples){
+        printf("%-12s failed %d\n", label, number_of_failures);
+        free(latencies);
+        return;
+    }
+
+    qsort(latencies, number_of_samples, sizeof(long), compare_latency);
+
+    printf("%-12s round trips %d failed %d, p50 %ld us p99 %ld us "
+           "max %ld us\n",
+           label, number_of_samples, number_of_failures,
+           latencies[number_of_samples / 2],
+           latencies[(int)(number_of_samples * 0.99)],
+           latencies[number_of_samples - 1]);
+
+    free(latencies);
+}
+
+void print_transport_latency(Config *config, int number_of_commands){
+    int device_handle = -1;
+
+    /* BlueZ goes first, since the user channel takes the controller down */
+    device_handle = hci_open_dev(config->advertise_dongle_id);
+    if(device_handle >= 0){
+        measure_round_trips(transport_names[HCI_TRANSPORT_BLUEZ],
+                            device_handle, number_of_commands);
+        hci_close_dev(device_handle);
+    }else{
+        printf("%-12s unavailable\n", transport_names[HCI_TRANSPORT_BLUEZ]);
+    }
+
+    if(HCI_TRANSPORT_BLUEZ == transport_type){
+        return;
+    }
+
+    device_handle = open_hci_device(config->advertise_dongle_id);
+    if(device_handle < 0){
+        printf("%-12s unavailable\n", transport_names[transport_type]);
+        return;
+    }
+    measure_round_trips(transport_names[transport_type], device_handle,
+                        number_of_commands);
+}
+
+#endif
@@ -0,0 +1,263 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to send HCI commands to the advertising dongle either
+    through BlueZ or over a transport which the Tag owns exclusively.
+
+File Name:
+
+    Transport.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    With the BlueZ transport, every thread opens its own raw HCI socket
+    and hci_send_req does the framing, while bluetoothd keeps using the
+    same controller. The user channel transport binds a HCI socket to
+    HCI_CHANNEL_USER, and the UART transport opens the serial port of the
+    controller. Either way the kernel and bluetoothd no longer touch the
+    controller, and the Tag frames H4 packets and parses the events
+    itself. The exclusive transport is opened once and shared by the
+    threads of the Tag, which take turns sending commands. Only the
+    advertising dongle uses the configured transport, and other dongles
+    such as the one of the loopback scanner stay on BlueZ.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "Tag.h"
+
+/*
+  CONSTANTS
+*/
+
+#ifndef HCI_CHANNEL_USER
+#define HCI_CHANNEL_USER 1
+#endif
+
+/* Maximum size of a H4 event packet: packet type, event header and up to
+   255 bytes of parameters */
+#define H4_MAX_EVENT_PACKET_SIZE (1 + HCI_EVENT_HDR_SIZE + 255)
+
+/* Maximum size of a H4 command packet */
+#define H4_MAX_COMMAND_PACKET_SIZE (1 + HCI_COMMAND_HDR_SIZE + 255)
+
+/* Maximum size of any packet read from the user channel */
+#define H4_MAX_PACKET_SIZE 1500
+
+/* Number of LE meta events kept for receive_hci_event, which arrive on the
+   shared handle while another thread waits for its command */
+#define HCI_PENDING_EVENT_QUEUE_SIZE 8
+
+/* Time in milliseconds for which receive_hci_event holds the shared handle
+   while waiting for an event, so that the commands of other threads are
+   not held back longer */
+#define HCI_EVENT_WAIT_SLICE_IN_MS 20
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The transports to the advertising dongle */
+typedef enum _HciTransportType{
+
+    /* Raw HCI sockets of BlueZ, shared with bluetoothd */
+    HCI_TRANSPORT_BLUEZ = 0,
+    /* A HCI socket bound to HCI_CHANNEL_USER */
+    HCI_TRANSPORT_USER_CHANNEL = 1,
+    /* H4 over the UART of the controller */
+    HCI_TRANSPORT_UART = 2,
+
+    NUMBER_OF_HCI_TRANSPORTS
+
+} HciTransportType;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  init_hci_transport:
+
+      This function selects the transport to the advertising dongle from
+      the config. It must be called before any HCI socket is opened.
+
+  Parameters:
+
+      config - the pointer to the config struct of the Tag
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode init_hci_transport(Config *config);
+
+/*
+  open_hci_device:
+
+      This function opens a handle to the dongle. For the advertising
+      dongle on an exclusive transport, it returns the shared handle and
+      opens the transport on first use.
+
+  Parameters:
+
+      dongle_device_id - the id of the dongle
+
+  Return value:
+
+      int - the handle of the dongle, or -1 if the dongle cannot be opened
+*/
+
+int open_hci_device(int dongle_device_id);
+
+/*
+  close_hci_device:
+
+      This function releases a handle opened by open_hci_device. The shared
+      handle of an exclusive transport stays open for the life of the Tag.
+
+  Parameters:
+
+      device_handle - the handle of the dongle
+
+  Return value:
+
+      None
+*/
+
+void close_hci_device(int device_handle);
+
+/*
+  adopt_hci_device:
+
+      This function makes a handle of the exclusive transport received from
+      the previous Tag on an upgrade the shared handle, owned by the caller.
+
+  Parameters:
+
+      device_handle - the handle received from the previous Tag
+
+  Return value:
+
+      None
+*/
+
+void adopt_hci_device(int device_handle);
+
+/*
+  send_hci_command:
+
+      This function sends a HCI command and waits for its Command Complete
+      event, like hci_send_req of BlueZ, over the transport of the handle.
+
+  Parameters:
+
+      device_handle - the handle of the dongle
+      request - the command and the buffer of the return parameters
+      timeout_in_ms - the time to wait for the event
+
+  Return value:
+
+      int - 0 if the command completes, or -1 with errno set otherwise
+*/
+
+int send_hci_command(int device_handle,
+                     struct hci_request *request,
+                     int timeout_in_ms);
+
+/*
+  receive_hci_event:
+
+      This function waits for the next event of the dongle, such as an LE
+      advertising report. On the shared handle of an exclusive transport,
+      LE meta events which arrived while another thread waited for its
+      command are returned first, with their original reception time.
+
+  Parameters:
+
+      device_handle - the handle of the dongle
+      buffer - the buffer of the event, which starts with the H4 packet
+               type like the events read from a raw HCI socket
+      size - the size of the buffer
+      timeout_in_ms - the time to wait for an event
+      reception_time - the CLOCK_MONOTONIC time at which the event was read
+
+  Return value:
+
+      int - the length of the event, or -1 with errno set otherwise
+*/
+
+int receive_hci_event(int device_handle,
+                      uint8_t *buffer,
+                      int size,
+                      int timeout_in_ms,
+                      struct timespec *reception_time);
+
+/*
+  read_hci_bdaddr:
+
+      This function reads the BD address of the dongle, like hci_devba of
+      BlueZ. The advertising dongle on an exclusive transport is asked
+      with the Read BD_ADDR command.
+
+  Parameters:
+
+      dongle_device_id - the id of the dongle
+      bdaddr - the BD address to be filled
+
+  Return value:
+
+      int - 0 on success, or -1 otherwise
+*/
+
+int read_hci_bdaddr(int dongle_device_id, bdaddr_t *bdaddr);
+
+#ifndef MINIMAL_FOOTPRINT
+
+/*
+  print_transport_latency:
+
+      This function sends Read Local Version Information repeatedly over
+      BlueZ and over the configured transport, and prints the round trip
+      latency of both.
+
+  Parameters:
+
+      config - the pointer to the config struct of the Tag
+      number_of_commands - the number of round trips on each transport
+
+  Return value:
+
+      None
+*/
+
+void print_transport_latency(Config *config, int number_of_commands);
+
+#endif
+
+#endif
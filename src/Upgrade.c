@@ -0,0 +1,286 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the programs used by the Tag to hand over
+      advertising to a new binary without disabling it.
+
+ File Name:
+
+      Upgrade.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Upgrade.h"
+#include "Transport.h"
+
+#define Debugging
+
+bool upgrade_requested = false;
+
+static uint64_t get_time_in_ns(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void upgrade_handler(int signal){
+    TRACE_INSTANT(TRACEPOINT_SIGNAL, signal);
+
+    upgrade_requested = true;
+    ready_to_work = false;
+}
+
+static ErrorCode send_handoff(int handoff_socket,
+                              UpgradeMessage *message,
+                              int device_handle){
+    struct msghdr header;
+    struct iovec vector;
+    struct cmsghdr *control_message = NULL;
+    char control_buffer[CMSG_SPACE(sizeof(int))];
+
+    memset(&header, 0, sizeof(header));
+    memset(control_buffer, 0, sizeof(control_buffer));
+
+    vector.iov_base = message;
+    vector.iov_len = sizeof(UpgradeMessage);
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control_buffer;
+    header.msg_controllen = sizeof(control_buffer);
+
+    control_message = CMSG_FIRSTHDR(&header);
+    control_message->cmsg_level = SOL_SOCKET;
+    control_message->cmsg_type = SCM_RIGHTS;
+    control_message->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(control_message), &device_handle, sizeof(int));
+
+    if(sizeof(UpgradeMessage) != sendmsg(handoff_socket, &header, 0)){
+        return E_OPEN_SOCKET;
+    }
+
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode hand_off_to_binary(char *binary_path,
+                             int dongle_device_id,
+                             uint64_t handoff_start_time_in_ns){
+    int handoff_sockets[2] = {-1, -1};
+    char handoff_argument[LENGTH_OF_HANDOFF_ARGUMENT];
+    UpgradeMessage message;
+    PersistentState *state = NULL;
+    struct pollfd poll_descriptor;
+    int device_handle = -1;
+    int retry_time = 0;
+    uint8_t acknowledgement = 0;
+    pid_t pid = 0;
+    ErrorCode return_value = WORK_SUCCESSFULLY;
+
+    state = get_persistent_state();
+    if(NULL == state){
+        return E_OPEN_FILE;
+    }
+
+    retry_time = SOCKET_OPEN_RETRY;
+    while(retry_time--){
+        device_handle = open_hci_device(dongle_device_id);
+
+        if(device_handle >= 0){
+            break;
+        }
+    }
+    if(device_handle < 0){
+        return E_OPEN_DEVICE;
+    }
+
+    if(-1 == socketpair(AF_UNIX, SOCK_SEQPACKET, 0, handoff_sockets)){
+        close_hci_device(device_handle);
+        return E_OPEN_SOCKET;
+    }
+
+    pid = fork();
+    if(-1 == pid){
+        close(handoff_sockets[0]);
+        close(handoff_sockets[1]);
+        close_hci_device(device_handle);
+        return E_OPEN_FILE;
+    }
+
+    if(0 == pid){
+        /* The new Tag outlives the running Tag, so it leaves its session */
+        close(handoff_sockets[0]);
+        close_hci_device(device_handle);
+        setsid();
+        snprintf(handoff_argument, sizeof(handoff_argument), "%d",
+                 handoff_sockets[1]);
+        execl(binary_path, binary_path, "-u", handoff_argument,
+              (char *)NULL);
+        _exit(E_OPEN_FILE);
+    }
+
+    close(handoff_sockets[1]);
+
+    memset(&message, 0, sizeof(message));
+    message.magic = UPGRADE_MAGIC;
+    message.version = UPGRADE_VERSION;
+    message.state_version = STATE_VERSION;
+    message.state_length = sizeof(PersistentState);
+    message.handoff_start_time_in_ns = handoff_start_time_in_ns;
+
+    TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+    message.state = *state;
+    pthread_mutex_unlock(&g_advertising.lock);
+
+    return_value = send_handoff(handoff_sockets[0], &message,
+                                device_handle);
+
+    /* The new Tag holds its own copy of the HCI socket */
+    close_hci_device(device_handle);
+
+    if(WORK_SUCCESSFULLY == return_value){
+        poll_descriptor.fd = handoff_sockets[0];
+        poll_descriptor.events = POLLIN;
+
+        if(poll(&poll_descriptor, 1, UPGRADE_ACK_TIMEOUT_IN_MS) <= 0 ||
+           1 != recv(handoff_sockets[0], &acknowledgement, 1, 0) ||
+           WORK_SUCCESSFULLY != acknowledgement){
+            return_value = E_OPEN_SOCKET;
+        }
+    }
+
+    close(handoff_sockets[0]);
+
+    if(WORK_SUCCESSFULLY != return_value){
+        zlog_error(category_health_report,
+                   "New binary %s did not take over, keep running",
+                   binary_path);
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "New binary %s did not take over, keep running",
+                   binary_path);
+#endif
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return return_value;
+    }
+
+    zlog_info(category_health_report,
+              "Handed over to %s (pid %d)", binary_path, pid);
+
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode take_over_from_handoff(int handoff_socket, int *device_handle){
+    struct msghdr header;
+    struct iovec vector;
+    struct cmsghdr *control_message = NULL;
+    char control_buffer[CMSG_SPACE(sizeof(int))];
+    UpgradeMessage message;
+    uint8_t acknowledgement = WORK_SUCCESSFULLY;
+    ssize_t length = 0;
+
+    *device_handle = -1;
+
+    memset(&header, 0, sizeof(header));
+    memset(&message, 0, sizeof(message));
+
+    vector.iov_base = &message;
+    vector.iov_len = sizeof(UpgradeMessage);
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control_buffer;
+    header.msg_controllen = sizeof(control_buffer);
+
+    length = recvmsg(handoff_socket, &header, 0);
+
+    control_message = CMSG_FIRSTHDR(&header);
+    if(NULL != control_message &&
+       SOL_SOCKET == control_message->cmsg_level &&
+       SCM_RIGHTS == control_message->cmsg_type){
+        memcpy(device_handle, CMSG_DATA(control_message), sizeof(int));
+    }
+
+    /* A binary with another layout of the state cannot take over, and the
+       previous Tag keeps running */
+    if(sizeof(UpgradeMessage) != length ||
+       UPGRADE_MAGIC != message.magic ||
+       UPGRADE_VERSION != message.version ||
+       STATE_VERSION != message.state_version ||
+       sizeof(PersistentState) != message.state_length ||
+       *device_handle < 0){
+        zlog_error(category_health_report,
+                   "Invalid handoff from the previous Tag");
+#ifdef Debugging
+        zlog_error(category_debug,
+                   "Invalid handoff from the previous Tag");
+#endif
+        if(*device_handle >= 0){
+            close_hci_device(*device_handle);
+            *device_handle = -1;
+        }
+        acknowledgement = E_OPEN_SOCKET;
+        send(handoff_socket, &acknowledgement, 1, 0);
+        close(handoff_socket);
+        return E_OPEN_SOCKET;
+    }
+
+    /* The handed over socket is the only way to an exclusive transport */
+    adopt_hci_device(*device_handle);
+
+    TRACE_MUTEX_LOCK(TRACEPOINT_ADVERTISING_LOCK, &g_advertising.lock);
+    g_advertising.dongle_device_id = message.state.dongle_device_id;
+    g_advertising.min_interval_in_units_0625_ms =
+        message.state.min_interval_in_units_0625_ms;
+    g_advertising.max_interval_in_units_0625_ms =
+        message.state.max_interval_in_units_0625_ms;
+    g_advertising.tx_power_in_dbm = message.state.tx_power_in_dbm;
+    g_advertising.extended_advertising = message.state.extended_advertising;
+    g_advertising.payload = message.state.payload;
+    restore_persistent_state(&message.state);
+    pthread_mutex_unlock(&g_advertising.lock);
+
+    send(handoff_socket, &acknowledgement, 1, 0);
+    close(handoff_socket);
+
+    zlog_info(category_health_report,
+              "Took over advertising in %llu us, sequence %d",
+              (unsigned long long)
+                  ((get_time_in_ns() - message.handoff_start_time_in_ns) /
+                   1000),
+              g_advertising.payload.sequence_number);
+
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode wait_for_previous_exit(pid_t previous_pid){
+    int retry_time = 0;
+
+    /* The new Tag is reparented once the previous Tag exits */
+    retry_time = UPGRADE_EXIT_RETRY;
+    while(retry_time--){
+        if(getppid() != previous_pid){
+            return single_running_instance(TAG_LOCK_FILE);
+        }
+        usleep(UPGRADE_EXIT_RETRY_INTERVAL_IN_MICRO_SECONDS);
+    }
+
+    return E_OPEN_FILE;
+}
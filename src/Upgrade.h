@@ -0,0 +1,192 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains declarations of structs and functions used
+    by the Tag to upgrade its binary without interrupting advertising.
+
+File Name:
+
+    Upgrade.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+    On SIGUSR2 the running Tag stops the threads which update the payload
+    and execs the binary it was started from, which is the new binary once
+    it has been copied over the old one. The running Tag passes a HCI
+    socket of the dongle and its serialized state to the new Tag over a
+    Unix-domain socket. The new Tag adopts the state without sending any
+    advertising command, so the dongle keeps advertising throughout. The
+    running Tag exits without disabling advertising once the new Tag
+    acknowledges, or resumes its work if the new Tag fails to take over.
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <limits.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "Tag.h"
+#include "State.h"
+
+/*
+  CONSTANTS
+*/
+
+/* Signal which asks the running Tag to hand over to a new binary */
+#define UPGRADE_SIGNAL SIGUSR2
+
+/* Magic number of the handoff message */
+#define UPGRADE_MAGIC 0x54555047
+
+/* Version of the layout of the handoff message */
+#define UPGRADE_VERSION 1
+
+/* Time in milliseconds the running Tag waits for the new Tag to take
+   over */
+#define UPGRADE_ACK_TIMEOUT_IN_MS 5000
+
+/* Number of times and time interval in micro seconds the new Tag checks
+   whether the previous Tag has exited */
+#define UPGRADE_EXIT_RETRY 500
+#define UPGRADE_EXIT_RETRY_INTERVAL_IN_MICRO_SECONDS 10000
+
+/* Number of characters of the file descriptor passed on the command line
+   of the new Tag */
+#define LENGTH_OF_HANDOFF_ARGUMENT 16
+
+/*
+  TYPEDEF STRUCTS
+*/
+
+/* The handoff message from the running Tag to the new Tag */
+typedef struct UpgradeMessage {
+
+    uint32_t magic;
+
+    uint32_t version;
+
+    /* Version and length of the state of the running Tag, which the new Tag
+       must understand */
+    uint32_t state_version;
+    uint32_t state_length;
+
+    /* CLOCK_MONOTONIC time at which the running Tag stopped updating the
+       payload */
+    uint64_t handoff_start_time_in_ns;
+
+    PersistentState state;
+
+} UpgradeMessage;
+
+/*
+  GLOBAL VARIABLES
+*/
+
+/* Whether UPGRADE_SIGNAL asked the Tag to hand over to a new binary */
+extern bool upgrade_requested;
+
+/*
+  FUNCTIONS
+*/
+
+/*
+  upgrade_handler:
+
+      This function handles UPGRADE_SIGNAL. It stops the main loop like
+      ctrlc_handler, and marks that the Tag should hand over to a new binary
+      instead of disabling advertising.
+
+  Parameters:
+
+      signal - the signal number
+
+  Return value:
+
+      None
+*/
+
+void upgrade_handler(int signal);
+
+/*
+  hand_off_to_binary:
+
+      This function execs the binary with the file descriptor of a
+      Unix-domain socket, sends a HCI socket of the dongle and the state of
+      the Tag over it, and waits for the new Tag to acknowledge. The threads
+      which update the payload must be stopped before.
+
+  Parameters:
+
+      binary_path - the path of the binary to be executed
+      dongle_device_id - the id of the advertising dongle
+      handoff_start_time_in_ns - the time at which the Tag stopped updating
+                                 the payload
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY once the new Tag has taken over
+*/
+
+ErrorCode hand_off_to_binary(char *binary_path,
+                             int dongle_device_id,
+                             uint64_t handoff_start_time_in_ns);
+
+/*
+  take_over_from_handoff:
+
+      This function receives the HCI socket and the state from the previous
+      Tag, restores the advertising state and the state file from it, and
+      acknowledges the previous Tag. It sends no HCI command.
+
+  Parameters:
+
+      handoff_socket - the Unix-domain socket to the previous Tag
+      device_handle - the HCI socket handed over by the previous Tag
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode take_over_from_handoff(int handoff_socket, int *device_handle);
+
+/*
+  wait_for_previous_exit:
+
+      This function waits for the previous Tag, which is the parent of the
+      new Tag, to exit and release the lock file.
+
+  Parameters:
+
+      previous_pid - the process id of the previous Tag
+
+  Return value:
+
+      ErrorCode - The error code for the corresponding error if the function
+                  fails or WORK SUCCESSFULLY otherwise
+*/
+
+ErrorCode wait_for_previous_exit(pid_t previous_pid);
+
+#endif
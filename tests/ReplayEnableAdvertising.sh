@@ -0,0 +1,52 @@
+#!/bin/bash
+
+# Replays traces/enable_advertising.btsnoop, the HCI trace of a cold start
+# on a legacy controller, and checks that enable_advertising sends the
+# recorded commands with the recorded parameters. The Tag runs with the
+# config next to the trace in a scratch directory, on the H4 UART
+# transport with the pseudo terminal of HciReplay.
+TEST_DIR=$(cd "$(dirname "$0")" && pwd)
+TAG_DIR=$(dirname "$TEST_DIR")
+TRACE=$TEST_DIR/traces/enable_advertising
+
+WORK_DIR=`mktemp -d`
+REPLAY_PID=
+TAG_PID=
+trap 'kill $REPLAY_PID $TAG_PID 2>/dev/null; rm -rf "$WORK_DIR"' EXIT
+mkdir "$WORK_DIR/bin" "$WORK_DIR/config"
+
+"$TAG_DIR/bin/HciReplay" -x 0 -t 5000 "$TRACE.btsnoop" \
+    > "$WORK_DIR/replay.out" 2>&1 &
+REPLAY_PID=$!
+
+# HciReplay prints the path of its pseudo terminal first
+for i in `seq 50`; do
+    [ -s "$WORK_DIR/replay.out" ] && break
+    sleep 0.1
+done
+PSEUDO_TERMINAL=`head -n 1 "$WORK_DIR/replay.out"`
+
+sed -e "s#^hci_uart_device=.*#hci_uart_device=$PSEUDO_TERMINAL#" \
+    "$TRACE.conf" > "$WORK_DIR/config/config.conf"
+cp "$TAG_DIR/config/zlog.conf" "$WORK_DIR/config/"
+
+(cd "$WORK_DIR/bin" && exec "$TAG_DIR/bin/Tag" > "$WORK_DIR/tag.out" 2>&1) &
+TAG_PID=$!
+
+wait $REPLAY_PID
+STATUS=$?
+REPLAY_PID=
+
+kill -INT $TAG_PID 2>/dev/null
+wait $TAG_PID 2>/dev/null
+TAG_PID=
+
+if [ $STATUS -ne 0 ]; then
+    echo "ReplayEnableAdvertising failed with status $STATUS"
+    cat "$WORK_DIR/replay.out" "$WORK_DIR/tag.out"
+    exit 1
+fi
+
+echo "ReplayEnableAdvertising passed"
+
+exit 0
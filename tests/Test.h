@@ -0,0 +1,91 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+Project Name:
+
+    BeDIS
+
+File Description:
+
+    This header file contains the checks shared by the unit tests of the
+    Tag. A failed check prints its file, line and expression and is
+    counted, and the test returns the number of failed checks as its exit
+    status, so that "make test" stops at the first failing test.
+
+File Name:
+
+    Test.h
+
+Version:
+
+    1.0,  20201019
+
+Abstract:
+
+Authors:
+
+    Chun Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+  GLOBAL VARIABLES
+*/
+
+/* Number of checks run and failed by the test */
+static int number_of_checks = 0;
+static int number_of_failures = 0;
+
+/*
+  MACROS
+*/
+
+#define CHECK(expression) \
+    do{ \
+        number_of_checks++; \
+        if(!(expression)){ \
+            number_of_failures++; \
+            fprintf(stderr, "%s:%d: check failed: %s\n", \
+                    __FILE__, __LINE__, #expression); \
+        } \
+    }while(0)
+
+#define CHECK_EQUAL(expected, actual) \
+    do{ \
+        long long expected_value = (long long)(expected); \
+        long long actual_value = (long long)(actual); \
+        number_of_checks++; \
+        if(expected_value != actual_value){ \
+            number_of_failures++; \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", \
+                    __FILE__, __LINE__, #actual, actual_value, \
+                    expected_value); \
+        } \
+    }while(0)
+
+#define CHECK_BYTES(expected, actual, length) \
+    do{ \
+        number_of_checks++; \
+        if(0 != memcmp((expected), (actual), (length))){ \
+            number_of_failures++; \
+            fprintf(stderr, "%s:%d: %s differs from %s\n", \
+                    __FILE__, __LINE__, #actual, #expected); \
+        } \
+    }while(0)
+
+/* Prints the summary of the test and returns its exit status */
+#define REPORT_TEST(name) \
+    (printf("%-16s %d checks, %d failed\n", \
+            (name), number_of_checks, number_of_failures), \
+     number_of_failures > 0 ? 1 : 0)
+
+#endif
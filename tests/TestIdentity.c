@@ -0,0 +1,127 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the unit test of the private identities: SipHash
+      against the test vectors of its reference implementation, the
+      parsing of keys, and a private identity derived for a known key and
+      epoch, which the resolvers of the backend derive the same way.
+
+ File Name:
+
+      TestIdentity.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Identity.h"
+#include "Test.h"
+
+/* Outputs of SipHash-2-4 with the key 00 01 .. 0f for the messages
+   00 01 .. (length - 1), from the reference implementation */
+static const struct {
+    size_t length;
+    uint64_t output;
+} siphash_vectors[] = {
+    {0, 0x726fdb47dd0e0e31ULL},
+    {1, 0x74f839c593dc67fdULL},
+    {2, 0x0d6c8009d9a94f5aULL},
+    {3, 0x85676696d7fb7e2dULL},
+    {7, 0xab0200f58b01d137ULL},
+    {8, 0x93f5f5799a932462ULL},
+    {9, 0x9e0082df0ba9e4b0ULL},
+    {15, 0xa129ca6149be45e5ULL},
+    {16, 0x3f2acc7f57c29bdbULL},
+    {63, 0x958a324ceb064572ULL}
+};
+
+static uint8_t test_key[IDENTITY_KEY_LENGTH];
+
+static void test_siphash_vectors(void){
+    uint8_t message[64];
+    int i;
+
+    for(i = 0 ; i < sizeof(message) ; i++){
+        message[i] = i;
+    }
+
+    for(i = 0 ; i < sizeof(siphash_vectors) / sizeof(siphash_vectors[0]) ;
+        i++){
+        CHECK_EQUAL(siphash_vectors[i].output,
+                    siphash_2_4(test_key, message,
+                                siphash_vectors[i].length));
+    }
+}
+
+static void test_parse_identity_key(void){
+    uint8_t key[IDENTITY_KEY_LENGTH];
+
+    CHECK(parse_identity_key("000102030405060708090a0b0c0d0e0f", key));
+    CHECK_BYTES(test_key, key, IDENTITY_KEY_LENGTH);
+    CHECK(parse_identity_key("000102030405060708090A0B0C0D0E0F", key));
+    CHECK_BYTES(test_key, key, IDENTITY_KEY_LENGTH);
+
+    CHECK(!parse_identity_key("", key));
+    CHECK(!parse_identity_key("000102030405060708090a0b0c0d0e", key));
+    CHECK(!parse_identity_key("000102030405060708090a0b0c0d0e0f00", key));
+    CHECK(!parse_identity_key("0001020304050607xx090a0b0c0d0e0f", key));
+}
+
+static void test_derive_private_identity(void){
+    const uint8_t address[] = {0x1A, 0xD4, 0x8F, 0x80, 0x03, 0x3E};
+    const uint8_t coordinate_mask[] = {
+        0xC5, 0xBD, 0x89, 0xEA, 0x49, 0x13, 0xBB, 0x4C
+    };
+    const uint8_t field_mask[] = {0x36, 0xE1, 0x12, 0x38, 0xD2, 0x7D, 0x80};
+    PrivateIdentity identity, next_identity;
+
+    CHECK_EQUAL(1, get_identity_epoch(900, 900));
+    CHECK_EQUAL(0, get_identity_epoch(899, 900));
+
+    derive_private_identity(test_key, 1, &identity);
+    CHECK_EQUAL(1, identity.epoch);
+    CHECK_BYTES(address, identity.address, IDENTITY_ADDRESS_LENGTH);
+    CHECK_BYTES(coordinate_mask, identity.coordinate_mask,
+                IDENTITY_COORDINATES_LENGTH);
+    CHECK_BYTES(field_mask, identity.field_mask, IDENTITY_FIELDS_LENGTH);
+    CHECK_EQUAL(0xA2, identity.sequence_start);
+
+    /* Every epoch looks like another Tag with a non-resolvable private
+       address */
+    derive_private_identity(test_key, 2, &next_identity);
+    CHECK(0 != memcmp(identity.address, next_identity.address,
+                      IDENTITY_ADDRESS_LENGTH));
+    CHECK(0 != memcmp(identity.field_mask, next_identity.field_mask,
+                      IDENTITY_FIELDS_LENGTH));
+    CHECK_EQUAL(0, next_identity.address[IDENTITY_ADDRESS_LENGTH - 1] &
+                   IDENTITY_ADDRESS_TYPE_MASK);
+}
+
+int main(int argc, char **argv){
+    int i;
+
+    for(i = 0 ; i < IDENTITY_KEY_LENGTH ; i++){
+        test_key[i] = i;
+    }
+
+    test_siphash_vectors();
+    test_parse_identity_key();
+    test_derive_private_identity();
+
+    return REPORT_TEST("TestIdentity");
+}
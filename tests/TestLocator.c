@@ -0,0 +1,157 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the unit test of the table of LBeacons of the
+      locator: reports of a known LBeacon update its entry, the table
+      stops inserting at its load limit, and expiring LBeacons keeps every
+      remaining LBeacon reachable on its probe sequence.
+
+ File Name:
+
+      TestLocator.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Locator.h"
+#include "Test.h"
+
+#define NANO_SECONDS_PER_SECOND 1000000000ULL
+
+static uint8_t coordinates[LENGTH_OF_COORDINATES];
+
+static void fill_beacon_address(bdaddr_t *bdaddr, int beacon){
+    memset(bdaddr, 0, sizeof(bdaddr_t));
+    bdaddr->b[5] = 0xB0;
+    bdaddr->b[0] = beacon & 0xFF;
+    bdaddr->b[1] = (beacon >> 8) & 0xFF;
+}
+
+static BeaconEntry *find_entry(BeaconTable *table, bdaddr_t *bdaddr){
+    int i;
+
+    for(i = 0 ; i < LOCATOR_TABLE_SIZE ; i++){
+        if(table->entries[i].is_used &&
+           0 == memcmp(&table->entries[i].bdaddr, bdaddr, sizeof(bdaddr_t))){
+            return &table->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void test_insert_and_update(void){
+    static BeaconTable table;
+    BeaconEntry *entry = NULL;
+    bdaddr_t bdaddr;
+
+    memset(&table, 0, sizeof(table));
+    fill_beacon_address(&bdaddr, 1);
+
+    record_beacon_report(&table, &bdaddr, coordinates, -60, 1);
+    record_beacon_report(&table, &bdaddr, coordinates, -40, 2);
+    CHECK_EQUAL(1, table.number_of_beacons);
+
+    entry = find_entry(&table, &bdaddr);
+    CHECK(NULL != entry);
+    if(NULL != entry){
+        CHECK_EQUAL(2, entry->number_of_reports);
+        CHECK_EQUAL(2, entry->last_seen_time_in_ns);
+        CHECK(entry->smoothed_rssi > -60 && entry->smoothed_rssi < -40);
+    }
+}
+
+static void test_table_is_bounded(void){
+    static BeaconTable table;
+    bdaddr_t bdaddr;
+    int beacon;
+
+    memset(&table, 0, sizeof(table));
+
+    for(beacon = 0 ; beacon < LOCATOR_MAX_NUMBER_OF_BEACONS + 10 ;
+        beacon++){
+        fill_beacon_address(&bdaddr, beacon);
+        record_beacon_report(&table, &bdaddr, coordinates, -60, 1);
+    }
+    CHECK_EQUAL(LOCATOR_MAX_NUMBER_OF_BEACONS, table.number_of_beacons);
+    CHECK_EQUAL(10, table.number_of_drops);
+
+    /* Known LBeacons are still updated when the table is full */
+    fill_beacon_address(&bdaddr, 0);
+    record_beacon_report(&table, &bdaddr, coordinates, -60, 2);
+    CHECK_EQUAL(10, table.number_of_drops);
+    CHECK_EQUAL(2, find_entry(&table, &bdaddr)->number_of_reports);
+}
+
+static void test_expire_keeps_probe_sequences(void){
+    static BeaconTable table;
+    uint64_t old_time = 1 * NANO_SECONDS_PER_SECOND;
+    uint64_t new_time = 20 * NANO_SECONDS_PER_SECOND;
+    uint64_t now = old_time +
+                   (LOCATOR_BEACON_TIMEOUT_IN_SECONDS + 1) *
+                   NANO_SECONDS_PER_SECOND;
+    BeaconEntry *entry = NULL;
+    bdaddr_t bdaddr;
+    int beacon;
+
+    memset(&table, 0, sizeof(table));
+
+    /* At the load limit the probe sequences run into each other, so
+       removing an entry has to move the following ones back */
+    for(beacon = 0 ; beacon < LOCATOR_MAX_NUMBER_OF_BEACONS ; beacon++){
+        fill_beacon_address(&bdaddr, beacon);
+        record_beacon_report(&table, &bdaddr, coordinates, -60,
+                             0 == beacon % 2 ? old_time : new_time);
+    }
+
+    expire_beacons(&table, now);
+    CHECK_EQUAL(LOCATOR_MAX_NUMBER_OF_BEACONS / 2, table.number_of_beacons);
+
+    for(beacon = 0 ; beacon < LOCATOR_MAX_NUMBER_OF_BEACONS ; beacon++){
+        fill_beacon_address(&bdaddr, beacon);
+        CHECK_EQUAL(0 == beacon % 2, NULL == find_entry(&table, &bdaddr));
+    }
+
+    /* A report of a remaining LBeacon finds its entry instead of
+       inserting it again */
+    for(beacon = 1 ; beacon < LOCATOR_MAX_NUMBER_OF_BEACONS ; beacon += 2){
+        fill_beacon_address(&bdaddr, beacon);
+        record_beacon_report(&table, &bdaddr, coordinates, -60, now);
+    }
+    CHECK_EQUAL(LOCATOR_MAX_NUMBER_OF_BEACONS / 2, table.number_of_beacons);
+
+    for(beacon = 1 ; beacon < LOCATOR_MAX_NUMBER_OF_BEACONS ; beacon += 2){
+        fill_beacon_address(&bdaddr, beacon);
+        entry = find_entry(&table, &bdaddr);
+        CHECK(NULL != entry && 2 == entry->number_of_reports);
+    }
+
+    /* Nothing is heard any more */
+    expire_beacons(&table, now + (LOCATOR_BEACON_TIMEOUT_IN_SECONDS + 1) *
+                               NANO_SECONDS_PER_SECOND);
+    CHECK_EQUAL(0, table.number_of_beacons);
+}
+
+int main(int argc, char **argv){
+    test_insert_and_update();
+    test_table_is_bounded();
+    test_expire_keeps_probe_sequences();
+
+    return REPORT_TEST("TestLocator");
+}
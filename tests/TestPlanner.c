@@ -0,0 +1,163 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the unit test of the advertising planner: a plan
+      depends only on the BD address, co-located tags get distinct
+      schedules, and the planned fleet delivers more advertising events
+      than the fleet pinned to the configured interval.
+
+ File Name:
+
+      TestPlanner.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Planner.h"
+#include "Test.h"
+
+/* Number of tags of the fleet whose plans are compared */
+#define NUMBER_OF_PLANNED_TAGS 1000
+
+#define INTERVAL_IN_UNITS_0625_MS 1600
+#define SPREAD_IN_UNITS_0625_MS 32
+
+static void fill_fleet_address(bdaddr_t *bdaddr, int tag){
+    memset(bdaddr, 0, sizeof(bdaddr_t));
+    bdaddr->b[5] = 0xC1;
+    bdaddr->b[0] = tag & 0xFF;
+    bdaddr->b[1] = (tag >> 8) & 0xFF;
+}
+
+static void test_plan_is_deterministic(void){
+    AdvertisingPlan first, second;
+    bdaddr_t bdaddr;
+
+    fill_fleet_address(&bdaddr, 7);
+
+    CHECK_EQUAL(WORK_SUCCESSFULLY,
+                plan_advertising_schedule(&bdaddr,
+                                          INTERVAL_IN_UNITS_0625_MS,
+                                          SPREAD_IN_UNITS_0625_MS,
+                                          false, &first));
+    CHECK_EQUAL(WORK_SUCCESSFULLY,
+                plan_advertising_schedule(&bdaddr,
+                                          INTERVAL_IN_UNITS_0625_MS,
+                                          SPREAD_IN_UNITS_0625_MS,
+                                          false, &second));
+    CHECK_BYTES(&first, &second, sizeof(AdvertisingPlan));
+}
+
+static void test_plan_bounds(void){
+    AdvertisingPlan plan;
+    bdaddr_t bdaddr;
+    int tag;
+
+    for(tag = 0 ; tag < NUMBER_OF_PLANNED_TAGS ; tag++){
+        fill_fleet_address(&bdaddr, tag);
+
+        plan_advertising_schedule(&bdaddr, INTERVAL_IN_UNITS_0625_MS,
+                                  SPREAD_IN_UNITS_0625_MS, false, &plan);
+        CHECK(plan.min_interval_in_units_0625_ms >=
+              INTERVAL_IN_UNITS_0625_MS);
+        CHECK(plan.min_interval_in_units_0625_ms <=
+              INTERVAL_IN_UNITS_0625_MS + SPREAD_IN_UNITS_0625_MS);
+        CHECK_EQUAL(plan.min_interval_in_units_0625_ms,
+                    plan.max_interval_in_units_0625_ms);
+        CHECK(plan.start_phase_in_micro_seconds >= 0);
+        CHECK(plan.start_phase_in_micro_seconds <
+              INTERVAL_IN_UNITS_0625_MS * MICRO_SECONDS_PER_INTERVAL_UNIT);
+
+        /* The range lets the controller go up to the top of the spread */
+        plan_advertising_schedule(&bdaddr, INTERVAL_IN_UNITS_0625_MS,
+                                  SPREAD_IN_UNITS_0625_MS, true, &plan);
+        CHECK_EQUAL(INTERVAL_IN_UNITS_0625_MS + SPREAD_IN_UNITS_0625_MS,
+                    plan.max_interval_in_units_0625_ms);
+    }
+
+    fill_fleet_address(&bdaddr, 0);
+    CHECK_EQUAL(E_ADVERTISE_MODE,
+                plan_advertising_schedule(
+                    &bdaddr, MIN_ADVERTISING_INTERVAL_IN_UNITS_0625_MS - 1,
+                    SPREAD_IN_UNITS_0625_MS, false, &plan));
+    CHECK_EQUAL(E_ADVERTISE_MODE,
+                plan_advertising_schedule(
+                    &bdaddr, MAX_ADVERTISING_INTERVAL_IN_UNITS_0625_MS + 1,
+                    SPREAD_IN_UNITS_0625_MS, false, &plan));
+}
+
+static void test_plans_are_distinct(void){
+    static bool is_offset_used[SPREAD_IN_UNITS_0625_MS + 1];
+    static bool is_phase_used[INTERVAL_IN_UNITS_0625_MS];
+    AdvertisingPlan plan;
+    bdaddr_t bdaddr;
+    int number_of_offsets = 0;
+    int number_of_phases = 0;
+    int offset, phase;
+    int tag;
+
+    for(tag = 0 ; tag < NUMBER_OF_PLANNED_TAGS ; tag++){
+        fill_fleet_address(&bdaddr, tag);
+        plan_advertising_schedule(&bdaddr, INTERVAL_IN_UNITS_0625_MS,
+                                  SPREAD_IN_UNITS_0625_MS, false, &plan);
+
+        offset = plan.min_interval_in_units_0625_ms -
+                 INTERVAL_IN_UNITS_0625_MS;
+        phase = plan.start_phase_in_micro_seconds /
+                MICRO_SECONDS_PER_INTERVAL_UNIT;
+
+        if(!is_offset_used[offset]){
+            is_offset_used[offset] = true;
+            number_of_offsets++;
+        }
+        if(!is_phase_used[phase]){
+            is_phase_used[phase] = true;
+            number_of_phases++;
+        }
+    }
+
+    /* Consecutive addresses cover every offset of the spread, and 1000
+       tags hashed into 1600 phases leave about 730 distinct phases */
+    CHECK_EQUAL(SPREAD_IN_UNITS_0625_MS + 1, number_of_offsets);
+    CHECK(number_of_phases > NUMBER_OF_PLANNED_TAGS * 2 / 3);
+}
+
+static void test_planned_fleet_delivers_more(void){
+    double pinned = 0;
+    double planned = 0;
+
+    pinned = simulate_fleet_delivery_rate(50, INTERVAL_IN_UNITS_0625_MS,
+                                          SPREAD_IN_UNITS_0625_MS,
+                                          false, false, 0, 60);
+    planned = simulate_fleet_delivery_rate(50, INTERVAL_IN_UNITS_0625_MS,
+                                           SPREAD_IN_UNITS_0625_MS,
+                                           true, false, 0, 60);
+
+    CHECK(planned > pinned);
+    CHECK(planned > 0.9);
+}
+
+int main(int argc, char **argv){
+    test_plan_is_deterministic();
+    test_plan_bounds();
+    test_plans_are_distinct();
+    test_planned_fleet_delivers_more();
+
+    return REPORT_TEST("TestPlanner");
+}
@@ -0,0 +1,149 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the unit test of the provisioning bundles: a
+      record survives encoding and decoding and a round trip through a
+      file, change_mac.sh finds the address at its fixed offset, and
+      bundles with a bad header, checksum or length are refused.
+
+ File Name:
+
+      TestProvision.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Provision.h"
+#include "Test.h"
+
+static void fill_record(ProvisionRecord *record){
+    int i;
+
+    memset(record, 0, sizeof(ProvisionRecord));
+    record->serial_number = 0x01020304;
+    for(i = 0 ; i < PROVISION_ADDRESS_LENGTH ; i++){
+        record->address[i] = 0xA0 + i;
+    }
+    record->sync_slot_index = -1;
+    for(i = 0 ; i < PROVISION_UUID_LENGTH ; i++){
+        record->uuid[i] = i;
+    }
+    for(i = 0 ; i < PROVISION_KEY_LENGTH ; i++){
+        record->key[i] = 0xF0 - i;
+    }
+}
+
+static void check_same_record(ProvisionRecord *expected,
+                              ProvisionRecord *actual){
+    CHECK_EQUAL(expected->serial_number, actual->serial_number);
+    CHECK_BYTES(expected->address, actual->address,
+                PROVISION_ADDRESS_LENGTH);
+    CHECK_EQUAL(expected->sync_slot_index, actual->sync_slot_index);
+    CHECK_BYTES(expected->uuid, actual->uuid, PROVISION_UUID_LENGTH);
+    CHECK_BYTES(expected->key, actual->key, PROVISION_KEY_LENGTH);
+}
+
+static void test_encode_and_decode(void){
+    uint8_t bundle[PROVISION_BUNDLE_SIZE];
+    ProvisionRecord record, decoded;
+
+    fill_record(&record);
+    encode_provision_bundle(&record, bundle);
+
+    CHECK_BYTES("TPRV", bundle, 4);
+    CHECK_BYTES(record.address, bundle + PROVISION_ADDRESS_OFFSET,
+                PROVISION_ADDRESS_LENGTH);
+
+    memset(&decoded, 0, sizeof(decoded));
+    CHECK(decode_provision_bundle(bundle, sizeof(bundle), &decoded));
+    check_same_record(&record, &decoded);
+
+    record.sync_slot_index = 17;
+    encode_provision_bundle(&record, bundle);
+    CHECK(decode_provision_bundle(bundle, sizeof(bundle), &decoded));
+    CHECK_EQUAL(17, decoded.sync_slot_index);
+}
+
+static void test_refuse_bad_bundles(void){
+    uint8_t bundle[PROVISION_BUNDLE_SIZE];
+    ProvisionRecord record, decoded;
+    int i;
+
+    fill_record(&record);
+
+    /* Every flipped byte is caught by the header or the checksum */
+    for(i = 0 ; i < PROVISION_BUNDLE_SIZE ; i++){
+        encode_provision_bundle(&record, bundle);
+        bundle[i] ^= 0x01;
+        CHECK(!decode_provision_bundle(bundle, sizeof(bundle), &decoded));
+    }
+
+    encode_provision_bundle(&record, bundle);
+    CHECK(!decode_provision_bundle(bundle, sizeof(bundle) - 1, &decoded));
+}
+
+static void test_file_round_trip(void){
+    char path[64];
+    ProvisionRecord record, read_record;
+    struct stat status;
+    int file = -1;
+
+    snprintf(path, sizeof(path), "/tmp/TestProvision.%d", (int)getpid());
+    fill_record(&record);
+
+    CHECK(write_provision_bundle(path, &record));
+    CHECK(0 == stat(path, &status) &&
+          PROVISION_FILE_MODE == (status.st_mode & 0777));
+
+    memset(&read_record, 0, sizeof(read_record));
+    CHECK(read_provision_bundle(path, &read_record));
+    check_same_record(&record, &read_record);
+
+    /* A longer file is not a bundle */
+    file = open(path, O_WRONLY | O_APPEND);
+    CHECK(file >= 0 && 1 == write(file, "\n", 1));
+    close(file);
+    CHECK(!read_provision_bundle(path, &read_record));
+
+    unlink(path);
+    CHECK(!read_provision_bundle(path, &read_record));
+}
+
+static void test_format(void){
+    ProvisionRecord record;
+    char address[PROVISION_ADDRESS_TEXT_LENGTH];
+    char uuid[2 * PROVISION_UUID_LENGTH + 1];
+
+    fill_record(&record);
+
+    format_provision_address(record.address, address);
+    CHECK(0 == strcmp("A5:A4:A3:A2:A1:A0", address));
+
+    format_provision_uuid(&record, uuid);
+    CHECK(0 == strcasecmp("000102030405060708090a0b0c0d0e0f", uuid));
+}
+
+int main(int argc, char **argv){
+    test_encode_and_decode();
+    test_refuse_bad_bundles();
+    test_file_round_trip();
+    test_format();
+
+    return REPORT_TEST("TestProvision");
+}
@@ -0,0 +1,165 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the unit test of the state file: the CRC-32 is
+      the one of IEEE 802.3, a saved state survives unmapping, and a state
+      with a bad checksum, another version or layout, another dongle or
+      another config is not resumed.
+
+ File Name:
+
+      TestState.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "State.h"
+#include "Test.h"
+
+/* CRC-32 of the config of the saved state */
+#define TEST_CONFIG_CHECKSUM 0x12345678
+
+static char state_file_name[64];
+
+static bdaddr_t dongle_bdaddr = {{0x01, 0x00, 0x00, 0x00, 0x00, 0xC1}};
+
+static void save_test_state(void){
+    static AdvertisingState advertising;
+    AdvertisingPayload payload;
+    le_set_advertising_data_cp advertising_data;
+
+    reset_persistent_state(&dongle_bdaddr, TEST_CONFIG_CHECKSUM);
+
+    advertising.dongle_device_id = 0;
+    advertising.min_interval_in_units_0625_ms = 1626;
+    advertising.max_interval_in_units_0625_ms = 1626;
+    advertising.tx_power_in_dbm = 4;
+    save_advertising_parameters(&advertising);
+
+    memset(&payload, 0, sizeof(payload));
+    payload.sequence_number = 7;
+    memset(&advertising_data, 0, sizeof(advertising_data));
+    advertising_data.length = 20;
+    advertising_data.data[0] = 0x02;
+    save_advertising_data(&payload, &advertising_data);
+}
+
+static void test_crc32_checksum(void){
+    CHECK_EQUAL(0xCBF43926u, crc32_checksum("123456789", 9));
+    CHECK_EQUAL(0, crc32_checksum("", 0));
+}
+
+static void test_saved_state_is_valid(void){
+    PersistentState *state = NULL;
+
+    save_test_state();
+    CHECK(is_persistent_state_valid(&dongle_bdaddr, TEST_CONFIG_CHECKSUM));
+
+    /* The state survives the Tag */
+    unmap_persistent_state();
+    CHECK(!is_persistent_state_valid(&dongle_bdaddr, TEST_CONFIG_CHECKSUM));
+    CHECK_EQUAL(WORK_SUCCESSFULLY, map_persistent_state(state_file_name));
+    CHECK(is_persistent_state_valid(&dongle_bdaddr, TEST_CONFIG_CHECKSUM));
+
+    state = get_persistent_state();
+    CHECK_EQUAL(1626, state->min_interval_in_units_0625_ms);
+    CHECK_EQUAL(20, state->advertising_data_length);
+    CHECK_EQUAL(7, state->payload.sequence_number);
+    CHECK_EQUAL(1, state->number_of_updates);
+}
+
+static void test_state_of_other_dongle_or_config(void){
+    bdaddr_t other_bdaddr = {{0x02, 0x00, 0x00, 0x00, 0x00, 0xC1}};
+
+    save_test_state();
+    CHECK(!is_persistent_state_valid(&other_bdaddr, TEST_CONFIG_CHECKSUM));
+    CHECK(!is_persistent_state_valid(&dongle_bdaddr,
+                                     TEST_CONFIG_CHECKSUM + 1));
+}
+
+static void test_corrupted_state(void){
+    PersistentState *state = NULL;
+
+    /* A write torn by a crash leaves a bad checksum */
+    save_test_state();
+    state = get_persistent_state();
+    state->advertising_data[1] ^= 0x01;
+    CHECK(!is_persistent_state_valid(&dongle_bdaddr, TEST_CONFIG_CHECKSUM));
+
+    save_test_state();
+    state->checksum ^= 0x80000000;
+    CHECK(!is_persistent_state_valid(&dongle_bdaddr, TEST_CONFIG_CHECKSUM));
+
+    /* A state without advertising data was never on the air */
+    reset_persistent_state(&dongle_bdaddr, TEST_CONFIG_CHECKSUM);
+    CHECK(!is_persistent_state_valid(&dongle_bdaddr, TEST_CONFIG_CHECKSUM));
+}
+
+static void test_state_of_other_version(void){
+    PersistentState *state = NULL;
+
+    /* The version and the length lie before the checksum, so a state of
+       another layout is rejected by them alone */
+    save_test_state();
+    state = get_persistent_state();
+    state->version = STATE_VERSION - 1;
+    CHECK(!is_persistent_state_valid(&dongle_bdaddr, TEST_CONFIG_CHECKSUM));
+
+    save_test_state();
+    state->length = sizeof(PersistentState) - 8;
+    CHECK(!is_persistent_state_valid(&dongle_bdaddr, TEST_CONFIG_CHECKSUM));
+
+    save_test_state();
+    state->magic = 0;
+    CHECK(!is_persistent_state_valid(&dongle_bdaddr, TEST_CONFIG_CHECKSUM));
+
+    /* A cold start over a state of another version keeps nothing of it */
+    save_test_state();
+    save_start_to_air_time(false, 1000);
+    state->version = STATE_VERSION - 1;
+    reset_persistent_state(&dongle_bdaddr, TEST_CONFIG_CHECKSUM);
+    CHECK_EQUAL(STATE_VERSION, state->version);
+    CHECK_EQUAL(0, state->cold_start_to_air_in_us);
+}
+
+int main(int argc, char **argv){
+    int return_value = 0;
+
+    snprintf(state_file_name, sizeof(state_file_name),
+             "/tmp/TestState.%d", (int)getpid());
+
+    test_crc32_checksum();
+
+    if(WORK_SUCCESSFULLY != map_persistent_state(state_file_name)){
+        fprintf(stderr, "Unable to map %s\n", state_file_name);
+        return 1;
+    }
+
+    test_saved_state_is_valid();
+    test_state_of_other_dongle_or_config();
+    test_corrupted_state();
+    test_state_of_other_version();
+
+    unmap_persistent_state();
+    unlink(state_file_name);
+
+    return_value = REPORT_TEST("TestState");
+
+    return return_value;
+}
@@ -0,0 +1,80 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the globals and the HCI functions of Tag.c which
+      the other modules refer to, so that the unit tests link the modules
+      without the main program of the Tag. The tests never talk to a
+      dongle, and every HCI function fails.
+
+ File Name:
+
+      TestStub.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Tag.h"
+
+/* Without zlog_init the categories stay NULL and zlog drops the messages
+   of the modules under test */
+zlog_category_t *category_health_report, *category_debug;
+
+bool ready_to_work;
+
+AdvertisingState g_advertising = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+ErrorCode single_running_instance(char *file_name){
+    return WORK_SUCCESSFULLY;
+}
+
+ErrorCode send_hci_request(int device_handle,
+                           uint16_t ogf,
+                           uint16_t ocf,
+                           void *cparam,
+                           int clen,
+                           void *rparam,
+                           int rlen){
+    return E_OPEN_DEVICE;
+}
+
+void set_payload_identity(AdvertisingPayload *payload,
+                          PrivateIdentity *identity){
+    memcpy(payload->coordinate_mask, identity->coordinate_mask,
+           LENGTH_OF_COORDINATES);
+    memcpy(payload->field_mask, identity->field_mask, LENGTH_OF_FIELD_MASK);
+    payload->sequence_number = identity->sequence_start;
+}
+
+ErrorCode update_advertising_data(int device_handle){
+    return E_OPEN_DEVICE;
+}
+
+ErrorCode set_advertising_interval(int device_handle,
+                                   int min_interval_in_units_0625_ms,
+                                   int max_interval_in_units_0625_ms){
+    return E_OPEN_DEVICE;
+}
+
+ErrorCode restart_advertising(int device_handle){
+    return E_OPEN_DEVICE;
+}
+
+ErrorCode set_private_address(int device_handle, bdaddr_t *address){
+    return E_OPEN_DEVICE;
+}
@@ -0,0 +1,214 @@
+/*
+  2020 © Copyright (c) BiDaE Technology Inc.
+  Provided under BiDaE SHAREWARE LICENSE-1.0 in the LICENSE.
+
+ Project Name:
+
+      BeDIS
+
+ File Description:
+
+      This file contains the unit test of the payload template: the default
+      template compiles to the layout the scanners expect, patching writes
+      only the dirty slots and drops the sensor summary until it is
+      published, and matching accepts the patched data but not data with
+      another fixed byte.
+
+ File Name:
+
+      TestTemplate.c
+
+ Version:
+
+       1.0,  20201019
+
+ Abstract:
+
+ Authors:
+
+      Chun-Yu Lai, chunyu1202@gmail.com
+
+*/
+
+#include "Template.h"
+#include "Test.h"
+
+/* Length of the advertising data of the default template with and without
+   the sensor summary */
+#define DEFAULT_FULL_LENGTH 24
+#define DEFAULT_LENGTH_WITHOUT_SUMMARY 20
+
+static void fill_payload(AdvertisingPayload *payload){
+    int i;
+
+    memset(payload, 0, sizeof(AdvertisingPayload));
+    for(i = 0 ; i < LENGTH_OF_COORDINATES ; i++){
+        payload->coordinates[i] = 0x10 + i;
+    }
+    payload->button_state = 1;
+    payload->measured_power = -50;
+    payload->major_number = 2;
+    payload->minor_number = 3;
+    payload->sequence_number = 0x1FF;
+    payload->dirty_slots = ALL_PAYLOAD_SLOTS;
+}
+
+static void test_compile_default_template(void){
+    static PayloadTemplate payload_template;
+    const uint8_t header[] = {0x02, 0x01, 0x04, 0x14, 0xFF, 0x0F, 0x00};
+
+    CHECK_EQUAL(WORK_SUCCESSFULLY,
+                compile_payload_template("", &payload_template));
+    CHECK_EQUAL(DEFAULT_FULL_LENGTH, payload_template.full_length);
+    CHECK_EQUAL(7, payload_template.number_of_slots);
+    CHECK_EQUAL(3, payload_template.sensor_summary_length_offset);
+    CHECK_BYTES(header, payload_template.image.data, sizeof(header));
+
+    CHECK_EQUAL(7, find_payload_slot(&payload_template,
+                                     PAYLOAD_SLOT_COORDINATES));
+    CHECK_EQUAL(15, find_payload_slot(&payload_template,
+                                      PAYLOAD_SLOT_BUTTON));
+    CHECK_EQUAL(19, find_payload_slot(&payload_template,
+                                      PAYLOAD_SLOT_SEQUENCE));
+    CHECK_EQUAL(20, find_payload_slot(&payload_template,
+                                      PAYLOAD_SLOT_SENSOR_SUMMARY));
+}
+
+static void test_compile_malformed_templates(void){
+    static PayloadTemplate payload_template;
+
+    /* Nothing may follow the sensor summary */
+    CHECK_EQUAL(E_ADVERTISE_MODE,
+                compile_payload_template("ff,sensor_summary,button",
+                                         &payload_template));
+    CHECK_EQUAL(E_ADVERTISE_MODE,
+                compile_payload_template("ff,sensor_summary;09,41",
+                                         &payload_template));
+    CHECK_EQUAL(E_ADVERTISE_MODE,
+                compile_payload_template("ff,unknown_slot",
+                                         &payload_template));
+    CHECK_EQUAL(E_ADVERTISE_MODE,
+                compile_payload_template("ff,0f0",
+                                         &payload_template));
+
+    /* 32 bytes do not fit into legacy advertising data */
+    CHECK_EQUAL(E_ADVERTISE_MODE,
+                compile_payload_template(
+                    "ff,coordinates,coordinates,coordinates,"
+                    "coordinates",
+                    &payload_template));
+}
+
+static void test_patch_default_template(void){
+    static PayloadTemplate payload_template;
+    AdvertisingPayload payload;
+    le_set_advertising_data_cp *data = NULL;
+    const uint8_t expected[] = {
+        0x02, 0x01, 0x04, 0x10, 0xFF, 0x0F, 0x00,
+        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+        0x01, 0xCE, 0x02, 0x03, 0xFF
+    };
+
+    compile_payload_template("", &payload_template);
+    fill_payload(&payload);
+
+    data = patch_payload_template(&payload_template, &payload);
+    CHECK_EQUAL(DEFAULT_LENGTH_WITHOUT_SUMMARY, data->length);
+    CHECK_BYTES(expected, data->data, sizeof(expected));
+    CHECK_EQUAL(0, payload.dirty_slots);
+
+    /* Only the dirty slots are written */
+    payload.button_state = 0;
+    payload.sequence_number = 0x20;
+    payload.dirty_slots = PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_SEQUENCE);
+    data = patch_payload_template(&payload_template, &payload);
+    CHECK_EQUAL(0x01, data->data[15]);
+    CHECK_EQUAL(0x20, data->data[19]);
+
+    /* A published summary lengthens the AD structure and the data */
+    payload.has_sensor_summary = true;
+    payload.motion_state = 1;
+    payload.motion_energy = 8;
+    payload.temperature_min = -5;
+    payload.temperature_max = 40;
+    payload.dirty_slots = PAYLOAD_SLOT_BIT(PAYLOAD_SLOT_SENSOR_SUMMARY);
+    data = patch_payload_template(&payload_template, &payload);
+    CHECK_EQUAL(DEFAULT_FULL_LENGTH, data->length);
+    CHECK_EQUAL(0x14, data->data[3]);
+    CHECK_EQUAL(0x01, data->data[20]);
+    CHECK_EQUAL(0x08, data->data[21]);
+    CHECK_EQUAL(0xFB, data->data[22]);
+    CHECK_EQUAL(0x28, data->data[23]);
+}
+
+static void test_patch_masked_fields(void){
+    static PayloadTemplate payload_template;
+    AdvertisingPayload payload;
+    le_set_advertising_data_cp *data = NULL;
+    int i;
+
+    compile_payload_template("", &payload_template);
+    fill_payload(&payload);
+    for(i = 0 ; i < LENGTH_OF_COORDINATES ; i++){
+        payload.coordinate_mask[i] = 0xFF;
+    }
+    for(i = 0 ; i < LENGTH_OF_FIELD_MASK ; i++){
+        payload.field_mask[i] = 0x0F;
+    }
+
+    data = patch_payload_template(&payload_template, &payload);
+    CHECK_EQUAL(0xEF, data->data[7]);
+    CHECK_EQUAL(0xC1, data->data[16]);
+    CHECK_EQUAL(0x0D, data->data[17]);
+    CHECK_EQUAL(0x0C, data->data[18]);
+
+    /* Neither the button nor the sequence number is masked */
+    CHECK_EQUAL(0x01, data->data[15]);
+    CHECK_EQUAL(0xFF, data->data[19]);
+}
+
+static void test_match_default_template(void){
+    static PayloadTemplate payload_template;
+    AdvertisingPayload payload;
+    le_set_advertising_data_cp *data = NULL;
+    uint8_t received[MAX_ADVERTISING_DATA_LENGTH];
+
+    compile_payload_template("", &payload_template);
+    fill_payload(&payload);
+    data = patch_payload_template(&payload_template, &payload);
+    memcpy(received, data->data, data->length);
+
+    CHECK(match_payload_template(&payload_template, received,
+                                 data->length));
+
+    /* Other slot values still match */
+    received[19] = 0x42;
+    CHECK(match_payload_template(&payload_template, received,
+                                 data->length));
+
+    /* Another company identifier does not */
+    received[5] = 0x4C;
+    CHECK(!match_payload_template(&payload_template, received,
+                                  data->length));
+    received[5] = 0x0F;
+
+    /* Nor does a length of the AD structure which disagrees with the
+       length of the data */
+    received[3] = 0x14;
+    CHECK(!match_payload_template(&payload_template, received,
+                                  data->length));
+    received[3] = 0x10;
+
+    CHECK(!match_payload_template(&payload_template, received,
+                                  data->length - 1));
+}
+
+int main(int argc, char **argv){
+    test_compile_default_template();
+    test_compile_malformed_templates();
+    test_patch_default_template();
+    test_patch_masked_fields();
+    test_match_default_template();
+
+    return REPORT_TEST("TestTemplate");
+}